@@ -694,8 +694,16 @@ bmw32_close(sph_bmw_small_context *sc, unsigned ub, unsigned n,
 	}
 	memset(buf + ptr, 0, (sizeof sc->buf) - 8 - ptr);
 #if SPH_64
-	sph_enc64le_aligned(buf + (sizeof sc->buf) - 8,
-		SPH_T64(sc->bit_count + n));
+	/*
+	 * compress_small() reads the block as 32-bit words, so the bit count
+	 * is written as two 32-bit words too: a 64-bit store there breaks
+	 * strict aliasing and the optimizer is free to move the reads of the
+	 * last two words before it.
+	 */
+	sph_enc32le_aligned(buf + (sizeof sc->buf) - 8,
+		SPH_T32(sc->bit_count + n));
+	sph_enc32le_aligned(buf + (sizeof sc->buf) - 4,
+		SPH_T32((sc->bit_count + n) >> 32));
 #else
 	sph_enc32le_aligned(buf + (sizeof sc->buf) - 8,
 		sc->bit_count_low + n);
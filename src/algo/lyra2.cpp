@@ -21,6 +21,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <new>
+#include <vector>
 #include "lyra2.h"
 #include "sponge.h"
 
@@ -63,18 +65,24 @@ int LYRA2_new( void *K, uint64_t kLen, const void *pwd, uint64_t pwdlen, const v
     const int64_t ROW_LEN_INT64 = BLOCK_LEN_INT64 * nCols;
     const int64_t ROW_LEN_BYTES = ROW_LEN_INT64 * 8;
 
-    i = (int64_t) ((int64_t) nRows * (int64_t) ROW_LEN_BYTES);
-    uint64_t *wholeMatrix = (uint64_t*) malloc(i);
-    if (wholeMatrix == NULL) {
+    //The matrix and the pointers to its rows are kept by the thread between calls,
+    //hashing a header with Lyra2REv2 needs just 1.5 KiB of them and then doesn't allocate
+    static thread_local std::vector<uint64_t> matrixOfThread;
+    static thread_local std::vector<uint64_t*> rowsOfThread;
+    try {
+      if (matrixOfThread.size() < nRows * ROW_LEN_INT64)
+        matrixOfThread.resize(nRows * ROW_LEN_INT64);
+      if (rowsOfThread.size() < nRows)
+        rowsOfThread.resize(nRows);
+    } catch (const std::bad_alloc&) {
       return -1;
     }
+
+    i = (int64_t) ((int64_t) nRows * (int64_t) ROW_LEN_BYTES);
+    uint64_t *wholeMatrix = matrixOfThread.data();
 	memset(wholeMatrix, 0, i);
 
-    //Allocates pointers to each row of the matrix
-    uint64_t **memMatrix = (uint64_t**) malloc(nRows * sizeof (uint64_t*));
-    if (memMatrix == NULL) {
-      return -1;
-    }
+    uint64_t **memMatrix = rowsOfThread.data();
     //Places the pointers in the correct positions
     uint64_t *ptrWord = wholeMatrix;
     for (i = 0; i < (int64_t) nRows; i++) {
@@ -123,10 +131,7 @@ int LYRA2_new( void *K, uint64_t kLen, const void *pwd, uint64_t pwdlen, const v
 
     //======================= Initializing the Sponge State ====================//
     //Sponge state: 16 uint64_t, BLOCK_LEN_INT64 words of them for the bitrate (b) and the remainder for the capacity (c)
-    uint64_t *state = (uint64_t*) malloc(16 * sizeof (uint64_t));
-    if (state == NULL) {
-      return -1;
-    }
+    uint64_t state[16];
     initState(state);
     //==========================================================================/
 
@@ -200,14 +205,8 @@ int LYRA2_new( void *K, uint64_t kLen, const void *pwd, uint64_t pwdlen, const v
     squeeze(state, (unsigned char*) K, kLen);
     //==========================================================================/
 
-    //========================= Freeing the memory =============================//
-    free(memMatrix);
-    free(wholeMatrix);
-
-    //Wiping out the sponge's internal state before freeing it
+    //Wiping out the sponge's internal state
     memset(state, 0, 16 * sizeof (uint64_t));
-    free(state);
-    //==========================================================================/
 
     return 0;
 }
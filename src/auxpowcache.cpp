@@ -0,0 +1,95 @@
+// Copyright (c) 2020 The Dogecoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php
+
+#include "auxpowcache.h"
+
+#include "peerversion.h"
+#include "serialize.h"
+#include "util.h"
+#include "utillog.h"
+
+#include <algorithm>
+
+CAuxpowCache auxpowCache ;
+
+std::shared_ptr< CAuxPow > CAuxpowCache::Get( const uint256 & hash )
+{
+    LOCK( cs ) ;
+    auto it = mapEntries.find( hash ) ;
+    if ( it == mapEntries.end() ) return nullptr ;
+
+    lruList.splice( lruList.begin(), lruList, it->second.itLru ) ;
+    return it->second.auxpow ;
+}
+
+void CAuxpowCache::Put( const uint256 & hash, const std::shared_ptr< CAuxPow > & auxpow )
+{
+    if ( auxpow == nullptr ) return ;
+
+    // serialized size plus what's around it in memory, close enough for a limit
+    size_t nEntryUsage = ::GetSerializeSize( *auxpow, SER_DISK, PEER_VERSION ) + sizeof( CAuxPow ) + sizeof( Entry ) + 2 * sizeof( uint256 ) + 64 ;
+
+    LOCK( cs ) ;
+    auto it = mapEntries.find( hash ) ;
+    if ( it != mapEntries.end() ) {
+        lruList.splice( lruList.begin(), lruList, it->second.itLru ) ;
+        return ;
+    }
+
+    lruList.push_front( hash ) ;
+    Entry & entry = mapEntries[ hash ] ;
+    entry.auxpow = auxpow ;
+    entry.nUsage = nEntryUsage ;
+    entry.itLru = lruList.begin() ;
+    nUsage += nEntryUsage ;
+
+    Trim() ;
+}
+
+void CAuxpowCache::Trim()
+{
+    AssertLockHeld( cs ) ;
+    while ( nUsage > nMaxUsage && ! lruList.empty() ) {
+        auto it = mapEntries.find( lruList.back() ) ;
+        assert( it != mapEntries.end() ) ;
+        nUsage -= it->second.nUsage ;
+        mapEntries.erase( it ) ;
+        lruList.pop_back() ;
+    }
+}
+
+void CAuxpowCache::SetMaxUsage( size_t nMaxUsageIn )
+{
+    LOCK( cs ) ;
+    nMaxUsage = nMaxUsageIn ;
+    Trim() ;
+}
+
+void CAuxpowCache::Clear()
+{
+    LOCK( cs ) ;
+    mapEntries.clear() ;
+    lruList.clear() ;
+    nUsage = 0 ;
+}
+
+size_t CAuxpowCache::GetUsage() const
+{
+    LOCK( cs ) ;
+    return nUsage ;
+}
+
+size_t CAuxpowCache::GetCount() const
+{
+    LOCK( cs ) ;
+    return mapEntries.size() ;
+}
+
+void InitAuxpowCache()
+{
+    int64_t nMaxSize = std::min( std::max( (int64_t)0, GetArg( "-auxpowcache", DEFAULT_AUXPOW_CACHE_SIZE ) ), MAX_AUXPOW_CACHE_SIZE ) ;
+    auxpowCache.Clear() ;
+    auxpowCache.SetMaxUsage( (size_t)nMaxSize << 20 ) ;
+    LogPrintf( "Using %d MiB for auxpows of block headers\n", nMaxSize ) ;
+}
@@ -0,0 +1,73 @@
+// Copyright (c) 2020 The Dogecoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php
+
+#ifndef DOGECOIN_AUXPOWCACHE_H
+#define DOGECOIN_AUXPOWCACHE_H
+
+#include "auxpow.h"
+#include "sync.h"
+#include "uint256.h"
+
+#include <list>
+#include <memory>
+#include <unordered_map>
+
+/** Default for -auxpowcache, megabytes of auxpows kept in memory */
+static const unsigned int DEFAULT_AUXPOW_CACHE_SIZE = 32 ;
+/** Maximum -auxpowcache */
+static const int64_t MAX_AUXPOW_CACHE_SIZE = 16384 ;
+
+/**
+ * Auxpows of merge-mined block headers, by sha256 hash of the block.
+ * The block index doesn't hold auxpows, so without them in memory
+ * every merge-mined header served to peers would be read from blk*.dat.
+ * When the size goes over the limit, least recently used ones are dropped
+ */
+class CAuxpowCache
+{
+private:
+    struct CacheHasher
+    {
+        size_t operator()( const uint256 & hash ) const {  return hash.GetCheapHash() ;  }
+    } ;
+
+    typedef std::list< uint256 > LruList ;
+
+    struct Entry
+    {
+        std::shared_ptr< CAuxPow > auxpow ;
+        size_t nUsage ;
+        LruList::iterator itLru ;
+    } ;
+
+    mutable CCriticalSection cs ;
+    std::unordered_map< uint256, Entry, CacheHasher > mapEntries ;
+    LruList lruList ; // most recently used at front
+    size_t nUsage ;
+    size_t nMaxUsage ;
+
+    void Trim() ;
+
+public:
+    CAuxpowCache() : nUsage( 0 ), nMaxUsage( DEFAULT_AUXPOW_CACHE_SIZE << 20 ) {}
+
+    /** Auxpow of block with this hash, or null when it isn't here */
+    std::shared_ptr< CAuxPow > Get( const uint256 & hash ) ;
+
+    void Put( const uint256 & hash, const std::shared_ptr< CAuxPow > & auxpow ) ;
+
+    void SetMaxUsage( size_t nMaxUsageIn ) ;
+
+    void Clear() ;
+
+    size_t GetUsage() const ;
+    size_t GetCount() const ;
+} ;
+
+extern CAuxpowCache auxpowCache ;
+
+/** To be called once in AppInitMain/TestingSetup, sets size of auxpowCache from -auxpowcache */
+void InitAuxpowCache() ;
+
+#endif
@@ -5,8 +5,11 @@
 #include "bench.h"
 #include "coins.h"
 #include "policy/policy.h"
+#include "serialize.h"
+#include "version.h"
 #include "wallet/crypter.h"
 
+#include <iostream>
 #include <vector>
 
 // FIXME: Dedup with SetupDummyInputs in test/transaction_tests.cpp
@@ -36,14 +39,14 @@ SetupDummyInputs( CBasicKeyStore & keystoreRet, CCoinsViewCache & coinsRet )
     dummyTransactions[ 0 ].vout[ 0 ].scriptPubKey << ToByteVector( key[ 0 ].GetPubKey() ) << OP_CHECKSIG ;
     dummyTransactions[ 0 ].vout[ 1 ].nValue = 50 * E6COIN ;
     dummyTransactions[ 0 ].vout[ 1 ].scriptPubKey << ToByteVector( key[ 1 ].GetPubKey() ) << OP_CHECKSIG ;
-    coinsRet.ModifyCoins( dummyTransactions[ 0 ].GetTxHash() )->FromTx( dummyTransactions[ 0 ], 0 ) ;
+    AddCoins( coinsRet, dummyTransactions[ 0 ], 0 ) ;
 
     dummyTransactions[ 1 ].vout.resize( 2 ) ;
     dummyTransactions[ 1 ].vout[ 0 ].nValue = 21 * E6COIN ;
     dummyTransactions[ 1 ].vout[ 0 ].scriptPubKey = GetScriptForDestination( key[ 2 ].GetPubKey().GetID() ) ;
     dummyTransactions[ 1 ].vout[ 1 ].nValue = 22 * E6COIN ;
     dummyTransactions[ 1 ].vout[ 1 ].scriptPubKey = GetScriptForDestination( key[ 3 ].GetPubKey().GetID() ) ;
-    coinsRet.ModifyCoins( dummyTransactions[ 1 ].GetTxHash() )->FromTx( dummyTransactions[ 1 ], 0 ) ;
+    AddCoins( coinsRet, dummyTransactions[ 1 ], 0 ) ;
 
     return dummyTransactions ;
 }
@@ -85,4 +88,72 @@ static void CCoinsCaching(benchmark::State& state)
     }
 }
 
+// Coins of the chainstate in memory, counting bytes which CCoinsViewDB would write for flushes
+class CountingCoinsView : public TrivialCoinsView
+{
+public:
+    std::map< COutPoint, Coin > coins ;
+    size_t nFlushedBytes = 0 ;
+
+    virtual bool GetCoin( const COutPoint & outpoint, Coin & coin ) const override
+    {
+        auto it = coins.find( outpoint ) ;
+        if ( it == coins.end() ) return false ;
+        coin = it->second ;
+        return true ;
+    }
+
+    virtual bool HaveCoin( const COutPoint & outpoint ) const override {  return coins.count( outpoint ) != 0 ;  }
+
+    virtual bool BatchWrite( CCoinsMap & mapCoins, const uint256 & blockHash ) override
+    {
+        for ( CCoinsMap::iterator it = mapCoins.begin() ; it != mapCoins.end() ; it = mapCoins.erase( it ) ) {
+            if ( ! ( it->second.flags & CCoinsCacheEntry::DIRTY ) ) continue ;
+            // key is 'C', txid and VARINT of output number
+            uint32_t n = it->first.n ;
+            nFlushedBytes += 1 + 32 + ::GetSerializeSize( VARINT( n ), SER_DISK, PROTOCOL_VERSION ) ;
+            if ( it->second.coin.IsSpent() )
+                coins.erase( it->first ) ;
+            else {
+                nFlushedBytes += ::GetSerializeSize( it->second.coin, SER_DISK, PROTOCOL_VERSION ) ;
+                coins[ it->first ] = it->second.coin ;
+            }
+        }
+        return true ;
+    }
+} ;
+
+// Spending one output of a pool payout transaction with 500 outputs,
+// cache takes in that coin only and flush writes that coin only
+static void CCoinsPayoutSpend(benchmark::State& state)
+{
+    CMutableTransaction payout ;
+    payout.vin.resize( 1 ) ;
+    payout.vout.resize( 500 ) ;
+    for ( size_t i = 0 ; i < payout.vout.size() ; i ++ ) {
+        payout.vout[ i ].nValue = ( 1 + i % 7 ) * E6COIN + i ;
+        payout.vout[ i ].scriptPubKey << OP_DUP << OP_HASH160 << std::vector< unsigned char >( 20, (unsigned char)i ) << OP_EQUALVERIFY << OP_CHECKSIG ;
+    }
+    const CTransaction tx( payout ) ;
+
+    CountingCoinsView chainstate ;
+    for ( size_t i = 0 ; i < tx.vout.size() ; i ++ )
+        chainstate.coins[ COutPoint( tx.GetTxHash(), i ) ] = Coin( tx.vout[ i ], 1, false ) ;
+
+    const COutPoint spent( tx.GetTxHash(), 250 ) ;
+    size_t nCacheUsage = 0 ;
+    while (state.KeepRunning()) {
+        CCoinsViewCache cache( &chainstate ) ;
+        chainstate.nFlushedBytes = 0 ;
+        Coin coin ;
+        bool is_spent = cache.SpendCoin( spent, &coin ) ;
+        assert( is_spent ) ;
+        nCacheUsage = cache.DynamicMemoryUsage() ;
+        cache.Flush() ;
+        chainstate.coins[ spent ] = std::move( coin ) ;
+    }
+    std::cout << "# CCoinsPayoutSpend, cache " << nCacheUsage << " bytes, flush " << chainstate.nFlushedBytes << " bytes" << std::endl ;
+}
+
 BENCHMARK(CCoinsCaching);
+BENCHMARK(CCoinsPayoutSpend);
@@ -8,11 +8,13 @@
 #include "bloom.h"
 #include "hash.h"
 #include "uint256.h"
+#include "utilstrencodings.h"
 #include "utiltime.h"
 #include "crypto/ripemd160.h"
 #include "crypto/sha1.h"
 #include "crypto/sha256.h"
 #include "crypto/sha512.h"
+#include "algo/Lyra2RE.h"
 
 /* Number of bytes to hash per iteration */
 static const uint64_t BUFFER_SIZE = 1000*1000;
@@ -69,6 +71,18 @@ static void SipHash_32b(benchmark::State& state)
     }
 }
 
+static void LYRA2RE2_80b(benchmark::State& state)
+{
+    uint256 hash;
+    std::vector<uint8_t> in(80,0);
+    while (state.KeepRunning()) {
+        for (int i = 0; i < 1000; i++) {
+            in[76] = i;
+            lyra2re2_hash((const char*)in.data(), BEGIN(hash));
+        }
+    }
+}
+
 BENCHMARK(RIPEMD160);
 BENCHMARK(SHA1);
 BENCHMARK(SHA256);
@@ -76,3 +90,4 @@ BENCHMARK(SHA512);
 
 BENCHMARK(SHA256_32b);
 BENCHMARK(SipHash_32b);
+BENCHMARK(LYRA2RE2_80b);
@@ -0,0 +1,98 @@
+// Copyright (c) 2020 The Dogecoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php
+
+#include "bench.h"
+#include "crypto/scrypt.h"
+#include "uint256.h"
+#include "utilstrencodings.h"
+
+#include <vector>
+
+// Every iteration hashes this many headers which differ only in nonce
+static const uint32_t NONCES = SCRYPT_MAX_WAYS;
+
+static const char* HEADER_HEX = "020000004c1271c211717198227392b029a64a7971931d351b387bb80db027f270411e398a07046f7d4a08dd815412a8712f874a7ebf0507e3878bd24e20a3b73fd750a667d2f451eac7471b00de6659";
+
+// Both PBKDF2 passes as scrypt did them before, keyed anew for every pass and nonce
+static void SCRYPT_PBKDF2_WholeHeader(benchmark::State& state)
+{
+    std::vector<unsigned char> header = ParseHex(HEADER_HEX);
+    uint8_t B[128];
+    uint8_t hash[32];
+    while (state.KeepRunning()) {
+        for (uint32_t n = 0; n < NONCES; n++) {
+            memcpy(&header[76], &n, 4);
+            PBKDF2_SHA256(&header[0], 80, &header[0], 80, 1, B, 128);
+            PBKDF2_SHA256(&header[0], 80, B, 128, 1, hash, 32);
+        }
+    }
+}
+
+// Both PBKDF2 passes keyed once per nonce, with the key's first 64 bytes hashed once per header
+static void SCRYPT_PBKDF2_Midstate(benchmark::State& state)
+{
+    std::vector<unsigned char> header = ParseHex(HEADER_HEX);
+    scrypt_header_midstate midstate;
+    scrypt_header_midstate_init(&midstate, (const char*)&header[0]);
+    uint8_t B[128];
+    uint8_t hash[32];
+    uint8_t keyHash[32];
+    while (state.KeepRunning()) {
+        for (uint32_t n = 0; n < NONCES; n++) {
+            memcpy(&header[76], &n, 4);
+            CSHA256 keyHasher = midstate.keyHasher;
+            keyHasher.Write(&header[64], 16).Finalize(keyHash);
+            CHMAC_SHA256 keyed(keyHash, 32);
+            scrypt_pbkdf2_in(keyed, &header[0], B);
+            scrypt_pbkdf2_out(keyed, B, hash);
+        }
+    }
+}
+
+static void SCRYPT_Nonces_OneByOne(benchmark::State& state)
+{
+    std::vector<unsigned char> header = ParseHex(HEADER_HEX);
+    std::vector<char> scratchpad(SCRYPT_SCRATCHPAD_SIZE);
+    uint256 hash;
+    while (state.KeepRunning()) {
+        for (uint32_t n = 0; n < NONCES; n++) {
+            memcpy(&header[76], &n, 4);
+            scrypt_1024_1_1_256_sp((const char*)&header[0], BEGIN(hash), &scratchpad[0]);
+        }
+    }
+}
+
+static void SCRYPT_Nonces_Multi(benchmark::State& state)
+{
+    scrypt_detect_multi();
+    std::vector<unsigned char> header = ParseHex(HEADER_HEX);
+    std::vector<char> headers(NONCES * 80);
+    std::vector<char> scratchpad(SCRYPT_MULTI_SCRATCHPAD_SIZE);
+    uint256 hashes[NONCES];
+    while (state.KeepRunning()) {
+        for (uint32_t n = 0; n < NONCES; n++) {
+            memcpy(&header[76], &n, 4);
+            memcpy(&headers[n * 80], &header[0], 80);
+        }
+        scrypt_1024_1_1_256_sp_multi(&headers[0], BEGIN(hashes[0]), &scratchpad[0], NONCES);
+    }
+}
+
+static void SCRYPT_Nonces_MultiMidstate(benchmark::State& state)
+{
+    scrypt_detect_multi();
+    std::vector<unsigned char> header = ParseHex(HEADER_HEX);
+    scrypt_header_midstate midstate;
+    scrypt_header_midstate_init(&midstate, (const char*)&header[0]);
+    std::vector<char> scratchpad(SCRYPT_MULTI_SCRATCHPAD_SIZE);
+    uint256 hashes[NONCES];
+    while (state.KeepRunning())
+        scrypt_1024_1_1_256_sp_nonces(&midstate, 0, BEGIN(hashes[0]), &scratchpad[0], NONCES);
+}
+
+BENCHMARK(SCRYPT_PBKDF2_WholeHeader);
+BENCHMARK(SCRYPT_PBKDF2_Midstate);
+BENCHMARK(SCRYPT_Nonces_OneByOne);
+BENCHMARK(SCRYPT_Nonces_Multi);
+BENCHMARK(SCRYPT_Nonces_MultiMidstate);
@@ -13,8 +13,12 @@
 #include "txmempool.h"
 #include "validation.h"
 #include "utillog.h"
+#include "utilthread.h"
 
-#include <unordered_map>
+#include <atomic>
+#include <limits>
+#include <memory>
+#include <mutex>
 
 #define MIN_TRANSACTION_BASE_SIZE (::GetSerializeSize(CTransaction(), SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS))
 
@@ -46,6 +50,138 @@ uint64_t CBlockHeaderAndShortTxIDs::GetShortID(const uint256& txhash) const {
     return SipHashUint256(shorttxidk0, shorttxidk1, txhash) & 0xffffffffffffL;
 }
 
+namespace {
+
+/**
+ * Flat open addressing table of the short IDs of a compact block to positions in the block,
+ * read by many threads at once. Short IDs are chosen by the peer, so slots are salted
+ * and too long a probe fails as the buckets of std::unordered_map did
+ */
+class ShortIdTable
+{
+public:
+    explicit ShortIdTable( size_t nIds ) : salt( GetRand( std::numeric_limits< uint64_t >::max() ) )
+    {
+        // load of a quarter at most keeps probes short
+        size_t nSlots = 16 ;
+        while ( nSlots < 4 * nIds ) nSlots <<= 1 ;
+        mask = nSlots - 1 ;
+        slots.assign( nSlots, std::make_pair( EMPTY, uint16_t( 0 ) ) ) ;
+    }
+
+    /** False for a short ID here already or probing too long */
+    bool Insert( uint64_t shortid, uint16_t position )
+    {
+        for ( size_t i = Slot( shortid ), n = 0 ; n < MAX_PROBE ; i = ( i + 1 ) & mask, n ++ ) {
+            if ( slots[ i ].first == shortid )
+                return false ;
+            if ( slots[ i ].first == EMPTY ) {
+                slots[ i ] = std::make_pair( shortid, position ) ;
+                return true ;
+            }
+        }
+        return false ;
+    }
+
+    /** Position of the short ID in the block, or -1 */
+    int Find( uint64_t shortid ) const
+    {
+        for ( size_t i = Slot( shortid ), n = 0 ; n < MAX_PROBE ; i = ( i + 1 ) & mask, n ++ ) {
+            if ( slots[ i ].first == shortid )
+                return slots[ i ].second ;
+            if ( slots[ i ].first == EMPTY )
+                return -1 ;
+        }
+        return -1 ;
+    }
+
+private:
+    // short IDs are 48 bits, this one is none
+    static const uint64_t EMPTY = ~uint64_t( 0 ) ;
+    static const size_t MAX_PROBE = 64 ;
+
+    size_t Slot( uint64_t shortid ) const
+    {
+        uint64_t h = ( shortid ^ salt ) * 0x9e3779b97f4a7c15ULL ;
+        return ( h ^ ( h >> 29 ) ) & mask ;
+    }
+
+    const uint64_t salt ;
+    uint64_t mask ;
+    std::vector< std::pair< uint64_t, uint16_t > > slots ;
+} ;
+
+const uint64_t ShortIdTable::EMPTY ;
+const size_t ShortIdTable::MAX_PROBE ;
+
+/** Mempool transactions whose short IDs are looked up by one thread at a time */
+static const size_t SHORTID_LOOKUP_CHUNK = 4096 ;
+
+/**
+ * (mempool index, block position) of mempool transactions matching short IDs, in mempool order,
+ * computed on the parallel task workers for a big mempool. Chunks are taken in order, and matches of
+ * chunks done one after another from the first are counted as the mempool walked one by one counts
+ * them: a position matched a second time isn't matched any more. No chunk is taken once that count
+ * says every position has exactly one match, as then the walk stops. So what's returned is always
+ * for a prefix of the mempool with all matches the walk one by one would see
+ */
+std::vector< std::pair< size_t, uint16_t > > MatchShortIds( const CBlockHeaderAndShortTxIDs & cmpctblock, const ShortIdTable & table,
+                                                            size_t nPositions, size_t nIds,
+                                                            const std::vector< std::pair< uint256, CTxMemPool::txiter > > & vTxHashes )
+{
+    // with every transaction prefilled, the walk one by one stops at the first entry
+    if ( nIds == 0 )
+        return std::vector< std::pair< size_t, uint16_t > >() ;
+
+    const size_t nChunks = ( vTxHashes.size() + SHORTID_LOOKUP_CHUNK - 1 ) / SHORTID_LOOKUP_CHUNK ;
+    std::vector< std::vector< std::pair< size_t, uint16_t > > > vChunkMatches( nChunks ) ;
+    std::atomic< size_t > nNext( 0 ) ;
+    std::atomic< bool > fAllMatched( false ) ;
+
+    std::mutex mutexCount ;
+    std::vector< char > vChunkDone( nChunks, 0 ) ;
+    size_t nChunksCounted = 0 ;
+    std::vector< uint8_t > vMatchesAt( nPositions, 0 ) ; // 0, 1, or 2 for more
+    size_t nMatchedOnce = 0 ;
+
+    // One call per chunk, each taking the next chunk in order, skipped once the walk would have stopped
+    ForEachInParallel( nChunks, [ & ]( size_t ) {
+        if ( fAllMatched )
+            return ;
+        const size_t c = nNext ++ ;
+        const size_t nEnd = std::min( vTxHashes.size(), ( c + 1 ) * SHORTID_LOOKUP_CHUNK ) ;
+        for ( size_t i = c * SHORTID_LOOKUP_CHUNK ; i < nEnd ; i ++ ) {
+            int position = table.Find( cmpctblock.GetShortID( vTxHashes[ i ].first ) ) ;
+            if ( position >= 0 )
+                vChunkMatches[ c ].push_back( std::make_pair( i, uint16_t( position ) ) ) ;
+        }
+
+        std::lock_guard< std::mutex > lock( mutexCount ) ;
+        vChunkDone[ c ] = 1 ;
+        for ( ; nChunksCounted < nChunks && vChunkDone[ nChunksCounted ] && ! fAllMatched ; nChunksCounted ++ ) {
+            for ( const std::pair< size_t, uint16_t > & match : vChunkMatches[ nChunksCounted ] ) {
+                uint8_t & nAt = vMatchesAt[ match.second ] ;
+                if ( nAt == 0 )
+                    nMatchedOnce ++ ;
+                else if ( nAt == 1 )
+                    nMatchedOnce -- ;
+                nAt = std::min( 2, nAt + 1 ) ;
+                if ( nMatchedOnce == nIds ) {
+                    fAllMatched = true ;
+                    break ;
+                }
+            }
+        }
+    } ) ;
+
+    std::vector< std::pair< size_t, uint16_t > > vMatches ;
+    for ( const std::vector< std::pair< size_t, uint16_t > > & v : vChunkMatches )
+        vMatches.insert( vMatches.end(), v.begin(), v.end() ) ;
+    return vMatches ;
+}
+
+} // namespace
+
 
 
 ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& cmpctblock, const std::vector<std::pair<uint256, CTransactionRef>>& extra_txn) {
@@ -80,67 +216,56 @@ ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& c
     // Because well-formed cmpctblock messages will have a (relatively) uniform distribution
     // of short IDs, any highly-uneven distribution of elements can be safely treated as a
     // READ_STATUS_FAILED.
-    std::unordered_map<uint64_t, uint16_t> shorttxids(cmpctblock.shorttxids.size());
+    // With a table too crowded at some short ID (it isn't with a well-formed cmpctblock),
+    // a fall back to the full block is as rare as a collision of short IDs
+    ShortIdTable shorttxids(cmpctblock.shorttxids.size());
     uint16_t index_offset = 0;
     for (size_t i = 0; i < cmpctblock.shorttxids.size(); i++) {
         while (txn_available[i + index_offset])
             index_offset++;
-        shorttxids[cmpctblock.shorttxids[i]] = i + index_offset;
-        // To determine the chance that the number of entries in a bucket exceeds N,
-        // we use the fact that the number of elements in a single bucket is
-        // binomially distributed (with n = the number of shorttxids S, and p =
-        // 1 / the number of buckets), that in the worst case the number of buckets is
-        // equal to S (due to std::unordered_map having a default load factor of 1.0),
-        // and that the chance for any bucket to exceed N elements is at most
-        // buckets * (the chance that any given bucket is above N elements).
-        // Thus: P(max_elements_per_bucket > N) <= S * (1 - cdf(binomial(n=S,p=1/S), N)).
-        // If we assume blocks of up to 16000, allowing 12 elements per bucket should
-        // only fail once per ~1 million block transfers (per peer and connection).
-        if (shorttxids.bucket_size(shorttxids.bucket(cmpctblock.shorttxids[i])) > 12)
-            return READ_STATUS_FAILED;
+        // TODO: in the shortid-collision case, we should instead request both transactions
+        // which collided. Falling back to full-block-request here is overkill
+        if (!shorttxids.Insert(cmpctblock.shorttxids[i], i + index_offset))
+            return READ_STATUS_FAILED; // Short ID collision
     }
-    // TODO: in the shortid-collision case, we should instead request both transactions
-    // which collided. Falling back to full-block-request here is overkill
-    if (shorttxids.size() != cmpctblock.shorttxids.size())
-        return READ_STATUS_FAILED; // Short ID collision
 
     std::vector<bool> have_txn(txn_available.size());
     {
     LOCK( pool->cs ) ;
     const std::vector< std::pair< uint256, CTxMemPool::txiter > > & vTxHashes = pool->vTxHashes ;
-    for ( size_t i = 0 ; i < vTxHashes.size() ; i ++ ) {
-        uint64_t shortid = cmpctblock.GetShortID( vTxHashes[ i ].first ) ;
-        std::unordered_map< uint64_t, uint16_t >::iterator idit = shorttxids.find( shortid ) ;
-        if ( idit != shorttxids.end() ) {
-            if ( ! have_txn[ idit->second ] ) {
-                txn_available[ idit->second ] = vTxHashes[ i ].second->GetTxPtr() ;
-                have_txn[ idit->second ]  = true ;
-                mempool_count ++ ;
-            } else {
-                // If we find two mempool txn that match the short id, just request it.
-                // This should be rare enough that the extra bandwidth doesn't matter,
-                // but eating a round-trip due to FillBlock failure would be annoying
-                if ( txn_available[ idit->second ] ) {
-                    txn_available[ idit->second ].reset() ;
-                    mempool_count -- ;
-                }
+    // Short IDs are computed on the parallel task workers, then matches are taken here in mempool order,
+    // with the same outcome as walking the mempool one by one
+    const std::vector< std::pair< size_t, uint16_t > > vMatches =
+            MatchShortIds( cmpctblock, shorttxids, txn_available.size(), cmpctblock.shorttxids.size(), vTxHashes ) ;
+    for ( const std::pair< size_t, uint16_t > & match : vMatches ) {
+        if ( ! have_txn[ match.second ] ) {
+            txn_available[ match.second ] = vTxHashes[ match.first ].second->GetTxPtr() ;
+            have_txn[ match.second ]  = true ;
+            mempool_count ++ ;
+        } else {
+            // If we find two mempool txn that match the short id, just request it.
+            // This should be rare enough that the extra bandwidth doesn't matter,
+            // but eating a round-trip due to FillBlock failure would be annoying
+            if ( txn_available[ match.second ] ) {
+                txn_available[ match.second ].reset() ;
+                mempool_count -- ;
             }
         }
         // Though ideally we'd continue scanning for the two-txn-match-shortid case,
         // the performance win of an early exit here is too good to pass up and worth
         // the extra risk
-        if ( mempool_count == shorttxids.size() )
+        if ( mempool_count == cmpctblock.shorttxids.size() )
             break ;
     }
     }
 
     for (size_t i = 0; i < extra_txn.size(); i++) {
         uint64_t shortid = cmpctblock.GetShortID(extra_txn[i].first);
-        std::unordered_map<uint64_t, uint16_t>::iterator idit = shorttxids.find(shortid);
-        if (idit != shorttxids.end()) {
-            if (!have_txn[idit->second]) {
-                txn_available[idit->second] = extra_txn[i].second;
-                have_txn[idit->second]  = true;
+        int position = shorttxids.Find(shortid);
+        if (position >= 0) {
+            if (!have_txn[position]) {
+                txn_available[position] = extra_txn[i].second;
+                have_txn[position]  = true;
                 mempool_count++;
                 extra_count++;
             } else {
@@ -150,9 +275,9 @@ ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& c
                 // but eating a round-trip due to FillBlock failure would be annoying
                 // Note that we dont want duplication between extra_txn and mempool to
                 // trigger this case, so we compare witness hashes first
-                if (txn_available[idit->second] &&
-                        txn_available[idit->second]->GetWitnessHash() != extra_txn[i].second->GetWitnessHash()) {
-                    txn_available[idit->second].reset();
+                if (txn_available[position] &&
+                        txn_available[position]->GetWitnessHash() != extra_txn[i].second->GetWitnessHash()) {
+                    txn_available[position].reset();
                     mempool_count--;
                     extra_count--;
                 }
@@ -161,7 +286,7 @@ ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& c
         // Though ideally we'd continue scanning for the two-txn-match-shortid case,
         // the performance win of an early exit here is too good to pass up and worth
         // the extra risk
-        if ( mempool_count == shorttxids.size() )
+        if ( mempool_count == cmpctblock.shorttxids.size() )
             break ;
     }
 
@@ -0,0 +1,97 @@
+// Copyright (c) 2020 The Dogecoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php
+
+#include "blockfilemap.h"
+
+#include "utillog.h"
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+CBlockFileMapper blockFileMapper ;
+
+CMappedFile::~CMappedFile()
+{
+#ifndef WIN32
+    munmap( const_cast< char * >( pdata ), nSize ) ;
+#endif
+}
+
+std::shared_ptr< const CMappedFile > MapFile( const std::string & strPath )
+{
+#ifndef WIN32
+    int fd = open( strPath.c_str(), O_RDONLY ) ;
+    if ( fd < 0 ) return nullptr ;
+
+    std::shared_ptr< const CMappedFile > mapped ;
+    struct stat st ;
+    if ( fstat( fd, &st ) == 0 && st.st_size > 0 ) {
+        void * p = mmap( nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0 ) ;
+        if ( p != MAP_FAILED )
+            mapped = std::make_shared< const CMappedFile >( (const char *)p, (size_t)st.st_size ) ;
+        else
+            LogPrintf( "%s: can't map %s\n", __func__, strPath ) ;
+    }
+    // the mapping stays valid without the descriptor
+    close( fd ) ;
+    return mapped ;
+#else
+    return nullptr ;
+#endif
+}
+
+std::shared_ptr< const CMappedFile > CBlockFileMapper::Map( const std::string & strPath, size_t nNeeded )
+{
+    LOCK( cs ) ;
+    auto it = mapFiles.find( strPath ) ;
+    if ( it != mapFiles.end() ) {
+        lruList.splice( lruList.begin(), lruList, it->second.itLru ) ;
+        if ( it->second.mapped->size() >= nNeeded )
+            return it->second.mapped ;
+    }
+
+    // not mapped yet, or the file has grown since
+    std::shared_ptr< const CMappedFile > mapped = MapFile( strPath ) ;
+    if ( mapped == nullptr || mapped->size() < nNeeded )
+        return nullptr ;
+
+    if ( it == mapFiles.end() ) {
+        lruList.push_front( strPath ) ;
+        it = mapFiles.insert( std::make_pair( strPath, Entry() ) ).first ;
+        it->second.itLru = lruList.begin() ;
+    }
+    it->second.mapped = mapped ;
+
+    while ( mapFiles.size() > nMaxFiles ) {
+        mapFiles.erase( lruList.back() ) ;
+        lruList.pop_back() ;
+    }
+    return mapped ;
+}
+
+void CBlockFileMapper::Forget( const std::string & strPath )
+{
+    LOCK( cs ) ;
+    auto it = mapFiles.find( strPath ) ;
+    if ( it == mapFiles.end() ) return ;
+    lruList.erase( it->second.itLru ) ;
+    mapFiles.erase( it ) ;
+}
+
+void CBlockFileMapper::Clear()
+{
+    LOCK( cs ) ;
+    mapFiles.clear() ;
+    lruList.clear() ;
+}
+
+size_t CBlockFileMapper::GetCount()
+{
+    LOCK( cs ) ;
+    return mapFiles.size() ;
+}
@@ -0,0 +1,81 @@
+// Copyright (c) 2020 The Dogecoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php
+
+#ifndef DOGECOIN_BLOCKFILEMAP_H
+#define DOGECOIN_BLOCKFILEMAP_H
+
+#include "sync.h"
+
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+
+/** Maximum number of blk*.dat and rev*.dat files kept mapped, a file takes up to 144 MiB of address space */
+static const size_t MAX_BLOCK_FILE_MAPPINGS = sizeof( void * ) > 4 ? 64 : 4 ;
+
+/** Read-only memory mapping of a whole file */
+class CMappedFile
+{
+private:
+    const char * pdata ;
+    size_t nSize ;
+
+public:
+    CMappedFile( const char * pdataIn, size_t nSizeIn ) : pdata( pdataIn ), nSize( nSizeIn ) {}
+    ~CMappedFile() ;
+
+    CMappedFile( const CMappedFile & ) = delete ;
+    CMappedFile & operator=( const CMappedFile & ) = delete ;
+
+    const char * data() const {  return pdata ;  }
+    size_t size() const {  return nSize ;  }
+} ;
+
+/** Mapping of the whole file with this path, null when it can't be mapped */
+std::shared_ptr< const CMappedFile > MapFile( const std::string & strPath ) ;
+
+/**
+ * Mappings of blk*.dat and rev*.dat files, for reading blocks and undo data
+ * from the page cache instead of opening, seeking and reading files through
+ * buffers again for every record. When there are more mappings than the limit,
+ * least recently used ones are closed. A reader holding a mapping keeps it
+ * alive even after it's closed here
+ */
+class CBlockFileMapper
+{
+private:
+    // by path of the file
+    typedef std::list< std::string > LruList ;
+
+    struct Entry
+    {
+        std::shared_ptr< const CMappedFile > mapped ;
+        LruList::iterator itLru ;
+    } ;
+
+    CCriticalSection cs ;
+    std::map< std::string, Entry > mapFiles ;
+    LruList lruList ; // most recently used at front
+    size_t nMaxFiles ;
+
+public:
+    CBlockFileMapper() : nMaxFiles( MAX_BLOCK_FILE_MAPPINGS ) {}
+
+    /**
+     * Mapping of file with this path which has at least nNeeded bytes, the file
+     * is mapped again when it has grown since it was mapped. Null when it can't be mapped
+     */
+    std::shared_ptr< const CMappedFile > Map( const std::string & strPath, size_t nNeeded ) ;
+
+    /** Close mapping of the file, when it's removed or truncated */
+    void Forget( const std::string & strPath ) ;
+
+    void Clear() ;
+    size_t GetCount() ;
+} ;
+
+extern CBlockFileMapper blockFileMapper ;
+
+#endif
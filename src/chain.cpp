@@ -5,6 +5,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php
 
 #include "chain.h"
+#include "auxpowcache.h"
 #include "chainparams.h"
 #include "validation.h"
 
@@ -14,15 +15,6 @@ CBlockHeader CBlockIndex::GetBlockHeader( const Consensus::Params & consensusPar
 
     block.nVersion       = nVersion ;
 
-    /* The CBlockIndex object's block header doesn't include the auxpow.
-       So if this is an auxpow block, read it from disk instead. Only
-       read the actual *header*, not the full block */
-    if ( block.IsAuxpowInVersion() )
-    {
-        ReadBlockHeaderFromDisk( block, this, consensusParams ) ;
-        return block ;
-    }
-
     if ( pprev )
         block.hashPrevBlock = pprev->GetBlockSha256Hash() ;
 
@@ -31,6 +23,21 @@ CBlockHeader CBlockIndex::GetBlockHeader( const Consensus::Params & consensusPar
     block.nBits          = nBits ;
     block.nNonce         = nNonce ;
 
+    /* The CBlockIndex object's block header doesn't include the auxpow.
+       So if this is an auxpow block, take it from auxpowCache or read it
+       from disk when it isn't there. Only read the actual *header*, not
+       the full block */
+    if ( block.IsAuxpowInVersion() )
+    {
+        block.auxpow = auxpowCache.Get( GetBlockSha256Hash() ) ;
+        if ( block.auxpow != nullptr )
+            return block ;
+
+        if ( ReadBlockHeaderFromDisk( block, this, consensusParams ) )
+            auxpowCache.Put( GetBlockSha256Hash(), block.auxpow ) ;
+        return block ;
+    }
+
     return block ;
 }
 
@@ -103,8 +110,13 @@ const CBlockIndex *CChain::FindFork(const CBlockIndex *pindex) const {
     }
     if (pindex->nHeight > Height())
         pindex = pindex->GetAncestor(Height());
-    while (pindex && !Contains(pindex))
-        pindex = pindex->pprev;
+    while ( pindex != nullptr && ! Contains( pindex ) ) {
+        // when the skip isn't in this chain either, the fork is below it
+        if ( pindex->pskip != nullptr && ! Contains( pindex->pskip ) )
+            pindex = pindex->pskip ;
+        else
+            pindex = pindex->pprev ;
+    }
     return pindex;
 }
 
@@ -15,6 +15,9 @@
 #include "uint256.h"
 #include "utiltime.h"
 
+#include <memory>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 class CBlockFileInfo
@@ -153,6 +156,8 @@ enum BlockStatus: uint32_t {
     BLOCK_FAILED_MASK        =   BLOCK_FAILED_VALID | BLOCK_FAILED_CHILD,
 
     BLOCK_OPT_WITNESS       =   128, //!< block data in blk*.data was received with a witness-enforcing client
+
+    BLOCK_POW_CHECKED       =   256, //!< proof of work of block data in blk*.dat was checked, reading it doesn't check again
 };
 
 /** The block chain is a tree shaped structure starting with the
@@ -216,6 +221,9 @@ public:
     // (memory only) Maximum nTime in the chain upto and including this block
     unsigned int nTimeMax;
 
+    // (memory only) Position of this block in the block index snapshot, -1 when it isn't there
+    int32_t nSnapshotSlot ;
+
     void SetNull()
     {
         sha256HashBlock = nullptr ;
@@ -236,6 +244,7 @@ public:
 
         nSequenceId = 0;
         nTimeMax = 0;
+        nSnapshotSlot = -1 ;
 
         nVersion = 0;
         hashMerkleRoot = uint256();
@@ -426,6 +435,57 @@ public:
     }
 };
 
+/**
+ * Storage of block index entries, which are made in slabs of many and never
+ * freed one by one, only all together. Entries made one after another are next
+ * to one another, and as the index is loaded parents first and new blocks come
+ * mostly in order of height, so are the blocks of a chain. Walking a chain by
+ * pprev and pskip then touches few pages and cache lines
+ */
+class CBlockIndexArena
+{
+private:
+    static const size_t ENTRIES_PER_SLAB = 4096 ;
+
+    typedef std::aligned_storage< sizeof( CBlockIndex ), alignof( CBlockIndex ) >::type Entry ;
+    std::vector< std::unique_ptr< Entry[] > > slabs ;
+    size_t nUsedInLastSlab ;
+
+public:
+    CBlockIndexArena() : nUsedInLastSlab( 0 ) {}
+
+    CBlockIndexArena( const CBlockIndexArena & ) = delete ;
+    CBlockIndexArena & operator=( const CBlockIndexArena & ) = delete ;
+
+    template < typename ... Args >
+    CBlockIndex * New( Args && ... args )
+    {
+        if ( slabs.empty() || nUsedInLastSlab == ENTRIES_PER_SLAB ) {
+            slabs.emplace_back( new Entry[ ENTRIES_PER_SLAB ] ) ;
+            nUsedInLastSlab = 0 ;
+        }
+        return new ( &slabs.back()[ nUsedInLastSlab ++ ] ) CBlockIndex( std::forward< Args >( args ) ... ) ;
+    }
+
+    //! Free all the entries at once, pointers to them are no longer valid
+    void Clear()
+    {
+        static_assert( std::is_trivially_destructible< CBlockIndex >::value, "entries are freed without destructors" ) ;
+        slabs.clear() ;
+        nUsedInLastSlab = 0 ;
+    }
+
+    size_t size() const
+    {
+        return slabs.empty() ? 0 : ( slabs.size() - 1 ) * ENTRIES_PER_SLAB + nUsedInLastSlab ;
+    }
+
+    size_t DynamicMemoryUsage() const
+    {
+        return slabs.size() * ENTRIES_PER_SLAB * sizeof( Entry ) + slabs.capacity() * sizeof( slabs[ 0 ] ) ;
+    }
+} ;
+
 /** An in-memory indexed chain of blocks */
 class CChain {
 private:
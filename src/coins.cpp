@@ -5,158 +5,117 @@
 
 #include "coins.h"
 
+#include "consensus/consensus.h"
 #include "memusage.h"
+#include "version.h"
 
 #include <assert.h>
-
-/**
- * calculate number of bytes for the bitmask, and its number of non-zero bytes
- * each bit in the bitmask represents the availability of one output, but the
- * availabilities of the first two outputs are encoded separately
- */
-void CCoins::CalcMaskSize(unsigned int &nBytes, unsigned int &nNonzeroBytes) const {
-    unsigned int nLastUsedByte = 0;
-    for (unsigned int b = 0; 2+b*8 < vout.size(); b++) {
-        bool fZero = true;
-        for (unsigned int i = 0; i < 8 && 2+b*8+i < vout.size(); i++) {
-            if (!vout[2+b*8+i].IsNull()) {
-                fZero = false;
-                continue;
-            }
-        }
-        if (!fZero) {
-            nLastUsedByte = b + 1;
-            nNonzeroBytes++;
-        }
-    }
-    nBytes += nLastUsedByte;
-}
-
-bool CCoins::Spend(uint32_t nPos) 
-{
-    if (nPos >= vout.size() || vout[nPos].IsNull())
-        return false;
-    vout[nPos].SetNull();
-    Cleanup();
-    return true;
-}
+#include <tuple>
 
 size_t CCoinsViewCache::DynamicMemoryUsage() const
 {
     return memusage::DynamicUsage( cacheCoins ) + cachedCoinsUsage ;
 }
 
-CCoinsMap::const_iterator CCoinsViewCache::FetchCoins( const uint256 & txhash ) const
+CCoinsMap::iterator CCoinsViewCache::FetchCoin( const COutPoint & outpoint ) const
 {
-    CCoinsMap::iterator it = cacheCoins.find( txhash ) ;
-    if (it != cacheCoins.end())
-        return it;
-    CCoins tmp;
-    if ( ! base->GetCoins( txhash, tmp ) )
-        return cacheCoins.end();
-    CCoinsMap::iterator ret = cacheCoins.insert( std::make_pair( txhash, CCoinsCacheEntry() ) ).first ;
-    tmp.swap(ret->second.coins);
-    if (ret->second.coins.IsPruned()) {
-        // The parent only has an empty entry for this txhash, we can consider our
+    CCoinsMap::iterator it = cacheCoins.find( outpoint ) ;
+    if ( it != cacheCoins.end() )
+        return it ;
+    Coin tmp ;
+    if ( ! base->GetCoin( outpoint, tmp ) )
+        return cacheCoins.end() ;
+    CCoinsMap::iterator ret = cacheCoins.emplace( std::piecewise_construct, std::forward_as_tuple( outpoint ), std::forward_as_tuple( std::move( tmp ) ) ).first ;
+    if ( ret->second.coin.IsSpent() ) {
+        // The parent only has an empty entry for this outpoint, we can consider our
         // version as fresh
         ret->second.flags = CCoinsCacheEntry::FRESH ;
     }
-    cachedCoinsUsage += ret->second.coins.DynamicMemoryUsage();
-    return ret;
+    cachedCoinsUsage += ret->second.coin.DynamicMemoryUsage() ;
+    return ret ;
 }
 
-bool CCoinsViewCache::GetCoins( const uint256 & txhash, CCoins & coins ) const
+bool CCoinsViewCache::GetCoin( const COutPoint & outpoint, Coin & coin ) const
 {
-    CCoinsMap::const_iterator it = FetchCoins( txhash ) ;
+    CCoinsMap::const_iterator it = FetchCoin( outpoint ) ;
     if ( it != cacheCoins.end() ) {
-        coins = it->second.coins;
-        return true;
+        coin = it->second.coin ;
+        return ! coin.IsSpent() ;
     }
-    return false;
+    return false ;
 }
 
-CCoinsModifier CCoinsViewCache::ModifyCoins( const uint256 & txhash )
+void CCoinsViewCache::AddCoin( const COutPoint & outpoint, Coin && coin, bool possible_overwrite )
 {
-    assert(!hasModifier);
-    std::pair< CCoinsMap::iterator, bool > ret = cacheCoins.insert( std::make_pair( txhash, CCoinsCacheEntry() ) ) ;
-    size_t cachedCoinUsage = 0;
-    if (ret.second) {
-        if ( ! base->GetCoins( txhash, ret.first->second.coins ) ) {
-            // The parent view does not have this entry; mark it as fresh
-            ret.first->second.coins.Clear();
-            ret.first->second.flags = CCoinsCacheEntry::FRESH;
-        } else if (ret.first->second.coins.IsPruned()) {
-            // The parent view only has a pruned entry for this; mark it as fresh
-            ret.first->second.flags = CCoinsCacheEntry::FRESH;
-        }
-    } else {
-        cachedCoinUsage = ret.first->second.coins.DynamicMemoryUsage();
+    assert( ! coin.IsSpent() ) ;
+    if ( coin.out.scriptPubKey.IsUnspendable() ) return ;
+
+    CCoinsMap::iterator it ;
+    bool inserted ;
+    std::tie( it, inserted ) = cacheCoins.emplace( std::piecewise_construct, std::forward_as_tuple( outpoint ), std::tuple<>() ) ;
+    bool fresh = false ;
+    if ( ! inserted )
+        cachedCoinsUsage -= it->second.coin.DynamicMemoryUsage() ;
+    if ( ! possible_overwrite ) {
+        if ( ! it->second.coin.IsSpent() )
+            throw std::logic_error( "Adding new coin that replaces non-pruned entry" ) ;
+        // If the coin is known to be spent in this view and the cache entry
+        // is not dirty, it must be spent in the parent view too, so it's fresh
+        fresh = ! ( it->second.flags & CCoinsCacheEntry::DIRTY ) ;
     }
-    // Assume that whenever ModifyCoins is called, the entry will be modified
-    ret.first->second.flags |= CCoinsCacheEntry::DIRTY;
-    return CCoinsModifier(*this, ret.first, cachedCoinUsage);
+    it->second.coin = std::move( coin ) ;
+    it->second.flags |= CCoinsCacheEntry::DIRTY | ( fresh ? CCoinsCacheEntry::FRESH : 0 ) ;
+    cachedCoinsUsage += it->second.coin.DynamicMemoryUsage() ;
 }
 
-/* ModifyNewCoins allows for faster coin modification when creating the new
- * outputs from a transaction.  It assumes that BIP 30 (no duplicate tx hashes)
- * applies and has already been tested for (or the test is not required due to
- * BIP 34, height in coinbase).  If we can assume BIP 30 then we know that any
- * non-coinbase transaction we are adding to the UTXO must not already exist in
- * the utxo unless it is fully spent.  Thus we can check only if it exists DIRTY
- * at the current level of the cache, in which case it is not safe to mark it
- * FRESH (b/c then its spentness still needs to flushed).  If it's not dirty and
- * doesn't exist or is pruned in the current cache, we know it either doesn't
- * exist or is pruned in parent caches, which is the definition of FRESH.  The
- * exception to this is the two historical violations of BIP 30 in the chain,
- * both of which were coinbases.  We do not mark these fresh so we we can ensure
- * that they will still be properly overwritten when spent
- */
-CCoinsModifier CCoinsViewCache::ModifyNewCoins( const uint256 & txhash, bool coinbase )
+void AddCoins( CCoinsViewCache & cache, const CTransaction & tx, int nHeight, bool check )
 {
-    assert(!hasModifier);
-    std::pair< CCoinsMap::iterator, bool > ret = cacheCoins.insert( std::make_pair( txhash, CCoinsCacheEntry() ) ) ;
-    if (!coinbase) {
-        // New coins must not already exist
-        if (!ret.first->second.coins.IsPruned())
-            throw std::logic_error("ModifyNewCoins should not find pre-existing coins on a non-coinbase unless they are pruned!");
-
-        if (!(ret.first->second.flags & CCoinsCacheEntry::DIRTY)) {
-            // If the coin is known to be pruned (have no unspent outputs) in
-            // the current view and the cache entry is not dirty, we know the
-            // coin also must be pruned in the parent view as well, so it is safe
-            // to mark this fresh
-            ret.first->second.flags |= CCoinsCacheEntry::FRESH;
-        }
+    bool fCoinbase = tx.IsCoinBase() ;
+    const uint256 & txid = tx.GetTxHash() ;
+    for ( size_t i = 0 ; i < tx.vout.size() ; ++ i ) {
+        // Coinbase may overwrite, for the two historical violations of BIP 30
+        // which were both coinbases
+        bool overwrite = check ? cache.HaveCoin( COutPoint( txid, i ) ) : fCoinbase ;
+        cache.AddCoin( COutPoint( txid, i ), Coin( tx.vout[ i ], nHeight, fCoinbase ), overwrite ) ;
     }
-    ret.first->second.coins.Clear();
-    ret.first->second.flags |= CCoinsCacheEntry::DIRTY;
-    return CCoinsModifier(*this, ret.first, 0);
 }
 
-const CCoins* CCoinsViewCache::AccessCoins( const uint256 & txhash ) const
+bool CCoinsViewCache::SpendCoin( const COutPoint & outpoint, Coin * moveout )
 {
-    CCoinsMap::const_iterator it = FetchCoins( txhash ) ;
-    if (it == cacheCoins.end()) {
-        return NULL;
+    CCoinsMap::iterator it = FetchCoin( outpoint ) ;
+    if ( it == cacheCoins.end() ) return false ;
+    cachedCoinsUsage -= it->second.coin.DynamicMemoryUsage() ;
+    if ( moveout != nullptr )
+        *moveout = std::move( it->second.coin ) ;
+    if ( it->second.flags & CCoinsCacheEntry::FRESH ) {
+        cacheCoins.erase( it ) ;
     } else {
-        return &it->second.coins;
+        it->second.flags |= CCoinsCacheEntry::DIRTY ;
+        it->second.coin.Clear() ;
     }
+    return true ;
 }
 
-bool CCoinsViewCache::HaveCoins( const uint256 & txhash ) const
+static const Coin coinEmpty ;
+
+const Coin & CCoinsViewCache::AccessCoin( const COutPoint & outpoint ) const
 {
-    CCoinsMap::const_iterator it = FetchCoins( txhash ) ;
-    // We're using vtx.empty() instead of IsPruned here for performance reasons,
-    // as we only care about the case where a transaction was replaced entirely
-    // in a reorganization (which wipes vout entirely, as opposed to spending
-    // which just cleans individual outputs)
-    return ( it != cacheCoins.end() && ! it->second.coins.vout.empty() ) ;
+    CCoinsMap::const_iterator it = FetchCoin( outpoint ) ;
+    if ( it == cacheCoins.end() )
+        return coinEmpty ;
+    return it->second.coin ;
 }
 
-bool CCoinsViewCache::HaveCoinsInCache( const uint256 & txhash ) const
+bool CCoinsViewCache::HaveCoin( const COutPoint & outpoint ) const
 {
-    CCoinsMap::const_iterator it = cacheCoins.find( txhash ) ;
-    return it != cacheCoins.end() ;
+    CCoinsMap::const_iterator it = FetchCoin( outpoint ) ;
+    return ( it != cacheCoins.end() && ! it->second.coin.IsSpent() ) ;
+}
+
+bool CCoinsViewCache::HaveCoinInCache( const COutPoint & outpoint ) const
+{
+    CCoinsMap::const_iterator it = cacheCoins.find( outpoint ) ;
+    return ( it != cacheCoins.end() && ! it->second.coin.IsSpent() ) ;
 }
 
 uint256 CCoinsViewCache::GetSha256OfBestBlock() const
@@ -168,19 +127,18 @@ uint256 CCoinsViewCache::GetSha256OfBestBlock() const
 
 bool CCoinsViewCache::BatchWrite( CCoinsMap & mapCoins, const uint256 & blockHash )
 {
-    assert(!hasModifier);
     for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) { // Ignore non-dirty entries for optimization
             CCoinsMap::iterator itUs = cacheCoins.find(it->first);
             if (itUs == cacheCoins.end()) {
                 // The parent cache does not have an entry, while the child does
                 // We can ignore it if it's both FRESH and pruned in the child
-                if (!(it->second.flags & CCoinsCacheEntry::FRESH && it->second.coins.IsPruned())) {
+                if (!(it->second.flags & CCoinsCacheEntry::FRESH && it->second.coin.IsSpent())) {
                     // Otherwise we will need to create it in the parent
                     // and move the data up and mark it as dirty
                     CCoinsCacheEntry& entry = cacheCoins[it->first];
-                    entry.coins.swap(it->second.coins);
-                    cachedCoinsUsage += entry.coins.DynamicMemoryUsage();
+                    entry.coin = std::move(it->second.coin);
+                    cachedCoinsUsage += entry.coin.DynamicMemoryUsage();
                     entry.flags = CCoinsCacheEntry::DIRTY;
                     // We can mark it FRESH in the parent if it was FRESH in the child
                     // Otherwise it might have just been flushed from the parent's cache
@@ -193,21 +151,21 @@ bool CCoinsViewCache::BatchWrite( CCoinsMap & mapCoins, const uint256 & blockHas
                 // parent cache entry has unspent outputs. If this ever happens,
                 // it means the FRESH flag was misapplied and there is a logic
                 // error in the calling code.
-                if ((it->second.flags & CCoinsCacheEntry::FRESH) && !itUs->second.coins.IsPruned())
+                if ((it->second.flags & CCoinsCacheEntry::FRESH) && !itUs->second.coin.IsSpent())
                     throw std::logic_error("FRESH flag misapplied to cache entry for base transaction with spendable outputs");
 
                 // Found the entry in the parent cache
-                if ((itUs->second.flags & CCoinsCacheEntry::FRESH) && it->second.coins.IsPruned()) {
+                if ((itUs->second.flags & CCoinsCacheEntry::FRESH) && it->second.coin.IsSpent()) {
                     // The grandparent does not have an entry, and the child is
                     // modified and being pruned. This means we can just delete
                     // it from the parent.
-                    cachedCoinsUsage -= itUs->second.coins.DynamicMemoryUsage();
+                    cachedCoinsUsage -= itUs->second.coin.DynamicMemoryUsage();
                     cacheCoins.erase(itUs);
                 } else {
                     // A normal modification.
-                    cachedCoinsUsage -= itUs->second.coins.DynamicMemoryUsage();
-                    itUs->second.coins.swap(it->second.coins);
-                    cachedCoinsUsage += itUs->second.coins.DynamicMemoryUsage();
+                    cachedCoinsUsage -= itUs->second.coin.DynamicMemoryUsage();
+                    itUs->second.coin = std::move(it->second.coin);
+                    cachedCoinsUsage += itUs->second.coin.DynamicMemoryUsage();
                     itUs->second.flags |= CCoinsCacheEntry::DIRTY;
                     // NOTE: It is possible the child has a FRESH flag here in
                     // the event the entry we found in the parent is pruned. But
@@ -232,24 +190,28 @@ bool CCoinsViewCache::Flush()
     return ok ;
 }
 
-void CCoinsViewCache::Uncache( const uint256 & hash )
+void CCoinsViewCache::Uncache( const COutPoint & outpoint )
 {
-    CCoinsMap::iterator it = cacheCoins.find(hash);
-    if (it != cacheCoins.end() && it->second.flags == 0) {
-        cachedCoinsUsage -= it->second.coins.DynamicMemoryUsage();
-        cacheCoins.erase(it);
+    CCoinsMap::iterator it = cacheCoins.find( outpoint ) ;
+    if ( it != cacheCoins.end() && it->second.flags == 0 ) {
+        cachedCoinsUsage -= it->second.coin.DynamicMemoryUsage() ;
+        cacheCoins.erase( it ) ;
     }
 }
 
-unsigned int CCoinsViewCache::GetCacheSize() const {
-    return cacheCoins.size();
+void CCoinsViewCache::AddFetchedCoin( const COutPoint & outpoint, Coin && coin )
+{
+    std::pair< CCoinsMap::iterator, bool > inserted = cacheCoins.emplace( std::piecewise_construct, std::forward_as_tuple( outpoint ), std::forward_as_tuple( std::move( coin ) ) ) ;
+    if ( ! inserted.second ) return ;
+
+    // same as in FetchCoin
+    if ( inserted.first->second.coin.IsSpent() )
+        inserted.first->second.flags = CCoinsCacheEntry::FRESH ;
+    cachedCoinsUsage += inserted.first->second.coin.DynamicMemoryUsage() ;
 }
 
-const CTxOut &CCoinsViewCache::GetOutputFor(const CTxIn& input) const
-{
-    const CCoins* coins = AccessCoins(input.prevout.hash);
-    assert(coins && coins->IsAvailable(input.prevout.n));
-    return coins->vout[input.prevout.n];
+unsigned int CCoinsViewCache::GetCacheSize() const {
+    return cacheCoins.size();
 }
 
 CAmount CCoinsViewCache::GetValueIn(const CTransaction& tx) const
@@ -259,7 +221,7 @@ CAmount CCoinsViewCache::GetValueIn(const CTransaction& tx) const
 
     CAmount nResult = 0;
     for (unsigned int i = 0; i < tx.vin.size(); i++)
-        nResult += GetOutputFor(tx.vin[i]).nValue;
+        nResult += AccessCoin(tx.vin[i].prevout).out.nValue;
 
     return nResult;
 }
@@ -268,9 +230,7 @@ bool CCoinsViewCache::HaveInputs(const CTransaction& tx) const
 {
     if (!tx.IsCoinBase()) {
         for (unsigned int i = 0; i < tx.vin.size(); i++) {
-            const COutPoint &prevout = tx.vin[i].prevout;
-            const CCoins* coins = AccessCoins(prevout.hash);
-            if (!coins || !coins->IsAvailable(prevout.n)) {
+            if (!HaveCoin(tx.vin[i].prevout)) {
                 return false;
             }
         }
@@ -286,34 +246,28 @@ double CCoinsViewCache::GetPriority(const CTransaction &tx, int nHeight, CAmount
     double dResult = 0.0;
     for ( const CTxIn & txin : tx.vin )
     {
-        const CCoins* coins = AccessCoins(txin.prevout.hash);
-        assert(coins);
-        if (!coins->IsAvailable(txin.prevout.n)) continue;
-        if (coins->nHeight <= nHeight) {
-            dResult += (double)(coins->vout[txin.prevout.n].nValue) * (nHeight-coins->nHeight);
-            inChainInputValue += coins->vout[txin.prevout.n].nValue;
+        const Coin& coin = AccessCoin(txin.prevout);
+        if (coin.IsSpent()) continue;
+        if (coin.nHeight <= nHeight) {
+            dResult += (double)(coin.out.nValue) * (nHeight-coin.nHeight);
+            inChainInputValue += coin.out.nValue;
         }
     }
     return tx.ComputePriority(dResult);
 }
 
-CCoinsModifier::CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_, size_t usage) : cache(cache_), it(it_), cachedCoinUsage(usage) {
-    assert(!cache.hasModifier);
-    cache.hasModifier = true;
-}
+static const size_t MIN_TRANSACTION_OUTPUT_WEIGHT = WITNESS_SCALE_FACTOR * ::GetSerializeSize( CTxOut(), SER_NETWORK, PROTOCOL_VERSION ) ;
+static const size_t MAX_OUTPUTS_PER_BLOCK = MAX_BLOCK_WEIGHT / MIN_TRANSACTION_OUTPUT_WEIGHT ;
 
-CCoinsModifier::~CCoinsModifier()
+const Coin & AccessByTxid( const CCoinsViewCache & view, const uint256 & txid )
 {
-    assert(cache.hasModifier);
-    cache.hasModifier = false;
-    it->second.coins.Cleanup();
-    cache.cachedCoinsUsage -= cachedCoinUsage; // Subtract the old usage
-    if ((it->second.flags & CCoinsCacheEntry::FRESH) && it->second.coins.IsPruned()) {
-        cache.cacheCoins.erase(it);
-    } else {
-        // If the coin still exists after the modification, add the new usage
-        cache.cachedCoinsUsage += it->second.coins.DynamicMemoryUsage();
+    COutPoint iter( txid, 0 ) ;
+    while ( iter.n < MAX_OUTPUTS_PER_BLOCK ) {
+        const Coin & alternate = view.AccessCoin( iter ) ;
+        if ( ! alternate.IsSpent() ) return alternate ;
+        ++ iter.n ;
     }
+    return coinEmpty ;
 }
 
 CCoinsViewCursor::~CCoinsViewCursor()
@@ -21,236 +21,100 @@
 #include <unordered_map>
 
 /**
- * Pruned version of CTransaction: only retains metadata and unspent transaction outputs
+ * A UTXO entry
  *
  * Serialized format:
- * - VARINT(nVersion)
- * - VARINT(nCode)
- * - unspentness bitvector, for vout[2] and further; least significant byte first
- * - the non-spent CTxOuts (via CTxOutCompressor)
- * - VARINT(nHeight)
+ * - VARINT((coinbase ? 1 : 0) | (height << 1))
+ * - the non-spent CTxOut (via CTxOutCompressor)
  *
- * The nCode value consists of:
- * - bit 0: IsCoinBase()
- * - bit 1: vout[0] is not spent
- * - bit 2: vout[1] is not spent
- * - The higher bits encode N, the number of non-zero bytes in the following bitvector.
- *   - In case both bit 1 and bit 2 are unset, they encode N-1, as there must be at
- *     least one non-spent output).
+ * Example: 97f23c835800816115944e077fe7c803cfa57f29b36bf87c1d35
+ *          <----><---------------------------------------------->
+ *            |                         |
+ *          code                      txout
  *
- * Example: 0104835800816115944e077fe7c803cfa57f29b36bf87c1d358bb85e
- *          <><><--------------------------------------------><---->
- *          |  \                  |                             /
- *    version   code             vout[1]                  height
+ *  - code = 203998 * 2 (not coinbase, height 203998)
+ *  - txout: 835800816115944e077fe7c803cfa57f29b36bf87c1d35
+ *           * 8358: compact amount representation for 60000000000 (600.00000000 DOGE)
+ *           * 00: special txout type pay-to-pubkey-hash
+ *           * 816115944e077fe7c803cfa57f29b36bf87c1d35: address uint160
  *
- *    - version = 1
- *    - code = 4 (vout[1] is not spent, and 0 non-zero bytes of bitvector follow)
- *    - unspentness bitvector: as 0 non-zero bytes follow, it has length 0
- *    - vout[1]: 835800816115944e077fe7c803cfa57f29b36bf87c1d35
- *               * 8358: compact amount representation for 60000000000 (600.00000000 DOGE)
- *               * 00: special txout type pay-to-pubkey-hash
- *               * 816115944e077fe7c803cfa57f29b36bf87c1d35: address uint160
- *    - height = 203998
- *
- *
- * Example: 0109044086ef97d5790061b01caab50f1b8e9c50a5057eb43c2d9563a4eebbd123008c988f1a4a4de2161e0f50aac7f17e7f9555caa486af3b
- *          <><><--><--------------------------------------------------><----------------------------------------------><---->
- *         /  \   \                     |                                                           |                     /
- *  version  code  unspentness       vout[4]                                                     vout[16]           height
- *
- *  - version = 1
- *  - code = 9 (coinbase, neither vout[0] or vout[1] are unspent,
- *                2 (1, +1 because both bit 1 and bit 2 are unset) non-zero bitvector bytes follow)
- *  - unspentness bitvector: bits 2 (0x04) and 14 (0x4000) are set, so vout[2+2] and vout[14+2] are unspent
- *  - vout[4]: 86ef97d5790061b01caab50f1b8e9c50a5057eb43c2d9563a4ee
- *             * 86ef97d579: compact amount representation for 234925952 (2.34925952 DOGE)
- *             * 00: special txout type pay-to-pubkey-hash
- *             * 61b01caab50f1b8e9c50a5057eb43c2d9563a4ee: address uint160
- *  - vout[16]: bbd123008c988f1a4a4de2161e0f50aac7f17e7f9555caa4
- *              * bbd123: compact amount representation for 110397 (0.00110397 DOGE)
- *              * 00: special txout type pay-to-pubkey-hash
- *              * 8c988f1a4a4de2161e0f50aac7f17e7f9555caa4: address uint160
- *  - height = 120891
+ * Every output has a record of its own keyed by outpoint, so spending one output
+ * of a transaction with many outputs touches only this output's record
  */
-class CCoins
+class Coin
 {
 public:
-    //! whether transaction is a coinbase
-    bool fCoinBase;
-
-    //! unspent transaction outputs; spent outputs are .IsNull(); spent outputs at the end of the array are dropped
-    std::vector<CTxOut> vout;
-
-    //! at which height this transaction was included in the active block chain
-    int nHeight;
-
-    //! version of the CTransaction; accesses to this value should probably check for nHeight as well,
-    //! as new tx version will probably only be introduced at certain heights
-    int nVersion;
+    //! unspent transaction output
+    CTxOut out ;
 
-    void FromTx(const CTransaction &tx, int nHeightIn) {
-        fCoinBase = tx.IsCoinBase();
-        vout = tx.vout;
-        nHeight = nHeightIn;
-        nVersion = tx.nVersion;
-        ClearUnspendable();
-    }
+    //! whether containing transaction was a coinbase
+    unsigned int fCoinBase : 1 ;
 
-    //! construct a CCoins from a CTransaction, at a given height
-    CCoins(const CTransaction &tx, int nHeightIn) {
-        FromTx(tx, nHeightIn);
-    }
+    //! at which height this containing transaction was included in the active block chain
+    uint32_t nHeight : 31 ;
 
-    void Clear() {
-        fCoinBase = false;
-        std::vector<CTxOut>().swap(vout);
-        nHeight = 0;
-        nVersion = 0;
-    }
+    //! construct a Coin from a CTxOut and height/coinbase information
+    Coin( CTxOut && outIn, int nHeightIn, bool fCoinBaseIn ) : out( std::move( outIn ) ), fCoinBase( fCoinBaseIn ), nHeight( nHeightIn ) {}
+    Coin( const CTxOut & outIn, int nHeightIn, bool fCoinBaseIn ) : out( outIn ), fCoinBase( fCoinBaseIn ), nHeight( nHeightIn ) {}
 
     //! empty constructor
-    CCoins() : fCoinBase(false), vout(0), nHeight(0), nVersion(0) { }
-
-    //!remove spent outputs at the end of vout
-    void Cleanup() {
-        while (vout.size() > 0 && vout.back().IsNull())
-            vout.pop_back();
-        if (vout.empty())
-            std::vector<CTxOut>().swap(vout);
-    }
-
-    void ClearUnspendable() {
-        for ( CTxOut & txout : vout ) {
-            if ( txout.scriptPubKey.IsUnspendable() )
-                txout.SetNull() ;
-        }
-        Cleanup();
-    }
-
-    void swap(CCoins &to) {
-        std::swap(to.fCoinBase, fCoinBase);
-        to.vout.swap(vout);
-        std::swap(to.nHeight, nHeight);
-        std::swap(to.nVersion, nVersion);
-    }
+    Coin() : fCoinBase( false ), nHeight( 0 ) { }
 
-    //! equality test
-    friend bool operator==(const CCoins &a, const CCoins &b) {
-         // Empty CCoins objects are always equal.
-         if (a.IsPruned() && b.IsPruned())
-             return true;
-         return a.fCoinBase == b.fCoinBase &&
-                a.nHeight == b.nHeight &&
-                a.nVersion == b.nVersion &&
-                a.vout == b.vout;
-    }
-    friend bool operator!=(const CCoins &a, const CCoins &b) {
-        return !(a == b);
+    void Clear() {
+        out.SetNull() ;
+        fCoinBase = false ;
+        nHeight = 0 ;
     }
 
-    void CalcMaskSize(unsigned int &nBytes, unsigned int &nNonzeroBytes) const;
-
     bool IsCoinBase() const {
-        return fCoinBase;
+        return fCoinBase ;
     }
 
-    template<typename Stream>
-    void Serialize(Stream &s) const {
-        unsigned int nMaskSize = 0, nMaskCode = 0;
-        CalcMaskSize(nMaskSize, nMaskCode);
-        bool fFirst = vout.size() > 0 && !vout[0].IsNull();
-        bool fSecond = vout.size() > 1 && !vout[1].IsNull();
-        assert(fFirst || fSecond || nMaskCode);
-        unsigned int nCode = 8*(nMaskCode - (fFirst || fSecond ? 0 : 1)) + (fCoinBase ? 1 : 0) + (fFirst ? 2 : 0) + (fSecond ? 4 : 0);
-        // version
-        ::Serialize(s, VARINT(this->nVersion));
-        // header code
-        ::Serialize(s, VARINT(nCode));
-        // spentness bitmask
-        for (unsigned int b = 0; b<nMaskSize; b++) {
-            unsigned char chAvail = 0;
-            for (unsigned int i = 0; i < 8 && 2+b*8+i < vout.size(); i++)
-                if (!vout[2+b*8+i].IsNull())
-                    chAvail |= (1 << i);
-            ::Serialize(s, chAvail);
-        }
-        // txouts themself
-        for (unsigned int i = 0; i < vout.size(); i++) {
-            if (!vout[i].IsNull())
-                ::Serialize(s, CTxOutCompressor(REF(vout[i])));
-        }
-        // coinbase height
-        ::Serialize(s, VARINT(nHeight));
+    template < typename Stream >
+    void Serialize( Stream & s ) const {
+        assert( ! IsSpent() ) ;
+        uint32_t code = nHeight * 2 + fCoinBase ;
+        ::Serialize( s, VARINT( code ) ) ;
+        ::Serialize( s, CTxOutCompressor( REF( out ) ) ) ;
     }
 
-    template<typename Stream>
-    void Unserialize(Stream &s) {
-        unsigned int nCode = 0;
-        // version
-        ::Unserialize(s, VARINT(this->nVersion));
-        // header code
-        ::Unserialize(s, VARINT(nCode));
-        fCoinBase = nCode & 1;
-        std::vector<bool> vAvail(2, false);
-        vAvail[0] = (nCode & 2) != 0;
-        vAvail[1] = (nCode & 4) != 0;
-        unsigned int nMaskCode = (nCode / 8) + ((nCode & 6) != 0 ? 0 : 1);
-        // spentness bitmask
-        while (nMaskCode > 0) {
-            unsigned char chAvail = 0;
-            ::Unserialize(s, chAvail);
-            for (unsigned int p = 0; p < 8; p++) {
-                bool f = (chAvail & (1 << p)) != 0;
-                vAvail.push_back(f);
-            }
-            if (chAvail != 0)
-                nMaskCode--;
-        }
-        // txouts themself
-        vout.assign(vAvail.size(), CTxOut());
-        for (unsigned int i = 0; i < vAvail.size(); i++) {
-            if (vAvail[i])
-                ::Unserialize(s, REF(CTxOutCompressor(vout[i])));
-        }
-        // coinbase height
-        ::Unserialize(s, VARINT(nHeight));
-        Cleanup();
+    template < typename Stream >
+    void Unserialize( Stream & s ) {
+        uint32_t code = 0 ;
+        ::Unserialize( s, VARINT( code ) ) ;
+        nHeight = code >> 1 ;
+        fCoinBase = code & 1 ;
+        ::Unserialize( s, REF( CTxOutCompressor( out ) ) ) ;
     }
 
-    //! mark a vout spent
-    bool Spend(uint32_t nPos);
+    //! spent coins are .IsNull() outputs, they aren't serialized
+    bool IsSpent() const {
+        return out.IsNull() ;
+    }
 
-    //! check whether a particular output is still available
-    bool IsAvailable(unsigned int nPos) const {
-        return (nPos < vout.size() && !vout[nPos].IsNull());
+    size_t DynamicMemoryUsage() const {
+        return memusage::DynamicUsage( out.scriptPubKey ) ;
     }
 
-    //! check whether the entire CCoins is spent
-    //! note that only !IsPruned() CCoins can be serialized
-    bool IsPruned() const {
-        for ( const CTxOut & out : vout )
-            if ( ! out.IsNull() )
-                return false ;
-        return true ;
+    friend bool operator==( const Coin & a, const Coin & b ) {
+        // Empty Coin objects are always equal
+        if ( a.IsSpent() && b.IsSpent() ) return true ;
+        return a.fCoinBase == b.fCoinBase && a.nHeight == b.nHeight && a.out == b.out ;
     }
 
-    size_t DynamicMemoryUsage() const {
-        size_t ret = memusage::DynamicUsage(vout);
-        for ( const CTxOut & out : vout ) {
-            ret += RecursiveDynamicUsage( out.scriptPubKey ) ;
-        }
-        return ret;
+    friend bool operator!=( const Coin & a, const Coin & b ) {
+        return ! ( a == b ) ;
     }
-};
+} ;
 
-class SaltedTxHasher
+class SaltedOutpointHasher
 {
 private:
     /** Salt */
-    const uint64_t k0, k1 ;
+    uint64_t k0, k1 ; // not const, so maps of coins can be swapped
 
 public:
-    SaltedTxHasher() :
+    SaltedOutpointHasher() :
         k0( GetRand( std::numeric_limits< uint64_t >::max() ) ),
         k1( GetRand( std::numeric_limits< uint64_t >::max() ) )
     { }
@@ -260,15 +124,15 @@ public:
      * unordered_map will behave unpredictably if the custom hasher returns
      * a uint64_t, resulting in failures when syncing the chain (#4634)
      */
-    size_t operator()( const uint256 & txhash ) const {
-        return SipHashUint256( k0, k1, txhash ) ;
+    size_t operator()( const COutPoint & outpoint ) const {
+        return SipHashUint256Extra( k0, k1, outpoint.hash, outpoint.n ) ;
     }
 };
 
 struct CCoinsCacheEntry
 {
-    CCoins coins; // The actual cached data
-    unsigned char flags;
+    Coin coin ; // The actual cached data
+    unsigned char flags ;
 
     enum Flags {
         DIRTY = (1 << 0), // This cache entry is potentially different from the version in the parent view
@@ -279,10 +143,11 @@ struct CCoinsCacheEntry
          * not mark FRESH if that condition is not guaranteed */
     };
 
-    CCoinsCacheEntry() : coins(), flags(0) {}
+    CCoinsCacheEntry() : flags( 0 ) {}
+    explicit CCoinsCacheEntry( Coin && coinIn ) : coin( std::move( coinIn ) ), flags( 0 ) {}
 };
 
-typedef std::unordered_map< uint256, CCoinsCacheEntry, SaltedTxHasher > CCoinsMap ;
+typedef std::unordered_map< COutPoint, CCoinsCacheEntry, SaltedOutpointHasher > CCoinsMap ;
 
 /** Cursor for iterating over CoinsView state */
 class CCoinsViewCursor
@@ -291,8 +156,8 @@ public:
     CCoinsViewCursor( const uint256 & hashOfBlock ): sha256Block( hashOfBlock ) { }
     virtual ~CCoinsViewCursor() ;
 
-    virtual bool GetKey( uint256 & key ) const = 0 ;
-    virtual bool GetValue( CCoins & coins ) const = 0 ;
+    virtual bool GetKey( COutPoint & key ) const = 0 ;
+    virtual bool GetValue( Coin & coin ) const = 0 ;
     /* Don't care about GetKeySize here */
     virtual unsigned int GetValueSize() const = 0 ;
 
@@ -310,23 +175,31 @@ private:
 class AbstractCoinsView
 {
 public:
-    // Retrieve the CCoins (unspent transaction outputs) for a given txhash
-    virtual bool GetCoins( const uint256 & txhash, CCoins & coins ) const {  return false ;  }
+    // Retrieve the Coin (unspent transaction output) for a given outpoint.
+    // Returns true only when an unspent coin was found, which is returned in coin.
+    // When false is returned, coin's value is unspecified
+    virtual bool GetCoin( const COutPoint & outpoint, Coin & coin ) const {  return false ;  }
 
-    // Just check whether we have data for a given txhash
-    // This may (but cannot always) return true for fully spent transactions
-    virtual bool HaveCoins( const uint256 & txhash ) const {  return false ;  }
+    // Just check whether a given outpoint is unspent
+    virtual bool HaveCoin( const COutPoint & outpoint ) const {  return false ;  }
 
     // Retrieve the block hash whose state this CoinsView currently represents
     virtual uint256 GetSha256OfBestBlock() const = 0 ;
 
-    // Do a bulk modification (multiple CCoins changes + BestBlock change)
+    // Do a bulk modification (multiple Coin changes + BestBlock change)
     // The passed mapCoins can be modified
     virtual bool BatchWrite( CCoinsMap & mapCoins, const uint256 & blockHash ) {  return false ;  }
 
     // Get a cursor to iterate over the whole state
     virtual CCoinsViewCursor * Cursor() const = 0 ;
 
+    // Wait until what was written to this view is stored, views which store it
+    // later than BatchWrite returns do so. Returns false when storing failed
+    virtual bool Sync() {  return true ;  }
+
+    // Memory taken by what was written to this view and isn't stored yet
+    virtual size_t WritingMemoryUsage() const {  return 0 ;  }
+
     // As we use CoinsViews polymorphically, have a virtual destructor
     virtual ~AbstractCoinsView() { }
 } ;
@@ -347,12 +220,13 @@ protected:
 public:
     CCoinsViewBacked( AbstractCoinsView * in ) : base( in ) { }
     void SetBackend( AbstractCoinsView & backend ) {  base = &backend ;  }
+    AbstractCoinsView * GetBackend() const {  return base ;  }
 
-    virtual bool GetCoins( const uint256 & txhash, CCoins & coins ) const override {
-        return base->GetCoins( txhash, coins ) ;
+    virtual bool GetCoin( const COutPoint & outpoint, Coin & coin ) const override {
+        return base->GetCoin( outpoint, coin ) ;
     }
-    virtual bool HaveCoins( const uint256 & txhash ) const override {
-        return base->HaveCoins( txhash ) ;
+    virtual bool HaveCoin( const COutPoint & outpoint ) const override {
+        return base->HaveCoin( outpoint ) ;
     }
     virtual uint256 GetSha256OfBestBlock() const override {
         return base->GetSha256OfBestBlock() ;
@@ -363,37 +237,18 @@ public:
     virtual CCoinsViewCursor * Cursor() const override {
         return base->Cursor() ;
     }
+    virtual bool Sync() override {
+        return base->Sync() ;
+    }
+    virtual size_t WritingMemoryUsage() const override {
+        return base->WritingMemoryUsage() ;
+    }
 } ;
 
-class CCoinsViewCache ;
-
-/**
- * A reference to a mutable cache entry. Encapsulating it allows us to run
- *  cleanup code after the modification is finished, and keeping track of
- *  concurrent modifications
- */
-class CCoinsModifier
-{
-private:
-    CCoinsViewCache& cache;
-    CCoinsMap::iterator it;
-    size_t cachedCoinUsage; // Cached memory usage of the CCoins object before modification
-    CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_, size_t usage);
-
-public:
-    CCoins* operator->() { return &it->second.coins; }
-    CCoins& operator*() { return it->second.coins; }
-    ~CCoinsModifier();
-    friend class CCoinsViewCache;
-};
-
 /** CoinsView that adds a memory cache for transactions to another CoinsView */
 class CCoinsViewCache : public CCoinsViewBacked
 {
 protected:
-    /* Whether this cache has an active modifier */
-    bool hasModifier ;
-
     /**
      * Make mutable so that we can "fill the cache" even from Get-methods
      * declared as "const"
@@ -401,21 +256,18 @@ protected:
     mutable uint256 sha256Block ;
     mutable CCoinsMap cacheCoins ;
 
-    /* Cached dynamic memory usage for the inner CCoins objects */
+    /* Cached dynamic memory usage for the inner Coin objects */
     mutable size_t cachedCoinsUsage ;
 
 public:
     CCoinsViewCache( AbstractCoinsView * in )
         : CCoinsViewBacked( in )
-        , hasModifier( false )
         , cachedCoinsUsage( 0 )
     { }
 
-    ~CCoinsViewCache() {  assert( ! hasModifier ) ;  }
-
     // derived from AbstractCoinsView
-    virtual bool GetCoins( const uint256 & txhash, CCoins & coins ) const override ;
-    virtual bool HaveCoins( const uint256 & txhash ) const override ;
+    virtual bool GetCoin( const COutPoint & outpoint, Coin & coin ) const override ;
+    virtual bool HaveCoin( const COutPoint & outpoint ) const override ;
     virtual uint256 GetSha256OfBestBlock() const override ;
     virtual bool BatchWrite( CCoinsMap & mapCoins, const uint256 & blockHash ) override ;
 
@@ -424,36 +276,31 @@ public:
     }
 
     /**
-     * Check if we have the given tx already loaded in this cache.
-     * The semantics are the same as HaveCoins(), but no calls to
+     * Check if we have the given utxo already loaded in this cache.
+     * The semantics are the same as HaveCoin(), but no calls to
      * the backing CoinsView are made
      */
-    bool HaveCoinsInCache( const uint256 & txhash ) const ;
+    bool HaveCoinInCache( const COutPoint & outpoint ) const ;
 
     /**
-     * Return a pointer to CCoins in the cache, or NULL if not found. This is
-     * more efficient than GetCoins. Modifications to other cache entries are
-     * allowed while accessing the returned pointer
+     * Return a reference to Coin in the cache, or a pruned one if not found. This is
+     * more efficient than GetCoin. Modifications to other cache entries are
+     * allowed while accessing the returned reference
      */
-    const CCoins * AccessCoins( const uint256 & txhash ) const ;
+    const Coin & AccessCoin( const COutPoint & outpoint ) const ;
 
     /**
-     * Return a modifiable reference to a CCoins. If no entry with the given
-     * txhash exists, a new one is created. Simultaneous modifications are not
-     * allowed
+     * Add a coin. Set possible_overwrite to true if an unspent version may
+     * already exist in the cache
      */
-    CCoinsModifier ModifyCoins( const uint256 & txhash ) ;
+    void AddCoin( const COutPoint & outpoint, Coin && coin, bool possible_overwrite ) ;
 
     /**
-     * Return a modifiable reference to a CCoins. Assumes that no entry with the given
-     * txhash exists and creates a new one. This saves a database access in the case where
-     * the coins were to be wiped out by FromTx anyway.  This should not be called with
-     * the 2 historical coinbase duplicate pairs because the new coins are marked fresh, and
-     * in the event the duplicate coinbase was spent before a flush, the now pruned coins
-     * would not properly overwrite the first coinbase of the pair. Simultaneous modifications
-     * are not allowed
+     * Spend a coin. Pass moveto in order to get the deleted data.
+     * If no unspent output exists for the passed outpoint, this call
+     * has no effect
      */
-    CCoinsModifier ModifyNewCoins( const uint256 & txhash, bool coinbase ) ;
+    bool SpendCoin( const COutPoint & outpoint, Coin * moveto = nullptr ) ;
 
     /**
      * Push the modifications applied to this cache to its base.
@@ -463,11 +310,24 @@ public:
     bool Flush() ;
 
     /**
-     * Removes the transaction with the given hash from the cache, if it is not modified
+     * Removes the UTXO with the given outpoint from the cache, if it is not modified
+     */
+    void Uncache( const COutPoint & outpoint ) ;
+
+    /**
+     * Whether there's any entry for this outpoint in the cache, spent or not.
+     * For outpoints without an entry the backing view would be asked
      */
-    void Uncache( const uint256 & txhash ) ;
+    bool HaveEntryInCache( const COutPoint & outpoint ) const {  return cacheCoins.count( outpoint ) > 0 ;  }
 
-    // Calculate the size of the cache (in number of transactions)
+    /**
+     * Puts a coin read from the backing view elsewhere into the cache, as if
+     * it was fetched by this cache. Does nothing if there's an entry for this
+     * outpoint already, that entry may be newer than the backing view
+     */
+    void AddFetchedCoin( const COutPoint & outpoint, Coin && coin ) ;
+
+    // Calculate the size of the cache (in number of transaction outputs)
     unsigned int GetCacheSize() const ;
 
     // Calculate the size of the cache (in bytes)
@@ -493,15 +353,23 @@ public:
      */
     double GetPriority( const CTransaction & tx, int nHeight, CAmount & inChainInputValue ) const ;
 
-    const CTxOut & GetOutputFor( const CTxIn & input ) const ;
-
-    friend class CCoinsModifier ;
-
 private:
-    CCoinsMap::const_iterator FetchCoins( const uint256 & txhash ) const ;
+    CCoinsMap::iterator FetchCoin( const COutPoint & outpoint ) const ;
 
     // no copy constructor
     CCoinsViewCache( const CCoinsViewCache & ) = delete ;
 } ;
 
+//! Utility function to add all of a transaction's outputs to a cache.
+// When check is false, this assumes that overwrites are only possible for coinbase transactions.
+// When check is true, the underlying view may be queried to determine whether an addition is
+// an overwrite
+void AddCoins( CCoinsViewCache & cache, const CTransaction & tx, int nHeight, bool check = false ) ;
+
+//! Utility function to find any unspent output with a given txid.
+// This function can be quite expensive because in the event of a transaction
+// which is not found in the cache, it can cause up to MAX_OUTPUTS_PER_BLOCK
+// lookups to database, so it should be used with care
+const Coin & AccessByTxid( const CCoinsViewCache & cache, const uint256 & txid ) ;
+
 #endif
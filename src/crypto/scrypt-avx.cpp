@@ -0,0 +1,132 @@
+// Copyright (c) 2020 The Dogecoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php
+
+/*
+ * Multi-lane scrypt(1024,1,1) kernels: salsa20/8 of several independent
+ * hashes is interleaved so that one vector register holds the same word
+ * of 8 (AVX2) or 16 (AVX-512F) hashes. Both kernels are compiled with
+ * function-level target attributes and are picked at runtime by
+ * scrypt_detect_multi(), the rest of the binary doesn't need -mavx2
+ */
+
+#include "crypto/scrypt.h"
+
+#if defined(USE_SCRYPT_AVX)
+
+#include <string.h>
+
+#include <immintrin.h>
+
+/* Load 32-word states of all lanes from per-lane PBKDF2 output */
+static inline void scrypt_lanes_load(uint32_t *X, const uint8_t *B, int ways)
+{
+	for (int k = 0; k < 32; k++)
+		for (int l = 0; l < ways; l++)
+			X[k * ways + l] = le32dec(&B[l * 128 + 4 * k]);
+}
+
+static inline void scrypt_lanes_store(uint8_t *B, const uint32_t *X, int ways)
+{
+	for (int k = 0; k < 32; k++)
+		for (int l = 0; l < ways; l++)
+			le32enc(&B[l * 128 + 4 * k], X[k * ways + l]);
+}
+
+/* One salsa20/8 core over vectors of lanes, the same schedule as xor_salsa8 in scrypt.cpp */
+#define SALSA8_VECTOR(T, B, Bx, XOR, ADD, ROTL) do { \
+	T x[16]; \
+	for (int w = 0; w < 16; w++) \
+		x[w] = B[w] = XOR(B[w], Bx[w]); \
+	for (int r = 0; r < 8; r += 2) { \
+		x[ 4] = XOR(x[ 4], ROTL(ADD(x[ 0], x[12]),  7));  x[ 9] = XOR(x[ 9], ROTL(ADD(x[ 5], x[ 1]),  7)); \
+		x[14] = XOR(x[14], ROTL(ADD(x[10], x[ 6]),  7));  x[ 3] = XOR(x[ 3], ROTL(ADD(x[15], x[11]),  7)); \
+		x[ 8] = XOR(x[ 8], ROTL(ADD(x[ 4], x[ 0]),  9));  x[13] = XOR(x[13], ROTL(ADD(x[ 9], x[ 5]),  9)); \
+		x[ 2] = XOR(x[ 2], ROTL(ADD(x[14], x[10]),  9));  x[ 7] = XOR(x[ 7], ROTL(ADD(x[ 3], x[15]),  9)); \
+		x[12] = XOR(x[12], ROTL(ADD(x[ 8], x[ 4]), 13));  x[ 1] = XOR(x[ 1], ROTL(ADD(x[13], x[ 9]), 13)); \
+		x[ 6] = XOR(x[ 6], ROTL(ADD(x[ 2], x[14]), 13));  x[11] = XOR(x[11], ROTL(ADD(x[ 7], x[ 3]), 13)); \
+		x[ 0] = XOR(x[ 0], ROTL(ADD(x[12], x[ 8]), 18));  x[ 5] = XOR(x[ 5], ROTL(ADD(x[ 1], x[13]), 18)); \
+		x[10] = XOR(x[10], ROTL(ADD(x[ 6], x[ 2]), 18));  x[15] = XOR(x[15], ROTL(ADD(x[11], x[ 7]), 18)); \
+		x[ 1] = XOR(x[ 1], ROTL(ADD(x[ 0], x[ 3]),  7));  x[ 6] = XOR(x[ 6], ROTL(ADD(x[ 5], x[ 4]),  7)); \
+		x[11] = XOR(x[11], ROTL(ADD(x[10], x[ 9]),  7));  x[12] = XOR(x[12], ROTL(ADD(x[15], x[14]),  7)); \
+		x[ 2] = XOR(x[ 2], ROTL(ADD(x[ 1], x[ 0]),  9));  x[ 7] = XOR(x[ 7], ROTL(ADD(x[ 6], x[ 5]),  9)); \
+		x[ 8] = XOR(x[ 8], ROTL(ADD(x[11], x[10]),  9));  x[13] = XOR(x[13], ROTL(ADD(x[12], x[15]),  9)); \
+		x[ 3] = XOR(x[ 3], ROTL(ADD(x[ 2], x[ 1]), 13));  x[ 4] = XOR(x[ 4], ROTL(ADD(x[ 7], x[ 6]), 13)); \
+		x[ 9] = XOR(x[ 9], ROTL(ADD(x[ 8], x[11]), 13));  x[14] = XOR(x[14], ROTL(ADD(x[13], x[12]), 13)); \
+		x[ 0] = XOR(x[ 0], ROTL(ADD(x[ 3], x[ 2]), 18));  x[ 5] = XOR(x[ 5], ROTL(ADD(x[ 4], x[ 7]), 18)); \
+		x[10] = XOR(x[10], ROTL(ADD(x[ 9], x[ 8]), 18));  x[15] = XOR(x[15], ROTL(ADD(x[14], x[13]), 18)); \
+	} \
+	for (int w = 0; w < 16; w++) \
+		B[w] = ADD(B[w], x[w]); \
+} while (0)
+
+/* Both halves of scrypt's ROMix over vectors of lanes. V holds 1024 states of
+   32 vectors each, so lane l of word k of state i is at ((i * 32 + k) * ways + l) */
+#define ROMIX_VECTOR(T, X, V, ways, LOADX, XOR, ADD, ROTL, GATHER, SETIDX) do { \
+	for (uint32_t i = 0; i < 1024; i++) { \
+		for (int k = 0; k < 32; k++) \
+			V[i * 32 + k] = X[k]; \
+		SALSA8_VECTOR(T, (&X[0]), (&X[16]), XOR, ADD, ROTL); \
+		SALSA8_VECTOR(T, (&X[16]), (&X[0]), XOR, ADD, ROTL); \
+	} \
+	for (uint32_t i = 0; i < 1024; i++) { \
+		uint32_t lo[ways]; \
+		LOADX(lo, X[16]); \
+		int32_t idx[ways]; \
+		for (int l = 0; l < ways; l++) \
+			idx[l] = (int32_t)((lo[l] & 1023) * 32 * ways + l); \
+		T vidx = SETIDX(idx); \
+		for (int k = 0; k < 32; k++) \
+			X[k] = XOR(X[k], GATHER((const int *)&V[k], vidx)); \
+		SALSA8_VECTOR(T, (&X[0]), (&X[16]), XOR, ADD, ROTL); \
+		SALSA8_VECTOR(T, (&X[16]), (&X[0]), XOR, ADD, ROTL); \
+	} \
+} while (0)
+
+#define AVX2_XOR(a, b) _mm256_xor_si256((a), (b))
+#define AVX2_ADD(a, b) _mm256_add_epi32((a), (b))
+#define AVX2_ROTL(a, n) _mm256_or_si256(_mm256_slli_epi32((a), (n)), _mm256_srli_epi32((a), 32 - (n)))
+#define AVX2_GATHER(base, vidx) _mm256_i32gather_epi32((base), (vidx), 4)
+#define AVX2_SETIDX(idx) _mm256_loadu_si256((const __m256i *)(idx))
+#define AVX2_LOADX(out, v) _mm256_storeu_si256((__m256i *)(out), (v))
+
+__attribute__((target("avx2")))
+void scrypt_core_avx2_x8(uint8_t *B, char *scratchpad)
+{
+	union {
+		__m256i v[32];
+		uint32_t u32[32 * 8];
+	} X;
+	__m256i *V;
+
+	V = (__m256i *)(((uintptr_t)(scratchpad) + 63) & ~ (uintptr_t)(63));
+
+	scrypt_lanes_load(X.u32, B, 8);
+	ROMIX_VECTOR(__m256i, X.v, V, 8, AVX2_LOADX, AVX2_XOR, AVX2_ADD, AVX2_ROTL, AVX2_GATHER, AVX2_SETIDX);
+	scrypt_lanes_store(B, X.u32, 8);
+}
+
+#define AVX512_XOR(a, b) _mm512_xor_si512((a), (b))
+#define AVX512_ADD(a, b) _mm512_add_epi32((a), (b))
+#define AVX512_ROTL(a, n) _mm512_rol_epi32((a), (n))
+#define AVX512_GATHER(base, vidx) _mm512_i32gather_epi32((vidx), (base), 4)
+#define AVX512_SETIDX(idx) _mm512_loadu_si512((const void *)(idx))
+#define AVX512_LOADX(out, v) _mm512_storeu_si512((void *)(out), (v))
+
+__attribute__((target("avx512f")))
+void scrypt_core_avx512_x16(uint8_t *B, char *scratchpad)
+{
+	union {
+		__m512i v[32];
+		uint32_t u32[32 * 16];
+	} X;
+	__m512i *V;
+
+	V = (__m512i *)(((uintptr_t)(scratchpad) + 63) & ~ (uintptr_t)(63));
+
+	scrypt_lanes_load(X.u32, B, 16);
+	ROMIX_VECTOR(__m512i, X.v, V, 16, AVX512_LOADX, AVX512_XOR, AVX512_ADD, AVX512_ROTL, AVX512_GATHER, AVX512_SETIDX);
+	scrypt_lanes_store(B, X.u32, 16);
+}
+
+#endif // USE_SCRYPT_AVX
@@ -92,9 +92,8 @@ static inline void xor_salsa8_sse2(__m128i B[4], const __m128i Bx[4])
 	B[3] = _mm_add_epi32(B[3], X3);
 }
 
-void scrypt_1024_1_1_256_sp_sse2(const char *input, char *output, char *scratchpad)
+void scrypt_core_sse2(uint8_t *B, char *scratchpad)
 {
-	uint8_t B[128];
 	union {
 		__m128i i128[8];
 		uint32_t u32[32];
@@ -104,8 +103,6 @@ void scrypt_1024_1_1_256_sp_sse2(const char *input, char *output, char *scratchp
 
 	V = (__m128i *)(((uintptr_t)(scratchpad) + 63) & ~ (uintptr_t)(63));
 
-	PBKDF2_SHA256((const uint8_t *)input, 80, (const uint8_t *)input, 80, 1, B, 128);
-
 	for (k = 0; k < 2; k++) {
 		for (i = 0; i < 16; i++) {
 			X.u32[k * 16 + i] = le32dec(&B[(k * 16 + (i * 5 % 16)) * 4]);
@@ -131,6 +128,14 @@ void scrypt_1024_1_1_256_sp_sse2(const char *input, char *output, char *scratchp
 			le32enc(&B[(k * 16 + (i * 5 % 16)) * 4], X.u32[k * 16 + i]);
 		}
 	}
+}
+
+void scrypt_1024_1_1_256_sp_sse2(const char *input, char *output, char *scratchpad)
+{
+	CHMAC_SHA256 keyed((const uint8_t *)input, 80);
+	uint8_t B[128];
 
-	PBKDF2_SHA256((const uint8_t *)input, 80, B, 128, 1, (uint8_t *)output, 32);
+	scrypt_pbkdf2_in(keyed, (const uint8_t *)input, B);
+	scrypt_core_sse2(B, scratchpad);
+	scrypt_pbkdf2_out(keyed, B, (uint8_t *)output);
 }
@@ -35,6 +35,14 @@
 #include <string.h>
 #include <openssl/sha.h>
 
+#include <algorithm>
+#include <new>
+#include <vector>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
 #if defined(USE_SSE2) && !defined(USE_SSE2_ALWAYS)
 #ifdef _MSC_VER
 // MSVC 64bit is unable to use inline asm
@@ -184,17 +192,41 @@ static inline void xor_salsa8(uint32_t B[16], const uint32_t Bx[16])
 	B[15] += x15;
 }
 
-void scrypt_1024_1_1_256_sp_generic(const char *input, char *output, char *scratchpad)
+void scrypt_pbkdf2_in(const CHMAC_SHA256 &keyed, const uint8_t *input, uint8_t *B)
+{
+	CHMAC_SHA256 PShctx = keyed;
+	uint8_t ivec[4];
+
+	/* The same as PBKDF2_SHA256(input, 80, input, 80, 1, B, 128) */
+	PShctx.Write(input, 80);
+	for (uint32_t i = 0; i < 4; i++) {
+		CHMAC_SHA256 hctx = PShctx;
+		be32enc(ivec, i + 1);
+		hctx.Write(ivec, 4);
+		hctx.Finalize(&B[i * CHMAC_SHA256::OUTPUT_SIZE]);
+	}
+}
+
+void scrypt_pbkdf2_out(const CHMAC_SHA256 &keyed, const uint8_t *B, uint8_t *output)
+{
+	CHMAC_SHA256 hctx = keyed;
+	uint8_t ivec[4];
+
+	/* The same as PBKDF2_SHA256(input, 80, B, 128, 1, output, 32) */
+	be32enc(ivec, 1);
+	hctx.Write(B, 128);
+	hctx.Write(ivec, 4);
+	hctx.Finalize(output);
+}
+
+void scrypt_core_generic(uint8_t *B, char *scratchpad)
 {
-	uint8_t B[128];
 	uint32_t X[32];
 	uint32_t *V;
 	uint32_t i, j, k;
 
 	V = (uint32_t *)(((uintptr_t)(scratchpad) + 63) & ~ (uintptr_t)(63));
 
-	PBKDF2_SHA256((const uint8_t *)input, 80, (const uint8_t *)input, 80, 1, B, 128);
-
 	for (k = 0; k < 32; k++)
 		X[k] = le32dec(&B[4 * k]);
 
@@ -213,13 +245,22 @@ void scrypt_1024_1_1_256_sp_generic(const char *input, char *output, char *scrat
 
 	for (k = 0; k < 32; k++)
 		le32enc(&B[4 * k], X[k]);
+}
 
-	PBKDF2_SHA256((const uint8_t *)input, 80, B, 128, 1, (uint8_t *)output, 32);
+void scrypt_1024_1_1_256_sp_generic(const char *input, char *output, char *scratchpad)
+{
+	CHMAC_SHA256 keyed((const uint8_t *)input, 80);
+	uint8_t B[128];
+
+	scrypt_pbkdf2_in(keyed, (const uint8_t *)input, B);
+	scrypt_core_generic(B, scratchpad);
+	scrypt_pbkdf2_out(keyed, B, (uint8_t *)output);
 }
 
 #if defined(USE_SSE2)
 // By default, set to generic scrypt function. This will prevent crash in case when scrypt_detect_sse2() wasn't called
 void (*scrypt_1024_1_1_256_sp_detected)(const char *input, char *output, char *scratchpad) = &scrypt_1024_1_1_256_sp_generic ;
+void (*scrypt_core_detected)(uint8_t *B, char *scratchpad) = &scrypt_core_generic ;
 
 void scrypt_detect_sse2()
 {
@@ -242,19 +283,203 @@ void scrypt_detect_sse2()
     if (cpuid_edx & 1<<26)
     {
         scrypt_1024_1_1_256_sp_detected = &scrypt_1024_1_1_256_sp_sse2 ;
+        scrypt_core_detected = &scrypt_core_sse2 ;
         LogPrintf( "scrypt: using scrypt-sse2 as detected\n" ) ;
     }
     else
     {
         scrypt_1024_1_1_256_sp_detected = &scrypt_1024_1_1_256_sp_generic ;
+        scrypt_core_detected = &scrypt_core_generic ;
         LogPrintf( "scrypt: using scrypt-generic, SSE2 unavailable\n" ) ;
     }
 #endif // USE_SSE2_ALWAYS
 }
 #endif
 
+typedef void (*scrypt_multi_core)(uint8_t *B, char *scratchpad);
+
+// By default, there's no multi-lane kernel and inputs are hashed one by one
+static scrypt_multi_core scrypt_multi_detected = NULL;
+static size_t scrypt_multi_detected_ways = 1;
+
+void scrypt_detect_multi()
+{
+#if defined(USE_SCRYPT_AVX)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+    {
+        scrypt_multi_detected = &scrypt_core_avx512_x16 ;
+        scrypt_multi_detected_ways = 16 ;
+        LogPrintf( "scrypt: using 16-way avx512 kernel for multiple hashes\n" ) ;
+        return ;
+    }
+    if (__builtin_cpu_supports("avx2"))
+    {
+        scrypt_multi_detected = &scrypt_core_avx2_x8 ;
+        scrypt_multi_detected_ways = 8 ;
+        LogPrintf( "scrypt: using 8-way avx2 kernel for multiple hashes\n" ) ;
+        return ;
+    }
+#endif
+    scrypt_multi_detected = NULL ;
+    scrypt_multi_detected_ways = 1 ;
+    LogPrintf( "scrypt: no multi-lane kernel, multiple hashes are computed one by one\n" ) ;
+}
+
+size_t scrypt_multi_ways()
+{
+    return scrypt_multi_detected_ways;
+}
+
+/* Scrypt of count inputs, inputAt(n) gives n-th input and HMAC keyed with it */
+template <typename InputAt>
+static void scrypt_1024_1_1_256_sp_lanes(InputAt inputAt, char *output, char *scratchpad, size_t count)
+{
+	const size_t ways = scrypt_multi_detected_ways;
+	uint8_t B[SCRYPT_MAX_WAYS * 128];
+	uint8_t input[80];
+	std::vector<CHMAC_SHA256> keyed;
+	keyed.reserve(ways);
+
+	for (size_t i = 0; i < count; i += ways) {
+		size_t lanes = std::min(ways, count - i);
+		keyed.clear();
+		for (size_t l = 0; l < lanes; l++) {
+			keyed.push_back(inputAt(i + l, input));
+			scrypt_pbkdf2_in(keyed.back(), input, &B[l * 128]);
+		}
+
+		if (scrypt_multi_detected != NULL && lanes > ways / 2) {
+			/* a short tail is padded with copies of its last lane, a full pass is cheaper than hashing one by one */
+			for (size_t l = lanes; l < ways; l++)
+				memcpy(&B[l * 128], &B[(lanes - 1) * 128], 128);
+			scrypt_multi_detected(B, scratchpad);
+		} else {
+			for (size_t l = 0; l < lanes; l++)
+				scrypt_core_sp(&B[l * 128], scratchpad);
+		}
+
+		for (size_t l = 0; l < lanes; l++)
+			scrypt_pbkdf2_out(keyed[l], &B[l * 128], (uint8_t *)&output[(i + l) * 32]);
+	}
+}
+
+void scrypt_1024_1_1_256_sp_multi(const char *input, char *output, char *scratchpad, size_t count)
+{
+	scrypt_1024_1_1_256_sp_lanes([input](size_t n, uint8_t *laneInput) -> CHMAC_SHA256 {
+		memcpy(laneInput, &input[n * 80], 80);
+		return CHMAC_SHA256(laneInput, 80);
+	}, output, scratchpad, count);
+}
+
+void scrypt_header_midstate_init(scrypt_header_midstate *midstate, const char *header)
+{
+	memcpy(midstate->header, header, 80);
+	midstate->keyHasher.Reset();
+	midstate->keyHasher.Write(midstate->header, 64);
+}
+
+void scrypt_1024_1_1_256_sp_nonces(const scrypt_header_midstate *midstate, uint32_t firstNonce, char *output, char *scratchpad, size_t count)
+{
+	scrypt_1024_1_1_256_sp_lanes([midstate, firstNonce](size_t n, uint8_t *laneInput) -> CHMAC_SHA256 {
+		memcpy(laneInput, midstate->header, 76);
+		le32enc(&laneInput[76], firstNonce + (uint32_t)n);
+
+		/* HMAC key longer than 64 bytes is replaced with its SHA-256, and the key's
+		   first 64 bytes were already hashed */
+		uint8_t keyHash[CSHA256::OUTPUT_SIZE];
+		CSHA256 keyHasher = midstate->keyHasher;
+		keyHasher.Write(&laneInput[64], 16).Finalize(keyHash);
+		return CHMAC_SHA256(keyHash, CSHA256::OUTPUT_SIZE);
+	}, output, scratchpad, count);
+}
+
+namespace {
+
+/** Scratchpad which lives as long as its thread and grows on demand */
+class ScryptThreadScratchpad
+{
+public:
+    ScryptThreadScratchpad() : memory(NULL), length(0), mapped(false), size(0) { }
+
+    ~ScryptThreadScratchpad() {  Free() ;  }
+
+    char * Get( size_t needed )
+    {
+        if ( needed > size ) {
+            Free() ;
+            Allocate( needed ) ;
+        }
+        return (char *)(((uintptr_t)(memory) + 63) & ~ (uintptr_t)(63)) ;
+    }
+
+private:
+    static const size_t HUGE_PAGE_SIZE = 2 << 20 ;
+
+    void Allocate( size_t needed )
+    {
+#if defined(__linux__)
+        // Multi-lane scratchpads are a whole number of huge pages aligned to huge page
+        // size, what transparent huge pages need. Single-lane ones fit in regular pages
+        bool huge = ( needed >= HUGE_PAGE_SIZE ) ;
+        size_t alignment = huge ? HUGE_PAGE_SIZE : 64 ;
+        size_t len = ( needed + alignment - 1 ) & ~ ( alignment - 1 ) ;
+        size_t extra = huge ? HUGE_PAGE_SIZE : 0 ;
+        void * p = mmap( NULL, len + extra, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 ) ;
+        if ( p != MAP_FAILED ) {
+            uintptr_t begin = (uintptr_t)p ;
+            uintptr_t alignedBegin = ( begin + alignment - 1 ) & ~ ( alignment - 1 ) ;
+            if ( extra > 0 ) {
+                // trim pages around the aligned range
+                if ( alignedBegin > begin )
+                    munmap( p, alignedBegin - begin ) ;
+                if ( begin + extra > alignedBegin )
+                    munmap( (void *)( alignedBegin + len ), begin + extra - alignedBegin ) ;
+#if defined(MADV_HUGEPAGE)
+                madvise( (void *)alignedBegin, len, MADV_HUGEPAGE ) ;
+#endif
+            }
+            memory = (char *)alignedBegin ;
+            length = len ;
+            mapped = true ;
+            size = len ;
+            return ;
+        }
+#endif
+        memory = (char *)malloc( needed + 63 ) ;
+        if ( memory == NULL ) throw std::bad_alloc() ;
+        length = needed + 63 ;
+        mapped = false ;
+        size = needed ;
+    }
+
+    void Free()
+    {
+        if ( memory == NULL ) return ;
+#if defined(__linux__)
+        if ( mapped ) munmap( memory, length ) ;
+        else
+#endif
+        free( memory ) ;
+        memory = NULL ;
+        length = size = 0 ;
+    }
+
+    char * memory ;
+    size_t length ;
+    bool mapped ;
+    size_t size ; // usable bytes after aligning to 64
+} ;
+
+}
+
+char *scrypt_thread_scratchpad(size_t size)
+{
+    static thread_local ScryptThreadScratchpad scratchpad ;
+    return scratchpad.Get( size ) ;
+}
+
 void scrypt_1024_1_1_256(const char* input, char* output)
 {
-	char scratchpad[SCRYPT_SCRATCHPAD_SIZE];
-    scrypt_1024_1_1_256_sp(input, output, scratchpad);
+    scrypt_1024_1_1_256_sp(input, output, scrypt_thread_scratchpad(SCRYPT_SCRATCHPAD_SIZE));
 }
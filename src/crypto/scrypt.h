@@ -3,26 +3,100 @@
 #include <stdlib.h>
 #include <stdint.h>
 
+#include "crypto/hmac_sha256.h"
+#include "crypto/sha256.h"
+
 static const int SCRYPT_SCRATCHPAD_SIZE = 131072 + 63;
 
+/** Scrypt of an 80-byte input with the scratchpad of calling thread */
 void scrypt_1024_1_1_256(const char *input, char *output);
+
+/**
+ * Scratchpad of calling thread, at least size bytes long. It is allocated on
+ * first use, 64-byte aligned, kept for the thread's lifetime and on Linux is
+ * advised onto transparent huge pages when it's a multi-lane one. The pointer
+ * stays valid until the same thread asks for a bigger scratchpad
+ */
+char *scrypt_thread_scratchpad(size_t size);
 void scrypt_1024_1_1_256_sp_generic(const char *input, char *output, char *scratchpad);
 
+/**
+ * ROMix of scrypt: turns 128 bytes B of the first PBKDF2 pass into the salt
+ * of the last pass. Multi-lane cores do that for several B laid one after another
+ */
+void scrypt_core_generic(uint8_t *B, char *scratchpad);
+
 #if defined(USE_SSE2)
 #if defined(_M_X64) || defined(__x86_64__) || defined(_M_AMD64) || (defined(MAC_OSX) && defined(__i386__))
 #define USE_SSE2_ALWAYS 1
 #define scrypt_1024_1_1_256_sp(input, output, scratchpad) scrypt_1024_1_1_256_sp_sse2((input), (output), (scratchpad))
+#define scrypt_core_sp(B, scratchpad) scrypt_core_sse2((B), (scratchpad))
 #else
 #define scrypt_1024_1_1_256_sp(input, output, scratchpad) scrypt_1024_1_1_256_sp_detected((input), (output), (scratchpad))
+#define scrypt_core_sp(B, scratchpad) scrypt_core_detected((B), (scratchpad))
 #endif
 
 void scrypt_detect_sse2();
 void scrypt_1024_1_1_256_sp_sse2(const char *input, char *output, char *scratchpad);
+void scrypt_core_sse2(uint8_t *B, char *scratchpad);
 extern void (*scrypt_1024_1_1_256_sp_detected)(const char *input, char *output, char *scratchpad);
+extern void (*scrypt_core_detected)(uint8_t *B, char *scratchpad);
 #else
 #define scrypt_1024_1_1_256_sp(input, output, scratchpad) scrypt_1024_1_1_256_sp_generic((input), (output), (scratchpad))
+#define scrypt_core_sp(B, scratchpad) scrypt_core_generic((B), (scratchpad))
 #endif
 
+/** The most inputs hashed by one pass of a multi-lane scrypt kernel */
+static const int SCRYPT_MAX_WAYS = 16;
+static const int SCRYPT_MULTI_SCRATCHPAD_SIZE = 131072 * SCRYPT_MAX_WAYS + 63;
+
+#if (defined(__x86_64__) || defined(_M_X64) || defined(_M_AMD64)) && defined(__GNUC__)
+#define USE_SCRYPT_AVX 1
+void scrypt_core_avx2_x8(uint8_t *B, char *scratchpad);
+void scrypt_core_avx512_x16(uint8_t *B, char *scratchpad);
+#endif
+
+/**
+ * Hash count 80-byte inputs which lie one after another in memory, writing
+ * 32 bytes of output per input. The scratchpad is SCRYPT_MULTI_SCRATCHPAD_SIZE
+ * bytes long. Inputs are hashed in groups of scrypt_multi_ways()
+ */
+void scrypt_1024_1_1_256_sp_multi(const char *input, char *output, char *scratchpad, size_t count);
+
+/** How many inputs the detected multi-lane kernel hashes at once, 1 when there's no such kernel */
+size_t scrypt_multi_ways();
+
+/** Pick the widest multi-lane scrypt kernel supported by this cpu */
+void scrypt_detect_multi();
+
+/**
+ * The part of scrypt of an 80-byte block header which doesn't depend on the nonce,
+ * header's last 4 bytes. HMAC key of scrypt's PBKDF2 is the whole header, and
+ * such a long key is replaced with its SHA-256. The first 64-byte block of that
+ * hashing has no nonce in it and is done once here
+ */
+struct scrypt_header_midstate
+{
+	uint8_t header[80];
+	CSHA256 keyHasher;
+};
+
+void scrypt_header_midstate_init(scrypt_header_midstate *midstate, const char *header);
+
+/**
+ * Hash count headers of midstate with nonces firstNonce, firstNonce + 1 and so on,
+ * writing 32 bytes of output per nonce, the same as scrypt_1024_1_1_256_sp_multi
+ */
+void scrypt_1024_1_1_256_sp_nonces(const scrypt_header_midstate *midstate, uint32_t firstNonce, char *output, char *scratchpad, size_t count);
+
+/**
+ * The first and the last PBKDF2-SHA256 passes of scrypt(1024,1,1,256), with 80-byte
+ * input as both password and salt. HMAC keyed with the input is set up once
+ * by the caller and is used for both passes
+ */
+void scrypt_pbkdf2_in(const CHMAC_SHA256 &keyed, const uint8_t *input, uint8_t *B);
+void scrypt_pbkdf2_out(const CHMAC_SHA256 &keyed, const uint8_t *B, uint8_t *output);
+
 void
 PBKDF2_SHA256(const uint8_t *passwd, size_t passwdlen, const uint8_t *salt,
     size_t saltlen, uint64_t c, uint8_t *buf, size_t dkLen);
@@ -11,6 +11,7 @@
 #include "init.h"
 #include "addrman.h"
 #include "amount.h"
+#include "auxpowcache.h"
 #include "chain.h"
 #include "chainparams.h"
 #include "chainparamsutil.h"
@@ -110,10 +111,10 @@ class CCoinsViewErrorCatcher : public CCoinsViewBacked
 public:
     CCoinsViewErrorCatcher( AbstractCoinsView * view ) : CCoinsViewBacked( view ) { }
 
-    virtual bool GetCoins( const uint256 & txhash, CCoins & coins ) const override
+    virtual bool GetCoin( const COutPoint & outpoint, Coin & coin ) const override
     {
         try {
-            return CCoinsViewBacked::GetCoins( txhash, coins ) ;
+            return CCoinsViewBacked::GetCoin( outpoint, coin ) ;
         } catch( const std::runtime_error & e ) {
             uiInterface.ThreadSafeMessageBox( _("Error reading from database, shutting down."), "", CClientUserInterface::MSG_ERROR ) ;
             LogPrintf( "Error reading from database: %s\n", e.what() ) ;
@@ -142,6 +143,9 @@ void StopAndJoinThreads( std::vector< std::thread > & threads )
     if ( g_connman != nullptr ) g_connman->Interrupt() ;
     if ( theScheduler != nullptr ) theScheduler->stop() ;
     StopScriptChecking() ;
+    StopBlockReadAhead() ;
+    StopVerifyingDB() ;
+    StopParallelTasks() ;
 
     JoinAll( threads ) ;
 
@@ -152,119 +156,6 @@ void StopAndJoinThreads( std::vector< std::thread > & threads )
     }
 }
 
-static const uint64_t MEMPOOL_DUMP_VERSION = 1 ;
-
-static bool LoadMempoolFromDump()
-{
-    int64_t nExpiryTimeout = GetArg( "-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY ) * 60 * 60 ;
-    FILE* mempoolFile = fopen( ( GetDirForData() / "mempool.dat" ).string().c_str(), "rb" ) ;
-    if ( mempoolFile == nullptr ) {
-        LogPrintf( "Failed to open mempool file for reading from disk. Continuing anyway\n" ) ;
-        return false ;
-    }
-
-    CAutoFile file( mempoolFile, SER_DISK, PEER_VERSION ) ;
-
-    int64_t count = 0 ;
-    int64_t skipped = 0 ;
-    int64_t failed = 0 ;
-    int64_t nNow = GetTime() ;
-
-    try {
-        uint64_t version ;
-        file >> version ;
-        if ( version != MEMPOOL_DUMP_VERSION ) return false ;
-
-        uint64_t num ;
-        file >> num ;
-        double prioritydummy = 0 ;
-        while ( num -- ) {
-            CTransactionRef tx ;
-            int64_t nTime ;
-            int64_t nFeeDelta ;
-            file >> tx ;
-            file >> nTime ;
-            file >> nFeeDelta ;
-
-            CAmount amountdelta = nFeeDelta ;
-            if ( amountdelta != 0 ) {
-                mempool.PrioritiseTransaction( tx->GetTxHash(), tx->GetTxHash().ToString(), prioritydummy, amountdelta ) ;
-            }
-            CValidationState state ;
-            if ( nTime + nExpiryTimeout > nNow ) {
-                LOCK( cs_main ) ;
-                AcceptToMemoryPoolWithTime( mempool, state, tx, true, NULL, nTime ) ;
-                if ( state.IsValid() ) {
-                    ++ count ;
-                } else {
-                    ++ failed ;
-                }
-            } else {
-                ++ skipped ;
-            }
-
-            if ( ShutdownRequested() ) return false ;
-        }
-        std::map< uint256, CAmount > mapDeltas ;
-        file >> mapDeltas ;
-
-        for ( const auto & i : mapDeltas ) {
-            mempool.PrioritiseTransaction( i.first, i.first.ToString(), prioritydummy, i.second ) ;
-        }
-    } catch ( const std::exception & e ) {
-        LogPrintf( "Failed to deserialize mempool data from file: %s. Continuing anyway.\n", e.what() ) ;
-        return false ;
-    }
-
-    LogPrintf( "Imported mempool transactions from disk: %i okay, %i failed, %i expired\n", count, failed, skipped ) ;
-    return true ;
-}
-
-static void DumpMempoolToFile()
-{
-    int64_t start = GetTimeMicros() ;
-
-    std::map< uint256, CAmount > mapDeltas ;
-    std::vector< TxMempoolInfo > vinfo ;
-
-    {
-        LOCK( mempool.cs ) ;
-        for ( const auto & i : mempool.mapDeltas ) {
-            mapDeltas[ i.first ] = i.second.second ;
-        }
-        vinfo = mempool.infoAll() ;
-    }
-
-    int64_t mid = GetTimeMicros() ;
-
-    try {
-        FILE* filestr = fopen( ( GetDirForData() / "mempool.dat.new" ).string().c_str(), "wb" ) ;
-        if ( filestr == nullptr ) return ;
-
-        CAutoFile file( filestr, SER_DISK, PEER_VERSION ) ;
-
-        uint64_t version = MEMPOOL_DUMP_VERSION ;
-        file << version ;
-
-        file << static_cast< uint64_t >( vinfo.size() ) ;
-        for ( const auto & i : vinfo ) {
-            file << *( i.tx ) ;
-            file << static_cast< uint64_t >( i.nTime ) ;
-            file << static_cast< uint64_t >( i.nFeeDelta ) ;
-            mapDeltas.erase( i.tx->GetTxHash() ) ;
-        }
-
-        file << mapDeltas ;
-        FileCommit( file.get() ) ;
-        file.fclose() ;
-        RenameOver( GetDirForData() / "mempool.dat.new", GetDirForData() / "mempool.dat" ) ;
-        int64_t last = GetTimeMicros() ;
-        LogPrintf( "Dumped mempool: %.6f s to copy, %.6f s to dump\n", ( mid - start ) * 0.000001, ( last - mid ) * 0.000001 ) ;
-    } catch ( const std::exception & e ) {
-        LogPrintf( "Can't dump mempool: %s. Continuing anyway\n", e.what() ) ;
-    }
-}
-
 std::atomic < bool > fDumpMempoolLater( false ) ;
 
 void Shutdown()
@@ -296,12 +187,17 @@ void Shutdown()
 
     StopTorControl();
     UnregisterNodeSignals(GetNodeSignals());
+    // The mempool is dumped while the chainstate is flushed
+    std::thread dumpMempoolThread ;
     if ( fDumpMempoolLater )
-        DumpMempoolToFile() ;
+        dumpMempoolThread = std::thread( &DumpMempoolToFile ) ;
 
     if ( pcoinsTip != nullptr )
         FlushStateToDisk() ;
 
+    if ( dumpMempoolThread.joinable() )
+        dumpMempoolThread.join() ;
+
     {
         LOCK( cs_main ) ;
 
@@ -403,6 +299,7 @@ std::string HelpMessage( WhatHelpMessage what )
     strUsage += HelpMessageOpt("-version", _("Print version and exit"));
     strUsage += HelpMessageOpt("-alerts", strprintf(_("Receive and display P2P network alerts (default: %u)"), DEFAULT_ALERTS));
     strUsage += HelpMessageOpt("-alertnotify=<cmd>", _("Execute command when a relevant alert is received or we see a really long fork (%s in cmd is replaced by message)"));
+    strUsage += HelpMessageOpt( "-auxpowcache=<n>", strprintf( _("Keep auxpows of merge-mined block headers in memory, up to <n> megabytes (0 to %d, default: %u)"), MAX_AUXPOW_CACHE_SIZE, DEFAULT_AUXPOW_CACHE_SIZE ) ) ;
     strUsage += HelpMessageOpt("-blocknotify=<cmd>", _("Execute command when the best block changes (%s in cmd is replaced by block hash, %i is replaced by block number)"));
     if (showDebug)
         strUsage += HelpMessageOpt("-blocksonly", strprintf(_("Whether to operate in a blocks only mode (default: %u)"), DEFAULT_BLOCKSONLY));
@@ -451,6 +348,7 @@ std::string HelpMessage( WhatHelpMessage what )
     strUsage += HelpMessageOpt("-maxreceivebuffer=<n>", strprintf(_("Maximum per-connection receive buffer, <n>*1000 bytes (default: %u)"), DEFAULT_MAXRECEIVEBUFFER));
     strUsage += HelpMessageOpt("-maxsendbuffer=<n>", strprintf(_("Maximum per-connection send buffer, <n>*1000 bytes (default: %u)"), DEFAULT_MAXSENDBUFFER));
     strUsage += HelpMessageOpt("-maxtimeadjustment", strprintf(_("Maximum allowed median peer time offset adjustment. Local perspective of time may be influenced by peers forward or backward by this amount. (default: %u seconds)"), DEFAULT_MAX_TIME_ADJUSTMENT));
+    strUsage += HelpMessageOpt( "-msghandlers=<n>", strprintf( _("Number of threads processing messages of peers, each peer's messages in order by one of them (1 to %d, default: %d)"), MAX_MESSAGE_HANDLER_THREADS, DEFAULT_MESSAGE_HANDLER_THREADS ) ) ;
     strUsage += HelpMessageOpt("-onion=<ip:port>", strprintf(_("Use separate SOCKS5 proxy to reach peers via Tor hidden services (default: %s)"), "-proxy"));
     strUsage += HelpMessageOpt("-onlynet=<net>", _("Only connect to nodes in network <net> (ipv4, ipv6 or onion)"));
     strUsage += HelpMessageOpt("-permitbaremultisig", strprintf(_("Relay non-P2SH multisig (default: %u)"), DEFAULT_PERMIT_BAREMULTISIG));
@@ -461,6 +359,7 @@ std::string HelpMessage( WhatHelpMessage what )
     strUsage += HelpMessageOpt("-proxy=<ip:port>", _("Connect through SOCKS5 proxy"));
     strUsage += HelpMessageOpt("-proxyrandomize", strprintf(_("Randomize credentials for every proxy connection. This enables Tor stream isolation (default: %u)"), DEFAULT_PROXYRANDOMIZE));
     strUsage += HelpMessageOpt("-seednode=<ip>", _("Connect to a node to retrieve peer addresses, and disconnect"));
+    strUsage += HelpMessageOpt( "-socketevents=<mode>", strprintf( _("How to wait for sockets of peers, epoll where there is or select, which allows no more than %u sockets (default: %s)"), FD_SETSIZE, DEFAULT_SOCKETEVENTS ) ) ;
     strUsage += HelpMessageOpt("-timeout=<n>", strprintf(_("Specify connection timeout in milliseconds (minimum: 1, default: %d)"), DEFAULT_CONNECT_TIMEOUT));
     strUsage += HelpMessageOpt("-torcontrol=<ip>:<port>", strprintf(_("Tor control port to use if onion listening enabled (default: %s)"), DEFAULT_TOR_CONTROL));
     strUsage += HelpMessageOpt("-torpassword=<pass>", _("Tor control port password (default: empty)"));
@@ -496,6 +395,7 @@ std::string HelpMessage( WhatHelpMessage what )
     {
         strUsage += HelpMessageOpt("-checkblocks=<n>", strprintf(_("How many blocks to check at startup (default: %u, 0 = all)"), DEFAULT_CHECKBLOCKS));
         strUsage += HelpMessageOpt("-checklevel=<n>", strprintf(_("How thorough the block verification of -checkblocks is (0-4, default: %u)"), DEFAULT_CHECKLEVEL));
+        strUsage += HelpMessageOpt( "-checkinbackground", strprintf( "Verify the blocks of -checkblocks after startup instead of before it, aborting when they're corrupted (default: %u)", DEFAULT_CHECK_IN_BACKGROUND ) ) ;
         strUsage += HelpMessageOpt( "-checkblockindex", strprintf( "Do a full consistency check for mapBlockIndex, setBlockIndexCandidates, chainActive and mapBlocksUnlinked occasionally. Also sets -checkmempool (default for chain \"%s\": %u)", NameOfChain(), Params().DefaultConsistencyChecks() ) ) ;
         strUsage += HelpMessageOpt( "-checkmempool=<n>", strprintf( "Run checks every <n> transactions (default for chain \"%s\": %u)", NameOfChain(), Params().DefaultConsistencyChecks() ) ) ;
         strUsage += HelpMessageOpt("-disablesafemode", strprintf("Disable safemode, override a real safe mode event (default: %u)", DEFAULT_DISABLE_SAFEMODE));
@@ -869,6 +769,7 @@ ServiceFlags nRelevantServices = NODE_NETWORK;
 int nMaxConnections;
 int nUserMaxConnections;
 int nFD;
+SocketEventsMode socketEventsMode = SOCKETEVENTS_SELECT ;
 ServiceFlags nLocalServices = NODE_NETWORK;
 
 }
@@ -962,8 +863,16 @@ bool AppInitParameterInteraction()
     nUserMaxConnections = GetArg( "-maxconnections", DEFAULT_MAX_PEER_CONNECTIONS ) ;
     nMaxConnections = std::max( nUserMaxConnections, 0 ) ;
 
+    std::string strSocketEvents = GetArg( "-socketevents", DEFAULT_SOCKETEVENTS ) ;
+    if ( strSocketEvents != "select" && strSocketEvents != "epoll" )
+        return InitError( strprintf( "Unknown -socketevents mode: %s", strSocketEvents ) ) ;
+    socketEventsMode = SocketEventsModeFromString( strSocketEvents ) ;
+    if ( socketEventsMode == SOCKETEVENTS_SELECT && strSocketEvents != "select" )
+        InitWarning( strprintf( "No %s here, -socketevents is select", strSocketEvents ) ) ;
+
     // Trim requested connection counts, to fit into system limitations
-    nMaxConnections = std::max( std::min( nMaxConnections, (int)( FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS - MAX_ADDNODE_CONNECTIONS ) ), 0 ) ;
+    if ( socketEventsMode == SOCKETEVENTS_SELECT )
+        nMaxConnections = std::max( std::min( nMaxConnections, (int)( FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS - MAX_ADDNODE_CONNECTIONS ) ), 0 ) ;
     nFD = RaiseFileDescriptorLimit( nMaxConnections + MIN_CORE_FILEDESCRIPTORS + MAX_ADDNODE_CONNECTIONS ) ;
     if (nFD < MIN_CORE_FILEDESCRIPTORS)
         return InitError(_("Not enough file descriptors available."));
@@ -1203,12 +1112,16 @@ bool AppInitMain( std::vector< std::thread > & threads, CScheduler & scheduler )
     LogPrintf( "Using at most %i automatic connections (%i file descriptors available)\n", nMaxConnections, nFD ) ;
 
     InitSignatureCache() ;
+    InitAuxpowCache() ;
 
     LogPrintf( "Using %u threads for script verification\n", nScriptCheckThreads ) ;
     if ( nScriptCheckThreads > 1 ) {
-        for ( int i = 0 ; i < nScriptCheckThreads - 1 ; i ++ )
+        for ( int i = 0 ; i < nScriptCheckThreads - 1 ; i ++ ) {
             threads.push_back( std::thread( &ThreadScriptCheck ) ) ;
+            threads.push_back( std::thread( &ThreadParallelTasks ) ) ;
+        }
     }
+    threads.push_back( std::thread( &ThreadBlockReadAhead ) ) ;
 
     // Start the scheduler thread
     assert( schedulerThread == nullptr ) ;
@@ -1233,6 +1146,7 @@ bool AppInitMain( std::vector< std::thread > & threads, CScheduler & scheduler )
 #if defined(USE_SSE2)
     scrypt_detect_sse2();
 #endif
+    scrypt_detect_multi();
 
     // ********************************************************* Step 5: verify wallet database integrity
 #ifdef ENABLE_WALLET
@@ -1401,6 +1315,7 @@ bool AppInitMain( std::vector< std::thread > & threads, CScheduler & scheduler )
 
     fReindex = GetBoolArg( "-reindex", false ) ;
     bool fReindexChainState = GetBoolArg( "-reindex-chainstate", false ) ;
+    bool fCheckInBackground = GetBoolArg( "-checkinbackground", DEFAULT_CHECK_IN_BACKGROUND ) ;
 
     boost::filesystem::path blocksDir = GetDirForData() / "blocks" ;
     if ( ! boost::filesystem::exists( blocksDir ) )
@@ -1466,6 +1381,12 @@ bool AppInitMain( std::vector< std::thread > & threads, CScheduler & scheduler )
                     break;
                 }
 
+                // Convert chainstate of per-transaction records to per-output coins
+                if ( ! pcoinsdbview->Upgrade() ) {
+                    strLoadError = _("Error upgrading chainstate database") ;
+                    break ;
+                }
+
                 // Check for changed -txindex state
                 if (fTxIndex != GetBoolArg("-txindex", DEFAULT_TXINDEX)) {
                     strLoadError = _("You need to rebuild the database using -reindex-chainstate to change -txindex");
@@ -1505,7 +1426,7 @@ bool AppInitMain( std::vector< std::thread > & threads, CScheduler & scheduler )
                     }
                 }
 
-                if ( ! WVerifyDB().VerifyDB(
+                if ( ! fCheckInBackground && ! WVerifyDB().VerifyDB(
                           chainparams, pcoinsdbview,
                           GetArg( "-checklevel", DEFAULT_CHECKLEVEL ),
                           GetArg( "-checkblocks", DEFAULT_CHECKBLOCKS )
@@ -1519,6 +1440,9 @@ bool AppInitMain( std::vector< std::thread > & threads, CScheduler & scheduler )
                 break;
             }
 
+            // From now on flushing the chainstate doesn't wait for writing to the database
+            pcoinsdbview->StartBackgroundWrites() ;
+
             fLoaded = true;
         } while(false);
 
@@ -1602,6 +1526,14 @@ bool AppInitMain( std::vector< std::thread > & threads, CScheduler & scheduler )
     if ( IsArgSet( "-blocknotify" ) )
         uiInterface.NotifyBlockTip.connect( BlockNotifyCallback ) ;
 
+    // Verify blocks in the background, unless the chain is built again from the start
+    if ( fCheckInBackground && ! fReindex && ! fReindexChainState )
+        threads.push_back( std::thread(
+                &ThreadVerifyDB,
+                GetArg( "-checklevel", DEFAULT_CHECKLEVEL ),
+                GetArg( "-checkblocks", DEFAULT_CHECKBLOCKS )
+        ) ) ;
+
     {
         std::vector< boost::filesystem::path > vImportFiles ;
         if ( mapMultiArgs.count( "-loadblock" ) )
@@ -1650,6 +1582,8 @@ bool AppInitMain( std::vector< std::thread > & threads, CScheduler & scheduler )
     connOptions.uiInterface = &uiInterface;
     connOptions.nSendBufferMaxSize = 1000*GetArg("-maxsendbuffer", DEFAULT_MAXSENDBUFFER);
     connOptions.nReceiveFloodSize = 1000*GetArg("-maxreceivebuffer", DEFAULT_MAXRECEIVEBUFFER);
+    connOptions.socketEventsMode = socketEventsMode ;
+    connOptions.nMessageHandlerThreads = GetArg( "-msghandlers", DEFAULT_MESSAGE_HANDLER_THREADS ) ;
 
     connOptions.nMaxOutboundTimeframe = nMaxOutboundTimeframe;
     connOptions.nMaxOutboundLimit = nMaxOutboundLimit;
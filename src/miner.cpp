@@ -13,6 +13,9 @@
 #include "consensus/consensus.h"
 #include "consensus/merkle.h"
 #include "consensus/validation.h"
+#include "crypto/common.h"
+#include "crypto/scrypt.h"
+#include "crypto/sha256.h"
 #include "dogecoin.h"
 #include "hash.h"
 #include "validation.h"
@@ -27,10 +30,13 @@
 #include "utilthread.h"
 #include "utilstr.h"
 #include "utilmoneystr.h"
+#include "utilstrencodings.h"
 #include "validationinterface.h"
 #include "wallet/wallet.h"
 
 #include <algorithm>
+#include <atomic>
+#include <mutex>
 #include <queue>
 #include <utility>
 
@@ -637,6 +643,17 @@ void BlockAssembler::addPriorityTxs()
     fNeedSizeAccounting = fSizeAccounting;
 }
 
+static void setExtraNonce( CBlock & block, const CBlockIndex * pindexPrev, uint32_t extraNonce )
+{
+    unsigned int nHeight = pindexPrev->nHeight + 1 ; // height first in coinbase required for block.version=2
+    CMutableTransaction txCoinbase( *block.vtx[ 0 ] ) ;
+    txCoinbase.vin[ 0 ].scriptSig = ( CScript() << nHeight << CScriptNum( extraNonce ) ) + COINBASE_FLAGS ;
+    assert( txCoinbase.vin[ 0 ].scriptSig.size() <= 100 ) ;
+
+    block.vtx[ 0 ] = MakeTransactionRef( std::move( txCoinbase ) ) ;
+    block.hashMerkleRoot = BlockMerkleRoot( block ) ;
+}
+
 void IncrementExtraNonce( CBlock * pblock, const CBlockIndex * pindexPrev, uint32_t & nExtraNonce )
 {
     // Update nExtraNonce
@@ -647,13 +664,7 @@ void IncrementExtraNonce( CBlock * pblock, const CBlockIndex * pindexPrev, uint3
         hashPrevBlock = pblock->hashPrevBlock;
     }
     ++nExtraNonce;
-    unsigned int nHeight = pindexPrev->nHeight+1; // Height first in coinbase required for block.version=2
-    CMutableTransaction txCoinbase(*pblock->vtx[0]);
-    txCoinbase.vin[0].scriptSig = (CScript() << nHeight << CScriptNum(nExtraNonce)) + COINBASE_FLAGS;
-    assert(txCoinbase.vin[0].scriptSig.size() <= 100);
-
-    pblock->vtx[0] = MakeTransactionRef(std::move(txCoinbase));
-    pblock->hashMerkleRoot = BlockMerkleRoot(*pblock);
+    setExtraNonce( *pblock, pindexPrev, nExtraNonce ) ;
 }
 
 //
@@ -793,12 +804,109 @@ static CAmount newCoinsByKind( CAmount maximumCoins, const std::string & kind, s
     return newCoins ;
 }
 
+/**
+ * Scan count nonces beginning with firstNonce looking at sha256 hash first,
+ * more costly hashes are computed only for nonces which pass with sha256 hash.
+ * On success block's nonce is the found one
+ */
+static bool ScanNoncesSha256First( CBlock & block, uint32_t firstNonce, uint32_t count, uint32_t solutionBits, const Consensus::Params & consensus )
+{
+    const arith_uint256 sha256Solution = arith_uint256().SetCompact( solutionBits ) << 1 ;
+
+    unsigned char header[ 80 ] ;
+    memcpy( header, BEGIN( block.nVersion ), 80 ) ;
+
+    // header's first 64 bytes don't depend on the nonce
+    CSHA256 midstate ;
+    midstate.Write( header, 64 ) ;
+
+    for ( uint32_t n = 0 ; n < count ; n ++ )
+    {
+        WriteLE32( &header[ 76 ], firstNonce + n ) ;
+
+        uint256 hash ;
+        CSHA256 hasher = midstate ;
+        hasher.Write( &header[ 64 ], 16 ).Finalize( hash.begin() ) ;
+        CSHA256().Write( hash.begin(), CSHA256::OUTPUT_SIZE ).Finalize( hash.begin() ) ;
+
+        if ( UintToArith256( hash ) <= sha256Solution ) {
+            block.nNonce = firstNonce + n ;
+            if ( CheckProofOfWork( block, solutionBits, consensus, /* cacheHashes */ false ) )
+                return true ;
+        }
+    }
+
+    return false ;
+}
+
+struct SharedBlockCandidate
+{
+    std::unique_ptr< CBlockTemplate > blockTemplate ;
+    const CBlockIndex * pindexPrev ;
+    unsigned int transactionsInMempool ;
+    int64_t madeMillis ;
+} ;
+
+// never changed after it's published, swapped with std::atomic_store for a new one
+static std::shared_ptr< const SharedBlockCandidate > sharedBlockCandidate ;
+
+// only one thread makes a new candidate, others wait for it
+static std::mutex candidateMaker_mutex ;
+
+static bool isCandidateOutdated( const SharedBlockCandidate & candidate )
+{
+    if ( candidate.pindexPrev != chainActive.Tip() )
+        return true ; // new chain's tip
+
+    int64_t age = GetTimeMillis() - candidate.madeMillis ;
+    if ( mempool.GetTransactionsUpdated() != candidate.transactionsInMempool && age > 20999 )
+        return true ; // new transactions
+
+    return age > 20 * 60000 ; // too long
+}
+
+/**
+ * The current block candidate, when it's outdated a new one is made with
+ * scriptPubKey in coinbase. Null if the block can't be made
+ */
+static std::shared_ptr< const SharedBlockCandidate > getSharedBlockCandidate( const CChainParams & chainparams, const CScript & scriptPubKey )
+{
+    std::shared_ptr< const SharedBlockCandidate > candidate = std::atomic_load( &sharedBlockCandidate ) ;
+    if ( candidate != nullptr && ! isCandidateOutdated( *candidate ) )
+        return candidate ;
+
+    std::lock_guard< std::mutex > lock( candidateMaker_mutex ) ;
+
+    // maybe another thread has just made it
+    candidate = std::atomic_load( &sharedBlockCandidate ) ;
+    if ( candidate != nullptr && ! isCandidateOutdated( *candidate ) )
+        return candidate ;
+
+    std::shared_ptr< SharedBlockCandidate > newCandidate = std::make_shared< SharedBlockCandidate >() ;
+    try {
+        LOCK( cs_main ) ; // for the same tip as in CreateNewBlock
+        newCandidate->transactionsInMempool = mempool.GetTransactionsUpdated() ;
+        newCandidate->pindexPrev = chainActive.Tip() ;
+        newCandidate->blockTemplate = BlockAssembler( chainparams ).CreateNewBlock( scriptPubKey ) ;
+    } catch ( const std::runtime_error & e ) {
+        return nullptr ;
+    }
+    if ( newCandidate->blockTemplate == nullptr )
+        return nullptr ;
+    newCandidate->madeMillis = GetTimeMillis() ;
+
+    candidate = newCandidate ;
+    std::atomic_store( &sharedBlockCandidate, candidate ) ;
+    return candidate ;
+}
+
 void MiningThread::MineBlocks()
 {
     if ( finished ) return ;
 
     LogPrintf( "MiningThread (%d) started\n", numberOfThread ) ;
     RenameThread( strprintf( "digger-%d", numberOfThread ) ) ;
+    PinThreadToCore( numberOfThread - 1 ) ;
 
     GetMainSignals().ScriptForMining( coinbaseScript ) ;
 
@@ -809,7 +917,13 @@ void MiningThread::MineBlocks()
         if ( coinbaseScript == nullptr || coinbaseScript->reserveScript.empty() )
             throw std::runtime_error( "No coinbase script available (mining needs a wallet)" ) ;
 
+        // extra nonce is unique for every thread, so nonces of threads never overlap
         uint32_t nExtraNonce = 0 ;
+        const SharedBlockCandidate * previousCandidate = nullptr ;
+
+        // scrypt hashes of consecutive nonces, for scanning nonces in batches
+        char * scratchpad = scrypt_thread_scratchpad( SCRYPT_MULTI_SCRATCHPAD_SIZE ) ;
+        uint256 hashes[ SCRYPT_MAX_WAYS ] ;
 
         while ( ! finished )
         {
@@ -835,9 +949,6 @@ void MiningThread::MineBlocks()
             // Create new block
             //
 
-            unsigned int transactionsInMempool = mempool.GetTransactionsUpdated() ;
-            CBlockIndex * pindexPrev = chainActive.Tip() ;
-
             bool candidateOk = false ;
             do {
                 candidateOk = assembleNewBlockCandidate() ;
@@ -848,6 +959,13 @@ void MiningThread::MineBlocks()
 
             if ( recreateBlock ) recreateBlock = false ;
 
+            const CBlockIndex * pindexPrev = sharedCandidate->pindexPrev ;
+            if ( sharedCandidate.get() != previousCandidate ) {
+                previousCandidate = sharedCandidate.get() ;
+                nExtraNonce = numberOfThread ;
+            } else
+                nExtraNonce += howManyThreads ;
+
             CAmount newCoins = newCoinsByKind( getAmountOfCoinsBeingGenerated(), kindOfHowManyCoinsToGenerate, randomNumber ) ;
 
             if ( newCoins != getAmountOfCoinsBeingGenerated() ) {
@@ -856,7 +974,7 @@ void MiningThread::MineBlocks()
                 currentCandidate->block.vtx[ 0 ] = MakeTransactionRef( std::move( coinbase ) ) ;
             }
 
-            const Consensus::Params & consensus = chainparams.GetConsensus( chainActive.Tip()->nHeight + 1 ) ;
+            const Consensus::Params & consensus = chainparams.GetConsensus( pindexPrev->nHeight + 1 ) ;
 
             //if ( ! consensus.fStrictChainId ) {
                 //currentCandidate->block.nVersion &= 0xff ;
@@ -867,7 +985,7 @@ void MiningThread::MineBlocks()
                 currentCandidate->block.SetAuxpow( nullptr ) ;
 
             CBlock * currentBlock = &currentCandidate->block ;
-            IncrementExtraNonce( currentBlock, pindexPrev, nExtraNonce ) ;
+            setExtraNonce( *currentBlock, pindexPrev, nExtraNonce ) ;
 
             //
             // Search
@@ -877,7 +995,7 @@ void MiningThread::MineBlocks()
             noncesScanned = 0 ;
 
             uint32_t solutionBits = currentBlock->nBits ;
-            currentBlock->nNonce = randomNumber() ;
+            uint32_t nextNonce = 0 ;
 
             LogPrintf(
                 "Running MiningThread (%d) with %u transactions in block (%u bytes)%s%s\n",
@@ -885,24 +1003,50 @@ void MiningThread::MineBlocks()
                 currentBlock->vtx.size(),
                 ::GetSerializeSize( *currentBlock, SER_NETWORK, PROTOCOL_VERSION ),
                 ( verbose ? strprintf( ", looking for scrypt hash <= %s", arith_uint256().SetCompact( solutionBits ).GetHex() ) : "" ),
-                ( verbose ? strprintf( ", random initial nonce 0x%x", currentBlock->nNonce ) : "" )
+                ( verbose ? strprintf( ", extra nonce %u", nExtraNonce ) : "" )
             ) ;
 
             while ( true )
             {
+                // proof-of-work of inu chain includes sha256 hash, which alone rejects nearly
+                // every nonce, so there nonces are scanned by sha256 hash in bulk
+                const bool sha256First = ( NameOfChain() == "inu" ) ;
+                const size_t ways = sha256First ? 0x1000 : scrypt_multi_ways() ;
+                arith_uint256 solutionHash = arith_uint256().SetCompact( solutionBits ) ;
+
+                // only the nonce changes while scanning
+                scrypt_header_midstate midstate ;
+                scrypt_header_midstate_init( &midstate, BEGIN( currentBlock->nVersion ) ) ;
+
                 bool found = false ;
-                while ( ! found ) // scan nonces
+                while ( ! found ) // scan nonces, as many at once as the multi-lane scrypt hashes
                 {
-                    currentBlock->nNonce ++ ;
-                    noncesScanned ++ ;
-
-                    if ( CheckProofOfWork( *currentBlock, solutionBits, consensus ) )
-                    {   // found a solution
-                        found = true ; break ;
+                    uint32_t firstNonce = nextNonce ;
+                    noncesScanned += ways ;
+
+                    if ( sha256First ) {
+                        found = ScanNoncesSha256First( *currentBlock, firstNonce, ways, solutionBits, consensus ) ;
+                    } else {
+                        scrypt_1024_1_1_256_sp_nonces( &midstate, firstNonce, BEGIN( hashes[ 0 ] ), scratchpad, ways ) ;
+
+                        for ( size_t lane = 0 ; lane < ways ; lane ++ ) {
+                            // scrypt hash is small enough, check the rest of proof-of-work
+                            if ( UintToArith256( hashes[ lane ] ) <= solutionHash ) {
+                                currentBlock->nNonce = firstNonce + lane ;
+                                if ( CheckProofOfWork( *currentBlock, solutionBits, consensus, /* cacheHashes */ false ) )
+                                {   // found a solution
+                                    found = true ; break ;
+                                }
+                            }
+                        }
                     }
+                    if ( found ) break ;
+
+                    nextNonce = firstNonce + ways ;
+                    currentBlock->nNonce = nextNonce - 1 ;
 
                     // not found after trying for a while
-                    if ( ( currentBlock->nNonce & 0xfff ) == 0 )
+                    if ( ( nextNonce & 0xfff ) < ways )
                         break ;
 
                     if ( finished || recreateBlock ) break ;
@@ -912,7 +1056,6 @@ void MiningThread::MineBlocks()
                 {
                     std::string proofOfWorkFound = strprintf( "MiningThread (%d):\n", numberOfThread ) ;
                     proofOfWorkFound += strprintf( "proof-of-work found with nonce 0x%x\n", currentBlock->nNonce ) ;
-                    arith_uint256 solutionHash = arith_uint256().SetCompact( solutionBits ) ;
                     proofOfWorkFound += strprintf( "   scrypt hash %s\n   <= solution %s\n",
                                                     currentBlock->GetScryptHash().GetHex(), solutionHash.GetHex() ) ;
                     if ( NameOfChain() == "inu" ) {
@@ -943,13 +1086,10 @@ void MiningThread::MineBlocks()
                     break ;
 
                 // check if block candidate needs to be rebuilt
-                if ( pindexPrev != chainActive.Tip() )
-                    break ; // new chain's tip
-                if ( mempool.GetTransactionsUpdated() != transactionsInMempool
-                           && GetTimeMillis() - scanBeginsMillis > 20999 )
-                    break ; // new transactions
-                if ( GetTimeMillis() - scanBeginsMillis > 20 * 60000 )
-                    break ; // too long
+                if ( std::atomic_load( &sharedBlockCandidate ) != sharedCandidate )
+                    break ; // another thread has made a new one
+                if ( isCandidateOutdated( *sharedCandidate ) )
+                    break ;
                 if ( ! g_connman->hasConnectedNodes() && chainparams.MiningRequiresPeers() )
                     break ; // no peers connected
 
@@ -963,8 +1103,11 @@ void MiningThread::MineBlocks()
                 if ( solutionBits != currentBlock->nBits )
                     solutionBits = currentBlock->nBits ;
 
-                // next nonce is random
-                currentBlock->nNonce = randomNumber() ;
+                // all nonces are scanned, go on with the next extra nonce
+                if ( nextNonce < ways ) {
+                    nExtraNonce += howManyThreads ;
+                    setExtraNonce( *currentBlock, pindexPrev, nExtraNonce ) ;
+                }
             }
 
             if ( verbose )
@@ -1001,14 +1144,15 @@ bool MiningThread::assembleNewBlockCandidate()
     if ( coinbaseScript == nullptr || coinbaseScript->reserveScript.empty() )
         return false ;
 
-    try {
-        std::unique_ptr< BlockAssembler > assembler( new BlockAssembler( chainparams ) ) ;
-        currentCandidate = assembler->CreateNewBlock( coinbaseScript->reserveScript ) ;
-        if ( currentCandidate == nullptr )
-            return false ;
-    } catch ( const std::runtime_error & e ) {
+    // transactions are chosen once for all threads, each thread only puts its own coinbase
+    sharedCandidate = getSharedBlockCandidate( chainparams, coinbaseScript->reserveScript ) ;
+    if ( sharedCandidate == nullptr )
         return false ;
-    }
+
+    currentCandidate.reset( new CBlockTemplate( *sharedCandidate->blockTemplate ) ) ;
+    CMutableTransaction coinbase( * currentCandidate->block.vtx[ 0 ] ) ;
+    coinbase.vout[ 0 ].scriptPubKey = coinbaseScript->reserveScript ;
+    currentCandidate->block.vtx[ 0 ] = MakeTransactionRef( std::move( coinbase ) ) ;
 
     return true ;
 }
@@ -1053,6 +1197,7 @@ void GenerateCoins( bool generate, int nThreads, const CChainParams & chainparam
         std::lock_guard < std::mutex > lock( miningThreads_mutex ) ;
         miningThreads.clear() ;
     }
+    std::atomic_store( &sharedBlockCandidate, std::shared_ptr< const SharedBlockCandidate >() ) ;
 
     if ( nThreads < 0 )
         nThreads = GetNumCores() ;
@@ -1067,7 +1212,7 @@ void GenerateCoins( bool generate, int nThreads, const CChainParams & chainparam
     {
         std::lock_guard < std::mutex > lock( miningThreads_mutex ) ;
         for ( unsigned int i = 1 ; i <= nThreads ; i++ )
-            miningThreads.push_back( std::unique_ptr< MiningThread >( new MiningThread( i, chainparams ) ) ) ;
+            miningThreads.push_back( std::unique_ptr< MiningThread >( new MiningThread( i, nThreads, chainparams ) ) ) ;
     }
 
     ChangeKindOfHowManyCoinsToGenerate( currentWayForNewCoins ) ;
@@ -227,18 +227,22 @@ int64_t UpdateTime( CBlockHeader * pblock, const Consensus::Params & consensusPa
 
 #include "arith_uint256.h"
 
+/** Block candidate made once for all mining threads, see MiningThread::assembleNewBlockCandidate */
+struct SharedBlockCandidate ;
+
 class MiningThread
 {
 
 public:
 
-    MiningThread( size_t number, const CChainParams & params, const std::string & manyNewCoinsKind = "maximum" )
-        : theThread( &MiningThread::MineBlocks, this )
-        , numberOfThread( number )
+    MiningThread( size_t number, size_t threads, const CChainParams & params, const std::string & manyNewCoinsKind = "maximum" )
+        : numberOfThread( number )
+        , howManyThreads( threads )
         , chainparams( params )
         , kindOfHowManyCoinsToGenerate( manyNewCoinsKind )
         , coinbaseScript( nullptr )
         , howManyBlocksWereGeneratedByThisThread( 0 )
+        , sharedCandidate( nullptr )
         , currentCandidate( nullptr )
         , randomDevice()
         , randomNumber( randomDevice() )
@@ -249,6 +253,7 @@ public:
         , verbose( false )
         , recreateBlock( false )
         , finished( false )
+        , theThread( &MiningThread::MineBlocks, this ) // the last, when everything else is ready
     { }
 
     ~MiningThread()
@@ -315,10 +320,11 @@ private:
 
     bool assembleNewBlockCandidate() ;
 
-    std::thread theThread ;
-
     size_t numberOfThread ;
 
+    // extra nonces of thread n are n, n + howManyThreads, n + 2 * howManyThreads...
+    size_t howManyThreads ;
+
     const CChainParams & chainparams ;
 
     std::string kindOfHowManyCoinsToGenerate ;
@@ -327,6 +333,9 @@ private:
 
     size_t howManyBlocksWereGeneratedByThisThread ;
 
+    std::shared_ptr< const SharedBlockCandidate > sharedCandidate ;
+
+    // copy of the shared candidate with coinbase of this thread
     std::unique_ptr< CBlockTemplate > currentCandidate ;
 
     std::random_device randomDevice ;
@@ -344,6 +353,8 @@ private:
 
     bool finished ;
 
+    std::thread theThread ;
+
 } ;
 
 const MiningThread * const getMiningThreadByNumber( size_t number ) ;
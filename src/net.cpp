@@ -31,6 +31,11 @@
 #include <string.h>
 #else
 #include <fcntl.h>
+#include <sys/uio.h>
+#endif
+
+#ifdef HAVE_EPOLL
+#include <sys/epoll.h>
 #endif
 
 #ifdef USE_UPNP
@@ -376,7 +381,7 @@ CNode* CConnman::ConnectNode(CAddress addrConnect, const char *pszDest, bool fCo
             ConnectSocketByName( addrConnect, hSocket, pszDest, BaseParams().GetDefaultPort(), nConnectTimeout, &proxyConnectionFailed ) :
             ConnectSocket( addrConnect, hSocket, nConnectTimeout, &proxyConnectionFailed ) )
     {
-        if (!IsSelectableSocket(hSocket)) {
+        if ( ! IsSocketUsable( hSocket ) ) {
             LogPrintf("Cannot create connection: non-selectable socket created (fd >= FD_SETSIZE ?)\n");
             CloseSocket(hSocket);
             return NULL;
@@ -843,28 +848,56 @@ size_t CConnman::SocketSendData(CNode *pnode) const
     size_t nSentSize = 0;
 
     while (it != pnode->vSendMsg.end()) {
-        const auto &data = *it;
-        assert(data.size() > pnode->nSendOffset);
-        int nBytes = 0;
+        assert((*it)->size() > pnode->nSendOffset);
+        ssize_t nBytes = 0;
+        size_t nTrySize = 0;
         {
             LOCK(pnode->cs_hSocket);
             if (pnode->hSocket == INVALID_SOCKET)
                 break;
+#ifdef WIN32
+            const std::vector< unsigned char > & data = **it ;
+            nTrySize = data.size() - pnode->nSendOffset ;
             nBytes = send( pnode->hSocket, reinterpret_cast< const char* >( data.data() ) + pnode->nSendOffset,
-                            data.size() - pnode->nSendOffset, MSG_NOSIGNAL | MSG_DONTWAIT ) ;
+                            nTrySize, MSG_NOSIGNAL | MSG_DONTWAIT ) ;
+#else
+            // queued buffers, headers and payloads of several messages, go with one syscall
+            struct iovec iov[ SEND_IOV_MAX ] ;
+            size_t nIov = 0 ;
+            size_t nOffset = pnode->nSendOffset ;
+            for ( auto itIov = it ; itIov != pnode->vSendMsg.end() && nIov < SEND_IOV_MAX ; ++ itIov, nOffset = 0 ) {
+                iov[ nIov ].iov_base = const_cast< unsigned char * >( ( *itIov )->data() ) + nOffset ;
+                iov[ nIov ].iov_len = ( *itIov )->size() - nOffset ;
+                nTrySize += iov[ nIov ].iov_len ;
+                nIov ++ ;
+            }
+            struct msghdr msg ;
+            memset( &msg, 0, sizeof( msg ) ) ;
+            msg.msg_iov = iov ;
+            msg.msg_iovlen = nIov ;
+            nBytes = sendmsg( pnode->hSocket, &msg, MSG_NOSIGNAL | MSG_DONTWAIT ) ;
+#endif
         }
         if (nBytes > 0) {
             pnode->nLastSend = GetSystemTimeInSeconds();
             pnode->nSendBytes += nBytes;
-            pnode->nSendOffset += nBytes;
             nSentSize += nBytes;
-            if (pnode->nSendOffset == data.size()) {
-                pnode->nSendOffset = 0;
-                pnode->nSendSize -= data.size();
-                pnode->fPauseSend = pnode->nSendSize > nSendBufferMaxSize;
-                it++;
-            } else {
-                // could not send full message; stop sending more
+            // drop the buffers sent in full
+            size_t nLeft = nBytes ;
+            while ( nLeft > 0 ) {
+                size_t nRest = ( *it )->size() - pnode->nSendOffset ;
+                if ( nLeft < nRest ) {
+                    pnode->nSendOffset += nLeft ;
+                    break ;
+                }
+                nLeft -= nRest ;
+                pnode->nSendOffset = 0 ;
+                pnode->nSendSize -= ( *it )->size() ;
+                it ++ ;
+            }
+            pnode->fPauseSend = pnode->nSendSize > nSendBufferMaxSize;
+            if ( (size_t)nBytes < nTrySize ) {
+                // could not send everything tried; stop sending more
                 break;
             }
         } else {
@@ -1067,7 +1100,7 @@ void CConnman::AcceptConnection(const ListenSocket& hListenSocket) {
         return;
     }
 
-    if (!IsSelectableSocket(hSocket))
+    if ( ! IsSocketUsable( hSocket ) )
     {
         LogPrintf("connection from %s dropped: non-selectable socket\n", addr.ToString());
         CloseSocket(hSocket);
@@ -1134,6 +1167,10 @@ void CConnman::ThreadSocketHandler()
                 {
                     // remove from vNodes
                     vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
+#ifdef HAVE_EPOLL
+                    // events for its socket are not looked at anymore
+                    mapEpollNodes.erase( pnode->GetId() ) ;
+#endif
 
                     // release outbound grant (if any)
                     pnode->grantOutbound.Release();
@@ -1182,109 +1219,38 @@ void CConnman::ThreadSocketHandler()
                 clientInterface->NotifyNumConnectionsChanged( nPrevNodeCount ) ;
         }
 
-        //
-        // Find which sockets have data to receive
-        //
-        struct timeval timeout;
-        timeout.tv_sec  = 0;
-        timeout.tv_usec = 50000; // frequency to poll pnode->vSend
-
-        fd_set fdsetRecv;
-        fd_set fdsetSend;
-        fd_set fdsetError;
-        FD_ZERO(&fdsetRecv);
-        FD_ZERO(&fdsetSend);
-        FD_ZERO(&fdsetError);
-        SOCKET hSocketMax = 0;
-        bool have_fds = false;
-
-        for ( const ListenSocket & hListenSocket : vhListenSocket ) {
-            FD_SET(hListenSocket.socket, &fdsetRecv);
-            hSocketMax = std::max(hSocketMax, hListenSocket.socket);
-            have_fds = true;
-        }
-
+        std::vector< CNode* > vNodesCopy ;
         {
             LOCK( cs_vNodes ) ;
-            for ( CNode* pnode : vNodes )
-            {
-                // Implement the following logic:
-                // * If there is data to send, select() for sending data. As this only
-                //   happens when optimistic write failed, we choose to first drain the
-                //   write buffer in this case before receiving more. This avoids
-                //   needlessly queueing received data, if the remote peer is not themselves
-                //   receiving data. This means properly utilizing TCP flow control signalling
-                // * Otherwise, if there is space left in the receive buffer, select() for
-                //   receiving data
-                // * Hand off all complete messages to the processor, to be handled without
-                //   blocking here
-
-                bool select_recv = !pnode->fPauseRecv;
-                bool select_send;
-                {
-                    LOCK(pnode->cs_vSend);
-                    select_send = !pnode->vSendMsg.empty();
-                }
-
-                LOCK(pnode->cs_hSocket);
-                if (pnode->hSocket == INVALID_SOCKET)
-                    continue;
-
-                FD_SET(pnode->hSocket, &fdsetError);
-                hSocketMax = std::max(hSocketMax, pnode->hSocket);
-                have_fds = true;
-
-                if (select_send) {
-                    FD_SET(pnode->hSocket, &fdsetSend);
-                    continue;
-                }
-                if (select_recv) {
-                    FD_SET(pnode->hSocket, &fdsetRecv);
-                }
-            }
+            vNodesCopy = vNodes ;
+            for ( CNode* pnode : vNodesCopy )
+                pnode->AddRef() ;
         }
 
-        int nSelect = select(have_fds ? hSocketMax + 1 : 0,
-                             &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
-        if (interruptNet)
-            return;
-
-        if (nSelect == SOCKET_ERROR)
-        {
-            if (have_fds)
-            {
-                int nErr = WSAGetLastError();
-                LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
-                for (unsigned int i = 0; i <= hSocketMax; i++)
-                    FD_SET(i, &fdsetRecv);
-            }
-            FD_ZERO(&fdsetSend);
-            FD_ZERO(&fdsetError);
-            if (!interruptNet.sleep_for(std::chrono::milliseconds(timeout.tv_usec/1000)))
-                return;
-        }
+        //
+        // Find which sockets are ready
+        //
+        bool fListenReady = false ;
+#ifdef HAVE_EPOLL
+        if ( socketEventsMode == SOCKETEVENTS_EPOLL )
+            fListenReady = SocketEventsEpoll( vNodesCopy ) ;
+        else
+#endif
+            fListenReady = SocketEventsSelect( vNodesCopy ) ;
+        if ( interruptNet )
+            return ;
 
         //
         // Accept new connections
         //
-        for ( const ListenSocket & hListenSocket : vhListenSocket )
-        {
-            if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv))
-            {
-                AcceptConnection(hListenSocket);
-            }
-        }
+        if ( fListenReady )
+            for ( const ListenSocket & hListenSocket : vhListenSocket )
+                if ( hListenSocket.socket != INVALID_SOCKET )
+                    AcceptConnection( hListenSocket ) ;
 
         //
         // Service each socket
         //
-        std::vector< CNode* > vNodesCopy ;
-        {
-            LOCK( cs_vNodes ) ;
-            vNodesCopy = vNodes ;
-            for ( CNode* pnode : vNodesCopy )
-                pnode->AddRef() ;
-        }
         for ( CNode* pnode : vNodesCopy )
         {
             if ( interruptNet ) return ;
@@ -1292,18 +1258,13 @@ void CConnman::ThreadSocketHandler()
             //
             // Receive
             //
-            bool recvSet = false;
-            bool sendSet = false;
-            bool errorSet = false;
-            {
-                LOCK(pnode->cs_hSocket);
-                if (pnode->hSocket == INVALID_SOCKET)
-                    continue;
-                recvSet = FD_ISSET(pnode->hSocket, &fdsetRecv);
-                sendSet = FD_ISSET(pnode->hSocket, &fdsetSend);
-                errorSet = FD_ISSET(pnode->hSocket, &fdsetError);
+            bool recvSet = pnode->fSocketReadyRecv ;
+            if ( recvSet && socketEventsMode != SOCKETEVENTS_SELECT ) {
+                // as with select, drain the send buffer before receiving more
+                LOCK( pnode->cs_vSend ) ;
+                recvSet = ! pnode->fPauseRecv && pnode->vSendMsg.empty() ;
             }
-            if (recvSet || errorSet)
+            if ( recvSet )
             {
                 {
                     {
@@ -1336,7 +1297,7 @@ void CConnman::ThreadSocketHandler()
                                     pnode->nProcessQueueSize += nSizeAdded;
                                     pnode->fPauseRecv = pnode->nProcessQueueSize > nReceiveFloodSize;
                                 }
-                                WakeMessageHandler();
+                                WakeMessageHandler( pnode ) ;
                             }
                         }
                         else if (nBytes == 0)
@@ -1350,6 +1311,8 @@ void CConnman::ThreadSocketHandler()
                         {
                             // error
                             int nErr = WSAGetLastError();
+                            if ( nErr == WSAEWOULDBLOCK )
+                                pnode->fSocketReadyRecv = false ;
                             if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS)
                             {
                                 if (!pnode->fDisconnect)
@@ -1364,12 +1327,16 @@ void CConnman::ThreadSocketHandler()
             //
             // Send
             //
-            if (sendSet)
+            if ( pnode->fSocketReadySend )
             {
-                LOCK(pnode->cs_vSend);
-                size_t nBytes = SocketSendData(pnode);
-                if (nBytes) {
-                    RecordBytesSent(nBytes);
+                LOCK( pnode->cs_vSend ) ;
+                if ( ! pnode->vSendMsg.empty() ) {
+                    size_t nBytes = SocketSendData( pnode ) ;
+                    if ( nBytes )
+                        RecordBytesSent( nBytes ) ;
+                    // with edge-triggered events, the socket is writable again when there's an event saying so
+                    if ( ! pnode->vSendMsg.empty() && socketEventsMode != SOCKETEVENTS_SELECT )
+                        pnode->fSocketReadySend = false ;
                 }
             }
 
@@ -1415,13 +1382,204 @@ void CConnman::ThreadSocketHandler()
     }
 }
 
+SocketEventsMode SocketEventsModeFromString( const std::string & str )
+{
+#ifdef HAVE_EPOLL
+    if ( str == "epoll" ) return SOCKETEVENTS_EPOLL ;
+#endif
+    return SOCKETEVENTS_SELECT ;
+}
+
+bool CConnman::IsSocketUsable( SOCKET hSocket ) const
+{
+    return socketEventsMode != SOCKETEVENTS_SELECT || IsSelectableSocket( hSocket ) ;
+}
+
+bool CConnman::SocketEventsSelect( const std::vector< CNode* > & vNodesReady )
+{
+    struct timeval timeout;
+    timeout.tv_sec  = 0;
+    timeout.tv_usec = 50000; // frequency to poll pnode->vSend
+
+    fd_set fdsetRecv;
+    fd_set fdsetSend;
+    fd_set fdsetError;
+    FD_ZERO(&fdsetRecv);
+    FD_ZERO(&fdsetSend);
+    FD_ZERO(&fdsetError);
+    SOCKET hSocketMax = 0;
+    bool have_fds = false;
+
+    for ( const ListenSocket & hListenSocket : vhListenSocket ) {
+        FD_SET(hListenSocket.socket, &fdsetRecv);
+        hSocketMax = std::max(hSocketMax, hListenSocket.socket);
+        have_fds = true;
+    }
+
+    for ( CNode* pnode : vNodesReady )
+    {
+        // Implement the following logic:
+        // * If there is data to send, select() for sending data. As this only
+        //   happens when optimistic write failed, we choose to first drain the
+        //   write buffer in this case before receiving more. This avoids
+        //   needlessly queueing received data, if the remote peer is not themselves
+        //   receiving data. This means properly utilizing TCP flow control signalling
+        // * Otherwise, if there is space left in the receive buffer, select() for
+        //   receiving data
+        // * Hand off all complete messages to the processor, to be handled without
+        //   blocking here
+
+        bool select_recv = !pnode->fPauseRecv;
+        bool select_send;
+        {
+            LOCK(pnode->cs_vSend);
+            select_send = !pnode->vSendMsg.empty();
+        }
+
+        LOCK(pnode->cs_hSocket);
+        if (pnode->hSocket == INVALID_SOCKET)
+            continue;
+
+        FD_SET(pnode->hSocket, &fdsetError);
+        hSocketMax = std::max(hSocketMax, pnode->hSocket);
+        have_fds = true;
+
+        if (select_send) {
+            FD_SET(pnode->hSocket, &fdsetSend);
+            continue;
+        }
+        if (select_recv) {
+            FD_SET(pnode->hSocket, &fdsetRecv);
+        }
+    }
+
+    int nSelect = select(have_fds ? hSocketMax + 1 : 0,
+                         &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+    if (interruptNet)
+        return false;
+
+    if (nSelect == SOCKET_ERROR)
+    {
+        if (have_fds)
+        {
+            int nErr = WSAGetLastError();
+            LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
+            for (unsigned int i = 0; i <= hSocketMax; i++)
+                FD_SET(i, &fdsetRecv);
+        }
+        FD_ZERO(&fdsetSend);
+        FD_ZERO(&fdsetError);
+        if (!interruptNet.sleep_for(std::chrono::milliseconds(timeout.tv_usec/1000)))
+            return false;
+    }
+
+    for ( CNode* pnode : vNodesReady )
+    {
+        LOCK( pnode->cs_hSocket ) ;
+        bool fValid = ( pnode->hSocket != INVALID_SOCKET ) ;
+        pnode->fSocketReadyRecv = fValid && ( FD_ISSET( pnode->hSocket, &fdsetRecv ) || FD_ISSET( pnode->hSocket, &fdsetError ) ) ;
+        pnode->fSocketReadySend = fValid && FD_ISSET( pnode->hSocket, &fdsetSend ) ;
+    }
+
+    bool fListenReady = false ;
+    for ( const ListenSocket & hListenSocket : vhListenSocket )
+        if ( hListenSocket.socket != INVALID_SOCKET && FD_ISSET( hListenSocket.socket, &fdsetRecv ) )
+            fListenReady = true ;
+    return fListenReady ;
+}
+
+#ifdef HAVE_EPOLL
+
+/** What events of listening sockets carry instead of a node id */
+static const uint64_t EPOLL_LISTEN_SOCKET = std::numeric_limits< uint64_t >::max() ;
+
+bool CConnman::SocketEventsEpoll( const std::vector< CNode* > & vNodesReady )
+{
+    // Register sockets of new nodes, and see whether some node is still ready from before
+    bool fReadyBefore = false ;
+    for ( CNode* pnode : vNodesReady )
+    {
+        if ( ! pnode->fSocketRegistered ) {
+            LOCK( pnode->cs_hSocket ) ;
+            if ( pnode->hSocket == INVALID_SOCKET )
+                continue ;
+
+            struct epoll_event event ;
+            event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET ;
+            event.data.u64 = pnode->GetId() ;
+            if ( epoll_ctl( epollfd, EPOLL_CTL_ADD, pnode->hSocket, &event ) == SOCKET_ERROR ) {
+                LogPrintf( "epoll_ctl for peer=%d failed: %s\n", pnode->GetId(), NetworkErrorString( WSAGetLastError() ) ) ;
+                pnode->fDisconnect = true ;
+                continue ;
+            }
+            pnode->fSocketRegistered = true ;
+            mapEpollNodes[ pnode->GetId() ] = pnode ;
+        }
+
+        if ( pnode->fSocketReadyRecv || pnode->fSocketReadySend ) {
+            LOCK( pnode->cs_vSend ) ;
+            bool fHaveSendData = ! pnode->vSendMsg.empty() ;
+            if ( ( pnode->fSocketReadySend && fHaveSendData ) ||
+                    ( pnode->fSocketReadyRecv && ! pnode->fPauseRecv && ! fHaveSendData ) )
+                fReadyBefore = true ;
+        }
+    }
+
+    struct epoll_event events[ 256 ] ;
+    int nEvents = epoll_wait( epollfd, events, 256, fReadyBefore ? 0 : 50 ) ;
+    if ( interruptNet )
+        return false ;
+
+    if ( nEvents == SOCKET_ERROR )
+    {
+        int nErr = WSAGetLastError() ;
+        if ( nErr != WSAEINTR ) {
+            LogPrintf( "socket epoll_wait error %s\n", NetworkErrorString( nErr ) ) ;
+            interruptNet.sleep_for( std::chrono::milliseconds( 50 ) ) ;
+        }
+        return false ;
+    }
+
+    bool fListenReady = false ;
+    for ( int i = 0 ; i < nEvents ; ++ i )
+    {
+        if ( events[ i ].data.u64 == EPOLL_LISTEN_SOCKET ) {
+            fListenReady = true ;
+            continue ;
+        }
+
+        // nodes which are gone have no entry
+        auto it = mapEpollNodes.find( (NodeId)events[ i ].data.u64 ) ;
+        if ( it == mapEpollNodes.end() )
+            continue ;
+
+        if ( events[ i ].events & ( EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR ) )
+            it->second->fSocketReadyRecv = true ;
+        if ( events[ i ].events & ( EPOLLOUT | EPOLLHUP | EPOLLERR ) )
+            it->second->fSocketReadySend = true ;
+    }
+    return fListenReady ;
+}
+
+#endif
+
 void CConnman::WakeMessageHandler()
 {
     {
         std::lock_guard<std::mutex> lock(mutexMsgProc);
-        fMsgProcWake = true;
+        std::fill( vMsgProcWake.begin(), vMsgProcWake.end(), true ) ;
+    }
+    condMsgProc.notify_all();
+}
+
+void CConnman::WakeMessageHandler( const CNode * pnode )
+{
+    {
+        std::lock_guard< std::mutex > lock( mutexMsgProc ) ;
+        vMsgProcWake[ pnode->GetId() % nMessageHandlerThreads ] = true ;
     }
-    condMsgProc.notify_one();
+    // threads sleep on the same condition, each looks at its own flag
+    condMsgProc.notify_all() ;
 }
 
 
@@ -1959,16 +2117,17 @@ bool CConnman::OpenNetworkConnection(const CAddress& addrConnect, bool fCountFai
     return true;
 }
 
-void CConnman::ThreadMessageHandler()
+void CConnman::ThreadMessageHandler( int nThread )
 {
     while ( ! flagInterruptMsgProc )
     {
+        // Only this thread processes messages of its nodes, so they're processed in order
         std::vector< CNode* > vNodesCopy ;
         {
             LOCK( cs_vNodes ) ;
-            vNodesCopy = vNodes ;
-            for ( CNode* pnode : vNodesCopy )
-                pnode->AddRef() ;
+            for ( CNode* pnode : vNodes )
+                if ( pnode->GetId() % nMessageHandlerThreads == nThread )
+                    vNodesCopy.push_back( pnode->AddRef() ) ;
         }
 
         bool fMoreWork = false ;
@@ -1999,9 +2158,9 @@ void CConnman::ThreadMessageHandler()
         std::unique_lock< std::mutex > lock( mutexMsgProc ) ;
         if ( ! fMoreWork ) {
             condMsgProc.wait_until( lock, std::chrono::steady_clock::now() + std::chrono::milliseconds( 100 ),
-                            [ this ] {  return fMsgProcWake ;  } ) ;
+                            [ this, nThread ] {  return vMsgProcWake[ nThread ] || flagInterruptMsgProc ;  } ) ;
         }
-        fMsgProcWake = false ;
+        vMsgProcWake[ nThread ] = false ;
     }
 }
 
@@ -2190,6 +2349,12 @@ CConnman::CConnman(uint64_t nSeed0In, uint64_t nSeed1In) : nSeed0(nSeed0In), nSe
     nBestHeight = 0;
     clientInterface = nullptr ;
     flagInterruptMsgProc = false;
+    nMessageHandlerThreads = 1 ;
+    vMsgProcWake.assign( nMessageHandlerThreads, false ) ;
+    socketEventsMode = SOCKETEVENTS_SELECT ;
+#ifdef HAVE_EPOLL
+    epollfd = -1 ;
+#endif
 }
 
 NodeId CConnman::GetNewNodeId()
@@ -2217,6 +2382,32 @@ bool CConnman::Start(CScheduler& scheduler, std::string& strNodeError, Options c
     nMaxOutboundLimit = connOptions.nMaxOutboundLimit;
     nMaxOutboundTimeframe = connOptions.nMaxOutboundTimeframe;
 
+    nMessageHandlerThreads = std::max( 1, std::min( connOptions.nMessageHandlerThreads, MAX_MESSAGE_HANDLER_THREADS ) ) ;
+
+    socketEventsMode = connOptions.socketEventsMode ;
+#ifdef HAVE_EPOLL
+    if ( socketEventsMode == SOCKETEVENTS_EPOLL ) {
+        epollfd = epoll_create1( EPOLL_CLOEXEC ) ;
+        if ( epollfd == -1 ) {
+            LogPrintf( "epoll_create1 failed: %s, using select\n", NetworkErrorString( WSAGetLastError() ) ) ;
+            socketEventsMode = SOCKETEVENTS_SELECT ;
+        }
+    }
+    if ( socketEventsMode == SOCKETEVENTS_EPOLL ) {
+        // listening sockets stay level-triggered, one connection is accepted at a time
+        for ( const ListenSocket & hListenSocket : vhListenSocket ) {
+            struct epoll_event event ;
+            event.events = EPOLLIN ;
+            event.data.u64 = EPOLL_LISTEN_SOCKET ;
+            if ( epoll_ctl( epollfd, EPOLL_CTL_ADD, hListenSocket.socket, &event ) == SOCKET_ERROR ) {
+                strNodeError = strprintf( "epoll_ctl for listening socket failed: %s", NetworkErrorString( WSAGetLastError() ) ) ;
+                return false ;
+            }
+        }
+    }
+#endif
+    LogPrintf( "Waiting for sockets with %s\n", socketEventsMode == SOCKETEVENTS_EPOLL ? "epoll" : "select" ) ;
+
     SetBestHeight(connOptions.nBestHeight);
 
     clientInterface = connOptions.uiInterface;
@@ -2276,7 +2467,7 @@ bool CConnman::Start(CScheduler& scheduler, std::string& strNodeError, Options c
 
     {
         std::unique_lock<std::mutex> lock(mutexMsgProc);
-        fMsgProcWake = false;
+        vMsgProcWake.assign( nMessageHandlerThreads, false ) ;
     }
 
     // Send and receive from sockets, accept connections
@@ -2299,7 +2490,13 @@ bool CConnman::Start(CScheduler& scheduler, std::string& strNodeError, Options c
         threadOpenConnections = std::thread(&TraceThread<std::function<void()> >, "opencon", std::function<void()>(std::bind(&CConnman::ThreadOpenConnections, this)));
 
     // Process messages
-    threadMessageHandler = std::thread(&TraceThread<std::function<void()> >, "msghand", std::function<void()>(std::bind(&CConnman::ThreadMessageHandler, this)));
+    LogPrintf( "Using %d threads for processing messages\n", nMessageHandlerThreads ) ;
+    for ( int i = 0 ; i < nMessageHandlerThreads ; i ++ )
+        threadMessageHandlers.emplace_back(
+                                &TraceThread< std::function< void() > >,
+                                "msghand",
+                                std::function< void() >( std::bind( &CConnman::ThreadMessageHandler, this, i ) )
+                          ) ;
 
     // Dump network addresses
     scheduler.scheduleEvery( std::bind( &CConnman::DumpData, this ), DUMP_ADDRESSES_INTERVAL ) ;
@@ -2348,7 +2545,9 @@ void CConnman::Interrupt()
 
 void CConnman::Stop()
 {
-    if ( threadMessageHandler.joinable() ) threadMessageHandler.join() ;
+    for ( std::thread & thread : threadMessageHandlers )
+        if ( thread.joinable() ) thread.join() ;
+    threadMessageHandlers.clear() ;
     if ( threadOpenConnections.joinable() ) threadOpenConnections.join() ;
     if ( threadOpenAddedConnections.joinable() ) threadOpenAddedConnections.join() ;
     if ( threadDNSAddressSeed.joinable() ) threadDNSAddressSeed.join() ;
@@ -2378,6 +2577,13 @@ void CConnman::Stop()
     vNodes.clear();
     vNodesDisconnected.clear();
     vhListenSocket.clear();
+#ifdef HAVE_EPOLL
+    mapEpollNodes.clear() ;
+    if ( epollfd != -1 ) {
+        close( epollfd ) ;
+        epollfd = -1 ;
+    }
+#endif
     delete semOutbound;
     semOutbound = NULL;
     delete semAddnode;
@@ -2707,6 +2913,9 @@ CNode::CNode(NodeId idIn, ServiceFlags nLocalServicesIn, int nMyStartingHeightIn
     nMinPingUsecTime = std::numeric_limits< int64_t >::max() ;
     fPauseRecv = false;
     fPauseSend = false;
+    fSocketReadyRecv = false ;
+    fSocketReadySend = false ;
+    fSocketRegistered = false ;
     nProcessQueueSize = 0;
 
     for ( const std::string & msg : getAllNetMessageTypes() )
@@ -2766,11 +2975,9 @@ bool CConnman::NodeFullyConnected( const CNode* pnode )
     return pnode != nullptr && pnode->fSuccessfullyConnected && ! pnode->fDisconnect ;
 }
 
-void CConnman::PushMessage( CNode * pnode, CSerializedNetMsg && msg )
+CSharedNetMsg::CSharedNetMsg( CSerializedNetMsg && msg )
 {
     size_t nMessageSize = msg.data.size() ;
-    size_t nTotalSize = nMessageSize + CMessageHeader::HEADER_SIZE ;
-    LogPrint( "net", "sending %s (%d bytes) peer=%d\n", SanitizeString( msg.command.c_str() ), nMessageSize, pnode->id ) ;
 
     std::vector<unsigned char> serializedHeader;
     serializedHeader.reserve(CMessageHeader::HEADER_SIZE);
@@ -2780,6 +2987,23 @@ void CConnman::PushMessage( CNode * pnode, CSerializedNetMsg && msg )
 
     CVectorWriter{ SER_NETWORK, INIT_PROTO_VERSION, serializedHeader, 0, hdr } ;
 
+    header = std::make_shared< const std::vector< unsigned char > >( std::move( serializedHeader ) ) ;
+    if ( nMessageSize )
+        data = std::make_shared< const std::vector< unsigned char > >( std::move( msg.data ) ) ;
+    command = std::move( msg.command ) ;
+}
+
+void CConnman::PushMessage( CNode * pnode, CSerializedNetMsg && msg )
+{
+    PushMessage( pnode, CSharedNetMsg( std::move( msg ) ) ) ;
+}
+
+void CConnman::PushMessage( CNode * pnode, const CSharedNetMsg & msg )
+{
+    size_t nMessageSize = msg.data ? msg.data->size() : 0 ;
+    size_t nTotalSize = nMessageSize + CMessageHeader::HEADER_SIZE ;
+    LogPrint( "net", "sending %s (%d bytes) peer=%d\n", SanitizeString( msg.command.c_str() ), nMessageSize, pnode->id ) ;
+
     size_t nBytesSent = 0 ;
     {
         LOCK( pnode->cs_vSend ) ;
@@ -2791,9 +3015,9 @@ void CConnman::PushMessage( CNode * pnode, CSerializedNetMsg && msg )
 
         if ( pnode->nSendSize > nSendBufferMaxSize )
             pnode->fPauseSend = true ;
-        pnode->vSendMsg.push_back( std::move( serializedHeader ) ) ;
+        pnode->vSendMsg.push_back( msg.header ) ;
         if ( nMessageSize )
-            pnode->vSendMsg.push_back( std::move( msg.data ) ) ;
+            pnode->vSendMsg.push_back( msg.data ) ;
 
         // if write queue is empty, try "optimistic write"
         if ( optimisticSend )
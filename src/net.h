@@ -61,6 +61,10 @@ static const int MAX_OUTBOUND_CONNECTIONS = 12 ;
 static const int MAX_ADDNODE_CONNECTIONS = 12 ;
 /** The maximum number of peer connections to maintain */
 static const unsigned int DEFAULT_MAX_PEER_CONNECTIONS = 125 ;
+/** Default for -msghandlers, the number of threads processing peer messages */
+static const int DEFAULT_MESSAGE_HANDLER_THREADS = 4 ;
+/** Maximum number of threads processing peer messages */
+static const int MAX_MESSAGE_HANDLER_THREADS = 16 ;
 /** -listen default */
 static const bool DEFAULT_LISTEN = true;
 /** -upnp default */
@@ -69,6 +73,8 @@ static const bool DEFAULT_UPNP = USE_UPNP;
 #else
 static const bool DEFAULT_UPNP = false;
 #endif
+/** The maximum number of queued buffers given to one sendmsg */
+static const size_t SEND_IOV_MAX = 64 ;
 /** The maximum number of entries in mapAskFor */
 static const size_t MAPASKFOR_MAX_SZ = MAX_INV_SZ;
 /** The maximum number of entries in setAskFor (larger due to getdata latency) */
@@ -86,6 +92,22 @@ static const size_t DEFAULT_MAXSENDBUFFER    = 1 * 1000;
 
 static const ServiceFlags REQUIRED_SERVICES = NODE_NETWORK;
 
+/** How the socket thread waits for sockets to be ready */
+enum SocketEventsMode {
+    SOCKETEVENTS_SELECT,    // select() over all sockets every time, up to FD_SETSIZE of them
+    SOCKETEVENTS_EPOLL      // edge-triggered epoll, each socket registered once
+} ;
+
+/** Default for -socketevents */
+#ifdef HAVE_EPOLL
+static const char * const DEFAULT_SOCKETEVENTS = "epoll" ;
+#else
+static const char * const DEFAULT_SOCKETEVENTS = "select" ;
+#endif
+
+/** Mode of -socketevents, falling back to select when there's no such mode here */
+SocketEventsMode SocketEventsModeFromString( const std::string & str ) ;
+
 // NOTE: When adjusting this, update rpcnet:setban's help ("12h")
 static const unsigned int DEFAULT_MISBEHAVING_BANTIME = 60 * 60 * 12 ; // 12-hour ban by default
 
@@ -117,6 +139,17 @@ struct CSerializedNetMsg
     std::string command ;
 } ;
 
+/** A message with its header serialized once, which send queues of any number of peers share */
+struct CSharedNetMsg
+{
+    CSharedNetMsg() = default ;
+    explicit CSharedNetMsg( CSerializedNetMsg && msg ) ;
+
+    std::shared_ptr< const std::vector< unsigned char > > header ;
+    std::shared_ptr< const std::vector< unsigned char > > data ;    // null for no payload
+    std::string command ;
+} ;
+
 
 class CConnman
 {
@@ -143,6 +176,8 @@ public:
         unsigned int nReceiveFloodSize = 0;
         uint64_t nMaxOutboundTimeframe = 0;
         uint64_t nMaxOutboundLimit = 0;
+        SocketEventsMode socketEventsMode = SOCKETEVENTS_SELECT ;
+        int nMessageHandlerThreads = 1 ;
     };
     CConnman(uint64_t seed0, uint64_t seed1);
     ~CConnman();
@@ -158,6 +193,7 @@ public:
     bool ForNode( NodeId id, std::function< bool( CNode* pnode ) > func ) ;
 
     void PushMessage( CNode* pnode, CSerializedNetMsg&& msg ) ;
+    void PushMessage( CNode* pnode, const CSharedNetMsg & msg ) ;
 
     bool hasConnectedNodes()
     {
@@ -298,7 +334,10 @@ public:
 
     unsigned int GetReceiveFloodSize() const;
 
+    /** Wake all message handler threads */
     void WakeMessageHandler();
+    /** Wake the message handler thread this node belongs to */
+    void WakeMessageHandler( const CNode * pnode ) ;
 
 private:
 
@@ -312,11 +351,17 @@ private:
     void ThreadOpenAddedConnections();
     void ProcessOneShot();
     void ThreadOpenConnections();
-    void ThreadMessageHandler();
+    void ThreadMessageHandler( int nThread ) ;
     void AcceptConnection(const ListenSocket& hListenSocket);
     void ThreadSocketHandler();
     void ThreadDNSAddressSeed();
 
+    /** Wait for sockets to be ready, setting fSocketReady* of nodes. Returns whether a listening socket is */
+    bool SocketEventsSelect( const std::vector< CNode* > & vNodesReady ) ;
+    bool SocketEventsEpoll( const std::vector< CNode* > & vNodesReady ) ;
+    /** Whether the socket thread can wait for this socket */
+    bool IsSocketUsable( SOCKET hSocket ) const ;
+
     uint64_t CalculateKeyedNetGroup(const CAddress& ad) const;
 
     bool AttemptToEvictConnection();
@@ -368,6 +413,13 @@ private:
     unsigned int nReceiveFloodSize;
 
     std::vector<ListenSocket> vhListenSocket;
+
+    SocketEventsMode socketEventsMode ;
+#ifdef HAVE_EPOLL
+    int epollfd ;
+    // Nodes registered with epollfd, by the id they're registered with (socket thread only)
+    std::map< NodeId, CNode* > mapEpollNodes ;
+#endif
     std::atomic<bool> fNetworkActive;
     banmap_t setBanned;
     CCriticalSection cs_setBanned;
@@ -402,8 +454,11 @@ private:
     /** SipHasher seeds for deterministic randomness */
     const uint64_t nSeed0, nSeed1;
 
-    /** flag for waking the message processor */
-    bool fMsgProcWake;
+    /** Each node's messages are processed by thread id % nMessageHandlerThreads, in order */
+    int nMessageHandlerThreads ;
+
+    /** flags for waking the message processors, one per thread */
+    std::vector< bool > vMsgProcWake ;
 
     std::condition_variable condMsgProc;
     std::mutex mutexMsgProc;
@@ -415,7 +470,7 @@ private:
     std::thread threadSocketHandler;
     std::thread threadOpenAddedConnections;
     std::thread threadOpenConnections;
-    std::thread threadMessageHandler;
+    std::vector< std::thread > threadMessageHandlers ;
 };
 
 extern std::unique_ptr< CConnman > g_connman ;
@@ -585,7 +640,8 @@ public:
     size_t nSendSize; // total size of all vSendMsg entries
     size_t nSendOffset; // offset inside the first vSendMsg already sent
     uint64_t nSendBytes;
-    std::deque<std::vector<unsigned char>> vSendMsg;
+    // buffers may be shared with queues of other nodes
+    std::deque< std::shared_ptr< const std::vector< unsigned char > > > vSendMsg ;
     CCriticalSection cs_vSend;
     CCriticalSection cs_hSocket;
     CCriticalSection cs_vRecv;
@@ -635,6 +691,12 @@ public:
     const uint64_t nKeyedNetGroup;
     std::atomic_bool fPauseRecv;
     std::atomic_bool fPauseSend;
+
+    // Readiness of the socket, used by the socket thread only. With select it's
+    // what select() says, with edge-triggered epoll it lasts until a call would block
+    bool fSocketReadyRecv ;
+    bool fSocketReadySend ;
+    bool fSocketRegistered ;
 protected:
 
     mapMsgCmdSize mapSendBytesPerMsgCmd;
@@ -644,9 +706,10 @@ public:
     uint256 hashContinue;
     std::atomic<int> nStartingHeight;
 
-    // flood relay
+    // flood relay, addresses are pushed by the handler threads of other nodes
     std::vector<CAddress> vAddrToSend;
     CRollingBloomFilter addrKnown;
+    CCriticalSection cs_vAddrToSend;
     bool fGetAddr;
     std::set<uint256> setKnown;
     int64_t nNextAddrSend;
@@ -690,7 +753,7 @@ public:
     // Whether a ping is requested
     std::atomic<bool> fPingQueued;
 
-    // Alert relay
+    // Alert relay, protected by cs_inventory
     std::vector<CAlert> vAlertToSend;
 
     CNode(NodeId id, ServiceFlags nLocalServicesIn, int nMyStartingHeightIn, SOCKET hSocketIn, const CAddress &addrIn, uint64_t nKeyedNetGroupIn, uint64_t nLocalHostNonceIn, const std::string &addrNameIn = "", bool fInboundIn = false);
@@ -763,6 +826,7 @@ public:
 
     void AddAddressKnown(const CAddress& _addr)
     {
+        LOCK(cs_vAddrToSend);
         addrKnown.insert(_addr.GetKey());
     }
 
@@ -771,6 +835,7 @@ public:
         // Known checking here is only to save space from duplicates.
         // SendMessages will filter it again for knowns that were added
         // after addresses were pushed.
+        LOCK(cs_vAddrToSend);
         if (_addr.IsValid() && !addrKnown.contains(_addr.GetKey())) {
             if (vAddrToSend.size() >= MAX_ADDR_TO_SEND) {
                 vAddrToSend[insecure_rand.rand32() % vAddrToSend.size()] = _addr;
@@ -784,6 +849,7 @@ public:
     {
         // don't relay to nodes which haven't sent their version message
         if (_alert.IsInEffect() && nVersion != 0) {
+            LOCK(cs_inventory);
             vAlertToSend.push_back(_alert);
         }
     }
@@ -474,9 +474,16 @@ const CBlockIndex* LastCommonAncestor(const CBlockIndex* pa, const CBlockIndex*
         pb = pb->GetAncestor(pa->nHeight);
     }
 
-    while (pa != pb && pa && pb) {
-        pa = pa->pprev;
-        pb = pb->pprev;
+    while ( pa != pb && pa != nullptr && pb != nullptr ) {
+        // At the same height skips are at the same height too. When they
+        // differ, the branches meet below them
+        if ( pa->pskip != pb->pskip && pa->pskip != nullptr && pb->pskip != nullptr ) {
+            pa = pa->pskip ;
+            pb = pb->pskip ;
+        } else {
+            pa = pa->pprev ;
+            pb = pb->pprev ;
+        }
     }
 
     // Eventually all chain branches meet at the genesis block
@@ -786,6 +793,9 @@ static std::shared_ptr<const CBlock> most_recent_block;
 static std::shared_ptr<const CBlockHeaderAndShortTxIDs> most_recent_compact_block;
 static uint256 most_recent_block_hash;
 
+/** Messages of transactions and compact blocks, serialized once for all peers */
+static CSharedNetMsgCache relayMsgCache( MAX_RELAY_MSG_CACHE_BYTES ) ;
+
 void PeerLogicValidation::NewPoWValidBlock(const CBlockIndex *pindex, const std::shared_ptr<const CBlock>& pblock) {
     std::shared_ptr<const CBlockHeaderAndShortTxIDs> pcmpctblock = std::make_shared<const CBlockHeaderAndShortTxIDs> (*pblock, true);
     const CNetMsgMaker msgMaker(PROTOCOL_VERSION);
@@ -808,7 +818,6 @@ void PeerLogicValidation::NewPoWValidBlock(const CBlockIndex *pindex, const std:
     }
 
     connman->ForEachNode([this, &pcmpctblock, pindex, &msgMaker, fWitnessEnabled, &hashBlock](CNode* pnode) {
-        // TODO: Avoid the repeated-serialization here
         if ( pnode->nVersion < INVALID_CB_NO_BAN_VERSION || pnode->fDisconnect )
             return ;
         ProcessBlockAvailability( pnode->GetId() ) ;
@@ -820,7 +829,7 @@ void PeerLogicValidation::NewPoWValidBlock(const CBlockIndex *pindex, const std:
 
             LogPrint( "net", "%s sending header-and-ids %s to peer=%d\n", "PeerLogicValidation::NewPoWValidBlock",
                         hashBlock.ToString(), pnode->id ) ;
-            connman->PushMessage( pnode, msgMaker.Make( NetMsgType::CMPCTBLOCK, *pcmpctblock ) ) ;
+            connman->PushMessage( pnode, relayMsgCache.Make( msgMaker, 0, NetMsgType::CMPCTBLOCK, hashBlock, *pcmpctblock ) ) ;
             info.pindexBestHeaderSent = pindex ;
         }
     });
@@ -917,12 +926,15 @@ bool static AlreadyHave(const CInv& inv) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
                 recentRejects->reset() ;
             }
 
-            // Use pcoinsTip->HaveCoinsInCache as a quick approximation to exclude
-            // requesting or processing some txs which have already been included in a block
+            // Use pcoinsTip->HaveCoinInCache as a quick approximation to exclude
+            // requesting or processing some txs which have already been included in a block.
+            // Outputs of a transaction are checked as far as the second one, since a
+            // transaction with an unspendable first output has no coin for it
             return recentRejects->contains(inv.hash) ||
                    mempool.exists(inv.hash) ||
                    mapOrphanTransactions.count(inv.hash) ||
-                   pcoinsTip->HaveCoinsInCache(inv.hash);
+                   pcoinsTip->HaveCoinInCache(COutPoint(inv.hash, 0)) || // Best effort: only try output 0 and 1
+                   pcoinsTip->HaveCoinInCache(COutPoint(inv.hash, 1));
         }
     case MSG_BLOCK:
     case MSG_WITNESS_BLOCK:
@@ -976,10 +988,23 @@ static void RelayAddress( const CAddress & addr, bool fReachable, CConnman & con
     connman.ForEachNodeThen( std::move( sortfunc ), std::move( pushfunc ) ) ;
 }
 
-void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParams, CConnman& connman, const std::atomic<bool>& interruptMsgProc)
+/** Whole block to read and send without cs_main, with what reading it needs of its index taken under the lock */
+struct BlockToSend
+{
+    CInv inv ;
+    const CBlockIndex * pindex{ nullptr } ;
+    CDiskBlockPos pos ;
+    bool fPowChecked{ false } ;
+} ;
+
+/**
+ * Answers getdata under cs_main, except a whole block which is left in blockToSend to be read and sent
+ * without the lock. What isn't found is left in vNotFound, to go after the block as it always did
+ */
+static void ProcessGetDataLocked( CNode* pfrom, const Consensus::Params& consensusParams, CConnman& connman, const std::atomic<bool>& interruptMsgProc,
+                                  BlockToSend & blockToSend, std::vector< CInv > & vNotFound )
 {
     std::deque<CInv>::iterator it = pfrom->vRecvGetData.begin();
-    std::vector<CInv> vNotFound;
     const CNetMsgMaker msgMaker(pfrom->GetSendVersion());
     LOCK(cs_main);
 
@@ -990,8 +1015,10 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
 
         const CInv &inv = *it;
         {
-            if (interruptMsgProc)
-                return;
+            if ( interruptMsgProc ) {
+                vNotFound.clear() ;
+                return ;
+            }
 
             it++;
 
@@ -1044,14 +1071,16 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                 // it's available before trying to send
                 if ( send && ( mi->second->nStatus & BLOCK_DATA_EXISTS ) )
                 {
-                    // Send block from disk
+                    // Send block from disk, whole blocks as bytes of block file
                     CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second, consensusParams))
-                        assert(!"cannot load block from disk");
-                    if ( inv.type == MSG_BLOCK )
-                        connman.PushMessage( pfrom, msgMaker.Make( SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::BLOCK, block ) ) ;
-                    else if ( inv.type == MSG_WITNESS_BLOCK )
-                        connman.PushMessage( pfrom, msgMaker.Make( NetMsgType::BLOCK, block ) ) ;
+                    if ( inv.type == MSG_BLOCK || inv.type == MSG_WITNESS_BLOCK ) {
+                        blockToSend.inv = inv ;
+                        blockToSend.pindex = mi->second ;
+                        blockToSend.pos = mi->second->GetBlockPos() ;
+                        blockToSend.fPowChecked = ( mi->second->nStatus & BLOCK_POW_CHECKED ) ;
+                    }
+                    else if ( ! ReadBlockFromDisk( block, mi->second, consensusParams ) )
+                        assert( ! "cannot load block from disk" ) ;
                     else if (inv.type == MSG_FILTERED_BLOCK)
                     {
                         bool sendMerkleBlock = false;
@@ -1094,7 +1123,7 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                     }
 
                     // Trigger the peer node to send a getblocks request for the next batch of inventory
-                    if (inv.hash == pfrom->hashContinue)
+                    if ( blockToSend.pindex == nullptr && inv.hash == pfrom->hashContinue )
                     {
                         // Bypass PushInventory, this must send even if redundant,
                         // and we want it right after the last block so they don't
@@ -1113,14 +1142,14 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                 int sendFlags = ( inv.type == MSG_TX ) ? SERIALIZE_TRANSACTION_NO_WITNESS : 0 ;
                 auto mi = mapRelay.find( inv.hash ) ;
                 if ( mi != mapRelay.end() ) {
-                    connman.PushMessage( pfrom, msgMaker.Make( sendFlags, NetMsgType::TX, *mi->second ) ) ;
+                    connman.PushMessage( pfrom, relayMsgCache.MakeTx( msgMaker, sendFlags, *mi->second ) ) ;
                     push = true ;
                 } else if ( pfrom->timeLastMempoolReq ) {
                     auto txinfo = mempool.info( inv.hash ) ;
                     // To protect privacy, do not answer getdata using the mempool when
                     // that TX couldn't have been INVed in reply to a MEMPOOL request
                     if ( txinfo.tx && txinfo.nTime <= pfrom->timeLastMempoolReq ) {
-                        connman.PushMessage( pfrom, msgMaker.Make( sendFlags, NetMsgType::TX, *txinfo.tx ) ) ;
+                        connman.PushMessage( pfrom, relayMsgCache.MakeTx( msgMaker, sendFlags, *txinfo.tx ) ) ;
                         push = true ;
                     }
                 }
@@ -1137,6 +1166,40 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
     }
 
     pfrom->vRecvGetData.erase( pfrom->vRecvGetData.begin(), it ) ;
+}
+
+void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParams, CConnman& connman, const std::atomic<bool>& interruptMsgProc)
+{
+    BlockToSend blockToSend ;
+    std::vector< CInv > vNotFound ;
+    ProcessGetDataLocked( pfrom, consensusParams, connman, interruptMsgProc, blockToSend, vNotFound ) ;
+    const CNetMsgMaker msgMaker( pfrom->GetSendVersion() ) ;
+
+    // Reading and sending a whole block keeps other peers waiting for cs_main no longer
+    if ( blockToSend.pindex != nullptr ) {
+        const CInv & inv = blockToSend.inv ;
+        std::vector< unsigned char > vchBlock ;
+        if ( ReadRawBlockFromDisk( vchBlock, blockToSend.pos, inv.hash, blockToSend.fPowChecked, inv.type == MSG_WITNESS_BLOCK, consensusParams ) ) {
+            connman.PushMessage( pfrom, msgMaker.MakeRaw( NetMsgType::BLOCK, std::move( vchBlock ) ) ) ;
+
+            // Trigger the peer node to send a getblocks request for the next batch of inventory
+            if ( inv.hash == pfrom->hashContinue )
+            {
+                std::vector< CInv > vInv ;
+                {
+                    LOCK( cs_main ) ;
+                    vInv.push_back( CInv( MSG_BLOCK, chainActive.Tip()->GetBlockSha256Hash() ) ) ;
+                }
+                connman.PushMessage( pfrom, msgMaker.Make( NetMsgType::INV, vInv ) ) ;
+                pfrom->hashContinue.SetNull() ;
+            }
+        } else {
+            LOCK( cs_main ) ;
+            // the block may be pruned since
+            if ( ( blockToSend.pindex->nStatus & BLOCK_DATA_EXISTS ) && blockToSend.pindex->GetBlockPos() == blockToSend.pos )
+                assert( ! "cannot load block from disk" ) ;
+        }
+    }
 
     if (!vNotFound.empty()) {
         // Let the peer know that we didn't find what it asked for, so it doesn't
@@ -2425,9 +2488,10 @@ bool static ProcessMessage( CNode * pfrom, const std::string & strCommand, CData
         }
         pfrom->fSentAddr = true;
 
-        pfrom->vAddrToSend.clear();
         std::vector<CAddress> vAddr = connman.GetAddresses();
         FastRandomContext insecure_rand;
+        LOCK(pfrom->cs_vAddrToSend);
+        pfrom->vAddrToSend.clear();
         for ( const CAddress & addr : vAddr )
             pfrom->PushAddress(addr, insecure_rand);
     }
@@ -2867,6 +2931,7 @@ bool SendMessages(CNode* pto, CConnman& connman, const std::atomic<bool>& interr
         //
         if (pto->nNextAddrSend < nNow) {
             pto->nNextAddrSend = PoissonNextSend(nNow, AVG_ADDRESS_BROADCAST_INTERVAL);
+            LOCK(pto->cs_vAddrToSend);
             std::vector<CAddress> vAddr;
             vAddr.reserve(pto->vAddrToSend.size());
             for ( const CAddress & addr : pto->vAddrToSend )
@@ -2999,27 +3064,33 @@ bool SendMessages(CNode* pto, CConnman& connman, const std::atomic<bool>& interr
                                 vHeaders.front().GetSha256Hash().ToString(), pto->id ) ;
 
                     int sendFlags = info.fWantsCmpctWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS ;
+                    const uint256 hashBlock = pBestIndex->GetBlockSha256Hash() ;
 
-                    bool fGotBlockFromCache = false ;
-                    {
-                        LOCK( cs_most_recent_block ) ;
-                        if ( most_recent_block_hash == pBestIndex->GetBlockSha256Hash() ) {
-                            if ( info.fWantsCmpctWitness )
-                                connman.PushMessage( pto, msgMaker.Make( sendFlags, NetMsgType::CMPCTBLOCK, *most_recent_compact_block ) ) ;
-                            else {
-                                CBlockHeaderAndShortTxIDs cmpctblock( *most_recent_block, info.fWantsCmpctWitness ) ;
-                                connman.PushMessage( pto, msgMaker.Make( sendFlags, NetMsgType::CMPCTBLOCK, cmpctblock ) ) ;
+                    // Peers announced to at once share one message
+                    CSharedNetMsg msg ;
+                    if ( ! relayMsgCache.Find( hashBlock, sendFlags, NetMsgType::CMPCTBLOCK, msg ) ) {
+                        bool fGotBlockFromCache = false ;
+                        {
+                            LOCK( cs_most_recent_block ) ;
+                            if ( most_recent_block_hash == hashBlock ) {
+                                if ( info.fWantsCmpctWitness )
+                                    msg = relayMsgCache.Make( msgMaker, sendFlags, NetMsgType::CMPCTBLOCK, hashBlock, *most_recent_compact_block ) ;
+                                else {
+                                    CBlockHeaderAndShortTxIDs cmpctblock( *most_recent_block, info.fWantsCmpctWitness ) ;
+                                    msg = relayMsgCache.Make( msgMaker, sendFlags, NetMsgType::CMPCTBLOCK, hashBlock, cmpctblock ) ;
+                                }
+                                fGotBlockFromCache = true ;
                             }
-                            fGotBlockFromCache = true ;
+                        }
+                        if (!fGotBlockFromCache) {
+                            CBlock block;
+                            bool ret = ReadBlockFromDisk(block, pBestIndex, consensusParams);
+                            assert(ret);
+                            CBlockHeaderAndShortTxIDs cmpctblock( block, info.fWantsCmpctWitness ) ;
+                            msg = relayMsgCache.Make( msgMaker, sendFlags, NetMsgType::CMPCTBLOCK, hashBlock, cmpctblock ) ;
                         }
                     }
-                    if (!fGotBlockFromCache) {
-                        CBlock block;
-                        bool ret = ReadBlockFromDisk(block, pBestIndex, consensusParams);
-                        assert(ret);
-                        CBlockHeaderAndShortTxIDs cmpctblock( block, info.fWantsCmpctWitness ) ;
-                        connman.PushMessage( pto, msgMaker.Make( sendFlags, NetMsgType::CMPCTBLOCK, cmpctblock ) ) ;
-                    }
+                    connman.PushMessage( pto, msg ) ;
                     info.pindexBestHeaderSent = pBestIndex ;
                 } else if ( info.fPreferHeaders ) {
                     if (vHeaders.size() > 1) {
@@ -3260,6 +3331,7 @@ bool SendMessages(CNode* pto, CConnman& connman, const std::atomic<bool>& interr
         //
         // Message: alert
         //
+        LOCK(pto->cs_inventory);
         for ( const CAlert & alert : pto->vAlertToSend ) {
             // returns true if wasn't already contained in the set
             if (pto->setKnown.insert(alert.GetHash()).second)
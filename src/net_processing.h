@@ -47,6 +47,9 @@ static const unsigned int INVENTORY_BROADCAST_INTERVAL = 5 ;
 /** Maximum number of inventory items to send per transmission */
 static const unsigned int INVENTORY_BROADCAST_MAX = 7 * INVENTORY_BROADCAST_INTERVAL ;
 
+/** Size of the messages of transactions and compact blocks kept serialized for all peers */
+static const size_t MAX_RELAY_MSG_CACHE_BYTES = 8 * 1000 * 1000 ;
+
 /** Maximum length of reject messages */
 static const unsigned int MAX_REJECT_MESSAGE_LENGTH = 111 ;
 
@@ -19,6 +19,7 @@
 
 #ifndef WIN32
 #include <fcntl.h>
+#include <poll.h>
 #endif
 
 #include <boost/algorithm/string/predicate.hpp> // for starts_with() and ends_with()
@@ -199,6 +200,27 @@ struct timeval MillisToTimeval(int64_t nTimeout)
     return timeout;
 }
 
+/**
+ * Wait up to nTimeout milliseconds for the socket to be readable or writable. Returns as select() does.
+ * It's poll() where there is, so sockets don't have to be below FD_SETSIZE
+ */
+static int WaitForSocket( SOCKET hSocket, bool fWrite, int64_t nTimeout )
+{
+#ifdef WIN32
+    struct timeval timeout = MillisToTimeval( nTimeout ) ;
+    fd_set fdset ;
+    FD_ZERO( &fdset ) ;
+    FD_SET( hSocket, &fdset ) ;
+    return select( hSocket + 1, fWrite ? NULL : &fdset, fWrite ? &fdset : NULL, NULL, &timeout ) ;
+#else
+    struct pollfd pollSocket ;
+    pollSocket.fd = hSocket ;
+    pollSocket.events = fWrite ? POLLOUT : POLLIN ;
+    pollSocket.revents = 0 ;
+    return poll( &pollSocket, 1, nTimeout ) ;
+#endif
+}
+
 /**
  * Read bytes from socket. This will either read the full number of bytes requested
  * or return False on error or timeout.
@@ -227,14 +249,7 @@ bool static InterruptibleRecv(char* data, size_t len, int timeout, SOCKET& hSock
         } else { // Other error or blocking
             int nErr = WSAGetLastError();
             if (nErr == WSAEINPROGRESS || nErr == WSAEWOULDBLOCK || nErr == WSAEINVAL) {
-                if (!IsSelectableSocket(hSocket)) {
-                    return false;
-                }
-                struct timeval tval = MillisToTimeval(std::min(endTime - curTime, maxWait));
-                fd_set fdset;
-                FD_ZERO(&fdset);
-                FD_SET(hSocket, &fdset);
-                int nRet = select(hSocket + 1, &fdset, NULL, NULL, &tval);
+                int nRet = WaitForSocket( hSocket, false, std::min( endTime - curTime, maxWait ) ) ;
                 if (nRet == SOCKET_ERROR) {
                     return false;
                 }
@@ -436,11 +451,7 @@ bool static ConnectSocketDirectly(const CService &addrConnect, SOCKET& hSocketRe
         // WSAEINVAL is here because some legacy version of winsock uses it
         if (nErr == WSAEINPROGRESS || nErr == WSAEWOULDBLOCK || nErr == WSAEINVAL)
         {
-            struct timeval timeout = MillisToTimeval(nTimeout);
-            fd_set fdset;
-            FD_ZERO(&fdset);
-            FD_SET(hSocket, &fdset);
-            int nRet = select( hSocket + 1, NULL, &fdset, NULL, &timeout ) ;
+            int nRet = WaitForSocket( hSocket, true, nTimeout ) ;
             if ( nRet == 0 )
             {
                 LogPrintf( "%s to %s timeout\n", __func__, addrConnect.ToString() );
@@ -449,7 +460,7 @@ bool static ConnectSocketDirectly(const CService &addrConnect, SOCKET& hSocketRe
             }
             if ( nRet == SOCKET_ERROR )
             {
-                LogPrintf( "select() for %s failed: %s\n", addrConnect.ToString(), NetworkErrorString( WSAGetLastError() ) ) ;
+                LogPrintf( "waiting for connect to %s failed: %s\n", addrConnect.ToString(), NetworkErrorString( WSAGetLastError() ) ) ;
                 CloseSocket( hSocket ) ;
                 return false ;
             }
@@ -467,7 +478,7 @@ bool static ConnectSocketDirectly(const CService &addrConnect, SOCKET& hSocketRe
             }
             if ( nRet != 0 )
             {
-                LogPrintf( "connect to %s failed after select(): %s\n", addrConnect.ToString(), NetworkErrorString( nRet ) ) ;
+                LogPrintf( "connect to %s failed after waiting: %s\n", addrConnect.ToString(), NetworkErrorString( nRet ) ) ;
                 CloseSocket( hSocket ) ;
                 return false ;
             }
@@ -7,7 +7,14 @@
 #define DOGECOIN_NETMESSAGEMAKER_H
 
 #include "net.h"
+#include "primitives/transaction.h"
 #include "serialize.h"
+#include "sync.h"
+#include "uint256.h"
+
+#include <deque>
+#include <map>
+#include <tuple>
 
 class CNetMsgMaker
 {
@@ -29,8 +36,92 @@ public:
         return Make( 0, std::move( sCommand ), std::forward< Args >( args ) ... ) ;
     }
 
+    /** Message of bytes which are serialized already */
+    CSerializedNetMsg MakeRaw( std::string sCommand, std::vector< unsigned char > && vchData ) const
+    {
+        CSerializedNetMsg msg ;
+        msg.command = std::move( sCommand ) ;
+        msg.data = std::move( vchData ) ;
+        return msg ;
+    }
+
 private:
     const int nVersion ;
 } ;
 
+/**
+ * Bounded cache of messages serialized once for all peers, transactions and compact blocks
+ * by their hash and serialization flags. Their serialization must depend on nothing else,
+ * so transactions with witness go through MakeTx
+ */
+class CSharedNetMsgCache
+{
+public:
+    explicit CSharedNetMsgCache( size_t nMaxBytesIn ) : nMaxBytes( nMaxBytesIn ), nBytes( 0 ) {}
+
+    template < typename T >
+    CSharedNetMsg Make( const CNetMsgMaker & maker, int nFlags, const std::string & sCommand, const uint256 & hash, const T & obj )
+    {
+        CSharedNetMsg msg ;
+        if ( ! Find( hash, nFlags, sCommand, msg ) )
+            msg = Insert( hash, nFlags, CSharedNetMsg( maker.Make( nFlags, sCommand, obj ) ) ) ;
+        return msg ;
+    }
+
+    /** Transaction by its txid without witness, and by its wtxid with witness, as txid doesn't cover witness */
+    CSharedNetMsg MakeTx( const CNetMsgMaker & maker, int nFlags, const CTransaction & tx )
+    {
+        const uint256 hash = ( nFlags & SERIALIZE_TRANSACTION_NO_WITNESS ) ? tx.GetTxHash() : tx.GetWitnessHash() ;
+        return Make( maker, nFlags, NetMsgType::TX, hash, tx ) ;
+    }
+
+    bool Find( const uint256 & hash, int nFlags, const std::string & sCommand, CSharedNetMsg & msg ) const
+    {
+        LOCK( cs ) ;
+        auto it = mapMsgs.find( Key( hash, nFlags, sCommand ) ) ;
+        if ( it == mapMsgs.end() )
+            return false ;
+        msg = it->second ;
+        return true ;
+    }
+
+    /** Returns the message cached, which is the one cached before for the same key if any */
+    CSharedNetMsg Insert( const uint256 & hash, int nFlags, CSharedNetMsg && msg )
+    {
+        LOCK( cs ) ;
+        auto ret = mapMsgs.emplace( Key( hash, nFlags, msg.command ), std::move( msg ) ) ;
+        if ( ret.second ) {
+            vOrder.push_back( ret.first ) ;
+            nBytes += Size( ret.first->second ) ;
+            // the oldest go first, but the one just made stays
+            while ( nBytes > nMaxBytes && vOrder.size() > 1 ) {
+                nBytes -= Size( vOrder.front()->second ) ;
+                mapMsgs.erase( vOrder.front() ) ;
+                vOrder.pop_front() ;
+            }
+        }
+        return ret.first->second ;
+    }
+
+    size_t size() const
+    {
+        LOCK( cs ) ;
+        return mapMsgs.size() ;
+    }
+
+private:
+    typedef std::tuple< uint256, int, std::string > Key ;
+
+    static size_t Size( const CSharedNetMsg & msg )
+    {
+        return msg.header->size() + ( msg.data ? msg.data->size() : 0 ) ;
+    }
+
+    const size_t nMaxBytes ;
+    mutable CCriticalSection cs ;
+    std::map< Key, CSharedNetMsg > mapMsgs ;
+    std::deque< std::map< Key, CSharedNetMsg >::iterator > vOrder ;
+    size_t nBytes ;
+} ;
+
 #endif
@@ -93,7 +93,7 @@ uint32_t GetNextWorkRequired( const CBlockIndex * pindexLast, const CBlockHeader
     return bnNew.GetCompact();
 } */
 
-bool CheckProofOfWork( const CBlockHeader & block, unsigned int nBits, const Consensus::Params & params )
+bool CheckProofOfWork( const CBlockHeader & block, unsigned int nBits, const Consensus::Params & params, bool cacheHashes )
 {
     bool fNegative ;
     bool fOverflow ;
@@ -108,12 +108,15 @@ bool CheckProofOfWork( const CBlockHeader & block, unsigned int nBits, const Con
     // Proof that block's hash is not bigger than solution
 
     if ( NameOfChain() == "inu" ) {
-        return ( UintToArith256( block.GetScryptHash() ) <= solutionHash )
-                    && ( UintToArith256( block.GetLyra2Re2Hash() ) <= solutionHash )
-                        && ( UintToArith256( block.GetSha256Hash() ) <= ( solutionHash << 1 ) ) ;
+        // Hashes go from the cheapest to the costliest one: sha256 takes less than a microsecond,
+        // lyra2re2 is about 30 times cheaper than memory-hard scrypt. And the first failed
+        // hash is enough to reject, while sha256 alone rejects nearly every header
+        return ( UintToArith256( block.GetSha256Hash() ) <= ( solutionHash << 1 ) )
+                    && ( UintToArith256( block.GetLyra2Re2Hash( cacheHashes ) ) <= solutionHash )
+                        && ( UintToArith256( block.GetScryptHash( cacheHashes ) ) <= solutionHash ) ;
     }
 
-    return UintToArith256( block.GetScryptHash() ) <= solutionHash ;
+    return UintToArith256( block.GetScryptHash( cacheHashes ) ) <= solutionHash ;
 }
 
 bool CheckAuxProofOfWork( const CAuxPow & auxpow, unsigned int nBits, const Consensus::Params & params )
@@ -19,8 +19,11 @@ class CAuxPow ;
 uint32_t GetNextWorkRequired( const CBlockIndex * pindexLast, const CBlockHeader * pblock, const Consensus::Params & params, bool talkative = false ) ;
 ///uint32_t CalculateNextWorkRequired( const CBlockIndex * pindexLast, int64_t nFirstBlockTime, const Consensus::Params & ) ;
 
-/** Check whether a block header satisfies the proof-of-work requirement specified by nBits */
-bool CheckProofOfWork( const CBlockHeader & block, unsigned int nBits, const Consensus::Params & ) ;
+/**
+ * Check whether a block header satisfies the proof-of-work requirement specified by nBits.
+ * Scanning nonces, hashes aren't worth caching, see CPureBlockHeader::GetScryptHash
+ */
+bool CheckProofOfWork( const CBlockHeader & block, unsigned int nBits, const Consensus::Params &, bool cacheHashes = true ) ;
 bool CheckAuxProofOfWork( const CAuxPow & auxpow, unsigned int nBits, const Consensus::Params & ) ;
 
 #endif
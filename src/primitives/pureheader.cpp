@@ -9,11 +9,18 @@
 #include "chainparams.h"
 #include "crypto/scrypt.h"
 #include "hash.h"
+#include "random.h"
 #include "utilstrencodings.h"
 #include "utiltime.h"
 #include "algo/Lyra2RE.h"
 
+#include <array>
+#include <deque>
+#include <limits>
+#include <mutex>
 #include <sstream>
+#include <string.h>
+#include <unordered_map>
 #include <boost/format.hpp>
 
 void CPureBlockHeader::SetBaseVersion( int32_t nBaseVersion, int32_t nChainId )
@@ -28,17 +35,115 @@ uint256 CPureBlockHeader::GetSha256Hash() const
     return SerializeHash( *this ) ;
 }
 
-uint256 CPureBlockHeader::GetScryptHash() const
+namespace {
+
+/**
+ * Proof-of-work hashes of recently hashed headers, by all 80 bytes of header.
+ * Validation, logging, RPC and GUI each ask for hashes of the same few headers,
+ * and any change of a header's field makes it another key
+ */
+class PowHashCache
+{
+public:
+    typedef std::array< unsigned char, 80 > Key ;
+
+private:
+    /** Salted, as headers come from peers who could otherwise put them all into one bucket */
+    class KeyHasher
+    {
+    private:
+        const uint64_t k0, k1 ;
+
+    public:
+        KeyHasher() :
+            k0( GetRand( std::numeric_limits< uint64_t >::max() ) ),
+            k1( GetRand( std::numeric_limits< uint64_t >::max() ) )
+        { }
+
+        size_t operator()( const Key & key ) const {  return CSipHasher( k0, k1 ).Write( key.data(), key.size() ).Finalize() ;  }
+    } ;
+
+    static const size_t MAX_ENTRIES = 2048 ;
+
+    std::mutex mutex ;
+    std::unordered_map< Key, uint256, KeyHasher > hashes ;
+    std::deque< Key > order ; // oldest first
+
+public:
+    bool Get( const Key & key, uint256 & hash )
+    {
+        std::lock_guard< std::mutex > lock( mutex ) ;
+        auto it = hashes.find( key ) ;
+        if ( it == hashes.end() ) return false ;
+        hash = it->second ;
+        return true ;
+    }
+
+    void Put( const Key & key, const uint256 & hash )
+    {
+        std::lock_guard< std::mutex > lock( mutex ) ;
+        if ( ! hashes.emplace( key, hash ).second ) return ;
+        order.push_back( key ) ;
+        if ( order.size() > MAX_ENTRIES ) {
+            hashes.erase( order.front() ) ;
+            order.pop_front() ;
+        }
+    }
+} ;
+
+// constructed on first use, hashes may be asked for while other globals are initialized
+PowHashCache & ScryptHashes()
+{
+    static PowHashCache cache ;
+    return cache ;
+}
+
+PowHashCache & Lyra2Re2Hashes()
+{
+    static PowHashCache cache ;
+    return cache ;
+}
+
+}
+
+uint256 CPureBlockHeader::GetScryptHash( bool cache ) const
 {
     uint256 hash ;
+    if ( ! cache ) {
+        scrypt_1024_1_1_256( BEGIN(nVersion), BEGIN(hash) ) ;
+        return hash ;
+    }
+
+    PowHashCache::Key key ;
+    memcpy( key.data(), BEGIN(nVersion), key.size() ) ;
+    if ( ScryptHashes().Get( key, hash ) ) return hash ;
+
     scrypt_1024_1_1_256( BEGIN(nVersion), BEGIN(hash) ) ;
+    ScryptHashes().Put( key, hash ) ;
     return hash ;
 }
 
-uint256 CPureBlockHeader::GetLyra2Re2Hash() const
+void CPureBlockHeader::RememberScryptHash( const uint256 & hash ) const
+{
+    PowHashCache::Key key ;
+    memcpy( key.data(), BEGIN(nVersion), key.size() ) ;
+    ScryptHashes().Put( key, hash ) ;
+}
+
+uint256 CPureBlockHeader::GetLyra2Re2Hash( bool cache ) const
 {
     uint256 hash ;
+    if ( ! cache ) {
+        lyra2re2_hash( BEGIN(nVersion), BEGIN(hash) ) ;
+        return hash ;
+    }
+
+    PowHashCache::Key key ;
+    memcpy( key.data(), BEGIN(nVersion), key.size() ) ;
+    if ( Lyra2Re2Hashes().Get( key, hash ) ) return hash ;
+
     lyra2re2_hash( BEGIN(nVersion), BEGIN(hash) ) ;
+    Lyra2Re2Hashes().Put( key, hash ) ;
     return hash ;
 }
 
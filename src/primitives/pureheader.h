@@ -71,9 +71,16 @@ public:
 
     uint256 GetSha256Hash() const ;
 
-    uint256 GetScryptHash() const ;
+    /**
+     * Proof-of-work hashes of recent headers are kept, to hash each header once. Nonces
+     * being scanned are hashed with cache false, not to push out hashes asked for again
+     */
+    uint256 GetScryptHash( bool cache = true ) const ;
+
+    /** Keep the scrypt hash of this header hashed elsewhere, like by scrypt_1024_1_1_256_sp_multi with others */
+    void RememberScryptHash( const uint256 & hash ) const ;
 
-    uint256 GetLyra2Re2Hash() const ;
+    uint256 GetLyra2Re2Hash( bool cache = true ) const ;
 
     int64_t GetBlockTime() const
     {
@@ -455,10 +455,9 @@ void GenerateCoinsPage::updateTipBlockInfo()
                         const CTxOut & vout = prevoutTx->vout[ txin.prevout.n ] ;
                         txValueIn += vout.nValue ;
                     } else {
-                        const CCoins * unspentCoins = coinsView.AccessCoins( txin.prevout.hash ) ;
-                        if ( unspentCoins != nullptr && txin.prevout.n < unspentCoins->vout.size() ) {
-                            const CTxOut & vout = unspentCoins->vout[ txin.prevout.n ] ;
-                            txValueIn += vout.nValue ;
+                        const Coin & unspentCoin = coinsView.AccessCoin( txin.prevout ) ;
+                        if ( ! unspentCoin.IsSpent() ) {
+                            txValueIn += unspentCoin.out.nValue ;
                         } else {
                             feesOk = false ; break ;
                         }
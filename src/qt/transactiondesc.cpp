@@ -356,37 +356,29 @@ QString TransactionDesc::toHTML( CWallet * wallet, CWalletTx & wtx, TransactionR
         {
             // COutPoint txin.prevout is the location of the previous transaction's output that txin claims
             CCoinsViewCache coinsView( pcoinsTip ) ;
-            const CCoins * coins = coinsView.AccessCoins( txin.prevout.hash ) ;
-            if ( coins != nullptr )
+            const Coin & coin = coinsView.AccessCoin( txin.prevout ) ;
+            if ( ! coin.IsSpent() )
             {
-                if ( txin.prevout.n < coins->vout.size() )
+                const CTxOut & vout = coin.out ;
+                unspentInputsHtml += "<li>" ;
+                CTxDestination address ;
+                QString from ;
+                if ( ExtractDestination( vout.scriptPubKey, address ) )
                 {
-                    // std::vector< CTxOut > vout of CCoins are unspent transaction outputs
-                    // spent outputs are .IsNull()
-                    const CTxOut & vout = coins->vout[ txin.prevout.n ] ;
-                    if ( ! vout.IsNull() )
-                    {
-                        unspentInputsHtml += "<li>" ;
-                        CTxDestination address ;
-                        QString from ;
-                        if ( ExtractDestination( vout.scriptPubKey, address ) )
-                        {
-                            if ( wallet->mapAddressBook.count( address ) && ! wallet->mapAddressBook[ address ].name.empty() )
-                                from += GUIUtil::HtmlEscape( wallet->mapAddressBook[ address ].name ) + " " ;
-                            from += QString::fromStdString( CBase58Address( address ).ToString() ) ;
-                        }
-                        if ( from.isEmpty() )
-                            from = "\"" + QString::fromStdString( ScriptToAsmStr( vout.scriptPubKey ) ) + "\"" ;
-                        unspentInputsHtml += from + " " + tr("Amount") + "=" + UnitsOfCoin::formatHtmlWithUnit( unit, vout.nValue ) ;
-                        isminetype isMine = wallet->IsMine( vout ) ;
-                        unspentInputsHtml += " isMine=" + ( isMine & ISMINE_SPENDABLE ? tr("true") : tr("false") ) ;
-                        if ( isMine & ISMINE_ALL )
-                            unspentInputsHtml += " isWatchOnly=" + ( isMine & ISMINE_WATCH_ONLY ? tr("true") : tr("false") ) ;
-                        unspentInputsHtml += "</li>" ;
-
-                        unspentCoinsInInputs = true ;
-                    }
+                    if ( wallet->mapAddressBook.count( address ) && ! wallet->mapAddressBook[ address ].name.empty() )
+                        from += GUIUtil::HtmlEscape( wallet->mapAddressBook[ address ].name ) + " " ;
+                    from += QString::fromStdString( CBase58Address( address ).ToString() ) ;
                 }
+                if ( from.isEmpty() )
+                    from = "\"" + QString::fromStdString( ScriptToAsmStr( vout.scriptPubKey ) ) + "\"" ;
+                unspentInputsHtml += from + " " + tr("Amount") + "=" + UnitsOfCoin::formatHtmlWithUnit( unit, vout.nValue ) ;
+                isminetype isMine = wallet->IsMine( vout ) ;
+                unspentInputsHtml += " isMine=" + ( isMine & ISMINE_SPENDABLE ? tr("true") : tr("false") ) ;
+                if ( isMine & ISMINE_ALL )
+                    unspentInputsHtml += " isWatchOnly=" + ( isMine & ISMINE_WATCH_ONLY ? tr("true") : tr("false") ) ;
+                unspentInputsHtml += "</li>" ;
+
+                unspentCoinsInInputs = true ;
             }
         }
 
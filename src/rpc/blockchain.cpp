@@ -776,6 +776,22 @@ struct CCoinsStats
     CCoinsStats() : nHeight(0), nTransactions(0), nTransactionOutputs(0), nSerializedSize(0), nTotalAmount(0) {}
 } ;
 
+static void ApplyStats( CCoinsStats & stats, CHashWriter & ss, const uint256 & hash, const std::map< uint32_t, Coin > & outputs )
+{
+    assert( ! outputs.empty() ) ;
+    ss << hash ;
+    ss << VARINT( outputs.begin()->second.nHeight * 2 + outputs.begin()->second.fCoinBase ) ;
+    stats.nTransactions ++ ;
+    for ( const auto & output : outputs ) {
+        ss << VARINT( output.first + 1 ) ;
+        ss << *(const CScriptBase*)( &output.second.out.scriptPubKey ) ;
+        ss << VARINT( output.second.out.nValue ) ;
+        stats.nTransactionOutputs ++ ;
+        stats.nTotalAmount += output.second.out.nValue ;
+    }
+    ss << VARINT( 0 ) ;
+}
+
 // Calculate statistics about the unspent transaction output set
 static bool GetUTXOStats( AbstractCoinsView * view, CCoinsStats & stats )
 {
@@ -788,32 +804,29 @@ static bool GetUTXOStats( AbstractCoinsView * view, CCoinsStats & stats )
         stats.nHeight = mapBlockIndex.find(stats.hashBlock)->second->nHeight;
     }
     ss << stats.hashBlock;
-    arith_uint256 nTotalAmount = 0;
+    // coins of one transaction are next to each other in the database
+    uint256 prevkey ;
+    std::map< uint32_t, Coin > outputs ;
     while ( pcursor->Valid() ) {
         if ( ! IsRPCRunning() ) return false ;
-        uint256 key ;
-        CCoins coins ;
-        if ( pcursor->GetKey( key ) && pcursor->GetValue( coins ) ) {
-            stats.nTransactions++;
-            ss << key;
-            for (unsigned int i=0; i<coins.vout.size(); i++) {
-                const CTxOut &out = coins.vout[i];
-                if (!out.IsNull()) {
-                    stats.nTransactionOutputs++;
-                    ss << VARINT(i+1);
-                    ss << out;
-                    nTotalAmount += out.nValue;
-                }
+        COutPoint key ;
+        Coin coin ;
+        if ( pcursor->GetKey( key ) && pcursor->GetValue( coin ) ) {
+            if ( ! outputs.empty() && key.hash != prevkey ) {
+                ApplyStats( stats, ss, prevkey, outputs ) ;
+                outputs.clear() ;
             }
-            stats.nSerializedSize += 32 + pcursor->GetValueSize();
-            ss << VARINT(0);
+            prevkey = key.hash ;
+            outputs[ key.n ] = std::move( coin ) ;
+            stats.nSerializedSize += 32 + pcursor->GetValueSize() ;
         } else {
             return error("%s: unable to read value", __func__);
         }
         pcursor->Next();
     }
+    if ( ! outputs.empty() )
+        ApplyStats( stats, ss, prevkey, outputs ) ;
     stats.hashSerialized = ss.GetHash();
-    stats.nTotalAmount = nTotalAmount;
     return true;
 }
 
@@ -930,7 +943,6 @@ UniValue gettxout(const JSONRPCRequest& request)
             "        ,...\n"
             "     ]\n"
             "  },\n"
-            "  \"version\" : n,            (numeric) the version\n"
             "  \"coinbase\" : true|false   (boolean) coinbase or not\n"
             "}\n"
 
@@ -954,33 +966,31 @@ UniValue gettxout(const JSONRPCRequest& request)
     if (request.params.size() > 2)
         fMempool = request.params[2].get_bool();
 
-    CCoins coins;
-    if (fMempool) {
-        LOCK(mempool.cs);
-        CCoinsViewMemPool view(pcoinsTip, mempool);
-        if (!view.GetCoins(hash, coins))
-            return NullUniValue;
-        mempool.pruneSpent(hash, coins); // TODO: this should be done by the CCoinsViewMemPool
+    COutPoint out( hash, n ) ;
+
+    Coin coin ;
+    if ( fMempool ) {
+        LOCK( mempool.cs ) ;
+        CCoinsViewMemPool view( pcoinsTip, mempool ) ;
+        if ( ! view.GetCoin( out, coin ) || mempool.isSpent( out ) )
+            return NullUniValue ;
     } else {
-        if (!pcoinsTip->GetCoins(hash, coins))
-            return NullUniValue;
+        if ( ! pcoinsTip->GetCoin( out, coin ) )
+            return NullUniValue ;
     }
-    if (n<0 || (unsigned int)n>=coins.vout.size() || coins.vout[n].IsNull())
-        return NullUniValue;
 
     BlockMap::iterator it = mapBlockIndex.find( pcoinsTip->GetSha256OfBestBlock() ) ;
     CBlockIndex *pindex = it->second;
     ret.pushKV( "bestblock", pindex->GetBlockSha256Hash().GetHex() ) ;
-    if ((unsigned int)coins.nHeight == MEMPOOL_HEIGHT)
+    if ( coin.nHeight == MEMPOOL_HEIGHT )
         ret.pushKV( "confirmations", 0 ) ;
     else
-        ret.pushKV( "confirmations", pindex->nHeight - coins.nHeight + 1 ) ;
-    ret.pushKV( "value", ValueFromAmount( coins.vout[ n ].nValue ) ) ;
+        ret.pushKV( "confirmations", (int64_t)( pindex->nHeight - coin.nHeight + 1 ) ) ;
+    ret.pushKV( "value", ValueFromAmount( coin.out.nValue ) ) ;
     UniValue o(UniValue::VOBJ);
-    ScriptPubKeyToJSON(coins.vout[n].scriptPubKey, o, true);
+    ScriptPubKeyToJSON( coin.out.scriptPubKey, o, true ) ;
     ret.pushKV( "scriptPubKey", o ) ;
-    ret.pushKV( "version", coins.nVersion ) ;
-    ret.pushKV( "coinbase", coins.fCoinBase ) ;
+    ret.pushKV( "coinbase", (bool)coin.fCoinBase ) ;
 
     return ret;
 }
@@ -1003,8 +1013,7 @@ UniValue verifychain(const JSONRPCRequest& request)
             + HelpExampleRpc("verifychain", "")
         );
 
-    LOCK(cs_main);
-
+    // VerifyDB takes cs_main when it needs it, blocks are read and checked without it
     if (request.params.size() > 0)
         nCheckLevel = request.params[0].get_int();
     if (request.params.size() > 1)
@@ -1105,6 +1114,13 @@ UniValue getblockchaininfo( const JSONRPCRequest & request )
             "  \"chainwork\": \"xxxx\"     (string) maximum number of hashes to produce the current chain, in hexadecimal\n"
             "  \"pruned\": xx,             (boolean) if the blocks are subject to pruning\n"
             "  \"pruneheight\": xxxxxx,    (numeric) lowest-height complete block stored\n"
+            "  \"verification\": {         (object) the latest verification of databases, at startup or by verifychain\n"
+            "     \"state\": \"xxxx\",       (string) one of \"none\", \"running\", \"passed\", \"failed\", \"stopped\"\n"
+            "     \"level\": xx,            (numeric) how thorough it is, as -checklevel\n"
+            "     \"blocks\": xx,           (numeric) the number of blocks to check\n"
+            "     \"checked\": xx,          (numeric) the number of blocks checked so far\n"
+            "     \"progress\": xx          (numeric) estimate of progress reading and checking blocks [0..1]\n"
+            "  },\n"
             "  \"softforks\": [            (array) status of softforks in progress\n"
             "     {\n"
             "        \"id\": \"xxxx\",        (string) name of softfork\n"
@@ -1166,6 +1182,16 @@ UniValue getblockchaininfo( const JSONRPCRequest & request )
 
         obj.pushKV( "pruneheight", block->nHeight ) ;
     }
+
+    CVerifyDBStatus verifyStatus = GetVerifyDBStatus() ;
+    UniValue verification( UniValue::VOBJ ) ;
+    verification.pushKV( "state",    verifyStatus.strState ) ;
+    verification.pushKV( "level",    verifyStatus.nCheckLevel ) ;
+    verification.pushKV( "blocks",   verifyStatus.nBlocksToCheck ) ;
+    verification.pushKV( "checked",  verifyStatus.nBlocksChecked ) ;
+    verification.pushKV( "progress", verifyStatus.nBlocksToCheck > 0 ? (double)verifyStatus.nBlocksChecked / verifyStatus.nBlocksToCheck : 0.0 ) ;
+    obj.pushKV( "verification", verification ) ;
+
     return obj;
 }
 
@@ -133,7 +133,7 @@ UniValue generateBlocks( std::shared_ptr < CReserveScript > coinbaseScript, int
         int loop = 0 ;
         while ( nMaxTries > 0 && loop < nInnerLoopCount )
         {
-            if ( CheckProofOfWork( blockCandidate->block, blockCandidate->block.nBits, Params().GetConsensus( nHeight ) ) ) {
+            if ( CheckProofOfWork( blockCandidate->block, blockCandidate->block.nBits, Params().GetConsensus( nHeight ), /* cacheHashes */ false ) ) {
                 // found a solution
                 found = true ;
                 break ;
@@ -280,9 +280,9 @@ UniValue gettxoutproof(const JSONRPCRequest& request)
             throw JSONRPCError( RPC_INVALID_ADDRESS_OR_KEY, "Block not found" ) ;
         pblockindex = mapBlockIndex[ hashBlock ] ;
     } else {
-        CCoins coins ;
-        if ( pcoinsTip->GetCoins( oneTxHash, coins ) && coins.nHeight > 0 && coins.nHeight <= chainActive.Height() )
-            pblockindex = chainActive[ coins.nHeight ] ;
+        const Coin & coin = AccessByTxid( *pcoinsTip, oneTxHash ) ;
+        if ( ! coin.IsSpent() && coin.nHeight > 0 && coin.nHeight <= (unsigned int)chainActive.Height() )
+            pblockindex = chainActive[ coin.nHeight ] ;
     }
 
     if ( pblockindex == nullptr )
@@ -691,9 +691,7 @@ UniValue signrawtransaction(const JSONRPCRequest& request)
         view.SetBackend( viewMempool ) ; // temporarily switch cache backend to db+mempool view
 
         for ( const CTxIn & txin : mergedTx.vin ) {
-            const uint256& prevHash = txin.prevout.hash;
-            CCoins coins;
-            view.AccessCoins(prevHash); // this is certainly allowed to fail
+            view.AccessCoin( txin.prevout ) ; // load entries from viewChain into view; can fail
         }
 
         view.SetBackend(viewDummy); // switch back to avoid locking mempool for too long
@@ -748,20 +746,22 @@ UniValue signrawtransaction(const JSONRPCRequest& request)
             CScript scriptPubKey( pkData.begin(), pkData.end() ) ;
 
             {
-                CCoinsModifier coins = view.ModifyCoins(txid);
-                if (coins->IsAvailable(nOut) && coins->vout[nOut].scriptPubKey != scriptPubKey) {
+                COutPoint out( txid, nOut ) ;
+                const Coin & coin = view.AccessCoin( out ) ;
+                if ( ! coin.IsSpent() && coin.out.scriptPubKey != scriptPubKey ) {
                     std::string err( "Previous output scriptPubKey mismatch:\n" ) ;
-                    err = err + ScriptToAsmStr(coins->vout[nOut].scriptPubKey) + "\nvs:\n"+
-                        ScriptToAsmStr(scriptPubKey);
-                    throw JSONRPCError(RPC_DESERIALIZATION_ERROR, err);
+                    err = err + ScriptToAsmStr( coin.out.scriptPubKey ) + "\nvs:\n" +
+                        ScriptToAsmStr( scriptPubKey ) ;
+                    throw JSONRPCError( RPC_DESERIALIZATION_ERROR, err ) ;
                 }
-                if ((unsigned int)nOut >= coins->vout.size())
-                    coins->vout.resize(nOut+1);
-                coins->vout[nOut].scriptPubKey = scriptPubKey;
-                coins->vout[nOut].nValue = 0;
-                if (prevOut.exists("amount")) {
-                    coins->vout[nOut].nValue = AmountFromValue(find_value(prevOut, "amount"));
+                Coin newcoin ;
+                newcoin.out.scriptPubKey = scriptPubKey ;
+                newcoin.out.nValue = 0 ;
+                if ( prevOut.exists( "amount" ) ) {
+                    newcoin.out.nValue = AmountFromValue( find_value( prevOut, "amount" ) ) ;
                 }
+                newcoin.nHeight = 1 ;
+                view.AddCoin( out, std::move( newcoin ), true ) ;
             }
 
             // if redeemScript given and not using the local wallet (private keys
@@ -817,13 +817,13 @@ UniValue signrawtransaction(const JSONRPCRequest& request)
     // Sign what we can:
     for (unsigned int i = 0; i < mergedTx.vin.size(); i++) {
         CTxIn& txin = mergedTx.vin[i];
-        const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-        if (coins == NULL || !coins->IsAvailable(txin.prevout.n)) {
+        const Coin& coin = view.AccessCoin(txin.prevout);
+        if (coin.IsSpent()) {
             TxInErrorToJSON(txin, vErrors, "Input not found or already spent");
             continue;
         }
-        const CScript& prevPubKey = coins->vout[txin.prevout.n].scriptPubKey;
-        const CAmount& amount = coins->vout[txin.prevout.n].nValue;
+        const CScript& prevPubKey = coin.out.scriptPubKey;
+        const CAmount& amount = coin.out.nValue;
 
         SignatureData sigdata;
         // Only sign SIGHASH_SINGLE if there's a corresponding output:
@@ -890,9 +890,12 @@ UniValue sendrawtransaction(const JSONRPCRequest& request)
     bool fLimitFree = false ;
 
     CCoinsViewCache &view = *pcoinsTip;
-    const CCoins* existingCoins = view.AccessCoins(hashTx);
+    bool fHaveChain = false;
+    for (size_t o = 0; !fHaveChain && o < tx->vout.size(); o++) {
+        const Coin& existingCoin = view.AccessCoin(COutPoint(hashTx, o));
+        fHaveChain = !existingCoin.IsSpent();
+    }
     bool fHaveMempool = mempool.exists(hashTx);
-    bool fHaveChain = existingCoins && existingCoins->nHeight < 1000000000;
     if (!fHaveMempool && !fHaveChain) {
         // push to local node and sync with wallets
         CValidationState state;
@@ -139,6 +139,52 @@ private:
     size_t nPos;
 };
 
+/**
+ * Minimal stream reading serialized data from memory owned by someone else,
+ * like a mapped file, with no copy of the data into a stream of its own
+ */
+class CMemoryReader
+{
+private:
+    const int nType ;
+    const int nVersion ;
+    const char * pbegin ;
+    const char * pend ;
+
+public:
+    CMemoryReader( int nTypeIn, int nVersionIn, const char * pbeginIn, const char * pendIn )
+        : nType( nTypeIn ), nVersion( nVersionIn ), pbegin( pbeginIn ), pend( pendIn ) {}
+
+    template < typename T >
+    CMemoryReader & operator>>( T & obj )
+    {
+        ::Unserialize( *this, obj ) ;
+        return *this ;
+    }
+
+    void read( char * pch, size_t nSize )
+    {
+        if ( nSize > size() )
+            throw std::ios_base::failure( "CMemoryReader::read(): end of data" ) ;
+        memcpy( pch, pbegin, nSize ) ;
+        pbegin += nSize ;
+    }
+
+    void skip( size_t nSize )
+    {
+        if ( nSize > size() )
+            throw std::ios_base::failure( "CMemoryReader::skip(): end of data" ) ;
+        pbegin += nSize ;
+    }
+
+    size_t size() const {  return pend - pbegin ;  }
+    bool empty() const {  return pbegin == pend ;  }
+    const char * data() const {  return pbegin ;  }
+
+    int GetType() const {  return nType ;  }
+    int GetVersion() const {  return nVersion ;  }
+} ;
+
 /** Double ended buffer combining vector and stream-like interfaces
  *
  * >> and << read and write unformatted data using the above serialization templates.
@@ -3,6 +3,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php
 
 #include "auxpow.h"
+#include "auxpowcache.h"
 #include "chainparams.h"
 #include "coins.h"
 #include "consensus/merkle.h"
@@ -441,4 +442,41 @@ BOOST_AUTO_TEST_CASE(auxpow_pow)
 
 /* ************************************************************************** */
 
+BOOST_AUTO_TEST_CASE(auxpow_cache)
+{
+    CAuxpowBuilder builder(5, 42);
+    builder.setCoinbase(CScript() << OP_TRUE);
+    std::shared_ptr<CAuxPow> auxpow(new CAuxPow(builder.get()));
+    const uint256 hash1 = ArithToUint256(arith_uint256(1));
+    const uint256 hash2 = ArithToUint256(arith_uint256(2));
+    const uint256 hash3 = ArithToUint256(arith_uint256(3));
+
+    CAuxpowCache cache;
+    BOOST_CHECK(cache.Get(hash1) == nullptr);
+    cache.Put(hash1, auxpow);
+    BOOST_CHECK(cache.Get(hash1) == auxpow);
+    const size_t nEntryUsage = cache.GetUsage();
+    BOOST_CHECK(nEntryUsage > 0);
+
+    /* Putting it again doesn't count it twice */
+    cache.Put(hash1, auxpow);
+    BOOST_CHECK_EQUAL(cache.GetUsage(), nEntryUsage);
+
+    /* With room for two entries, the least recently used one goes away */
+    cache.SetMaxUsage(2 * nEntryUsage);
+    cache.Put(hash2, auxpow);
+    BOOST_CHECK(cache.Get(hash1) == auxpow);
+    cache.Put(hash3, auxpow);
+    BOOST_CHECK_EQUAL(cache.GetCount(), 2U);
+    BOOST_CHECK(cache.Get(hash1) == auxpow);
+    BOOST_CHECK(cache.Get(hash2) == nullptr);
+    BOOST_CHECK(cache.Get(hash3) == auxpow);
+
+    cache.SetMaxUsage(0);
+    BOOST_CHECK_EQUAL(cache.GetCount(), 0U);
+    BOOST_CHECK_EQUAL(cache.GetUsage(), 0U);
+}
+
+/* ************************************************************************** */
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -317,6 +317,110 @@ BOOST_AUTO_TEST_CASE(EmptyBlockRoundTripTest)
     }
 }
 
+BOOST_AUTO_TEST_CASE( BigMempoolRoundTripTest )
+{
+    // short IDs of a mempool this big are looked up on several threads
+    CTxMemPool pool ;
+    TestMemPoolEntryHelper entry ;
+    CMutableTransaction tx ;
+    tx.vin.resize( 1 ) ;
+    tx.vin[ 0 ].scriptSig.resize( 10 ) ;
+    tx.vout.resize( 1 ) ;
+    tx.vout[ 0 ].nValue = 42 ;
+
+    CBlock block ;
+    block.vtx.push_back( MakeTransactionRef( tx ) ) ;
+    for ( size_t i = 0 ; i < 10000 ; i ++ ) {
+        tx.vin[ 0 ].prevout.hash = GetRandHash() ;
+        CTransactionRef ptx = MakeTransactionRef( tx ) ;
+        pool.addUnchecked( ptx->GetTxHash(), entry.FromTx( *ptx ) ) ;
+        if ( i % 50 == 7 )
+            block.vtx.push_back( ptx ) ;
+    }
+    tx.vin[ 0 ].prevout.hash = GetRandHash() ;
+    block.vtx.push_back( MakeTransactionRef( tx ) ) ;    // not in mempool
+
+    block.nVersion = 1 ;
+    block.hashPrevBlock = GetRandHash() ;
+    block.nBits = 0x207fffff ;
+    bool mutated ;
+    block.hashMerkleRoot = BlockMerkleRoot( block, &mutated ) ;
+    assert( ! mutated ) ;
+    while ( ! CheckProofOfWork( block, block.nBits, Params().GetConsensus(0) ) ) ++ block.nNonce ;
+
+    CBlockHeaderAndShortTxIDs shortIDs( block, true ) ;
+    CDataStream stream( SER_NETWORK, PROTOCOL_VERSION ) ;
+    stream << shortIDs ;
+    CBlockHeaderAndShortTxIDs shortIDs2 ;
+    stream >> shortIDs2 ;
+
+    PartiallyDownloadedBlock partialBlock( &pool ) ;
+    BOOST_CHECK( partialBlock.InitData( shortIDs2, extra_txn ) == READ_STATUS_OK ) ;
+    for ( size_t i = 0 ; i + 1 < block.vtx.size() ; i ++ )
+        BOOST_CHECK( partialBlock.IsTxAvailable( i ) ) ;
+    BOOST_CHECK( ! partialBlock.IsTxAvailable( block.vtx.size() - 1 ) ) ;
+
+    CBlock block2 ;
+    BOOST_CHECK( partialBlock.FillBlock( block2, { block.vtx.back() } ) == READ_STATUS_OK ) ;
+    BOOST_CHECK_EQUAL( block.GetSha256Hash().ToString(), block2.GetSha256Hash().ToString() ) ;
+    BOOST_CHECK_EQUAL( block.hashMerkleRoot.ToString(), BlockMerkleRoot( block2, &mutated ).ToString() ) ;
+    BOOST_CHECK( ! mutated ) ;
+}
+
+BOOST_AUTO_TEST_CASE( ShortIdCollisionRoundTripTest )
+{
+    // every short ID has a match in the first chunk of the mempool, one of them also in the last chunk
+    CTxMemPool pool ;
+    TestMemPoolEntryHelper entry ;
+    CMutableTransaction tx ;
+    tx.vin.resize( 1 ) ;
+    tx.vin[ 0 ].scriptSig.resize( 10 ) ;
+    tx.vout.resize( 1 ) ;
+    tx.vout[ 0 ].nValue = 42 ;
+
+    CBlock block ;
+    block.vtx.push_back( MakeTransactionRef( tx ) ) ;
+    for ( size_t i = 0 ; i < 12000 ; i ++ ) {
+        tx.vin[ 0 ].prevout.hash = GetRandHash() ;
+        CTransactionRef ptx = MakeTransactionRef( tx ) ;
+        pool.addUnchecked( ptx->GetTxHash(), entry.FromTx( *ptx ) ) ;
+        if ( i < 2000 && i % 50 == 7 )
+            block.vtx.push_back( ptx ) ;
+    }
+
+    block.nVersion = 1 ;
+    block.hashPrevBlock = GetRandHash() ;
+    block.nBits = 0x207fffff ;
+    bool mutated ;
+    block.hashMerkleRoot = BlockMerkleRoot( block, &mutated ) ;
+    assert( ! mutated ) ;
+    while ( ! CheckProofOfWork( block, block.nBits, Params().GetConsensus(0) ) ) ++ block.nNonce ;
+
+    CBlockHeaderAndShortTxIDs shortIDs( block, true ) ;
+
+    // the last mempool entry gets the hash of the first transaction of the block which is
+    // in mempool, so the short ID of that transaction has a second match, another transaction
+    const size_t nCollided = 1 ;
+    LOCK( pool.cs ) ;
+    BOOST_CHECK( pool.vTxHashes[ 7 ].first == block.vtx[ nCollided ]->GetWitnessHash() ) ;
+    const uint256 hashLast = pool.vTxHashes.back().first ;
+    pool.vTxHashes.back().first = block.vtx[ nCollided ]->GetWitnessHash() ;
+
+    PartiallyDownloadedBlock partialBlock( &pool ) ;
+    BOOST_CHECK( partialBlock.InitData( shortIDs, extra_txn ) == READ_STATUS_OK ) ;
+    pool.vTxHashes.back().first = hashLast ;
+    BOOST_CHECK( ! partialBlock.IsTxAvailable( nCollided ) ) ;
+    for ( size_t i = 0 ; i < block.vtx.size() ; i ++ )
+        if ( i != nCollided )
+            BOOST_CHECK( partialBlock.IsTxAvailable( i ) ) ;
+
+    CBlock block2 ;
+    BOOST_CHECK( partialBlock.FillBlock( block2, { block.vtx[ nCollided ] } ) == READ_STATUS_OK ) ;
+    BOOST_CHECK_EQUAL( block.GetSha256Hash().ToString(), block2.GetSha256Hash().ToString() ) ;
+    BOOST_CHECK_EQUAL( block.hashMerkleRoot.ToString(), BlockMerkleRoot( block2, &mutated ).ToString() ) ;
+    BOOST_CHECK( ! mutated ) ;
+}
+
 BOOST_AUTO_TEST_CASE(TransactionsRequestSerializationTest) {
     BlockTransactionsRequest req1;
     req1.blockhash = GetRandHash();
@@ -128,6 +128,15 @@ BOOST_AUTO_TEST_CASE(siphash)
     tx.nVersion = 1;
     ss << tx;
     BOOST_CHECK_EQUAL(SipHashUint256(1, 2, ss.GetHash()), 0x79751e980c2a0a35ULL);
+
+    // SipHashUint256Extra is the same as hashing uint256 and then 4 more bytes
+    uint256 val = ss.GetHash();
+    for (uint32_t extra : {0u, 1u, 0x12345678u, 0xffffffffu}) {
+        CSipHasher hasher4(1, 2);
+        unsigned char extraBytes[4] = {(unsigned char)extra, (unsigned char)(extra >> 8), (unsigned char)(extra >> 16), (unsigned char)(extra >> 24)};
+        hasher4.Write(val.begin(), 32).Write(extraBytes, 4);
+        BOOST_CHECK_EQUAL(SipHashUint256Extra(1, 2, val, extra), hasher4.Finalize());
+    }
 }
 
 BOOST_AUTO_TEST_SUITE_END()
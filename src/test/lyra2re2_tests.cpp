@@ -0,0 +1,51 @@
+// Copyright (c) 2020 The Dogecoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php
+
+#include <boost/test/unit_test.hpp>
+
+#include "algo/Lyra2RE.h"
+#include "uint256.h"
+#include "utilstrencodings.h"
+
+#include <thread>
+
+BOOST_AUTO_TEST_SUITE(lyra2re2_tests)
+
+#define HASHCOUNT 3
+static const char* inputhex[HASHCOUNT] = { "020000004c1271c211717198227392b029a64a7971931d351b387bb80db027f270411e398a07046f7d4a08dd815412a8712f874a7ebf0507e3878bd24e20a3b73fd750a667d2f451eac7471b00de6659", "0200000011503ee6a855e900c00cfdd98f5f55fffeaee9b6bf55bea9b852d9de2ce35828e204eef76acfd36949ae56d1fbe81c1ac9c0209e6331ad56414f9072506a77f8c6faf551eac7471b00389d01", "010000007824bc3a8a1b4628485eee3024abd8626721f7f870f8ad4d2f33a27155167f6a4009d1285049603888fe85a84b6c803a53305a8d497965a5e896e1a00568359589faf551eac7471b0065434e" };
+static const char* expected[HASHCOUNT] = { "ae16465df6994b673150f3020df485df79c9049d29a0d5ea39ffde6da5e44538", "bc036832eb70eb55e57a4084f0fdc1df735424684cb5afb835bab564e53247fb", "6bab27b41ce1e6dcfd09b634ef6ab8cc478091d4acd2618a573a31b30a412446" };
+
+BOOST_AUTO_TEST_CASE(lyra2re2_hashtest)
+{
+    // Test Lyra2REv2 hash with known inputs against expected outputs
+    uint256 hash;
+    for (int i = 0; i < HASHCOUNT; i++) {
+        std::vector<unsigned char> inputbytes = ParseHex(inputhex[i]);
+        lyra2re2_hash((const char*)&inputbytes[0], BEGIN(hash));
+        BOOST_CHECK_EQUAL(hash.ToString(), expected[i]);
+        // The Lyra2 matrix left by the previous hash doesn't change the next one
+        lyra2re2_hash((const char*)&inputbytes[0], BEGIN(hash));
+        BOOST_CHECK_EQUAL(hash.ToString(), expected[i]);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(lyra2re2_threads_test)
+{
+    // Every thread hashes with a Lyra2 matrix of its own
+    uint256 hashes[HASHCOUNT];
+    std::vector<std::thread> threads;
+    for (int i = 0; i < HASHCOUNT; i++) {
+        threads.emplace_back([i, &hashes]() {
+            std::vector<unsigned char> inputbytes = ParseHex(inputhex[i]);
+            for (int n = 0; n < 100; n++)
+                lyra2re2_hash((const char*)&inputbytes[0], BEGIN(hashes[i]));
+        });
+    }
+    for (std::thread& t : threads)
+        t.join();
+    for (int i = 0; i < HASHCOUNT; i++)
+        BOOST_CHECK_EQUAL(hashes[i].ToString(), expected[i]);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
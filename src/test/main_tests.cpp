@@ -2,12 +2,21 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "blockfilemap.h"
 #include "chainparams.h"
+#include "consensus/validation.h"
+#include "key.h"
 #include "validation.h"
 #include "net.h"
+#include "pow.h"
+#include "script/interpreter.h"
+#include "streams.h"
+#include "txdb.h"
+#include "util.h"
 
 #include "test/test_dogecoin.h"
 
+#include <boost/filesystem/operations.hpp>
 #include <boost/signals2/signal.hpp>
 #include <boost/test/unit_test.hpp>
 
@@ -77,4 +86,379 @@ BOOST_AUTO_TEST_CASE(test_combiner_all)
     Test.disconnect(&ReturnTrue);
     BOOST_CHECK(Test());
 }
+
+BOOST_FIXTURE_TEST_CASE(block_pow_checked_test, TestChain240Setup)
+{
+    const Consensus::Params& params = Params().GetConsensus(0);
+    CBlockIndex* pindexGenesis = chainActive.Genesis();
+    CBlockIndex* pindexTip = chainActive.Tip();
+
+    // Accepted blocks have their proof of work checked once
+    BOOST_CHECK(pindexTip->nStatus & BLOCK_POW_CHECKED);
+
+    // Reading a block stored without the flag checks its proof of work and sets the flag
+    {
+        LOCK(cs_main);
+        pindexGenesis->nStatus &= ~BLOCK_POW_CHECKED;
+    }
+    CBlock block;
+    BOOST_CHECK(ReadBlockFromDisk(block, pindexGenesis, params));
+    BOOST_CHECK(block.GetSha256Hash() == pindexGenesis->GetBlockSha256Hash());
+    BOOST_CHECK(pindexGenesis->nStatus & BLOCK_POW_CHECKED);
+
+    BOOST_CHECK(ReadBlockFromDisk(block, pindexTip, params));
+    BOOST_CHECK(block.GetSha256Hash() == pindexTip->GetBlockSha256Hash());
+    CBlockHeader header;
+    BOOST_CHECK(ReadBlockHeaderFromDisk(header, pindexTip, params));
+    BOOST_CHECK(header.GetSha256Hash() == pindexTip->GetBlockSha256Hash());
+}
+
+BOOST_FIXTURE_TEST_CASE(process_new_block_headers_test, TestChain240Setup)
+{
+    const CChainParams& chainparams = Params();
+    const Consensus::Params& params = chainparams.GetConsensus(0);
+    const CBlockIndex* pindexTip = chainActive.Tip();
+
+    // A batch of headers on top of the tip, proof of work of them is checked by the pool
+    std::vector<CBlockHeader> headers;
+    uint256 hashPrev = pindexTip->GetBlockSha256Hash();
+    for (int i = 0; i < 40; i++) {
+        CBlockHeader header;
+        header.nVersion = pindexTip->nVersion;
+        header.hashPrevBlock = hashPrev;
+        header.hashMerkleRoot = uint256S(strprintf("%x", i + 1));
+        header.nTime = pindexTip->nTime + i + 1;
+        header.nBits = pindexTip->nBits;
+        while (!CheckProofOfWork(header, header.nBits, params)) ++header.nNonce;
+        headers.push_back(header);
+        hashPrev = header.GetSha256Hash();
+    }
+
+    std::vector<CBlockHeader> batch(headers.begin(), headers.begin() + 20);
+    CValidationState state;
+    const CBlockIndex* pindexLast = NULL;
+    BOOST_CHECK(ProcessNewBlockHeaders(batch, state, chainparams, &pindexLast));
+    BOOST_CHECK(pindexLast != NULL && pindexLast->GetBlockSha256Hash() == batch.back().GetSha256Hash());
+
+    // Known headers followed by new ones
+    BOOST_CHECK(ProcessNewBlockHeaders(headers, state, chainparams, &pindexLast));
+    BOOST_CHECK(pindexLast != NULL && pindexLast->GetBlockSha256Hash() == headers.back().GetSha256Hash());
+
+    // A header failing proof of work is rejected as it was before, headers in front of it are accepted
+    std::vector<CBlockHeader> branch;
+    hashPrev = pindexTip->GetBlockSha256Hash();
+    for (int i = 0; i < 10; i++) {
+        CBlockHeader header;
+        header.nVersion = pindexTip->nVersion;
+        header.hashPrevBlock = hashPrev;
+        header.hashMerkleRoot = uint256S(strprintf("%x", i + 100));
+        header.nTime = pindexTip->nTime + i + 1;
+        header.nBits = pindexTip->nBits;
+        if (i == 6) {
+            while (CheckProofOfWork(header, header.nBits, params)) ++header.nNonce;
+        } else {
+            while (!CheckProofOfWork(header, header.nBits, params)) ++header.nNonce;
+        }
+        branch.push_back(header);
+        hashPrev = header.GetSha256Hash();
+    }
+    CValidationState stateBad;
+    BOOST_CHECK(!ProcessNewBlockHeaders(branch, stateBad, chainparams, &pindexLast));
+    BOOST_CHECK_EQUAL(stateBad.GetRejectReason(), "high-hash");
+    int nDoS = 0;
+    BOOST_CHECK(stateBad.IsInvalid(nDoS) && nDoS == 10);
+    LOCK(cs_main);
+    BOOST_CHECK(mapBlockIndex.count(branch[5].GetSha256Hash()) == 1);
+    BOOST_CHECK(mapBlockIndex.count(branch[6].GetSha256Hash()) == 0);
+}
+
+BOOST_FIXTURE_TEST_CASE(reconnect_blocks_read_ahead_test, TestChain240Setup)
+{
+    const CChainParams& chainparams = Params();
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+
+    // A block spending a coinbase, with a few blocks on top of it
+    CMutableTransaction spend;
+    spend.nVersion = 1;
+    spend.vin.resize(1);
+    spend.vin[0].prevout = COutPoint(coinbaseTxns[0].GetTxHash(), 0);
+    spend.vout.resize(1);
+    spend.vout[0].nValue = 11000111;
+    spend.vout[0].scriptPubKey = scriptPubKey;
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(scriptPubKey, spend, 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+    BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    spend.vin[0].scriptSig << vchSig;
+
+    CBlock blockSpending = CreateAndProcessBlock({ spend }, scriptPubKey);
+    BOOST_CHECK(chainActive.Tip()->GetBlockSha256Hash() == blockSpending.GetSha256Hash());
+    for (int i = 0; i < 5; i++)
+        CreateAndProcessBlock({}, scriptPubKey);
+    CBlockIndex* pindexTip = chainActive.Tip();
+    CBlockIndex* pindexFirst = chainActive[chainActive.Height() - 20];
+
+    // Blocks connected again aren't in memory, those after the first one are read
+    // ahead. The second time coins they spend are read from the database too
+    for (int i = 0; i < 2; i++) {
+        CValidationState state;
+        {
+            LOCK(cs_main);
+            BOOST_CHECK(InvalidateBlock(state, chainparams, pindexFirst));
+            BOOST_CHECK(chainActive.Tip() == pindexFirst->pprev);
+            BOOST_CHECK(ResetBlockFailureFlags(pindexFirst));
+        }
+        if (i == 1)
+            FlushStateToDisk();
+        uint64_t nReadAhead = GetBlocksReadAhead();
+        BOOST_CHECK(ActivateBestChain(state, chainparams));
+        BOOST_CHECK(chainActive.Tip() == pindexTip);
+        BOOST_CHECK(GetBlocksReadAhead() > nReadAhead);
+
+        LOCK(cs_main);
+        BOOST_CHECK(pcoinsTip->GetSha256OfBestBlock() == pindexTip->GetBlockSha256Hash());
+        BOOST_CHECK(!pcoinsTip->HaveCoin(spend.vin[0].prevout));
+        BOOST_CHECK(pcoinsTip->HaveCoin(COutPoint(spend.GetTxHash(), 0)));
+        BOOST_CHECK_EQUAL(mempool.size(), 0);
+    }
+}
+
+BOOST_FIXTURE_TEST_CASE(read_block_mapped_test, TestChain240Setup)
+{
+    const Consensus::Params& params = Params().GetConsensus(0);
+
+    // Blocks are read from mappings of block files, the same as read from the files
+    for (CBlockIndex* pindex : { chainActive.Genesis(), chainActive[120], chainActive.Tip() }) {
+        CBlock block;
+        BOOST_CHECK(ReadBlockFromDisk(block, pindex, params));
+
+        CBlock blockFromFile;
+        CAutoFile filein(OpenBlockFile(pindex->GetBlockPos(), true), SER_DISK, PEER_VERSION);
+        BOOST_REQUIRE(!filein.isNull());
+        filein >> blockFromFile;
+        BOOST_CHECK(block.GetSha256Hash() == blockFromFile.GetSha256Hash());
+        BOOST_CHECK(block.vtx.size() == blockFromFile.vtx.size());
+        BOOST_CHECK(block.vtx[0]->GetTxHash() == blockFromFile.vtx[0]->GetTxHash());
+
+        const char* pbegin = nullptr;
+        const char* pend = nullptr;
+        std::shared_ptr<const CMappedFile> mapped = MapDiskRecord(pindex->GetBlockPos(), "blk", 0, pbegin, pend);
+        BOOST_REQUIRE(mapped != nullptr);
+        BOOST_CHECK_EQUAL((size_t)(pend - pbegin), ::GetSerializeSize(block, SER_DISK, PEER_VERSION));
+    }
+    BOOST_CHECK(blockFileMapper.GetCount() > 0);
+
+    // Too short memory fails to deserialize like a too short file does
+    const char* pbegin = nullptr;
+    const char* pend = nullptr;
+    std::shared_ptr<const CMappedFile> mapped = MapDiskRecord(chainActive.Tip()->GetBlockPos(), "blk", 0, pbegin, pend);
+    BOOST_REQUIRE(mapped != nullptr);
+    CMemoryReader reader(SER_DISK, PEER_VERSION, pbegin, pend - 1);
+    CBlock block;
+    BOOST_CHECK_THROW(reader >> block, std::ios_base::failure);
+
+    // Blocks written after the file was mapped are read too
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CBlock blockNew = CreateAndProcessBlock({}, scriptPubKey);
+    BOOST_CHECK(ReadBlockFromDisk(block, chainActive.Tip(), params));
+    BOOST_CHECK(block.GetSha256Hash() == blockNew.GetSha256Hash());
+}
+
+BOOST_FIXTURE_TEST_CASE(read_raw_block_test, TestChain240Setup)
+{
+    const Consensus::Params& params = Params().GetConsensus(0);
+
+    // Bytes of blocks for peers are the same as serialized blocks, with and without witness
+    for (CBlockIndex* pindex : { chainActive.Genesis(), chainActive[120], chainActive.Tip() }) {
+        CBlock block;
+        BOOST_CHECK(ReadBlockFromDisk(block, pindex, params));
+        for (bool fWitness : { true, false }) {
+            std::vector<unsigned char> vchExpected;
+            CVectorWriter(SER_NETWORK, PEER_VERSION | (fWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS), vchExpected, 0, block);
+            // mapped when proof of work was checked, else through the block
+            for (bool fPowChecked : { true, false }) {
+                std::vector<unsigned char> vchBlock;
+                BOOST_CHECK(ReadRawBlockFromDisk(vchBlock, pindex->GetBlockPos(), pindex->GetBlockSha256Hash(), fPowChecked, fWitness, params));
+                BOOST_CHECK(vchBlock == vchExpected);
+            }
+        }
+        // and not when the hash isn't of the block at the position
+        std::vector<unsigned char> vchBlock;
+        BOOST_CHECK(!ReadRawBlockFromDisk(vchBlock, pindex->GetBlockPos(), uint256S("0xbad"), true, true, params));
+    }
+}
+
+BOOST_FIXTURE_TEST_CASE(verify_db_test, TestChain240Setup)
+{
+    // Blocks are read and checked on threads, then reconnected at the tip
+    BOOST_CHECK(WVerifyDB().VerifyDB(Params(), pcoinsTip, 4, 100));
+    CVerifyDBStatus status = GetVerifyDBStatus();
+    BOOST_CHECK_EQUAL(status.strState, "passed");
+    BOOST_CHECK_EQUAL(status.nCheckLevel, 4);
+    BOOST_CHECK_EQUAL(status.nBlocksToCheck, 100);
+    BOOST_CHECK_EQUAL(status.nBlocksChecked, 100);
+
+    // All blocks but genesis
+    BOOST_CHECK(WVerifyDB().VerifyDB(Params(), pcoinsTip, 2, 0));
+    status = GetVerifyDBStatus();
+    BOOST_CHECK_EQUAL(status.strState, "passed");
+    BOOST_CHECK_EQUAL(status.nBlocksToCheck, chainActive.Height());
+    BOOST_CHECK_EQUAL(status.nBlocksChecked, chainActive.Height());
+}
+
+typedef std::map<uint256, std::unique_ptr<CBlockIndex>> TestBlockMap;
+
+static std::vector<CBlockIndex*> LoadTestBlockIndex(CBlockTreeDB& db, TestBlockMap& blocks)
+{
+    blocks.clear();
+    auto insert = [&blocks](const uint256& hash) -> CBlockIndex* {
+        if (hash.IsNull()) return nullptr;
+        std::unique_ptr<CBlockIndex>& pindex = blocks[hash];
+        if (!pindex) {
+            pindex.reset(new CBlockIndex());
+            pindex->SetBlockSha256Hash(blocks.find(hash)->first);
+        }
+        return pindex.get();
+    };
+    std::atomic<bool> running(true);
+    std::vector<CBlockIndex*> vOrdered;
+    BOOST_CHECK(db.LoadBlockIndexGuts(insert, running, vOrdered));
+    return vOrdered;
+}
+
+BOOST_AUTO_TEST_CASE(block_index_snapshot_test)
+{
+    // a chain of 30 blocks with a fork of 10 blocks from the 20th
+    TestBlockMap blocks;
+    std::vector<CBlockIndex*> vBlocks;
+    for (int i = 0; i < 40; i++) {
+        std::unique_ptr<CBlockIndex> pindex(new CBlockIndex());
+        pindex->pprev = (i == 0) ? nullptr : (i == 30) ? vBlocks[19] : vBlocks[i - 1];
+        pindex->nHeight = pindex->pprev ? pindex->pprev->nHeight + 1 : 0;
+        pindex->nVersion = 4;
+        pindex->nTime = 1000 + i;
+        pindex->nNonce = i;
+        pindex->nBlockTx = i + 1;
+        pindex->nStatus = BLOCK_VALID_TREE;
+        uint256 hash = CDiskBlockIndex(pindex.get()).GetBlockSha256Hash();
+        auto it = blocks.insert(std::make_pair(hash, std::move(pindex))).first;
+        it->second->SetBlockSha256Hash(it->first);
+        vBlocks.push_back(it->second.get());
+    }
+
+    {
+        CBlockTreeDB db(1 << 20, false, true);
+        // children may come before parents
+        std::vector<CBlockIndex*> vFirst(vBlocks.rbegin() + 10, vBlocks.rend());
+        BOOST_CHECK(db.WriteBatchSync({}, 0, vFirst));
+        for (CBlockIndex* pindex : vBlocks)
+            pindex->nStatus |= BLOCK_VALID_TRANSACTIONS;
+        BOOST_CHECK(db.WriteBatchSync({}, 0, vBlocks));
+    }
+
+    // Loaded from the snapshot, the same blocks with their latest records, parents first
+    {
+        CBlockTreeDB db(1 << 20, false, false);
+        TestBlockMap loaded;
+        std::vector<CBlockIndex*> vOrdered = LoadTestBlockIndex(db, loaded);
+        BOOST_CHECK_EQUAL(vOrdered.size(), vBlocks.size());
+        BOOST_CHECK_EQUAL(loaded.size(), vBlocks.size());
+        for (size_t i = 0; i < vOrdered.size(); i++) {
+            const CBlockIndex* pindex = vOrdered[i];
+            BOOST_CHECK(pindex->pprev == nullptr || pindex->pprev->nSnapshotSlot < pindex->nSnapshotSlot);
+            const CBlockIndex* pexpected = blocks.at(pindex->GetBlockSha256Hash()).get();
+            BOOST_CHECK_EQUAL(pindex->nHeight, pexpected->nHeight);
+            BOOST_CHECK_EQUAL(pindex->nStatus, pexpected->nStatus);
+            BOOST_CHECK_EQUAL(pindex->nBlockTx, pexpected->nBlockTx);
+            BOOST_CHECK_EQUAL(pindex->nTime, pexpected->nTime);
+            BOOST_CHECK(pindex->pprev == nullptr ? pexpected->pprev == nullptr
+                        : pindex->pprev->GetBlockSha256Hash() == pexpected->pprev->GetBlockSha256Hash());
+        }
+    }
+
+    // A record which doesn't match its checksum isn't loaded, the database is
+    {
+        boost::filesystem::path path = GetDirForData() / "blocks" / "indexsnapshot.dat";
+        {
+            // nTime of the 4th record, after the 16 bytes of header and 120 bytes of each record before
+            CAutoFile file(fopen(path.string().c_str(), "rb+"), SER_DISK, PEER_VERSION);
+            BOOST_REQUIRE(!file.isNull());
+            BOOST_CHECK(fseek(file.get(), 16 + 3 * 120 + 100, SEEK_SET) == 0);
+            file << (uint32_t)4321;
+        }
+        CBlockTreeDB db(1 << 20, false, false);
+        TestBlockMap loaded;
+        std::vector<CBlockIndex*> vOrdered = LoadTestBlockIndex(db, loaded);
+        BOOST_CHECK(vOrdered.empty());
+        BOOST_CHECK_EQUAL(loaded.size(), vBlocks.size());
+
+        // written again, and kept when only block files change
+        BOOST_CHECK(db.WriteIndexSnapshot(vBlocks));
+        CBlockFileInfo info;
+        info.AddBlock(39, 1039);
+        BOOST_CHECK(db.WriteBatchSync({ std::make_pair(0, &info) }, 0, {}));
+        vOrdered = LoadTestBlockIndex(db, loaded);
+        BOOST_CHECK_EQUAL(vOrdered.size(), vBlocks.size());
+    }
+
+    // A snapshot left behind by a version which writes blocks and block files without it isn't loaded
+    {
+        CBlockTreeDB db(1 << 20, false, false);
+        vBlocks[5]->nStatus |= BLOCK_FAILED_VALID;
+        CBlockFileInfo info;
+        info.AddBlock(40, 1040);
+        CDBBatch batch(db);
+        batch.Write(std::make_pair('f', 0), info);
+        batch.Write('l', 0);
+        batch.Write(std::make_pair('b', vBlocks[5]->GetBlockSha256Hash()), CDiskBlockIndex(vBlocks[5]));
+        BOOST_CHECK(db.WriteBatch(batch, true));
+        TestBlockMap loaded;
+        std::vector<CBlockIndex*> vOrdered = LoadTestBlockIndex(db, loaded);
+        BOOST_CHECK(vOrdered.empty());
+        BOOST_CHECK_EQUAL(loaded.at(vBlocks[5]->GetBlockSha256Hash())->nStatus, vBlocks[5]->nStatus);
+    }
+
+    // Nor one after such a version changed just the status of a block, with block files as they were
+    {
+        CBlockTreeDB db(1 << 20, false, false);
+        BOOST_CHECK(db.WriteIndexSnapshot(vBlocks));
+        TestBlockMap loaded;
+        BOOST_CHECK_EQUAL(LoadTestBlockIndex(db, loaded).size(), vBlocks.size());
+        vBlocks[7]->nStatus |= BLOCK_FAILED_VALID;
+        CDBBatch batch(db);
+        batch.Write('l', 0);
+        batch.Write(std::make_pair('b', vBlocks[7]->GetBlockSha256Hash()), CDiskBlockIndex(vBlocks[7]));
+        BOOST_CHECK(db.WriteBatch(batch, true));
+        TestBlockMap reloaded;
+        BOOST_CHECK(LoadTestBlockIndex(db, reloaded).empty());
+        BOOST_CHECK_EQUAL(reloaded.at(vBlocks[7]->GetBlockSha256Hash())->nStatus, vBlocks[7]->nStatus);
+    }
+
+    // Records piled up by many writes through one open file are loaded, until it's written again
+    {
+        CBlockTreeDB db(1 << 20, false, false);
+        BOOST_CHECK(db.WriteIndexSnapshot(vBlocks));
+        for (int i = 0; i < 30 && !db.IndexSnapshotWantsCompacting(); i++)
+            BOOST_CHECK(db.WriteBatchSync({}, 0, vBlocks));
+        BOOST_CHECK(db.IndexSnapshotWantsCompacting());
+        TestBlockMap loaded;
+        BOOST_CHECK_EQUAL(LoadTestBlockIndex(db, loaded).size(), vBlocks.size());
+        BOOST_CHECK(db.WriteIndexSnapshot(vBlocks));
+        BOOST_CHECK(!db.IndexSnapshotWantsCompacting());
+        BOOST_CHECK_EQUAL(LoadTestBlockIndex(db, loaded).size(), vBlocks.size());
+    }
+
+    {
+        boost::filesystem::path path = GetDirForData() / "blocks" / "indexsnapshot.dat";
+        CBlockTreeDB db(1 << 20, false, false);
+        BOOST_CHECK(boost::filesystem::remove(path));
+        TestBlockMap loaded;
+        std::vector<CBlockIndex*> vOrdered = LoadTestBlockIndex(db, loaded);
+        BOOST_CHECK(vOrdered.empty());
+        BOOST_CHECK_EQUAL(loaded.size(), vBlocks.size());
+        for (const auto& item : loaded)
+            BOOST_CHECK_EQUAL(item.second->nStatus, blocks.at(item.first)->nStatus);
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
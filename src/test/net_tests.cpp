@@ -5,11 +5,14 @@
 #include "addrman.h"
 #include "test/test_dogecoin.h"
 #include <string>
+#include <thread>
 #include <boost/test/unit_test.hpp>
 #include "hash.h"
 #include "serialize.h"
 #include "streams.h"
 #include "net.h"
+#include "netmessagemaker.h"
+#include "primitives/transaction.h"
 #include "netbase.h"
 #include "chainparams.h"
 
@@ -174,4 +177,138 @@ BOOST_AUTO_TEST_CASE(cnode_simple_test)
     BOOST_CHECK(pnode2->fFeeler == false);
 }
 
+BOOST_AUTO_TEST_CASE( cnode_push_address_threads )
+{
+    // message handler threads of other peers relay addresses to this node at once
+    in_addr ipv4Addr ;
+    ipv4Addr.s_addr = 0xa0b0c001 ;
+    CAddress addr( CService( ipv4Addr, 7777 ), NODE_NETWORK ) ;
+    CNode node( 0, NODE_NETWORK, 0, INVALID_SOCKET, addr, 0, 0, "", true ) ;
+
+    const int nThreads = 4 ;
+    const int nPerThread = 400 ;
+    std::vector< std::thread > threads ;
+    for ( int t = 0 ; t < nThreads ; t ++ ) {
+        threads.emplace_back( [ &node, t ] {
+            FastRandomContext insecure_rand ;
+            for ( int i = 0 ; i < nPerThread ; i ++ ) {
+                in_addr ip ;
+                ip.s_addr = htonl( 0x0a000000 + t * nPerThread + i ) ;
+                CAddress a( CService( ip, 22556 ), NODE_NETWORK ) ;
+                node.PushAddress( a, insecure_rand ) ;
+                if ( i % 2 == 0 ) node.AddAddressKnown( a ) ;
+            }
+        } ) ;
+    }
+    for ( std::thread & thread : threads )
+        thread.join() ;
+
+    LOCK( node.cs_vAddrToSend ) ;
+    BOOST_CHECK_EQUAL( node.vAddrToSend.size(), std::min< size_t >( nThreads * nPerThread, MAX_ADDR_TO_SEND ) ) ;
+}
+
+BOOST_AUTO_TEST_CASE( shared_message_cache )
+{
+    const CNetMsgMaker maker( PROTOCOL_VERSION ) ;
+    CMutableTransaction mtx ;
+    mtx.vin.resize( 1 ) ;
+    mtx.vin[ 0 ].scriptWitness.stack.push_back( std::vector< unsigned char >( 10, 0x42 ) ) ;
+    mtx.vout.resize( 1 ) ;
+    const CTransaction tx( mtx ) ;
+    const uint256 hash = tx.GetTxHash() ;
+
+    CSharedNetMsgCache cache( 1000 ) ;
+    CSharedNetMsg msg = cache.Make( maker, 0, NetMsgType::TX, hash, tx ) ;
+    CSharedNetMsg msgAgain = cache.Make( maker, 0, NetMsgType::TX, hash, tx ) ;
+    // one buffer for all
+    BOOST_CHECK( msg.data == msgAgain.data ) ;
+    BOOST_CHECK( msg.header == msgAgain.header ) ;
+    BOOST_CHECK( *msg.data == maker.Make( NetMsgType::TX, tx ).data ) ;
+
+    // serialized without witness is another message
+    CSharedNetMsg msgNoWitness = cache.Make( maker, SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::TX, hash, tx ) ;
+    BOOST_CHECK( msgNoWitness.data != msg.data ) ;
+    BOOST_CHECK( msgNoWitness.data->size() < msg.data->size() ) ;
+    BOOST_CHECK_EQUAL( cache.size(), 2U ) ;
+
+    // bounded, the oldest go first
+    for ( unsigned char i = 0 ; i < 100 ; i ++ ) {
+        mtx.nLockTime = i ;
+        const CTransaction txOther( mtx ) ;
+        cache.Make( maker, 0, NetMsgType::TX, txOther.GetTxHash(), txOther ) ;
+    }
+    CSharedNetMsg msgFound ;
+    BOOST_CHECK( ! cache.Find( hash, 0, NetMsgType::TX, msgFound ) ) ;
+    BOOST_CHECK( cache.size() < 1000 / msg.data->size() ) ;
+    mtx.nLockTime = 99 ;
+    BOOST_CHECK( cache.Find( CTransaction( mtx ).GetTxHash(), 0, NetMsgType::TX, msgFound ) ) ;
+}
+
+BOOST_AUTO_TEST_CASE( shared_message_cache_witness )
+{
+    const CNetMsgMaker maker( PROTOCOL_VERSION ) ;
+    CMutableTransaction mtx ;
+    mtx.vin.resize( 1 ) ;
+    mtx.vin[ 0 ].scriptWitness.stack.push_back( std::vector< unsigned char >( 10, 0x42 ) ) ;
+    mtx.vout.resize( 1 ) ;
+    const CTransaction tx( mtx ) ;
+    mtx.vin[ 0 ].scriptWitness.stack[ 0 ] = std::vector< unsigned char >( 20, 0x43 ) ;
+    const CTransaction txOtherWitness( mtx ) ;
+    BOOST_CHECK( tx.GetTxHash() == txOtherWitness.GetTxHash() ) ;
+    BOOST_CHECK( tx.GetWitnessHash() != txOtherWitness.GetWitnessHash() ) ;
+
+    CSharedNetMsgCache cache( 10000 ) ;
+    CSharedNetMsg msg = cache.MakeTx( maker, 0, tx ) ;
+    CSharedNetMsg msgOtherWitness = cache.MakeTx( maker, 0, txOtherWitness ) ;
+    // with witness, each transaction gets its own bytes
+    BOOST_CHECK( *msg.data == maker.Make( NetMsgType::TX, tx ).data ) ;
+    BOOST_CHECK( *msgOtherWitness.data == maker.Make( NetMsgType::TX, txOtherWitness ).data ) ;
+    BOOST_CHECK( *msg.data != *msgOtherWitness.data ) ;
+
+    // without witness, they are one message
+    CSharedNetMsg msgNoWitness = cache.MakeTx( maker, SERIALIZE_TRANSACTION_NO_WITNESS, tx ) ;
+    CSharedNetMsg msgOtherNoWitness = cache.MakeTx( maker, SERIALIZE_TRANSACTION_NO_WITNESS, txOtherWitness ) ;
+    BOOST_CHECK( msgNoWitness.data == msgOtherNoWitness.data ) ;
+    BOOST_CHECK_EQUAL( cache.size(), 3U ) ;
+}
+
+#ifndef WIN32
+BOOST_AUTO_TEST_CASE( push_shared_message )
+{
+    int sv[ 2 ] ;
+    BOOST_REQUIRE( socketpair( AF_UNIX, SOCK_STREAM, 0, sv ) == 0 ) ;
+
+    CConnman connman( 0x1337, 0x1337 ) ;
+    in_addr ipv4Addr ;
+    ipv4Addr.s_addr = 0xa0b0c001 ;
+    CAddress addr( CService( ipv4Addr, 7777 ), NODE_NETWORK ) ;
+    CNode node( 0, NODE_NETWORK, 0, sv[ 0 ], addr, 0, 0, "", false ) ;
+
+    // serialized once, pushed twice
+    CSharedNetMsg msg( CNetMsgMaker( INIT_PROTO_VERSION ).Make( NetMsgType::PING, uint64_t( 0x0123456789abcdef ) ) ) ;
+    BOOST_REQUIRE( msg.header && msg.data ) ;
+    BOOST_CHECK_EQUAL( msg.header->size(), CMessageHeader::HEADER_SIZE ) ;
+    BOOST_CHECK_EQUAL( msg.data->size(), 8U ) ;
+    connman.PushMessage( &node, msg ) ;
+    {
+        LOCK( node.cs_vSend ) ;
+        BOOST_CHECK( node.vSendMsg.empty() ) ;
+        // queued behind a message not sent yet, shared with the caller
+        node.vSendMsg.push_back( msg.data ) ;
+        node.nSendSize += msg.data->size() ;
+    }
+    connman.PushMessage( &node, msg ) ;
+    BOOST_CHECK_EQUAL( msg.header.use_count(), 2 ) ;
+    BOOST_CHECK_EQUAL( msg.data.use_count(), 3 ) ;
+
+    std::vector< unsigned char > vchSent( 64 ) ;
+    ssize_t nRecv = recv( sv[ 1 ], vchSent.data(), vchSent.size(), MSG_DONTWAIT ) ;
+    BOOST_REQUIRE_EQUAL( nRecv, (ssize_t)( CMessageHeader::HEADER_SIZE + 8 ) ) ;
+    BOOST_CHECK( std::equal( msg.header->begin(), msg.header->end(), vchSent.begin() ) ) ;
+    BOOST_CHECK( std::equal( msg.data->begin(), msg.data->end(), vchSent.begin() + CMessageHeader::HEADER_SIZE ) ) ;
+
+    close( sv[ 1 ] ) ;
+}
+#endif
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -1,9 +1,14 @@
 #include <boost/test/unit_test.hpp>
 
 #include "crypto/scrypt.h"
+#include "primitives/pureheader.h"
+#include "streams.h"
 #include "uint256.h"
 #include "util.h"
 #include "utilstrencodings.h"
+#include "version.h"
+
+#include <thread>
 
 BOOST_AUTO_TEST_SUITE(scrypt_tests)
 
@@ -29,7 +34,104 @@ BOOST_AUTO_TEST_CASE(scrypt_hashtest)
         // Test generic scrypt
         scrypt_1024_1_1_256_sp_generic((const char*)&inputbytes[0], BEGIN(scrypthash), scratchpad);
         BOOST_CHECK_EQUAL(scrypthash.ToString().c_str(), expected[i]);
+        // Test scrypt with the thread's own scratchpad
+        scrypt_1024_1_1_256((const char*)&inputbytes[0], BEGIN(scrypthash));
+        BOOST_CHECK_EQUAL(scrypthash.ToString().c_str(), expected[i]);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(scrypt_thread_scratchpad_test)
+{
+    char* small = scrypt_thread_scratchpad(SCRYPT_SCRATCHPAD_SIZE);
+    BOOST_CHECK_EQUAL((uintptr_t)small % 64, 0U);
+    // Asking for the same or a smaller size again gives the same memory
+    BOOST_CHECK(scrypt_thread_scratchpad(SCRYPT_SCRATCHPAD_SIZE) == small);
+    char* big = scrypt_thread_scratchpad(SCRYPT_MULTI_SCRATCHPAD_SIZE);
+    BOOST_CHECK_EQUAL((uintptr_t)big % 64, 0U);
+    BOOST_CHECK(scrypt_thread_scratchpad(SCRYPT_SCRATCHPAD_SIZE) == big);
+    memset(big, 0xd0, SCRYPT_MULTI_SCRATCHPAD_SIZE - 63);
+
+    // Another thread gets its own scratchpad
+    char* other = nullptr;
+    std::thread([&other]() { other = scrypt_thread_scratchpad(SCRYPT_SCRATCHPAD_SIZE); }).join();
+    BOOST_CHECK(other != nullptr && other != big);
+}
+
+BOOST_AUTO_TEST_CASE(scrypt_multi_hashtest)
+{
+    // Multi-lane scrypt must give the same hashes as one by one, with any number of inputs
+    const char* inputhex = "020000004c1271c211717198227392b029a64a7971931d351b387bb80db027f270411e398a07046f7d4a08dd815412a8712f874a7ebf0507e3878bd24e20a3b73fd750a667d2f451eac7471b00de6659";
+    scrypt_detect_multi();
+    std::vector<char> scratchpad(SCRYPT_MULTI_SCRATCHPAD_SIZE);
+    const size_t count = 2 * SCRYPT_MAX_WAYS + 3;
+    std::vector<unsigned char> header = ParseHex(inputhex);
+    std::vector<char> inputs(count * 80);
+    std::vector<uint256> expected(count);
+    for (size_t i = 0; i < count; i++) {
+        uint32_t nonce = 0x5966de00 + i;
+        memcpy(&header[76], &nonce, 4);
+        memcpy(&inputs[i * 80], &header[0], 80);
+        scrypt_1024_1_1_256_sp_generic((const char*)&header[0], BEGIN(expected[i]), &scratchpad[0]);
+    }
+    for (size_t n = 1; n <= count; n += (n < SCRYPT_MAX_WAYS + 1) ? 1 : SCRYPT_MAX_WAYS) {
+        std::vector<uint256> hashes(n);
+        scrypt_1024_1_1_256_sp_multi(&inputs[0], BEGIN(hashes[0]), &scratchpad[0], n);
+        for (size_t i = 0; i < n; i++)
+            BOOST_CHECK_EQUAL(hashes[i].ToString(), expected[i].ToString());
     }
+
+    // Hashing headers which differ only in nonce from their midstate gives the same
+    scrypt_header_midstate midstate;
+    scrypt_header_midstate_init(&midstate, &inputs[0]);
+    std::vector<uint256> hashes(count);
+    scrypt_1024_1_1_256_sp_nonces(&midstate, 0x5966de00, BEGIN(hashes[0]), &scratchpad[0], count);
+    for (size_t i = 0; i < count; i++)
+        BOOST_CHECK_EQUAL(hashes[i].ToString(), expected[i].ToString());
+
+#if defined(USE_SCRYPT_AVX)
+    // Test every multi-lane core this cpu can run, not only the widest one
+    struct { bool supported; void (*core)(uint8_t*, char*); size_t ways; } cores[] = {
+        { __builtin_cpu_supports("avx2") != 0, &scrypt_core_avx2_x8, 8 },
+        { __builtin_cpu_supports("avx512f") != 0, &scrypt_core_avx512_x16, 16 }
+    };
+    for (const auto& c : cores) {
+        if (!c.supported) continue;
+        uint8_t B[SCRYPT_MAX_WAYS * 128];
+        for (size_t i = 0; i < c.ways; i++)
+            scrypt_pbkdf2_in(CHMAC_SHA256((const uint8_t*)&inputs[i * 80], 80), (const uint8_t*)&inputs[i * 80], &B[i * 128]);
+        c.core(B, &scratchpad[0]);
+        for (size_t i = 0; i < c.ways; i++) {
+            scrypt_pbkdf2_out(CHMAC_SHA256((const uint8_t*)&inputs[i * 80], 80), &B[i * 128], (uint8_t*)BEGIN(hashes[i]));
+            BOOST_CHECK_EQUAL(hashes[i].ToString(), expected[i].ToString());
+        }
+    }
+#endif
+}
+
+BOOST_AUTO_TEST_CASE(scrypt_header_hash_test)
+{
+    // Scrypt hash of a header is remembered, and changing the header gives the new one
+    CDataStream stream(ParseHex("020000004c1271c211717198227392b029a64a7971931d351b387bb80db027f270411e398a07046f7d4a08dd815412a8712f874a7ebf0507e3878bd24e20a3b73fd750a667d2f451eac7471b00de6659"), SER_NETWORK, PROTOCOL_VERSION);
+    CPureBlockHeader header;
+    stream >> header;
+    const std::string expected = "00000000002bef4107f882f6115e0b01f348d21195dacd3582aa2dabd7985806";
+    BOOST_CHECK_EQUAL(header.GetScryptHash().ToString(), expected);
+    BOOST_CHECK_EQUAL(header.GetScryptHash().ToString(), expected);
+
+    header.nNonce++;
+    uint256 hash;
+    scrypt_1024_1_1_256(BEGIN(header.nVersion), BEGIN(hash));
+    BOOST_CHECK(header.GetScryptHash() == hash);
+    BOOST_CHECK(header.GetScryptHash().ToString() != expected);
+
+    header.nNonce--;
+    BOOST_CHECK_EQUAL(header.GetScryptHash().ToString(), expected);
+
+    // Hashed without the cache, as nonces being scanned are, the hash is the same
+    BOOST_CHECK_EQUAL(header.GetScryptHash(false).ToString(), expected);
+    header.nNonce++;
+    BOOST_CHECK(header.GetScryptHash(false) == hash);
+    BOOST_CHECK(header.GetLyra2Re2Hash(false) == header.GetLyra2Re2Hash());
 }
 
 BOOST_AUTO_TEST_SUITE_END()
@@ -143,4 +143,40 @@ BOOST_AUTO_TEST_CASE(findearliestatleast_test)
         BOOST_CHECK(vBlocksMain[r].GetAncestor(ret->nHeight) == ret);
     }
 }
+
+BOOST_AUTO_TEST_CASE(findfork_arena_test)
+{
+    // A main chain of 20000 blocks and branches off it, all in one arena
+    CBlockIndexArena arena;
+    std::vector<CBlockIndex*> vMain;
+    for (int i = 0; i < 20000; i++) {
+        CBlockIndex* pindex = arena.New();
+        pindex->nHeight = i;
+        pindex->pprev = i ? vMain.back() : NULL;
+        pindex->BuildSkip();
+        vMain.push_back(pindex);
+    }
+    BOOST_CHECK_EQUAL(arena.size(), vMain.size());
+    BOOST_CHECK(arena.DynamicMemoryUsage() >= vMain.size() * sizeof(CBlockIndex));
+
+    CChain chain;
+    chain.SetTip(vMain.back());
+    for (int n = 0; n < 100; n++) {
+        int nForkHeight = insecure_rand() % vMain.size();
+        CBlockIndex* pindex = vMain[nForkHeight];
+        int nLength = insecure_rand() % 5000;
+        for (int i = 0; i < nLength; i++) {
+            CBlockIndex* pnext = arena.New();
+            pnext->nHeight = pindex->nHeight + 1;
+            pnext->pprev = pindex;
+            pnext->BuildSkip();
+            pindex = pnext;
+        }
+        BOOST_CHECK(chain.FindFork(pindex) == vMain[nForkHeight]);
+    }
+
+    arena.Clear();
+    BOOST_CHECK_EQUAL(arena.size(), 0U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
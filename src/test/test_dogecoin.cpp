@@ -7,6 +7,7 @@
 
 #include "test_dogecoin.h"
 
+#include "auxpowcache.h"
 #include "chainparams.h"
 #include "consensus/consensus.h"
 #include "consensus/validation.h"
@@ -41,6 +42,7 @@ BasicTestingSetup::BasicTestingSetup( const std::string & chainName )
         SetupEnvironment() ;
         SetupNetworking() ;
         InitSignatureCache() ;
+        InitAuxpowCache() ;
         PickPrintToConsole() ; // don't want to write to debug log file
         fCheckBlockIndex = true ;
         SelectParams( chainName ) ;
@@ -74,9 +76,13 @@ TestingSetup::TestingSetup(const std::string& chainName) : BasicTestingSetup(cha
             bool ok = ActivateBestChain(state, chainparams);
             BOOST_CHECK(ok);
         }
+        pcoinsdbview->StartBackgroundWrites() ;
         nScriptCheckThreads = 3 ;
-        for ( int i = 0 ; i < nScriptCheckThreads - 1 ; i ++ )
+        for ( int i = 0 ; i < nScriptCheckThreads - 1 ; i ++ ) {
             scriptcheckThreads.push_back( std::thread( &ThreadScriptCheck ) ) ;
+            scriptcheckThreads.push_back( std::thread( &ThreadParallelTasks ) ) ;
+        }
+        scriptcheckThreads.push_back( std::thread( &ThreadBlockReadAhead ) ) ;
         g_connman = std::unique_ptr<CConnman>(new CConnman(0x1337, 0x1337)); // Deterministic randomness for tests
         connman = g_connman.get();
         RegisterNodeSignals(GetNodeSignals());
@@ -87,6 +93,8 @@ TestingSetup::~TestingSetup()
     UnregisterNodeSignals( GetNodeSignals() ) ;
 
     StopScriptChecking() ;
+    StopBlockReadAhead() ;
+    StopParallelTasks() ;
     JoinAll( scriptcheckThreads ) ;
 
     UnloadBlockIndex() ;
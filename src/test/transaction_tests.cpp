@@ -301,14 +301,14 @@ SetupDummyInputs( CBasicKeyStore & keystoreRet, CCoinsViewCache & coinsRet )
     dummyTransactions[ 0 ].vout[ 0 ].scriptPubKey << ToByteVector( key[ 0 ].GetPubKey() ) << OP_CHECKSIG ;
     dummyTransactions[ 0 ].vout[ 1 ].nValue = 50 * E6COIN ;
     dummyTransactions[ 0 ].vout[ 1 ].scriptPubKey << ToByteVector( key[ 1 ].GetPubKey() ) << OP_CHECKSIG ;
-    coinsRet.ModifyCoins( dummyTransactions[ 0 ].GetTxHash() )->FromTx( dummyTransactions[ 0 ], 0 ) ;
+    AddCoins( coinsRet, dummyTransactions[ 0 ], 0 ) ;
 
     dummyTransactions[ 1 ].vout.resize( 2 ) ;
     dummyTransactions[ 1 ].vout[ 0 ].nValue = 21 * E6COIN ;
     dummyTransactions[ 1 ].vout[ 0 ].scriptPubKey = GetScriptForDestination( key[ 2 ].GetPubKey().GetID() ) ;
     dummyTransactions[ 1 ].vout[ 1 ].nValue = 22 * E6COIN ;
     dummyTransactions[ 1 ].vout[ 1 ].scriptPubKey = GetScriptForDestination( key[ 3 ].GetPubKey().GetID() ) ;
-    coinsRet.ModifyCoins( dummyTransactions[ 1 ].GetTxHash() )->FromTx( dummyTransactions[ 1 ], 0 ) ;
+    AddCoins( coinsRet, dummyTransactions[ 1 ], 0 ) ;
 
     return dummyTransactions ;
 }
@@ -464,19 +464,20 @@ BOOST_AUTO_TEST_CASE(test_big_witness_transaction) {
     for ( int i = 0 ; i < 20 ; i ++ )
         scriptcheckthreads.push_back( std::thread( [&]{ scriptcheckqueue.Loop() ; } ) ) ;
 
-    CCoins coins;
-    coins.nVersion = 1;
-    coins.fCoinBase = false;
+    std::vector<Coin> coins;
     for(uint32_t i = 0; i < mtx.vin.size(); i++) {
-        CTxOut txout;
-        txout.nValue = 1000;
-        txout.scriptPubKey = scriptPubKey;
-        coins.vout.push_back(txout);
+        Coin coin;
+        coin.nHeight = 1;
+        coin.fCoinBase = false;
+        coin.out.nValue = 1000;
+        coin.out.scriptPubKey = scriptPubKey;
+        coins.emplace_back(std::move(coin));
     }
 
     for(uint32_t i = 0; i < mtx.vin.size(); i++) {
         std::vector<CScriptCheck> vChecks;
-        CScriptCheck check(coins, tx, i, SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_WITNESS, false, &txdata);
+        CTxOut& out = coins[tx.vin[i].prevout.n].out;
+        CScriptCheck check(out, tx, i, SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_WITNESS, false, &txdata);
         vChecks.push_back(CScriptCheck());
         check.swap(vChecks.back());
         control.Add(vChecks);
@@ -10,7 +10,9 @@
 #include "txmempool.h"
 #include "random.h"
 #include "script/standard.h"
+#include "streams.h"
 #include "test/test_dogecoin.h"
+#include "util.h"
 #include "utiltime.h"
 
 #include <boost/test/unit_test.hpp>
@@ -84,4 +86,134 @@ BOOST_FIXTURE_TEST_CASE(tx_mempool_block_doublespend, TestChain240Setup)
     BOOST_CHECK_EQUAL( mempool.size(), 0 ) ;
 }
 
+/** A spend of the first mature coinbase and a child spending it */
+static std::vector< CMutableTransaction > ParentAndChild( const TestChain240Setup & setup )
+{
+    CScript scriptPubKey = CScript() <<  ToByteVector(setup.coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+
+    std::vector< CMutableTransaction > txs ;
+    txs.resize( 2 ) ;
+    for ( int i = 0 ; i < 2 ; i ++ )
+    {
+        txs[i].nVersion = 1;
+        txs[i].vin.resize(1);
+        txs[i].vin[0].prevout.hash = ( i == 0 ) ? setup.coinbaseTxns[0].GetTxHash() : txs[0].GetTxHash() ;
+        txs[i].vin[0].prevout.n = 0;
+        txs[i].vout.resize(1);
+        txs[i].vout[0].nValue = ( i == 0 ) ? 11000111 : 10000111 ;
+        txs[i].vout[0].scriptPubKey = scriptPubKey;
+
+        std::vector<unsigned char> vchSig;
+        uint256 hash = SignatureHash(scriptPubKey, txs[i], 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+        BOOST_CHECK(setup.coinbaseKey.Sign(hash, vchSig));
+        vchSig.push_back((unsigned char)SIGHASH_ALL);
+        txs[i].vin[0].scriptSig << vchSig;
+    }
+    return txs ;
+}
+
+BOOST_FIXTURE_TEST_CASE(tx_precheck_chunk, TestChain240Setup)
+{
+    // Transactions are checked together before going to the memory pool,
+    // a child spending its parent checked in the same chunk
+
+    std::vector< CMutableTransaction > txs = ParentAndChild( *this ) ;
+
+    // and a transaction failing context-free checks
+    CMutableTransaction noInputs ;
+    noInputs.vout.resize( 1 ) ;
+    noInputs.vout[0].nValue = 1000 ;
+
+    std::vector< CTransactionRef > vtx = { MakeTransactionRef( txs[0] ), MakeTransactionRef( txs[1] ), MakeTransactionRef( noInputs ) } ;
+    std::vector< char > vPassed ;
+    PreCheckTransactions( mempool, vtx, vPassed ) ;
+    BOOST_CHECK_EQUAL( vPassed.size(), 3 ) ;
+    BOOST_CHECK( vPassed[0] && vPassed[1] ) ;
+    BOOST_CHECK( ! vPassed[2] ) ;
+
+    BOOST_CHECK( ToMemPool( txs[0] ) ) ;
+    BOOST_CHECK( ToMemPool( txs[1] ) ) ;
+    BOOST_CHECK_EQUAL( mempool.size(), 2 ) ;
+    mempool.clear() ;
+}
+
+BOOST_FIXTURE_TEST_CASE(mempool_dump_roundtrip, TestChain240Setup)
+{
+    // Transactions and fee deltas come back from mempool.dat written in chunks (version 2)
+    std::vector< CMutableTransaction > txs = ParentAndChild( *this ) ;
+    BOOST_CHECK( ToMemPool( txs[0] ) ) ;
+    BOOST_CHECK( ToMemPool( txs[1] ) ) ;
+
+    double prioritydummy = 0 ;
+    const uint256 hashChild = txs[1].GetTxHash() ;
+    const uint256 hashUnknown = GetRandHash() ;
+    mempool.PrioritiseTransaction( hashChild, hashChild.ToString(), prioritydummy, 1000 ) ;
+    mempool.PrioritiseTransaction( hashUnknown, hashUnknown.ToString(), prioritydummy, 2000 ) ;
+
+    DumpMempoolToFile() ;
+    {
+        CAutoFile file( fopen( ( GetDirForData() / "mempool.dat" ).string().c_str(), "rb" ), SER_DISK, PEER_VERSION ) ;
+        BOOST_REQUIRE( ! file.isNull() ) ;
+        uint64_t version ;
+        file >> version ;
+        BOOST_CHECK_EQUAL( version, 2 ) ;
+    }
+
+    mempool.clear() ;
+    mempool.ClearPrioritisation( hashChild ) ;
+    mempool.ClearPrioritisation( hashUnknown ) ;
+    BOOST_CHECK_EQUAL( mempool.size(), 0 ) ;
+
+    BOOST_CHECK( LoadMempoolFromDump() ) ;
+    BOOST_CHECK_EQUAL( mempool.size(), 2 ) ;
+    BOOST_CHECK( mempool.exists( txs[0].GetTxHash() ) ) ;
+    BOOST_CHECK( mempool.exists( hashChild ) ) ;
+
+    CAmount nFeeDelta = 0 ;
+    mempool.ApplyDeltas( hashChild, prioritydummy, nFeeDelta ) ;
+    BOOST_CHECK_EQUAL( nFeeDelta, 1000 ) ;
+    nFeeDelta = 0 ;
+    mempool.ApplyDeltas( hashUnknown, prioritydummy, nFeeDelta ) ;
+    BOOST_CHECK_EQUAL( nFeeDelta, 2000 ) ;
+
+    mempool.clear() ;
+    mempool.ClearPrioritisation( hashChild ) ;
+    mempool.ClearPrioritisation( hashUnknown ) ;
+}
+
+BOOST_FIXTURE_TEST_CASE(mempool_dump_v1_load, TestChain240Setup)
+{
+    // mempool.dat of version 1, with the number of transactions and then all of them, still loads
+    std::vector< CMutableTransaction > txs = ParentAndChild( *this ) ;
+    const uint256 hashUnknown = GetRandHash() ;
+    {
+        CAutoFile file( fopen( ( GetDirForData() / "mempool.dat" ).string().c_str(), "wb" ), SER_DISK, PEER_VERSION ) ;
+        BOOST_REQUIRE( ! file.isNull() ) ;
+        file << uint64_t( 1 ) ;
+        file << uint64_t( txs.size() ) ;
+        for ( const CMutableTransaction & tx : txs ) {
+            file << CTransaction( tx ) ;
+            file << int64_t( GetTime() ) ;
+            file << int64_t( 0 ) ;
+        }
+        std::map< uint256, CAmount > mapDeltas ;
+        mapDeltas[ hashUnknown ] = 3000 ;
+        file << mapDeltas ;
+    }
+
+    BOOST_CHECK_EQUAL( mempool.size(), 0 ) ;
+    BOOST_CHECK( LoadMempoolFromDump() ) ;
+    BOOST_CHECK_EQUAL( mempool.size(), 2 ) ;
+    BOOST_CHECK( mempool.exists( txs[0].GetTxHash() ) ) ;
+    BOOST_CHECK( mempool.exists( txs[1].GetTxHash() ) ) ;
+
+    double prioritydummy = 0 ;
+    CAmount nFeeDelta = 0 ;
+    mempool.ApplyDeltas( hashUnknown, prioritydummy, nFeeDelta ) ;
+    BOOST_CHECK_EQUAL( nFeeDelta, 3000 ) ;
+
+    mempool.clear() ;
+    mempool.ClearPrioritisation( hashUnknown ) ;
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -8,10 +8,13 @@
 #include "sync.h"
 #include "utilstrencodings.h"
 #include "utilmoneystr.h"
+#include "utilthread.h"
 #include "test/test_dogecoin.h"
 #include "test/test_random.h"
 
+#include <atomic>
 #include <stdint.h>
+#include <thread>
 #include <vector>
 
 #include <boost/test/unit_test.hpp>
@@ -567,4 +570,43 @@ BOOST_AUTO_TEST_CASE(test_ParseFixedPoint)
     BOOST_CHECK(!ParseFixedPoint("1.", 8, &amount));
 }
 
+BOOST_AUTO_TEST_CASE( test_ForEachInParallel )
+{
+    // workers of another thread start and quit as a test would
+    std::vector< std::thread > workers ;
+    for ( int i = 0 ; i < 3 ; i ++ )
+        workers.push_back( std::thread( &ThreadParallelTasks ) ) ;
+
+    const size_t n = 1000 ;
+    std::vector< std::atomic< int > > calls( n ) ;
+    for ( std::atomic< int > & c : calls ) c = 0 ;
+    ForEachInParallel( n, [ &calls ]( size_t i ) {  calls[ i ] ++ ;  } ) ;
+    for ( size_t i = 0 ; i < n ; i ++ )
+        BOOST_CHECK_EQUAL( calls[ i ], 1 ) ;
+
+    // nothing, and one call on the calling thread
+    ForEachInParallel( 0, [ &calls ]( size_t i ) {  calls[ i ] ++ ;  } ) ;
+    ForEachInParallel( 1, [ &calls ]( size_t i ) {  calls[ i ] ++ ;  } ) ;
+    BOOST_CHECK_EQUAL( calls[ 0 ], 2 ) ;
+    BOOST_CHECK_EQUAL( calls[ 1 ], 1 ) ;
+
+    // a call doesn't wait for another one, even one that keeps all workers busy
+    std::atomic< bool > release( false ) ;
+    std::atomic< int > blocked( 0 ) ;
+    std::thread busy( [ & ]() {
+        ForEachInParallel( 4, [ & ]( size_t ) {
+            blocked ++ ;
+            while ( ! release ) std::this_thread::yield() ;
+        } ) ;
+    } ) ;
+    while ( blocked < 4 ) std::this_thread::yield() ;
+    ForEachInParallel( n, [ &calls ]( size_t i ) {  calls[ i ] ++ ;  } ) ;
+    BOOST_CHECK_EQUAL( calls[ n - 1 ], 2 ) ;
+    release = true ;
+    busy.join() ;
+
+    StopParallelTasks() ;
+    JoinAll( workers ) ;
+}
+
 BOOST_AUTO_TEST_SUITE_END()
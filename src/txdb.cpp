@@ -6,14 +6,26 @@
 
 #include "txdb.h"
 
+#include "blockfilemap.h"
 #include "chainparams.h"
 #include "hash.h"
+#include "memusage.h"
+#include "peerversion.h"
 #include "pow.h"
+#include "random.h"
+#include "streams.h"
 #include "uint256.h"
+#include "ui_interface.h"
 #include "util.h"
+#include "utilstr.h"
+#include "utilthread.h"
 
 #include <stdint.h>
 
+#include <algorithm>
+#include <limits>
+
+static const char DB_COIN = 'C';
 static const char DB_COINS = 'c';
 static const char DB_BLOCK_FILES = 'f';
 static const char DB_TXINDEX = 't';
@@ -23,55 +35,384 @@ static const char DB_BEST_BLOCK = 'B';
 static const char DB_FLAG = 'F';
 static const char DB_REINDEX_FLAG = 'R';
 static const char DB_LAST_BLOCK = 'l';
+static const char DB_INDEX_SNAPSHOT = 's';
+
+
+namespace {
+
+/** Key of a coin in the database: DB_COIN, txid, VARINT(output's number) */
+struct CoinEntry
+{
+    COutPoint * outpoint ;
+    char key ;
 
+    CoinEntry( const COutPoint * ptr ) : outpoint( const_cast< COutPoint * >( ptr ) ), key( DB_COIN ) {}
+
+    template < typename Stream >
+    void Serialize( Stream & s ) const {
+        s << key ;
+        s << outpoint->hash ;
+        s << VARINT( outpoint->n ) ;
+    }
+
+    template < typename Stream >
+    void Unserialize( Stream & s ) {
+        s >> key ;
+        s >> outpoint->hash ;
+        s >> VARINT( outpoint->n ) ;
+    }
+} ;
+
+}
 
 CCoinsViewDB::CCoinsViewDB( size_t nCacheSize, bool fMemory, bool fWipe )
     : db( GetDirForData() / "chainstate", nCacheSize, fMemory, fWipe, true )
+    , fBackgroundWrites( false ), nWritingUsage( 0 ), fWriting( false ), fWriteFailed( false ), fQuit( false )
+{
+}
+
+CCoinsViewDB::~CCoinsViewDB()
+{
+    if ( ! writerThread.joinable() ) return ;
+
+    // what's being written is written to the end
+    {
+        std::lock_guard< std::mutex > lock( mutexWriting ) ;
+        fQuit = true ;
+    }
+    condWriting.notify_all() ;
+    writerThread.join() ;
+}
+
+void CCoinsViewDB::StartBackgroundWrites()
 {
+    if ( fBackgroundWrites ) return ;
+    fBackgroundWrites = true ;
+    writerThread = std::thread( &CCoinsViewDB::ThreadWriteCoins, this ) ;
 }
 
-bool CCoinsViewDB::GetCoins(const uint256 &txid, CCoins &coins) const {
-    return db.Read(std::make_pair(DB_COINS, txid), coins);
+void CCoinsViewDB::ThreadWriteCoins()
+{
+    RenameThread( "coinswriter" ) ;
+
+    std::unique_lock< std::mutex > lock( mutexWriting ) ;
+    while ( true ) {
+        condWriting.wait( lock, [ this ] {  return fWriting || fQuit ;  } ) ;
+        if ( ! fWriting ) break ;
+
+        // nobody changes mapWriting while fWriting, readers just look into it
+        lock.unlock() ;
+        bool fOk = false ;
+        try {
+            fOk = WriteCoins( mapWriting, hashBlockWriting ) ;
+        } catch ( const std::exception & e ) {
+            LogPrintf( "%s: %s\n", __func__, e.what() ) ;
+        }
+
+        // coins which failed to be written are still read from mapWriting
+        CCoinsMap mapWritten ;
+        lock.lock() ;
+        if ( fOk ) {
+            mapWritten.swap( mapWriting ) ;
+            nWritingUsage = 0 ;
+        }
+        else
+            error( "%s: failed to write to coin database", __func__ ) ;
+        fWriteFailed = ! fOk ;
+        fWriting = false ;
+        condWriting.notify_all() ;
+
+        // freeing the map takes a while, readers don't wait for that
+        lock.unlock() ;
+        mapWritten.clear() ;
+        lock.lock() ;
+    }
 }
 
-bool CCoinsViewDB::HaveCoins(const uint256 &txid) const {
-    return db.Exists(std::make_pair(DB_COINS, txid));
+void CCoinsViewDB::WaitForWrite() const
+{
+    std::unique_lock< std::mutex > lock( mutexWriting ) ;
+    condWriting.wait( lock, [ this ] {  return ! fWriting ;  } ) ;
+}
+
+size_t CCoinsViewDB::WritingMemoryUsage() const
+{
+    std::lock_guard< std::mutex > lock( mutexWriting ) ;
+    return nWritingUsage ;
+}
+
+bool CCoinsViewDB::Sync()
+{
+    std::unique_lock< std::mutex > lock( mutexWriting ) ;
+    condWriting.wait( lock, [ this ] {  return ! fWriting ;  } ) ;
+    return ! fWriteFailed ;
+}
+
+bool CCoinsViewDB::GetWritingCoin( const COutPoint & outpoint, Coin & coin ) const
+{
+    if ( ! fBackgroundWrites ) return false ;
+
+    std::lock_guard< std::mutex > lock( mutexWriting ) ;
+    CCoinsMap::const_iterator it = mapWriting.find( outpoint ) ;
+    if ( it == mapWriting.end() ) return false ;
+    coin = it->second.coin ;
+    return true ;
+}
+
+bool CCoinsViewDB::GetCoin( const COutPoint & outpoint, Coin & coin ) const
+{
+    if ( GetWritingCoin( outpoint, coin ) )
+        return ! coin.IsSpent() ;
+    return db.Read( CoinEntry( &outpoint ), coin ) ;
+}
+
+bool CCoinsViewDB::HaveCoin( const COutPoint & outpoint ) const
+{
+    Coin coin ;
+    if ( GetWritingCoin( outpoint, coin ) )
+        return ! coin.IsSpent() ;
+    return db.Exists( CoinEntry( &outpoint ) ) ;
 }
 
 uint256 CCoinsViewDB::GetSha256OfBestBlock() const
 {
+    if ( fBackgroundWrites ) {
+        std::lock_guard< std::mutex > lock( mutexWriting ) ;
+        if ( ( fWriting || fWriteFailed ) && ! hashBlockWriting.IsNull() )
+            return hashBlockWriting ;
+    }
+
     uint256 hashBestChain ;
     if ( ! db.Read( DB_BEST_BLOCK, hashBestChain ) )
         return uint256() ;
     return hashBestChain ;
 }
 
-bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
+bool CCoinsViewDB::BatchWrite( CCoinsMap & mapCoins, const uint256 & hashBlock )
+{
+    if ( ! fBackgroundWrites ) {
+        bool fOk = WriteCoins( mapCoins, hashBlock ) ;
+        mapCoins.clear() ;
+        return fOk ;
+    }
+
+    // as CCoinsViewCache::DynamicMemoryUsage counts them, before the caller waits for the lock
+    size_t nUsage = memusage::DynamicUsage( mapCoins ) ;
+    for ( const std::pair< const COutPoint, CCoinsCacheEntry > & entry : mapCoins )
+        nUsage += entry.second.coin.DynamicMemoryUsage() ;
+
+    std::unique_lock< std::mutex > lock( mutexWriting ) ;
+    condWriting.wait( lock, [ this ] {  return ! fWriting ;  } ) ;
+    if ( fWriteFailed ) return false ;
+
+    // the caller gets the empty map left by the previous write
+    mapWriting.swap( mapCoins ) ;
+    nWritingUsage = nUsage ;
+    hashBlockWriting = hashBlock ;
+    fWriting = true ;
+    condWriting.notify_all() ;
+    return true ;
+}
+
+bool CCoinsViewDB::WriteCoins( const CCoinsMap & mapCoins, const uint256 & hashBlock )
+{
     CDBBatch batch(db);
     size_t count = 0;
     size_t changed = 0;
-    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
+    for (CCoinsMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); it++) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
-            if (it->second.coins.IsPruned())
-                batch.Erase(std::make_pair(DB_COINS, it->first));
+            CoinEntry entry(&it->first);
+            if (it->second.coin.IsSpent())
+                batch.Erase(entry);
             else
-                batch.Write(std::make_pair(DB_COINS, it->first), it->second.coins);
+                batch.Write(entry, it->second.coin);
             changed++;
         }
         count++;
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
     }
     if (!hashBlock.IsNull())
         batch.Write(DB_BEST_BLOCK, hashBlock);
 
-    LogPrint("coindb", "Committing %u changed transactions (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
+    LogPrint("coindb", "Committing %u changed coins (out of %u), %u bytes to coin database...\n", (unsigned int)changed, (unsigned int)count, (unsigned int)batch.SizeEstimate());
     return db.WriteBatch(batch);
 }
 
+namespace {
+
+/** Record of a block in the block index snapshot, all the fields have fixed size */
+struct CBlockIndexRecord
+{
+    static const uint32_t NO_SLOT = 0xffffffff ;
+
+    uint256 hash ;
+    uint32_t nSlot ;
+    uint32_t nPrevSlot ;
+    int32_t nHeight ;
+    uint32_t nStatus ;
+    uint32_t nBlockTx ;
+    int32_t nFile ;
+    uint32_t nDataPos ;
+    uint32_t nUndoPos ;
+    int32_t nVersion ;
+    uint256 hashMerkleRoot ;
+    uint32_t nTime ;
+    uint32_t nBits ;
+    uint32_t nNonce ;
+
+    CBlockIndexRecord()
+        : nSlot( NO_SLOT ), nPrevSlot( NO_SLOT ), nHeight( 0 ), nStatus( 0 ), nBlockTx( 0 ), nFile( 0 )
+        , nDataPos( 0 ), nUndoPos( 0 ), nVersion( 0 ), nTime( 0 ), nBits( 0 ), nNonce( 0 ) {}
+
+    explicit CBlockIndexRecord( const CBlockIndex * pindex )
+        : hash( pindex->GetBlockSha256Hash() )
+        , nSlot( pindex->nSnapshotSlot )
+        , nPrevSlot( pindex->pprev != nullptr ? pindex->pprev->nSnapshotSlot : NO_SLOT )
+        , nHeight( pindex->nHeight ), nStatus( pindex->nStatus ), nBlockTx( pindex->nBlockTx )
+        , nFile( pindex->nFile ), nDataPos( pindex->nDataPos ), nUndoPos( pindex->nUndoPos )
+        , nVersion( pindex->nVersion ), hashMerkleRoot( pindex->hashMerkleRoot )
+        , nTime( pindex->nTime ), nBits( pindex->nBits ), nNonce( pindex->nNonce ) {}
+
+    void ApplyTo( CBlockIndex * pindex ) const
+    {
+        pindex->nHeight        = nHeight ;
+        pindex->nStatus        = nStatus ;
+        pindex->nBlockTx       = nBlockTx ;
+        pindex->nFile          = nFile ;
+        pindex->nDataPos       = nDataPos ;
+        pindex->nUndoPos       = nUndoPos ;
+        pindex->nVersion       = nVersion ;
+        pindex->hashMerkleRoot = hashMerkleRoot ;
+        pindex->nTime          = nTime ;
+        pindex->nBits          = nBits ;
+        pindex->nNonce         = nNonce ;
+    }
+
+    ADD_SERIALIZE_METHODS ;
+
+    template < typename Stream, typename Operation >
+    inline void SerializationOp( Stream & s, Operation ser_action ) {
+        READWRITE( hash ) ;
+        READWRITE( nSlot ) ;
+        READWRITE( nPrevSlot ) ;
+        READWRITE( nHeight ) ;
+        READWRITE( nStatus ) ;
+        READWRITE( nBlockTx ) ;
+        READWRITE( nFile ) ;
+        READWRITE( nDataPos ) ;
+        READWRITE( nUndoPos ) ;
+        READWRITE( nVersion ) ;
+        READWRITE( hashMerkleRoot ) ;
+        READWRITE( nTime ) ;
+        READWRITE( nBits ) ;
+        READWRITE( nNonce ) ;
+    }
+} ;
+
+static const char INDEX_SNAPSHOT_MAGIC[ 4 ] = { 'b', 'i', 'd', 'x' } ;
+static const size_t INDEX_SNAPSHOT_RECORD_DATA_SIZE = 112 ;
+// serialized CBlockIndexRecord, checksum
+static const size_t INDEX_SNAPSHOT_RECORD_SIZE = INDEX_SNAPSHOT_RECORD_DATA_SIZE + 8 ;
+// magic, size of record, generation
+static const size_t INDEX_SNAPSHOT_HEADER_SIZE = 16 ;
+
+/**
+ * What the database notes of the snapshot: the generation of the file, how many of its records go with
+ * the database, and a hash of the last block file and its info. Versions which don't know of the snapshot
+ * write those along with blocks, so a snapshot left behind by them doesn't match. Writes of blocks which
+ * don't touch block files, like of changed status, are caught with CLastBlockFile
+ */
+struct CIndexSnapshotInfo
+{
+    uint64_t nGeneration ;
+    uint32_t nRecords ;
+    uint256 hashBlockFiles ;
+
+    CIndexSnapshotInfo() : nGeneration( 0 ), nRecords( 0 ) {}
+    CIndexSnapshotInfo( uint64_t nGenerationIn, uint32_t nRecordsIn, const uint256 & hashBlockFilesIn )
+        : nGeneration( nGenerationIn ), nRecords( nRecordsIn ), hashBlockFiles( hashBlockFilesIn ) {}
+
+    ADD_SERIALIZE_METHODS ;
+
+    template < typename Stream, typename Operation >
+    inline void SerializationOp( Stream & s, Operation ser_action ) {
+        READWRITE( nGeneration ) ;
+        READWRITE( nRecords ) ;
+        READWRITE( hashBlockFiles ) ;
+    }
+} ;
+
+/**
+ * Number of the last block file, followed by the generation of the snapshot which goes with
+ * the database. Versions which don't know of the snapshot read just the number, and write just
+ * the number with every write of blocks, so after such a write there's no generation here
+ */
+struct CLastBlockFile
+{
+    int nFile ;
+    uint64_t nSnapshotGeneration ;
+
+    CLastBlockFile() : nFile( 0 ), nSnapshotGeneration( 0 ) {}
+    CLastBlockFile( int nFileIn, uint64_t nGenerationIn ) : nFile( nFileIn ), nSnapshotGeneration( nGenerationIn ) {}
+
+    template < typename Stream >
+    void Serialize( Stream & s ) const {
+        s << nFile ;
+        if ( nSnapshotGeneration != 0 )
+            s << nSnapshotGeneration ;
+    }
+
+    template < typename Stream >
+    void Unserialize( Stream & s ) {
+        s >> nFile ;
+        nSnapshotGeneration = 0 ;
+        if ( ! s.empty() )
+            s >> nSnapshotGeneration ;
+    }
+} ;
+
+static uint256 BlockFilesHash( int nLastFile, const CBlockFileInfo & info )
+{
+    CHashWriter ss( SER_GETHASH, 0 ) ;
+    ss << nLastFile << info ;
+    return ss.GetHash() ;
+}
+
+/** Checksum of a record's bytes, keyed with the generation so that records of another file don't pass */
+static uint64_t RecordChecksum( uint64_t nGeneration, const unsigned char * pbegin )
+{
+    return CSipHasher( nGeneration, 0 ).Write( pbegin, INDEX_SNAPSHOT_RECORD_DATA_SIZE ).Finalize() ;
+}
+
+static void WriteRecord( CAutoFile & fileout, uint64_t nGeneration, const CBlockIndex * pindex )
+{
+    std::vector< unsigned char > vchRecord ;
+    CVectorWriter( SER_DISK, PEER_VERSION, vchRecord, 0, CBlockIndexRecord( pindex ) ) ;
+    fileout.write( (const char*)vchRecord.data(), vchRecord.size() ) ;
+    fileout << RecordChecksum( nGeneration, vchRecord.data() ) ;
+}
+
+/** Call f( nBegin, nEnd ) for parts of [ 0, n ) in parallel, f must not throw */
+template < typename Function >
+void ForEachPart( size_t n, Function f )
+{
+    size_t nParts = ( n < 4096 ) ? 1 : std::max( 1, std::min( GetNumCores(), 16 ) ) ;
+    ForEachInParallel( nParts, [ & ]( size_t i ) {  f( n * i / nParts, n * ( i + 1 ) / nParts ) ;  } ) ;
+}
+
+}
+
 CBlockTreeDB::CBlockTreeDB( size_t nCacheSize, bool fMemory, bool fWipe )
     : CDBWrapper( GetDirForData() / "blocks" / "index", nCacheSize, fMemory, fWipe )
+    , nSnapshotGeneration( 0 ), nSnapshotRecords( 0 ), nSnapshotSlots( 0 ), fSnapshotBroken( false )
 {
+    if ( ! fMemory )
+        SetIndexSnapshotPath( GetDirForData() / "blocks" / "indexsnapshot.dat" ) ;
+}
+
+void CBlockTreeDB::SetIndexSnapshotPath( const boost::filesystem::path & path )
+{
+    assert( ::GetSerializeSize( CBlockIndexRecord(), SER_DISK, PEER_VERSION ) == INDEX_SNAPSHOT_RECORD_DATA_SIZE ) ;
+    pathSnapshot = path ;
 }
 
 bool CBlockTreeDB::ReadBlockFileInfo(int nFile, CBlockFileInfo &info) {
@@ -94,35 +435,47 @@ bool CBlockTreeDB::ReadLastBlockFile(int &nFile) {
     return Read(DB_LAST_BLOCK, nFile);
 }
 
+uint256 CBlockTreeDB::ReadBlockFilesHash()
+{
+    int nLastFile = -1 ;
+    CBlockFileInfo info ;
+    if ( ReadLastBlockFile( nLastFile ) )
+        ReadBlockFileInfo( nLastFile, info ) ;
+    return BlockFilesHash( nLastFile, info ) ;
+}
+
 CCoinsViewCursor * CCoinsViewDB::Cursor() const
 {
+    WaitForWrite() ;
     CCoinsViewDBCursor * i = new CCoinsViewDBCursor( const_cast< CDBWrapper * >( &db )->NewIterator(), GetSha256OfBestBlock() ) ;
     /* It seems that there are no const iterators for LevelDB. Since we
        only need read operations on it, use a const-cast to get around
        that restriction */
-    i->pcursor->Seek(DB_COINS);
+    i->pcursor->Seek(DB_COIN);
     // Cache key of first record
     if (i->pcursor->Valid()) {
-        i->pcursor->GetKey(i->keyTmp);
+        CoinEntry entry(&i->keyTmp.second);
+        i->pcursor->GetKey(entry);
+        i->keyTmp.first = entry.key;
     } else {
         i->keyTmp.first = 0; // Make sure Valid() and GetKey() return false
     }
     return i;
 }
 
-bool CCoinsViewDBCursor::GetKey(uint256 &key) const
+bool CCoinsViewDBCursor::GetKey(COutPoint &key) const
 {
     // Return cached key
-    if (keyTmp.first == DB_COINS) {
+    if (keyTmp.first == DB_COIN) {
         key = keyTmp.second;
         return true;
     }
     return false;
 }
 
-bool CCoinsViewDBCursor::GetValue(CCoins &coins) const
+bool CCoinsViewDBCursor::GetValue(Coin &coin) const
 {
-    return pcursor->GetValue(coins);
+    return pcursor->GetValue(coin);
 }
 
 unsigned int CCoinsViewDBCursor::GetValueSize() const
@@ -132,28 +485,265 @@ unsigned int CCoinsViewDBCursor::GetValueSize() const
 
 bool CCoinsViewDBCursor::Valid() const
 {
-    return keyTmp.first == DB_COINS;
+    return keyTmp.first == DB_COIN;
 }
 
 void CCoinsViewDBCursor::Next()
 {
     pcursor->Next();
-    if (!pcursor->Valid() || !pcursor->GetKey(keyTmp))
+    CoinEntry entry(&keyTmp.second);
+    if (!pcursor->Valid() || !pcursor->GetKey(entry)) {
         keyTmp.first = 0; // Invalidate cached key after last record so that Valid() and GetKey() return false
+    } else {
+        keyTmp.first = entry.key;
+    }
 }
 
-bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo) {
+bool CBlockTreeDB::WriteBatchSync( const std::vector< std::pair< int, const CBlockFileInfo* > > & fileInfo, int nLastFile, const std::vector< CBlockIndex * > & blockinfo )
+{
     CDBBatch batch(*this);
+    CBlockFileInfo infoLast ;
+    bool fHaveLast = false ;
     for (std::vector<std::pair<int, const CBlockFileInfo*> >::const_iterator it=fileInfo.begin(); it != fileInfo.end(); it++) {
         batch.Write(std::make_pair(DB_BLOCK_FILES, it->first), *it->second);
+        if ( it->first == nLastFile ) {
+            infoLast = *it->second ;
+            fHaveLast = true ;
+        }
     }
-    batch.Write(DB_LAST_BLOCK, nLastFile);
-    for ( std::vector< const CBlockIndex * >::const_iterator it = blockinfo.begin() ; it != blockinfo.end() ; it ++ ) {
+    for ( std::vector< CBlockIndex * >::const_iterator it = blockinfo.begin() ; it != blockinfo.end() ; it ++ ) {
         batch.Write( std::make_pair( DB_BLOCK_INDEX, ( *it )->GetBlockSha256Hash() ), CDiskBlockIndex( *it ) ) ;
     }
+    if ( ! fHaveLast )
+        ReadBlockFileInfo( nLastFile, infoLast ) ;
+    AppendToIndexSnapshot( blockinfo, BlockFilesHash( nLastFile, infoLast ), batch ) ;
+    batch.Write( DB_LAST_BLOCK, CLastBlockFile( nLastFile, fSnapshotBroken ? 0 : nSnapshotGeneration ) ) ;
     return WriteBatch(batch, true);
 }
 
+void CBlockTreeDB::AppendToIndexSnapshot( std::vector< CBlockIndex * > blocks, const uint256 & hashBlockFiles, CDBBatch & batch )
+{
+    if ( pathSnapshot.empty() || fSnapshotBroken ) return ;
+    if ( blocks.empty() ) {
+        // block files change without blocks too
+        if ( nSnapshotGeneration != 0 )
+            batch.Write( DB_INDEX_SNAPSHOT, CIndexSnapshotInfo( nSnapshotGeneration, nSnapshotRecords, hashBlockFiles ) ) ;
+        return ;
+    }
+
+    // parents get their slots before children
+    std::sort( blocks.begin(), blocks.end(), []( const CBlockIndex * pa, const CBlockIndex * pb ) {
+        return pa->nHeight < pb->nHeight ;
+    } ) ;
+
+    try {
+        // starting with no blocks there's a new file for them
+        uint64_t nGeneration = nSnapshotGeneration ;
+        if ( nGeneration == 0 && nSnapshotSlots > 0 )
+            throw std::runtime_error( "no file for blocks in snapshot" ) ;
+        if ( fileSnapshot == nullptr ) {
+            fileSnapshot.reset( new CAutoFile( fopen( pathSnapshot.string().c_str(), nGeneration == 0 ? "wb" : "rb+" ), SER_DISK, PEER_VERSION ) ) ;
+            if ( fileSnapshot->isNull() )
+                throw std::runtime_error( "can't open " + pathSnapshot.string() ) ;
+            if ( nGeneration == 0 ) {
+                nGeneration = GetRand( std::numeric_limits< uint64_t >::max() - 1 ) + 1 ;
+                *fileSnapshot << FLATDATA( INDEX_SNAPSHOT_MAGIC ) << (uint32_t)INDEX_SNAPSHOT_RECORD_SIZE << nGeneration ;
+            } else {
+                // past the records noted in the database, there may be some of a write which failed
+                long nEnd = INDEX_SNAPSHOT_HEADER_SIZE + (long)nSnapshotRecords * INDEX_SNAPSHOT_RECORD_SIZE ;
+                if ( ! TruncateFile( fileSnapshot->get(), nEnd ) || fseek( fileSnapshot->get(), nEnd, SEEK_SET ) != 0 )
+                    throw std::runtime_error( "can't truncate " + pathSnapshot.string() ) ;
+                FileCommit( fileSnapshot->get() ) ;
+            }
+        }
+        CAutoFile & fileout = *fileSnapshot ;
+
+        uint32_t nSlots = nSnapshotSlots ;
+        for ( CBlockIndex * pindex : blocks ) {
+            if ( pindex->pprev != nullptr && pindex->pprev->nSnapshotSlot < 0 )
+                throw std::runtime_error( "parent of block " + pindex->GetBlockSha256Hash().ToString() + " isn't in snapshot" ) ;
+            if ( pindex->nSnapshotSlot < 0 )
+                pindex->nSnapshotSlot = nSlots ++ ;
+            WriteRecord( fileout, nGeneration, pindex ) ;
+        }
+        // with no sync, records lost in a crash fail their checksums and the database is loaded
+        if ( fflush( fileout.get() ) != 0 )
+            throw std::runtime_error( "can't write to " + pathSnapshot.string() ) ;
+
+        nSnapshotGeneration = nGeneration ;
+        nSnapshotRecords += blocks.size() ;
+        nSnapshotSlots = nSlots ;
+        batch.Write( DB_INDEX_SNAPSHOT, CIndexSnapshotInfo( nSnapshotGeneration, nSnapshotRecords, hashBlockFiles ) ) ;
+    } catch ( const std::exception & e ) {
+        LogPrintf( "%s: %s, the block index will be loaded from the database\n", __func__, e.what() ) ;
+        fileSnapshot.reset() ;
+        fSnapshotBroken = true ;
+        batch.Erase( DB_INDEX_SNAPSHOT ) ;
+    }
+}
+
+bool CBlockTreeDB::WriteIndexSnapshot( const std::vector< CBlockIndex * > & vOrdered )
+{
+    if ( pathSnapshot.empty() ) return true ;
+
+    // whatever goes wrong, the records appended afterwards wouldn't match
+    fSnapshotBroken = true ;
+    nSnapshotGeneration = 0 ;
+    fileSnapshot.reset() ;
+
+    for ( size_t i = 0 ; i < vOrdered.size() ; ++ i )
+        vOrdered[ i ]->nSnapshotSlot = i ;
+
+    uint64_t nGeneration = GetRand( std::numeric_limits< uint64_t >::max() - 1 ) + 1 ;
+    boost::filesystem::path pathNew = pathSnapshot.string() + ".new" ;
+    try {
+        CAutoFile fileout( fopen( pathNew.string().c_str(), "wb" ), SER_DISK, PEER_VERSION ) ;
+        if ( fileout.isNull() )
+            return error( "%s: can't create %s", __func__, pathNew.string() ) ;
+        fileout << FLATDATA( INDEX_SNAPSHOT_MAGIC ) << (uint32_t)INDEX_SNAPSHOT_RECORD_SIZE << nGeneration ;
+        for ( const CBlockIndex * pindex : vOrdered ) {
+            if ( pindex->pprev != nullptr && pindex->pprev->nSnapshotSlot >= pindex->nSnapshotSlot )
+                return error( "%s: parent of block %s isn't before it", __func__, pindex->GetBlockSha256Hash().ToString() ) ;
+            WriteRecord( fileout, nGeneration, pindex ) ;
+        }
+        FileCommit( fileout.get() ) ;
+    } catch ( const std::exception & e ) {
+        return error( "%s: %s", __func__, e.what() ) ;
+    }
+    if ( ! RenameOver( pathNew, pathSnapshot ) )
+        return error( "%s: can't rename %s", __func__, pathNew.string() ) ;
+    int nLastFile = 0 ;
+    ReadLastBlockFile( nLastFile ) ;
+    CDBBatch batch( *this ) ;
+    batch.Write( DB_INDEX_SNAPSHOT, CIndexSnapshotInfo( nGeneration, vOrdered.size(), ReadBlockFilesHash() ) ) ;
+    batch.Write( DB_LAST_BLOCK, CLastBlockFile( nLastFile, nGeneration ) ) ;
+    if ( ! WriteBatch( batch, true ) )
+        return error( "%s: can't write to database", __func__ ) ;
+
+    nSnapshotGeneration = nGeneration ;
+    nSnapshotRecords = vOrdered.size() ;
+    nSnapshotSlots = vOrdered.size() ;
+    fSnapshotBroken = false ;
+    LogPrintf( "%s: %u blocks\n", __func__, vOrdered.size() ) ;
+    return true ;
+}
+
+bool CBlockTreeDB::LoadIndexSnapshot( std::function< CBlockIndex*( const uint256 & ) > insertBlockIndex,
+                                      const std::atomic< bool > & running, std::vector< CBlockIndex * > & vOrdered )
+{
+    // a note of the previous format doesn't read, and the index is loaded from the database
+    CIndexSnapshotInfo info ;
+    if ( pathSnapshot.empty() || ! Read( DB_INDEX_SNAPSHOT, info ) || info.nGeneration == 0 )
+        return false ;
+    CLastBlockFile last ;
+    if ( ! Read( DB_LAST_BLOCK, last ) || last.nSnapshotGeneration != info.nGeneration ) {
+        LogPrintf( "%s: blocks were written by a version which doesn't know of %s\n", __func__, pathSnapshot.string() ) ;
+        return false ;
+    }
+    if ( info.hashBlockFiles != ReadBlockFilesHash() ) {
+        LogPrintf( "%s: block files changed since %s was written\n", __func__, pathSnapshot.string() ) ;
+        return false ;
+    }
+    const size_t nRecords = info.nRecords ;
+    const size_t nNeeded = INDEX_SNAPSHOT_HEADER_SIZE + nRecords * INDEX_SNAPSHOT_RECORD_SIZE ;
+
+    // from a mapping, or from memory where the file can't be mapped
+    std::shared_ptr< const CMappedFile > mapped = MapFile( pathSnapshot.string() ) ;
+    std::vector< char > vchFile ;
+    const char * pbegin = nullptr ;
+    if ( mapped != nullptr && mapped->size() >= nNeeded ) {
+        pbegin = mapped->data() ;
+    } else if ( mapped == nullptr ) {
+        CAutoFile filein( fopen( pathSnapshot.string().c_str(), "rb" ), SER_DISK, PEER_VERSION ) ;
+        vchFile.resize( nNeeded ) ;
+        if ( ! filein.isNull() && fread( vchFile.data(), 1, nNeeded, filein.get() ) == nNeeded )
+            pbegin = vchFile.data() ;
+    }
+    if ( pbegin == nullptr ) {
+        LogPrintf( "%s: no %u records in %s\n", __func__, nRecords, pathSnapshot.string() ) ;
+        return false ;
+    }
+
+    std::vector< CBlockIndexRecord > records( nRecords ) ;
+    try {
+        char magic[ 4 ] ;
+        uint32_t nRecordSize ;
+        uint64_t nGeneration ;
+        CMemoryReader header( SER_DISK, PEER_VERSION, pbegin, pbegin + INDEX_SNAPSHOT_HEADER_SIZE ) ;
+        header >> FLATDATA( magic ) >> nRecordSize >> nGeneration ;
+        if ( memcmp( magic, INDEX_SNAPSHOT_MAGIC, sizeof( magic ) ) != 0 || nRecordSize != INDEX_SNAPSHOT_RECORD_SIZE || nGeneration != info.nGeneration ) {
+            LogPrintf( "%s: %s isn't the snapshot noted in the database\n", __func__, pathSnapshot.string() ) ;
+            return false ;
+        }
+    } catch ( const std::exception & e ) {
+        return false ;
+    }
+
+    std::atomic< bool > fBadRecord( false ) ;
+    ForEachPart( nRecords, [ & ]( size_t nBegin, size_t nEnd ) {
+        const char * pfirst = pbegin + INDEX_SNAPSHOT_HEADER_SIZE ;
+        try {
+            CMemoryReader reader( SER_DISK, PEER_VERSION, pfirst + nBegin * INDEX_SNAPSHOT_RECORD_SIZE, pfirst + nEnd * INDEX_SNAPSHOT_RECORD_SIZE ) ;
+            for ( size_t i = nBegin ; i < nEnd && ! fBadRecord ; ++ i ) {
+                uint64_t nChecksum ;
+                const unsigned char * precord = (const unsigned char *)pfirst + i * INDEX_SNAPSHOT_RECORD_SIZE ;
+                reader >> records[ i ] >> nChecksum ;
+                if ( nChecksum != RecordChecksum( info.nGeneration, precord ) )
+                    fBadRecord = true ;
+            }
+        } catch ( const std::exception & e ) {
+            fBadRecord = true ;
+        }
+    } ) ;
+    if ( fBadRecord ) {
+        LogPrintf( "%s: records of %s don't match their checksums\n", __func__, pathSnapshot.string() ) ;
+        return false ;
+    }
+
+    // The latest record of every block. New blocks take the next slot, and the parent's slot is before
+    std::vector< uint32_t > vLatest ;
+    for ( size_t i = 0 ; i < nRecords ; ++ i ) {
+        const CBlockIndexRecord & record = records[ i ] ;
+        if ( record.nSlot == vLatest.size() && ( record.nPrevSlot == CBlockIndexRecord::NO_SLOT || record.nPrevSlot < record.nSlot ) ) {
+            vLatest.push_back( i ) ;
+        } else if ( record.nSlot < vLatest.size() && record.hash == records[ vLatest[ record.nSlot ] ].hash
+                        && record.nPrevSlot == records[ vLatest[ record.nSlot ] ].nPrevSlot ) {
+            vLatest[ record.nSlot ] = i ;
+        } else {
+            LogPrintf( "%s: record %u of %s is broken\n", __func__, i, pathSnapshot.string() ) ;
+            return false ;
+        }
+    }
+
+    if ( ! running ) {
+        LogPrintf( "%s: stopping\n", __func__ ) ;
+        throw std::string( "stopthread" ) ;
+    }
+
+    // Entries are put into the map one by one, and filled in parallel
+    vOrdered.resize( vLatest.size() ) ;
+    for ( size_t nSlot = 0 ; nSlot < vLatest.size() ; ++ nSlot ) {
+        CBlockIndex * pindex = insertBlockIndex( records[ vLatest[ nSlot ] ].hash ) ;
+        if ( pindex->nSnapshotSlot >= 0 )
+            return error( "%s: block %s is in %s twice", __func__, pindex->GetBlockSha256Hash().ToString(), pathSnapshot.string() ) ;
+        pindex->nSnapshotSlot = nSlot ;
+        vOrdered[ nSlot ] = pindex ;
+    }
+    ForEachPart( vOrdered.size(), [ & ]( size_t nBegin, size_t nEnd ) {
+        for ( size_t nSlot = nBegin ; nSlot < nEnd ; ++ nSlot ) {
+            const CBlockIndexRecord & record = records[ vLatest[ nSlot ] ] ;
+            record.ApplyTo( vOrdered[ nSlot ] ) ;
+            vOrdered[ nSlot ]->pprev = ( record.nPrevSlot != CBlockIndexRecord::NO_SLOT ) ? vOrdered[ record.nPrevSlot ] : nullptr ;
+        }
+    } ) ;
+
+    nSnapshotGeneration = info.nGeneration ;
+    nSnapshotRecords = nRecords ;
+    nSnapshotSlots = vOrdered.size() ;
+    LogPrintf( "%s: %u blocks from %u records of %s\n", __func__, vOrdered.size(), nRecords, pathSnapshot.string() ) ;
+    return true ;
+}
+
 bool CBlockTreeDB::ReadTxIndex(const uint256 &txid, CDiskTxPos &pos) {
     return Read(std::make_pair(DB_TXINDEX, txid), pos);
 }
@@ -178,8 +768,18 @@ bool CBlockTreeDB::ReadFlag(const std::string &name, bool &fValue) {
 }
 
 bool CBlockTreeDB::LoadBlockIndexGuts( std::function< CBlockIndex*( const uint256 & ) > insertBlockIndex,
-                                        const std::atomic< bool > & running )
+                                        const std::atomic< bool > & running, std::vector< CBlockIndex * > & vOrdered )
 {
+    vOrdered.clear() ;
+    if ( LoadIndexSnapshot( insertBlockIndex, running, vOrdered ) ) {
+        // there are many more records than blocks after many writes
+        if ( IndexSnapshotWantsCompacting() )
+            WriteIndexSnapshot( vOrdered ) ;
+        return true ;
+    }
+    if ( ! vOrdered.empty() )
+        return false ;
+
     std::unique_ptr< CDBIterator > pcursor( NewIterator() ) ;
 
     pcursor->Seek(std::make_pair(DB_BLOCK_INDEX, uint256()));
@@ -223,3 +823,126 @@ bool CBlockTreeDB::LoadBlockIndexGuts( std::function< CBlockIndex*( const uint25
 
     return true;
 }
+
+namespace {
+
+//! Legacy class to deserialize pre-pertxout database entries without reindex
+class CCoins
+{
+public:
+    //! whether transaction is a coinbase
+    bool fCoinBase;
+
+    //! unspent transaction outputs; spent outputs are .IsNull(); spent outputs at the end of the array are dropped
+    std::vector<CTxOut> vout;
+
+    //! at which height this transaction was included in the active block chain
+    int nHeight;
+
+    //! empty constructor
+    CCoins() : fCoinBase(false), vout(0), nHeight(0) { }
+
+    template<typename Stream>
+    void Unserialize(Stream &s) {
+        unsigned int nCode = 0;
+        // version
+        int nVersionDummy;
+        ::Unserialize(s, VARINT(nVersionDummy));
+        // header code
+        ::Unserialize(s, VARINT(nCode));
+        fCoinBase = nCode & 1;
+        std::vector<bool> vAvail(2, false);
+        vAvail[0] = (nCode & 2) != 0;
+        vAvail[1] = (nCode & 4) != 0;
+        unsigned int nMaskCode = (nCode / 8) + ((nCode & 6) != 0 ? 0 : 1);
+        // spentness bitmask
+        while (nMaskCode > 0) {
+            unsigned char chAvail = 0;
+            ::Unserialize(s, chAvail);
+            for (unsigned int p = 0; p < 8; p++) {
+                bool f = (chAvail & (1 << p)) != 0;
+                vAvail.push_back(f);
+            }
+            if (chAvail != 0)
+                nMaskCode--;
+        }
+        // txouts themself
+        vout.assign(vAvail.size(), CTxOut());
+        for (unsigned int i = 0; i < vAvail.size(); i++) {
+            if (vAvail[i])
+                ::Unserialize(s, REF(CTxOutCompressor(vout[i])));
+        }
+        // coinbase height
+        ::Unserialize(s, VARINT(nHeight));
+    }
+};
+
+}
+
+/** Upgrade the database from older formats
+ *
+ * Currently implemented: from the per-tx utxo model to per-txout
+ */
+bool CCoinsViewDB::Upgrade()
+{
+    std::unique_ptr< CDBIterator > pcursor( db.NewIterator() ) ;
+    pcursor->Seek( std::make_pair( DB_COINS, uint256() ) ) ;
+    if ( ! pcursor->Valid() )
+        return true ;
+
+    int64_t count = 0 ;
+    LogPrintf( "Upgrading utxo-set database...\n" ) ;
+    LogPrintf( "[0%%]..." ) ;
+    uiInterface.ShowProgress( _("Upgrading UTXO database"), 0 ) ;
+    size_t batch_size = 1 << 24 ;
+    CDBBatch batch( db ) ;
+    int reportDone = 0 ;
+    std::pair< unsigned char, uint256 > key ;
+    std::pair< unsigned char, uint256 > prev_key = { DB_COINS, uint256() } ;
+    while ( pcursor->Valid() ) {
+        if ( ShutdownRequested() ) break ;
+
+        if ( pcursor->GetKey( key ) && key.first == DB_COINS ) {
+            if ( count ++ % 256 == 0 ) {
+                uint32_t high = 0x100 * *key.second.begin() + *( key.second.begin() + 1 ) ;
+                int percentageDone = (int)( high * 100.0 / 65536.0 + 0.5 ) ;
+                uiInterface.ShowProgress( _("Upgrading UTXO database"), percentageDone ) ;
+                if ( reportDone < percentageDone / 10 ) {
+                    // report max. every 10% step
+                    LogPrintf( "[%d%%]...", percentageDone ) ;
+                    reportDone = percentageDone / 10 ;
+                }
+            }
+            CCoins old_coins ;
+            if ( ! pcursor->GetValue( old_coins ) )
+                return error( "%s: cannot parse CCoins record", __func__ ) ;
+
+            // old record and its new ones are in the same batch, so an interrupted
+            // upgrade leaves every transaction in one format or the other
+            COutPoint outpoint( key.second, 0 ) ;
+            for ( size_t i = 0 ; i < old_coins.vout.size() ; ++ i ) {
+                if ( ! old_coins.vout[ i ].IsNull() && ! old_coins.vout[ i ].scriptPubKey.IsUnspendable() ) {
+                    Coin newcoin( std::move( old_coins.vout[ i ] ), old_coins.nHeight, old_coins.fCoinBase ) ;
+                    outpoint.n = i ;
+                    CoinEntry entry( &outpoint ) ;
+                    batch.Write( entry, newcoin ) ;
+                }
+            }
+            batch.Erase( key ) ;
+            if ( batch.SizeEstimate() > batch_size ) {
+                db.WriteBatch( batch ) ;
+                batch.Clear() ;
+                db.CompactRange( prev_key, key ) ;
+                prev_key = key ;
+            }
+            pcursor->Next() ;
+        } else {
+            break ;
+        }
+    }
+    db.WriteBatch( batch ) ;
+    db.CompactRange( std::make_pair( (unsigned char)DB_COINS, uint256() ), key ) ;
+    uiInterface.ShowProgress( "", 100 ) ;
+    LogPrintf( "[%s].\n", ShutdownRequested() ? "CANCELLED" : "DONE" ) ;
+    return ! ShutdownRequested() ;
+}
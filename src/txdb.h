@@ -12,9 +12,13 @@
 #include "chain.h"
 
 #include <atomic>
+#include <condition_variable>
 #include <functional>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -73,14 +77,51 @@ class CCoinsViewDB : public AbstractCoinsView
 {
 protected:
     CDBWrapper db;
+
+    /**
+     * With background writes, BatchWrite takes the coins and returns, and they
+     * are written by writerThread. Until written they are read from mapWriting,
+     * so the view looks the same as with coins written right away. The write
+     * is one leveldb batch together with the best block, on crash the database
+     * is left as it was after the previous write. Memory of coins not written yet
+     * is part of the -dbcache budget like that of the cache, see WritingMemoryUsage
+     */
+    bool fBackgroundWrites ;
+    std::thread writerThread ;
+    mutable std::mutex mutexWriting ;
+    mutable std::condition_variable condWriting ;
+    CCoinsMap mapWriting ;
+    size_t nWritingUsage ;
+    uint256 hashBlockWriting ;
+    bool fWriting ;
+    bool fWriteFailed ;
+    bool fQuit ;
+
+    bool WriteCoins( const CCoinsMap & mapCoins, const uint256 & hashBlock ) ;
+    void ThreadWriteCoins() ;
+    //! Whether the coin is among those not written yet, sets coin to it when it is
+    bool GetWritingCoin( const COutPoint & outpoint, Coin & coin ) const ;
+    void WaitForWrite() const ;
+
 public:
     CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    ~CCoinsViewDB() ;
 
-    virtual bool GetCoins( const uint256 & txid, CCoins & coins ) const override ;
-    virtual bool HaveCoins( const uint256 & txid ) const override ;
+    virtual bool GetCoin( const COutPoint & outpoint, Coin & coin ) const override ;
+    virtual bool HaveCoin( const COutPoint & outpoint ) const override ;
     virtual uint256 GetSha256OfBestBlock() const override ;
     virtual bool BatchWrite( CCoinsMap & mapCoins, const uint256 & hashBlock ) override ;
     virtual CCoinsViewCursor * Cursor() const override ;
+    virtual bool Sync() override ;
+
+    //! From now on coins are written on a thread of their own, the next write waits for the previous one
+    void StartBackgroundWrites() ;
+
+    //! Memory taken by coins passed to BatchWrite and not written yet, 0 when there are none
+    virtual size_t WritingMemoryUsage() const override ;
+
+    //! Attempt to update from an older database format. Returns whether the upgrade succeeded
+    bool Upgrade() ;
 } ;
 
 /** Specialization of CCoinsViewCursor to iterate over a CCoinsViewDB */
@@ -89,8 +130,8 @@ class CCoinsViewDBCursor: public CCoinsViewCursor
 public:
     ~CCoinsViewDBCursor() {}
 
-    virtual bool GetKey( uint256 & key ) const override;
-    virtual bool GetValue( CCoins & coins ) const override ;
+    virtual bool GetKey( COutPoint & key ) const override ;
+    virtual bool GetValue( Coin & coin ) const override ;
     virtual unsigned int GetValueSize() const override ;
 
     virtual bool Valid() const override ;
@@ -101,7 +142,7 @@ private:
         CCoinsViewCursor( hashBlockIn ), pcursor( pcursorIn ) { }
 
     std::unique_ptr< CDBIterator > pcursor ;
-    std::pair< char, uint256 > keyTmp ;
+    std::pair< char, COutPoint > keyTmp ;
 
     friend class CCoinsViewDB ;
 };
@@ -114,8 +155,36 @@ public:
 private:
     CBlockTreeDB(const CBlockTreeDB&);
     void operator=(const CBlockTreeDB&);
+
+    /**
+     * Every write of the block index is also appended to a file of fixed size
+     * records, in the order blocks got there first, so parents come before
+     * children. Loading it is reading the records in parallel from a mapping
+     * of the file, without iterating the database, hashing headers or sorting.
+     * The database is still what's true: each write of the index stores which
+     * generation of the file and how many of its records go with it, with a hash
+     * of the last block file and its info, which versions not knowing the file
+     * change too. The generation is also kept after the number of the last block
+     * file, which such versions write without it along with any blocks. When
+     * that doesn't match or a record fails its checksum, the
+     * index is loaded from the database and written to a new generation of the file
+     */
+    boost::filesystem::path pathSnapshot ;
+    uint64_t nSnapshotGeneration ; // 0 when there's no file to append to
+    uint32_t nSnapshotRecords ;
+    uint32_t nSnapshotSlots ;
+    bool fSnapshotBroken ;
+    std::unique_ptr< CAutoFile > fileSnapshot ; // open for appending since the first append
+
+    //! Append records of these blocks, and note them in the batch with the hash of block files
+    void AppendToIndexSnapshot( std::vector< CBlockIndex * > blocks, const uint256 & hashBlockFiles, CDBBatch & batch ) ;
+    //! Hash of the last block file and its info as they are in the database
+    uint256 ReadBlockFilesHash() ;
+    bool LoadIndexSnapshot( std::function< CBlockIndex*( const uint256 & ) > insertBlockIndex,
+                            const std::atomic< bool > & running, std::vector< CBlockIndex * > & vOrdered ) ;
+
 public:
-    bool WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo);
+    bool WriteBatchSync( const std::vector< std::pair< int, const CBlockFileInfo* > > & fileInfo, int nLastFile, const std::vector< CBlockIndex * > & blockinfo ) ;
     bool ReadBlockFileInfo(int nFile, CBlockFileInfo &fileinfo);
     bool ReadLastBlockFile(int &nFile);
     bool WriteReindexing(bool fReindex);
@@ -124,7 +193,23 @@ public:
     bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &list);
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
-    bool LoadBlockIndexGuts( std::function< CBlockIndex*( const uint256 & ) > insertBlockIndex, const std::atomic< bool > & running ) ;
+
+    /**
+     * Load the whole block index, from the snapshot when there's a valid one,
+     * then vOrdered has all the blocks with parents before children. Otherwise
+     * from the database and vOrdered is empty
+     */
+    bool LoadBlockIndexGuts( std::function< CBlockIndex*( const uint256 & ) > insertBlockIndex,
+                             const std::atomic< bool > & running, std::vector< CBlockIndex * > & vOrdered ) ;
+
+    //! Write all these blocks, parents before children, to a new generation of the block index snapshot
+    bool WriteIndexSnapshot( const std::vector< CBlockIndex * > & vOrdered ) ;
+
+    //! Whether there are so many more records in the snapshot than blocks that it's better written again
+    bool IndexSnapshotWantsCompacting() const {  return nSnapshotGeneration != 0 && nSnapshotRecords > 2 * nSnapshotSlots + 1000 ;  }
+
+    //! Keep the block index snapshot in this file, none by default for a database in memory
+    void SetIndexSnapshotPath( const boost::filesystem::path & path ) ;
 };
 
 #endif
@@ -375,17 +375,10 @@ const CTransaction & CTxMemPool::getTxByHash( uint256 hash )
     return ( *it ).GetTx() ;
 }
 
-void CTxMemPool::pruneSpent(const uint256 &hashTx, CCoins &coins)
+bool CTxMemPool::isSpent( const COutPoint & outpoint ) const
 {
-    LOCK(cs);
-
-    auto it = mapNextTx.lower_bound(COutPoint(hashTx, 0));
-
-    // iterate over all COutPoints in mapNextTx whose hash equals the provided hashTx
-    while (it != mapNextTx.end() && it->first->hash == hashTx) {
-        coins.Spend(it->first->n); // and remove those outputs from coins
-        it++;
-    }
+    LOCK( cs ) ;
+    return mapNextTx.count( outpoint ) != 0 ;
 }
 
 unsigned int CTxMemPool::GetTransactionsUpdated() const
@@ -564,10 +557,10 @@ void CTxMemPool::removeForReorg(const CCoinsViewCache *pcoins, unsigned int nMem
                 indexed_transaction_set::const_iterator it2 = mapTx.find(txin.prevout.hash);
                 if (it2 != mapTx.end())
                     continue;
-                const CCoins * coins = pcoins->AccessCoins( txin.prevout.hash ) ;
-                if ( nCheckFrequency != 0 ) assert( coins != nullptr ) ;
-                int nCoinbaseMaturity = Params().GetConsensus( coins->nHeight ).nCoinbaseMaturity ;
-                if ( coins == nullptr || ( coins->IsCoinBase() && ( (signed long)nMemPoolHeight ) - coins->nHeight < nCoinbaseMaturity ) ) {
+                const Coin & coin = pcoins->AccessCoin( txin.prevout ) ;
+                if ( nCheckFrequency != 0 ) assert( ! coin.IsSpent() ) ;
+                int nCoinbaseMaturity = Params().GetConsensus( coin.nHeight ).nCoinbaseMaturity ;
+                if ( coin.IsSpent() || ( coin.IsCoinBase() && ( (signed long)nMemPoolHeight ) - coin.nHeight < nCoinbaseMaturity ) ) {
                     txToRemove.insert( it ) ;
                     break ;
                 }
@@ -689,8 +682,7 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
                     parentSigOpCost += it2->GetSigOpCost();
                 }
             } else {
-                const CCoins* coins = pcoins->AccessCoins(txin.prevout.hash);
-                assert(coins && coins->IsAvailable(txin.prevout.n));
+                assert(pcoins->HaveCoin(txin.prevout));
             }
             // Check whether its inputs are marked in mapNextTx
             auto it3 = mapNextTx.find(txin.prevout);
@@ -928,20 +920,24 @@ bool CTxMemPool::HasNoInputsOf(const CTransaction &tx) const
     return true;
 }
 
-bool CCoinsViewMemPool::GetCoins(const uint256 &txid, CCoins &coins) const {
+bool CCoinsViewMemPool::GetCoin( const COutPoint & outpoint, Coin & coin ) const {
     // If an entry in the mempool exists, always return that one, as it's guaranteed to never
     // conflict with the underlying cache, and it cannot have pruned entries (as it contains full)
     // transactions. First checking the underlying cache risks returning a pruned entry instead
-    CTransactionRef ptx = mempool.get(txid);
-    if (ptx) {
-        coins = CCoins(*ptx, MEMPOOL_HEIGHT);
-        return true;
+    CTransactionRef ptx = mempool.get( outpoint.hash ) ;
+    if ( ptx ) {
+        if ( outpoint.n < ptx->vout.size() ) {
+            coin = Coin( ptx->vout[ outpoint.n ], MEMPOOL_HEIGHT, false ) ;
+            return true ;
+        } else {
+            return false ;
+        }
     }
-    return (base->GetCoins(txid, coins) && !coins.IsPruned());
+    return ( base->GetCoin( outpoint, coin ) && ! coin.IsSpent() ) ;
 }
 
-bool CCoinsViewMemPool::HaveCoins( const uint256 & txid ) const {
-    return mempool.exists( txid ) || base->HaveCoins( txid ) ;
+bool CCoinsViewMemPool::HaveCoin( const COutPoint & outpoint ) const {
+    return mempool.exists( outpoint ) || base->HaveCoin( outpoint ) ;
 }
 
 size_t CTxMemPool::DynamicMemoryUsage() const {
@@ -1020,7 +1016,7 @@ const CTxMemPool::setEntries & CTxMemPool::GetMemPoolChildren(txiter entry) cons
     return it->second.children;
 }
 
-void CTxMemPool::TrimToSize(size_t sizelimit, std::vector<uint256>* pvNoSpendsRemaining) {
+void CTxMemPool::TrimToSize(size_t sizelimit, std::vector<COutPoint>* pvNoSpendsRemaining) {
     LOCK(cs);
 
     unsigned nTxnRemoved = 0 ;
@@ -1043,9 +1039,7 @@ void CTxMemPool::TrimToSize(size_t sizelimit, std::vector<uint256>* pvNoSpendsRe
                 for ( const CTxIn & txin : tx.vin ) {
                     if (exists(txin.prevout.hash))
                         continue;
-                    auto iter = mapNextTx.lower_bound(COutPoint(txin.prevout.hash, 0));
-                    if (iter == mapNextTx.end() || iter->first->hash != txin.prevout.hash)
-                        pvNoSpendsRemaining->push_back(txin.prevout.hash);
+                    pvNoSpendsRemaining->push_back(txin.prevout);
                 }
             }
         }
@@ -17,6 +17,7 @@
 #include "amount.h"
 #include "feerate.h"
 #include "coins.h"
+#include "hash.h"
 #include "indirectmap.h"
 #include "primitives/transaction.h"
 #include "sync.h"
@@ -32,7 +33,7 @@
 class CAutoFile ;
 class CBlockIndex ;
 
-/** Fake height value used in CCoins to signify they are only in the memory pool */
+/** Fake height value used in Coin to signify they are only in the memory pool */
 static const unsigned int MEMPOOL_HEIGHT = 0x7FFFFFFF ;
 
 struct LockPoints
@@ -201,6 +202,23 @@ private:
     const LockPoints& lp;
 };
 
+class SaltedTxHasher
+{
+private:
+    /** Salt */
+    const uint64_t k0, k1 ;
+
+public:
+    SaltedTxHasher() :
+        k0( GetRand( std::numeric_limits< uint64_t >::max() ) ),
+        k1( GetRand( std::numeric_limits< uint64_t >::max() ) )
+    { }
+
+    size_t operator()( const uint256 & txhash ) const {
+        return SipHashUint256( k0, k1, txhash ) ;
+    }
+};
+
 // extracts a TxMemPoolEntry's transaction hash
 struct mempoolentry_txid
 {
@@ -517,7 +535,7 @@ public:
     void _clear(); //lock free
     bool CompareDepthAndScore(const uint256& hasha, const uint256& hashb);
     void queryHashes(std::vector<uint256>& vtxid);
-    void pruneSpent(const uint256& hash, CCoins &coins);
+    bool isSpent( const COutPoint & outpoint ) const ;
     unsigned int GetTransactionsUpdated() const;
     void AddTransactionsUpdated(unsigned int n);
     /**
@@ -573,7 +591,7 @@ public:
       *  pvNoSpendsRemaining, if set, will be populated with the list of transactions
       *  which are not in mempool which no longer have any spends in this mempool
       */
-    void TrimToSize(size_t sizelimit, std::vector<uint256>* pvNoSpendsRemaining=NULL);
+    void TrimToSize(size_t sizelimit, std::vector<COutPoint>* pvNoSpendsRemaining=NULL);
 
     /** Expire all transaction (and their dependencies) in the mempool older than time.
       * Return the number of removed transactions */
@@ -600,6 +618,13 @@ public:
         return (mapTx.count(hash) != 0);
     }
 
+    bool exists( const COutPoint & outpoint ) const
+    {
+        LOCK( cs ) ;
+        auto it = mapTx.find( outpoint.hash ) ;
+        return ( it != mapTx.end() && outpoint.n < it->GetTx().vout.size() ) ;
+    }
+
     CTransactionRef get(const uint256& hash) const;
     TxMempoolInfo info(const uint256& hash) const;
     std::vector<TxMempoolInfo> infoAll() const;
@@ -663,8 +688,8 @@ public:
         , mempool( mempoolIn )
     { }
 
-    virtual bool GetCoins( const uint256 & txhash, CCoins & coins ) const override ;
-    virtual bool HaveCoins( const uint256 & txhash ) const override ;
+    virtual bool GetCoin( const COutPoint & outpoint, Coin & coin ) const override ;
+    virtual bool HaveCoin( const COutPoint & outpoint ) const override ;
 } ;
 
 // We want to sort transactions by coin age priority
@@ -6,59 +6,93 @@
 #ifndef BITCOIN_UNDO_H
 #define BITCOIN_UNDO_H
 
-#include "compressor.h" 
+#include "coins.h"
+#include "compressor.h"
+#include "consensus/consensus.h"
 #include "primitives/transaction.h"
 #include "serialize.h"
+#include "version.h"
 
-/** Undo information for a CTxIn
+/** Undo information for a CTxIn is the Coin it spent
  *
- *  Contains the prevout's CTxOut being spent, and if this was the
- *  last output of the affected transaction, its metadata as well
- *  (coinbase or not, height, transaction version)
+ *  Formatted as the former CTxInUndo for undo files written before: code of
+ *  height and coinbase flag, then for records with height a transaction version
+ *  which isn't used anymore, then the txout. Old records have height and
+ *  coinbase flag only for the last unspent output of a transaction
  */
-class CTxInUndo
+class TxInUndoSerializer
 {
+    const Coin * txout ;
+
 public:
-    CTxOut txout;         // the txout data before being spent
-    bool fCoinBase;       // if the outpoint was the last unspent: whether it belonged to a coinbase
-    unsigned int nHeight; // if the outpoint was the last unspent: its height
-    int nVersion;         // if the outpoint was the last unspent: its version
-
-    CTxInUndo() : txout(), fCoinBase(false), nHeight(0), nVersion(0) {}
-    CTxInUndo(const CTxOut &txoutIn, bool fCoinBaseIn = false, unsigned int nHeightIn = 0, int nVersionIn = 0) : txout(txoutIn), fCoinBase(fCoinBaseIn), nHeight(nHeightIn), nVersion(nVersionIn) { }
-
-    template<typename Stream>
-    void Serialize(Stream &s) const {
-        ::Serialize(s, VARINT(nHeight*2+(fCoinBase ? 1 : 0)));
-        if (nHeight > 0)
-            ::Serialize(s, VARINT(this->nVersion));
-        ::Serialize(s, CTxOutCompressor(REF(txout)));
+    template < typename Stream >
+    void Serialize( Stream & s ) const {
+        ::Serialize( s, VARINT( txout->nHeight * 2 + ( txout->fCoinBase ? 1 : 0 ) ) ) ;
+        if ( txout->nHeight > 0 ) {
+            // Required to maintain compatibility with older undo format
+            ::Serialize( s, (unsigned char)0 ) ;
+        }
+        ::Serialize( s, CTxOutCompressor( REF( txout->out ) ) ) ;
     }
 
-    template<typename Stream>
-    void Unserialize(Stream &s) {
-        unsigned int nCode = 0;
-        ::Unserialize(s, VARINT(nCode));
-        nHeight = nCode / 2;
-        fCoinBase = nCode & 1;
-        if (nHeight > 0)
-            ::Unserialize(s, VARINT(this->nVersion));
-        ::Unserialize(s, REF(CTxOutCompressor(REF(txout))));
+    TxInUndoSerializer( const Coin * coin ) : txout( coin ) {}
+} ;
+
+class TxInUndoDeserializer
+{
+    Coin * txout ;
+
+public:
+    template < typename Stream >
+    void Unserialize( Stream & s ) {
+        unsigned int nCode = 0 ;
+        ::Unserialize( s, VARINT( nCode ) ) ;
+        txout->nHeight = nCode / 2 ;
+        txout->fCoinBase = nCode & 1 ;
+        if ( txout->nHeight > 0 ) {
+            // Old versions stored the version number for the last spend of
+            // a transaction's outputs. Non-final spends were indicated with
+            // height = 0
+            int nVersionDummy ;
+            ::Unserialize( s, VARINT( nVersionDummy ) ) ;
+        }
+        ::Unserialize( s, REF( CTxOutCompressor( REF( txout->out ) ) ) ) ;
     }
-};
+
+    TxInUndoDeserializer( Coin * coin ) : txout( coin ) {}
+} ;
+
+static const size_t MIN_TRANSACTION_INPUT_WEIGHT = WITNESS_SCALE_FACTOR * ::GetSerializeSize( CTxIn(), SER_NETWORK, PROTOCOL_VERSION ) ;
+static const size_t MAX_INPUTS_PER_BLOCK = MAX_BLOCK_WEIGHT / MIN_TRANSACTION_INPUT_WEIGHT ;
 
 /** Undo information for a CTransaction */
 class CTxUndo
 {
 public:
     // undo information for all txins
-    std::vector<CTxInUndo> vprevout;
+    std::vector< Coin > vprevout ;
 
-    ADD_SERIALIZE_METHODS;
+    // Coin serializes itself as in the chainstate, so the vector (de)serializer
+    // doesn't fit: each element goes through the undo format of TxInUndo*
 
-    template <typename Stream, typename Operation>
-    inline void SerializationOp(Stream& s, Operation ser_action) {
-        READWRITE(vprevout);
+    template < typename Stream >
+    void Serialize( Stream & s ) const {
+        uint64_t count = vprevout.size() ;
+        ::Serialize( s, COMPACTSIZE( REF( count ) ) ) ;
+        for ( const Coin & prevout : vprevout )
+            ::Serialize( s, REF( TxInUndoSerializer( &prevout ) ) ) ;
+    }
+
+    template < typename Stream >
+    void Unserialize( Stream & s ) {
+        // the count is checked before anything is allocated for it
+        uint64_t count = 0 ;
+        ::Unserialize( s, COMPACTSIZE( count ) ) ;
+        if ( count > MAX_INPUTS_PER_BLOCK )
+            throw std::ios_base::failure( "Too many input undo records" ) ;
+        vprevout.resize( count ) ;
+        for ( Coin & prevout : vprevout )
+            ::Unserialize( s, REF( TxInUndoDeserializer( &prevout ) ) ) ;
     }
 };
 
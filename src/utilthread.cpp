@@ -3,6 +3,11 @@
 
 #include "utilthread.h"
 
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
 #if defined(HAVE_CONFIG_H)
 #include "config/dogecoin-config.h"
 #endif
@@ -16,6 +21,11 @@
 #include <pthread_np.h>
 #endif
 
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
 void RenameThread( const std::string & name )
 {
 #if defined(PR_SET_NAME)
@@ -30,12 +40,125 @@ void RenameThread( const std::string & name )
 #endif
 }
 
+void PinThreadToCore( size_t n )
+{
+#if defined(__linux__)
+    // only cores of the process' affinity mask, others may be unavailable
+    cpu_set_t allowed ;
+    CPU_ZERO( &allowed ) ;
+    if ( ::sched_getaffinity( 0, sizeof( allowed ), &allowed ) != 0 ) return ;
+    int count = CPU_COUNT( &allowed ) ;
+    if ( count <= 1 ) return ;
+
+    size_t skip = n % count ;
+    for ( int cpu = 0 ; cpu < CPU_SETSIZE ; cpu ++ ) {
+        if ( ! CPU_ISSET( cpu, &allowed ) ) continue ;
+        if ( skip -- > 0 ) continue ;
+
+        cpu_set_t one ;
+        CPU_ZERO( &one ) ;
+        CPU_SET( cpu, &one ) ;
+        ::pthread_setaffinity_np( ::pthread_self(), sizeof( one ), &one ) ;
+        return ;
+    }
+#else
+    ( void ) n ; // not used
+#endif
+}
+
 void JoinAll( std::vector< std::thread > & threads )
 {
     for ( std::thread & thread : threads )
         if ( thread.joinable() ) thread.join() ;
 }
 
+/**
+ * One call of ForEachInParallel. Calls share the workers but not a queue:
+ * each has items of its own, workers take items of calls in turn and the
+ * caller takes items of its own call only, so a call doesn't wait for
+ * items of another one even when all workers are busy
+ */
+struct CParallelJob
+{
+    const std::function< void( size_t ) > & func ;
+    const size_t n ;
+    size_t nNext ; // next item to take
+    size_t nDone ;
+    std::condition_variable condDone ;
+
+    CParallelJob( const std::function< void( size_t ) > & f, size_t count ) : func( f ), n( count ), nNext( 0 ), nDone( 0 ) {}
+} ;
+
+static std::mutex mutexParallelTasks ;
+static std::condition_variable condParallelWorker ;
+static std::deque< CParallelJob * > jobsParallel ; // calls with items not taken yet
+static bool fQuitParallelTasks = false ;
+static int nParallelWorkers = 0 ; // the last one to quit lets workers be started again
+
+//! Take the next item of the job and put the job behind the others, with mutexParallelTasks held
+static size_t TakeParallelItem( CParallelJob & job )
+{
+    jobsParallel.erase( std::find( jobsParallel.begin(), jobsParallel.end(), &job ) ) ;
+    size_t i = job.nNext ++ ;
+    if ( job.nNext < job.n )
+        jobsParallel.push_back( &job ) ;
+    return i ;
+}
+
+//! Call the function for the item with the lock released, then count the item done
+static void RunParallelItem( CParallelJob & job, size_t i, std::unique_lock< std::mutex > & lock )
+{
+    lock.unlock() ;
+    job.func( i ) ;
+    lock.lock() ;
+    if ( ++ job.nDone == job.n )
+        job.condDone.notify_one() ;
+}
+
+void ThreadParallelTasks()
+{
+    RenameThread( "partask" ) ;
+    std::unique_lock< std::mutex > lock( mutexParallelTasks ) ;
+    nParallelWorkers ++ ;
+    while ( true ) {
+        condParallelWorker.wait( lock, [] {  return fQuitParallelTasks || ! jobsParallel.empty() ;  } ) ;
+        if ( fQuitParallelTasks ) {
+            if ( -- nParallelWorkers == 0 )
+                fQuitParallelTasks = false ;
+            return ;
+        }
+        CParallelJob & job = *jobsParallel.front() ;
+        RunParallelItem( job, TakeParallelItem( job ), lock ) ;
+    }
+}
+
+void StopParallelTasks()
+{
+    LogPrintf( "%s()\n", __func__ ) ;
+    std::lock_guard< std::mutex > lock( mutexParallelTasks ) ;
+    fQuitParallelTasks = ( nParallelWorkers > 0 ) ;
+    condParallelWorker.notify_all() ;
+}
+
+void ForEachInParallel( size_t n, const std::function< void( size_t ) > & func )
+{
+    if ( n == 0 ) return ;
+    if ( n == 1 ) {
+        func( 0 ) ;
+        return ;
+    }
+
+    CParallelJob job( func, n ) ;
+    std::unique_lock< std::mutex > lock( mutexParallelTasks ) ;
+    jobsParallel.push_back( &job ) ;
+    condParallelWorker.notify_all() ;
+
+    // with no workers or all of them busy, the caller alone gets it done
+    while ( job.nNext < job.n )
+        RunParallelItem( job, TakeParallelItem( job ), lock ) ;
+    job.condDone.wait( lock, [ &job ] {  return job.nDone == job.n ;  } ) ;
+}
+
 // change it to true for a clean exit
 std::atomic < bool > fRequestedShutdown { false } ;
 
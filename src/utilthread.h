@@ -6,16 +6,36 @@
 
 #include "utillog.h"
 
+#include <functional>
 #include <vector>
 #include <thread>
 
 void RenameThread( const std::string & name ) ;
 
+/**
+ * Bind the calling thread to n-th of cores it may run on (modulo their number),
+ * does nothing where there's no way to do it
+ */
+void PinThreadToCore( size_t n ) ;
+
 /**
  * Wait for all threads to finish
  */
 void JoinAll( std::vector< std::thread > & threads ) ;
 
+/**
+ * Call func( i ) for each i of [ 0, n ) on the workers running ThreadParallelTasks
+ * and on the calling thread, and return once all calls are done. Calls come in
+ * no particular order and func must not throw. Callers on several threads don't
+ * wait for each other: the workers share out between them, and each caller does
+ * items of its own until none is left
+ */
+void ForEachInParallel( size_t n, const std::function< void( size_t ) > & func ) ;
+
+/** Worker for ForEachInParallel, started with the other -par workers */
+void ThreadParallelTasks() ;
+void StopParallelTasks() ;
+
 /**
  * Return the number of physical cores available on the current system
  */
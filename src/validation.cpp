@@ -8,12 +8,16 @@
 
 #include "alert.h"
 #include "arith_uint256.h"
+#include "auxpowcache.h"
+#include "blockfilemap.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
 #include "consensus/consensus.h"
 #include "consensus/merkle.h"
 #include "consensus/validation.h"
+#include "crypto/common.h"
+#include "crypto/scrypt.h"
 #include "dogecoin.h"
 #include "hash.h"
 #include "init.h"
@@ -26,6 +30,7 @@
 #include "script/script.h"
 #include "script/sigcache.h"
 #include "script/standard.h"
+#include "streams.h"
 #include "timedata.h"
 #include "tinyformat.h"
 #include "txdb.h"
@@ -42,7 +47,13 @@
 #include "warnings.h"
 
 #include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
 #include <sstream>
+#include <thread>
+#include <unordered_set>
 
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/algorithm/string/join.hpp>
@@ -62,6 +73,8 @@
 CCriticalSection cs_main ;
 
 BlockMap mapBlockIndex ;
+// where the entries of mapBlockIndex are
+static CBlockIndexArena blockIndexArena ;
 CChain chainActive ;
 CBlockIndex * pindexBestHeader = nullptr ;
 CWaitableCriticalSection csBestBlock ;
@@ -395,15 +408,15 @@ bool CheckSequenceLocks( const CTransaction & tx, int flags, LockPoints * lp, bo
         prevheights.resize(tx.vin.size());
         for (size_t txinIndex = 0; txinIndex < tx.vin.size(); txinIndex++) {
             const CTxIn& txin = tx.vin[txinIndex];
-            CCoins coins;
-            if (!viewMemPool.GetCoins(txin.prevout.hash, coins)) {
+            Coin coin;
+            if (!viewMemPool.GetCoin(txin.prevout, coin)) {
                 return error("%s: Missing input", __func__);
             }
-            if (coins.nHeight == MEMPOOL_HEIGHT) {
+            if (coin.nHeight == MEMPOOL_HEIGHT) {
                 // Assume all mempool transaction confirm in the next block
                 prevheights[txinIndex] = tip->nHeight + 1;
             } else {
-                prevheights[txinIndex] = coins.nHeight;
+                prevheights[txinIndex] = coin.nHeight;
             }
         }
         lockPair = CalculateSequenceLocks( tx, flags, &prevheights, index ) ;
@@ -455,7 +468,7 @@ unsigned int GetP2SHSigOpCount( const CTransaction & tx, const CCoinsViewCache &
 
     unsigned int nSigOps = 0 ;
     for ( const CTxIn & txin : tx.vin ) {
-        const CTxOut & prevout = inputs.GetOutputFor( txin ) ;
+        const CTxOut & prevout = inputs.AccessCoin( txin.prevout ).out ;
         if ( prevout.scriptPubKey.IsPayToScriptHash() )
             nSigOps += prevout.scriptPubKey.GetSigOpCount( txin.scriptSig ) ;
     }
@@ -474,7 +487,7 @@ size_t GetTransactionSigOpCost( const CTransaction & tx, const CCoinsViewCache &
 
     size_t nSegWitSigOps = 0 ;
     for ( const CTxIn & txin : tx.vin ) {
-        const CTxOut & prevout = inputs.GetOutputFor( txin ) ;
+        const CTxOut & prevout = inputs.AccessCoin( txin.prevout ).out ;
         nSegWitSigOps += CountSegregatedWitnessSigOps( txin.scriptSig, prevout.scriptPubKey, &txin.scriptWitness, flags ) ;
     }
     nSigOps += nSegWitSigOps ;
@@ -537,9 +550,9 @@ void LimitMempoolSize(CTxMemPool& pool, size_t limit, unsigned long age) {
     if (expired != 0)
         LogPrint("mempool", "Expired %i transactions from the memory pool\n", expired);
 
-    std::vector< uint256 > vNoSpendsRemaining ;
+    std::vector< COutPoint > vNoSpendsRemaining ;
     pool.TrimToSize( limit, &vNoSpendsRemaining ) ;
-    for ( const uint256 & removed : vNoSpendsRemaining )
+    for ( const COutPoint & removed : vNoSpendsRemaining )
         pcoinsTip->Uncache( removed ) ;
 }
 
@@ -554,7 +567,7 @@ std::string FormatStateMessage(const CValidationState &state)
 
 bool AcceptToMemoryPoolWorker( CTxMemPool & pool, CValidationState & state, const CTransactionRef & ptx, bool fLimitFree,
                                bool * pfMissingInputs, int64_t nAcceptTime, std::list< CTransactionRef > * plTxnReplaced,
-                               std::vector< uint256 > & vHashTxnToUncache )
+                               std::vector< COutPoint > & coinsToUncache )
 {
     const CTransaction & tx = *ptx ;
     const uint256 hash = tx.GetTxHash() ;
@@ -647,20 +660,21 @@ bool AcceptToMemoryPoolWorker( CTxMemPool & pool, CValidationState & state, cons
         view.SetBackend(viewMemPool);
 
         // do we already have it?
-        bool fHadTxInCache = pcoinsTip->HaveCoinsInCache(hash);
-        if (view.HaveCoins(hash)) {
-            if (!fHadTxInCache)
-                vHashTxnToUncache.push_back(hash);
-            return state.Invalid(false, REJECT_ALREADY_KNOWN, "txn-already-known");
+        for ( size_t out = 0 ; out < tx.vout.size() ; out ++ ) {
+            COutPoint outpoint( hash, out ) ;
+            bool fHadCoinInCache = pcoinsTip->HaveCoinInCache( outpoint ) ;
+            if ( view.HaveCoin( outpoint ) ) {
+                if ( ! fHadCoinInCache )
+                    coinsToUncache.push_back( outpoint ) ;
+                return state.Invalid( false, REJECT_ALREADY_KNOWN, "txn-already-known" ) ;
+            }
         }
 
         // do all inputs exist?
-        // Note that this does not check for the presence of actual outputs (see the next check for that),
-        // and only helps with filling in pfMissingInputs (to determine missing vs spent)
         for ( const CTxIn & txin : tx.vin ) {
-            if ( ! pcoinsTip->HaveCoinsInCache( txin.prevout.hash ) )
-                vHashTxnToUncache.push_back( txin.prevout.hash ) ;
-            if ( ! view.HaveCoins( txin.prevout.hash ) ) {
+            if ( ! pcoinsTip->HaveCoinInCache( txin.prevout ) )
+                coinsToUncache.push_back( txin.prevout ) ;
+            if ( ! view.HaveCoin( txin.prevout ) ) {
                 if ( pfMissingInputs != nullptr ) *pfMissingInputs = true ;
                 return false ; // fMissingInputs and !state.IsInvalid() is used to detect this condition, don't set state.Invalid()
             }
@@ -711,8 +725,8 @@ bool AcceptToMemoryPoolWorker( CTxMemPool & pool, CValidationState & state, cons
         // during reorgs to ensure coinbase maturity is still met
         bool fSpendsCoinbase = false ;
         for ( const CTxIn & txin : tx.vin ) {
-            const CCoins * coins = view.AccessCoins( txin.prevout.hash ) ;
-            if ( coins->IsCoinBase() ) {
+            const Coin & coin = view.AccessCoin( txin.prevout ) ;
+            if ( coin.IsCoinBase() ) {
                 fSpendsCoinbase = true ;
                 break ;
             }
@@ -919,11 +933,11 @@ bool AcceptToMemoryPoolWorker( CTxMemPool & pool, CValidationState & state, cons
 bool AcceptToMemoryPoolWithTime( CTxMemPool& pool, CValidationState &state, const CTransactionRef &tx, bool fLimitFree,
                                  bool* pfMissingInputs, int64_t nAcceptTime, std::list<CTransactionRef>* plTxnReplaced )
 {
-    std::vector<uint256> vHashTxToUncache;
-    bool res = AcceptToMemoryPoolWorker( pool, state, tx, fLimitFree, pfMissingInputs, nAcceptTime, plTxnReplaced, vHashTxToUncache ) ;
+    std::vector< COutPoint > coinsToUncache ;
+    bool res = AcceptToMemoryPoolWorker( pool, state, tx, fLimitFree, pfMissingInputs, nAcceptTime, plTxnReplaced, coinsToUncache ) ;
     if ( ! res ) {
-        for ( const uint256 & hashTx : vHashTxToUncache )
-            pcoinsTip->Uncache( hashTx ) ;
+        for ( const COutPoint & outpoint : coinsToUncache )
+            pcoinsTip->Uncache( outpoint ) ;
     }
     // After we've (potentially) uncached entries, ensure our coins cache is still within its size limits
     CValidationState dummyState ;
@@ -937,6 +951,206 @@ bool AcceptToMemoryPool( CTxMemPool& pool, CValidationState &state, const CTrans
     return AcceptToMemoryPoolWithTime( pool, state, tx, fLimitFree, pfMissingInputs, GetTime(), plTxnReplaced ) ;
 }
 
+void PreCheckTransactions( CTxMemPool & pool, const std::vector< CTransactionRef > & vtx, std::vector< char > & vPassed )
+{
+    vPassed.assign( vtx.size(), 0 ) ;
+
+    // context-free checks
+    ForEachInParallel( vtx.size(), [ & ]( size_t i ) {
+        CValidationState state ;
+        vPassed[ i ] = ( CheckTransaction( *vtx[ i ], state ) && ! vtx[ i ]->IsCoinBase() ) ? 1 : 0 ;
+    } ) ;
+
+    // coins spent, from the chain tip, the mempool, or transactions before in vtx
+    std::vector< std::vector< Coin > > vSpent( vtx.size() ) ;
+    {
+        LOCK2( cs_main, pool.cs ) ;
+        CCoinsViewMemPool viewMemPool( pcoinsTip, pool ) ;
+        CCoinsViewCache view( &viewMemPool ) ;
+        for ( size_t i = 0 ; i < vtx.size() ; ++ i ) {
+            if ( ! vPassed[ i ] ) continue ;
+            const CTransaction & tx = *vtx[ i ] ;
+            vSpent[ i ].reserve( tx.vin.size() ) ;
+            for ( const CTxIn & txin : tx.vin )
+                vSpent[ i ].push_back( view.AccessCoin( txin.prevout ) ) ;
+            AddCoins( view, tx, MEMPOOL_HEIGHT, true ) ;
+        }
+    }
+
+    // scripts, with signatures that pass going to the signature cache
+    ForEachInParallel( vtx.size(), [ & ]( size_t i ) {
+        if ( ! vPassed[ i ] ) return ;
+        const CTransaction & tx = *vtx[ i ] ;
+        PrecomputedTransactionData txdata( tx ) ;
+        for ( unsigned int n = 0 ; n < tx.vin.size() ; ++ n ) {
+            // missing inputs are up to AcceptToMemoryPool
+            if ( vSpent[ i ][ n ].IsSpent() ) break ;
+            CScriptCheck check( vSpent[ i ][ n ].out, tx, n, STANDARD_SCRIPT_VERIFY_FLAGS, true, &txdata ) ;
+            if ( ! check() ) break ;
+        }
+    } ) ;
+}
+
+/**
+ * Version 1 of mempool.dat has the number of transactions and then all of them,
+ * version 2 has them in chunks, each with its number of transactions, up to a chunk of none.
+ * Either way, a transaction is followed by its time and fee delta, and more deltas are at the end
+ */
+static const uint64_t MEMPOOL_DUMP_VERSION = 2 ;
+
+/** Transactions of mempool.dat in a chunk, to check in parallel and accept under one cs_main lock */
+static const size_t MEMPOOL_DUMP_CHUNK = 1000 ;
+
+bool LoadMempoolFromDump()
+{
+    int64_t nExpiryTimeout = GetArg( "-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY ) * 60 * 60 ;
+    FILE* mempoolFile = fopen( ( GetDirForData() / "mempool.dat" ).string().c_str(), "rb" ) ;
+    if ( mempoolFile == nullptr ) {
+        LogPrintf( "Failed to open mempool file for reading from disk. Continuing anyway\n" ) ;
+        return false ;
+    }
+
+    CAutoFile file( mempoolFile, SER_DISK, PEER_VERSION ) ;
+
+    int64_t count = 0 ;
+    int64_t skipped = 0 ;
+    int64_t failed = 0 ;
+    int64_t nNow = GetTime() ;
+    int64_t start = GetTimeMicros() ;
+
+    try {
+        uint64_t version ;
+        file >> version ;
+        if ( version != 1 && version != MEMPOOL_DUMP_VERSION ) return false ;
+
+        uint64_t num = 0 ;
+        if ( version == 1 )
+            file >> num ;
+
+        double prioritydummy = 0 ;
+        std::vector< CTransactionRef > vtx ;
+        std::vector< int64_t > vTime ;
+        while ( true ) {
+            size_t nChunk = ( version == 1 ) ? std::min( num, (uint64_t)MEMPOOL_DUMP_CHUNK ) : ReadCompactSize( file ) ;
+            if ( nChunk == 0 ) break ;
+            num -= std::min( num, (uint64_t)nChunk ) ;
+
+            vtx.clear() ;
+            vTime.clear() ;
+            for ( size_t i = 0 ; i < nChunk ; ++ i ) {
+                CTransactionRef tx ;
+                int64_t nTime ;
+                int64_t nFeeDelta ;
+                file >> tx ;
+                file >> nTime ;
+                file >> nFeeDelta ;
+
+                CAmount amountdelta = nFeeDelta ;
+                if ( amountdelta != 0 ) {
+                    mempool.PrioritiseTransaction( tx->GetTxHash(), tx->GetTxHash().ToString(), prioritydummy, amountdelta ) ;
+                }
+                if ( nTime + nExpiryTimeout > nNow ) {
+                    vtx.push_back( tx ) ;
+                    vTime.push_back( nTime ) ;
+                } else {
+                    ++ skipped ;
+                }
+            }
+
+            std::vector< char > vPassed ;
+            PreCheckTransactions( mempool, vtx, vPassed ) ;
+
+            LOCK( cs_main ) ;
+            for ( size_t i = 0 ; i < vtx.size() ; ++ i ) {
+                CValidationState state ;
+                if ( vPassed[ i ] && AcceptToMemoryPoolWithTime( mempool, state, vtx[ i ], true, NULL, vTime[ i ] ) ) {
+                    ++ count ;
+                } else {
+                    ++ failed ;
+                }
+            }
+
+            if ( ShutdownRequested() ) return false ;
+        }
+        std::map< uint256, CAmount > mapDeltas ;
+        file >> mapDeltas ;
+
+        for ( const auto & i : mapDeltas ) {
+            mempool.PrioritiseTransaction( i.first, i.first.ToString(), prioritydummy, i.second ) ;
+        }
+    } catch ( const std::exception & e ) {
+        LogPrintf( "Failed to deserialize mempool data from file: %s. Continuing anyway.\n", e.what() ) ;
+        return false ;
+    }
+
+    LogPrintf( "Imported mempool transactions from disk: %i okay, %i failed, %i expired in %.3f s\n",
+                count, failed, skipped, ( GetTimeMicros() - start ) * 0.000001 ) ;
+    return true ;
+}
+
+void DumpMempoolToFile()
+{
+    int64_t start = GetTimeMicros() ;
+
+    std::map< uint256, CAmount > mapDeltas ;
+    std::vector< TxMempoolInfo > vinfo ;
+
+    {
+        LOCK( mempool.cs ) ;
+        for ( const auto & i : mempool.mapDeltas ) {
+            mapDeltas[ i.first ] = i.second.second ;
+        }
+        vinfo = mempool.infoAll() ;
+    }
+    for ( const auto & i : vinfo )
+        mapDeltas.erase( i.tx->GetTxHash() ) ;
+
+    int64_t mid = GetTimeMicros() ;
+
+    // Chunks are serialized on threads, then written in order
+    size_t nChunks = ( vinfo.size() + MEMPOOL_DUMP_CHUNK - 1 ) / MEMPOOL_DUMP_CHUNK ;
+    std::vector< std::vector< unsigned char > > vChunks( nChunks ) ;
+    {
+        ForEachInParallel( nChunks, [ & ]( size_t c ) {
+            size_t nBegin = c * MEMPOOL_DUMP_CHUNK ;
+            size_t nEnd = std::min( vinfo.size(), nBegin + MEMPOOL_DUMP_CHUNK ) ;
+            CVectorWriter writer( SER_DISK, PEER_VERSION, vChunks[ c ], 0 ) ;
+            WriteCompactSize( writer, nEnd - nBegin ) ;
+            for ( size_t i = nBegin ; i < nEnd ; ++ i ) {
+                writer << *( vinfo[ i ].tx ) ;
+                writer << static_cast< uint64_t >( vinfo[ i ].nTime ) ;
+                writer << static_cast< uint64_t >( vinfo[ i ].nFeeDelta ) ;
+            }
+        } ) ;
+    }
+
+    int64_t serialized = GetTimeMicros() ;
+
+    try {
+        FILE* filestr = fopen( ( GetDirForData() / "mempool.dat.new" ).string().c_str(), "wb" ) ;
+        if ( filestr == nullptr ) return ;
+
+        CAutoFile file( filestr, SER_DISK, PEER_VERSION ) ;
+
+        uint64_t version = MEMPOOL_DUMP_VERSION ;
+        file << version ;
+
+        for ( const std::vector< unsigned char > & vchChunk : vChunks )
+            file.write( (const char*)vchChunk.data(), vchChunk.size() ) ;
+        WriteCompactSize( file, 0 ) ;
+
+        file << mapDeltas ;
+        FileCommit( file.get() ) ;
+        file.fclose() ;
+        RenameOver( GetDirForData() / "mempool.dat.new", GetDirForData() / "mempool.dat" ) ;
+        int64_t last = GetTimeMicros() ;
+        LogPrintf( "Dumped mempool: %.6f s to copy, %.6f s to serialize, %.6f s to dump\n",
+                    ( mid - start ) * 0.000001, ( serialized - mid ) * 0.000001, ( last - serialized ) * 0.000001 ) ;
+    } catch ( const std::exception & e ) {
+        LogPrintf( "Can't dump mempool: %s. Continuing anyway\n", e.what() ) ;
+    }
+}
+
 /** Return transaction in txOut, and if it was found inside a block, its hash is placed in hashBlock */
 bool GetTransaction(const uint256 &hash, CTransactionRef &txOut, const Consensus::Params& consensusParams, uint256 &hashBlock, bool fAllowSlow)
 {
@@ -953,14 +1167,24 @@ bool GetTransaction(const uint256 &hash, CTransactionRef &txOut, const Consensus
         CDiskTxPos postx ;
         if ( pblocktree->ReadTxIndex( hash, postx ) )
         {
-            CAutoFile file( OpenBlockFile( postx, true ), SER_DISK, PEER_VERSION ) ;
-            if ( file.isNull() )
+            const char * pbegin = nullptr ;
+            const char * pend = nullptr ;
+            std::shared_ptr< const CMappedFile > mapped = MapDiskRecord( postx, "blk", 0, pbegin, pend ) ;
+            CAutoFile file( mapped ? nullptr : OpenBlockFile( postx, true ), SER_DISK, PEER_VERSION ) ;
+            if ( ! mapped && file.isNull() )
                 return error( "%s: OpenBlockFile failed", __func__ ) ;
             CBlockHeader header ;
             try {
-                file >> header ;
-                fseek( file.get(), postx.nTxOffset, SEEK_CUR ) ;
-                file >> txOut ;
+                if ( mapped ) {
+                    CMemoryReader reader( SER_DISK, PEER_VERSION, pbegin, pend ) ;
+                    reader >> header ;
+                    reader.skip( postx.nTxOffset ) ;
+                    reader >> txOut ;
+                } else {
+                    file >> header ;
+                    fseek( file.get(), postx.nTxOffset, SEEK_CUR ) ;
+                    file >> txOut ;
+                }
             } catch ( const std::exception & e ) {
                 return error("%s: Deserialize or I/O error - %s", __func__, e.what());
             }
@@ -974,15 +1198,9 @@ bool GetTransaction(const uint256 &hash, CTransactionRef &txOut, const Consensus
     CBlockIndex * pindexSlow = nullptr ;
 
     if ( fAllowSlow ) { // use coin database to locate block that contains transaction, and scan it
-        int nHeight = -1 ;
-        {
-            const CCoinsViewCache& view = *pcoinsTip ;
-            const CCoins* coins = view.AccessCoins( hash ) ;
-            if ( coins != nullptr )
-                nHeight = coins->nHeight ;
-        }
-        if ( nHeight > 0 )
-            pindexSlow = chainActive[ nHeight ] ;
+        const Coin & coin = AccessByTxid( *pcoinsTip, hash ) ;
+        if ( ! coin.IsSpent() )
+            pindexSlow = chainActive[ coin.nHeight ] ;
     }
 
     if ( pindexSlow != nullptr ) {
@@ -1031,37 +1249,66 @@ bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHea
 /* Generic implementation of block reading that can handle both a block and its header */
 
 template<typename T>
-static bool ReadBlockOrHeader(T& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams)
+static bool ReadBlockOrHeader(T& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams, bool fCheckPOW = true)
 {
     block.SetNull() ;
 
-    // Open history file to read
-    CAutoFile filein( OpenBlockFile( pos, true ), SER_DISK, PEER_VERSION ) ;
-    if ( filein.isNull() )
-        return error( "%s: OpenBlockFile failed for %s", __func__, pos.ToString() ) ;
-
-    // Read block
+    // Read block from mapping of the file, or else from the file
+    const char * pbegin = nullptr ;
+    const char * pend = nullptr ;
+    std::shared_ptr< const CMappedFile > mapped = MapDiskRecord( pos, "blk", 0, pbegin, pend ) ;
     try {
-        filein >> block ;
+        if ( mapped ) {
+            CMemoryReader reader( SER_DISK, PEER_VERSION, pbegin, pend ) ;
+            reader >> block ;
+        } else {
+            CAutoFile filein( OpenBlockFile( pos, true ), SER_DISK, PEER_VERSION ) ;
+            if ( filein.isNull() )
+                return error( "%s: OpenBlockFile failed for %s", __func__, pos.ToString() ) ;
+            filein >> block ;
+        }
     } catch ( const std::exception & e ) {
         return error( "%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString() ) ;
     }
 
     // Check the header
-    if ( ! CheckDogecoinProofOfWork( block, consensusParams ) )
+    if ( fCheckPOW && ! CheckDogecoinProofOfWork( block, consensusParams ) )
         return error( "%s: Errors in block header at %s", __func__, pos.ToString() ) ;
 
     return true ;
 }
 
+/**
+ * Blocks stored before there was BLOCK_POW_CHECKED get it when read for the first time.
+ * Only when cs_main is free or held by this thread, reading never waits for it
+ */
+static void SetPowChecked( const uint256 & hash, const CDiskBlockPos & pos )
+{
+    TRY_LOCK( cs_main, lockMain ) ;
+    if ( lockMain ) {
+        BlockMap::iterator it = mapBlockIndex.find( hash ) ;
+        if ( it != mapBlockIndex.end() && ( it->second->nStatus & BLOCK_DATA_EXISTS ) && it->second->GetBlockPos() == pos ) {
+            it->second->nStatus |= BLOCK_POW_CHECKED ;
+            setOfDirtyBlockIndices.insert( it->second ) ;
+        }
+    }
+}
+
 template<typename T>
 static bool ReadBlockOrHeader(T& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams)
 {
-    if ( ! ReadBlockOrHeader( block, pindex->GetBlockPos(), consensusParams ) )
+    // Proof of work of the stored block was checked when it was accepted, and
+    // the sha256 hash matching the index below tells that it's the same block
+    bool fCheckPOW = ! ( pindex->nStatus & BLOCK_POW_CHECKED ) ;
+    if ( ! ReadBlockOrHeader( block, pindex->GetBlockPos(), consensusParams, fCheckPOW ) )
         return false;
     if ( block.GetSha256Hash() != pindex->GetBlockSha256Hash() )
         return error( "ReadBlockOrHeader: sha256 hash doesn't match index for %s at %s",
                 pindex->ToString(), pindex->GetBlockPos().ToString() ) ;
+
+    if ( fCheckPOW )
+        SetPowChecked( pindex->GetBlockSha256Hash(), pindex->GetBlockPos() ) ;
+
     return true;
 }
 
@@ -1080,6 +1327,55 @@ bool ReadBlockHeaderFromDisk(CBlockHeader& block, const CBlockIndex* pindex, con
     return ReadBlockOrHeader(block, pindex, consensusParams);
 }
 
+bool ReadRawBlockFromDisk( std::vector< unsigned char > & vchBlock, const CDiskBlockPos & pos, const uint256 & hash, bool fPowChecked,
+                           bool fWitness, const Consensus::Params & consensusParams )
+{
+    const char * pbegin = nullptr ;
+    const char * pend = nullptr ;
+    std::shared_ptr< const CMappedFile > mapped ;
+    // proof of work of the block is checked once when it's read in full
+    if ( fPowChecked )
+        mapped = MapDiskRecord( pos, "blk", 0, pbegin, pend ) ;
+
+    if ( mapped ) {
+        bool fRaw = true ;
+        try {
+            CMemoryReader reader( SER_DISK, PEER_VERSION, pbegin, pend ) ;
+            CBlockHeader header ;
+            reader >> header ;
+            if ( header.GetSha256Hash() != hash )
+                return error( "%s: sha256 hash doesn't match index for %s at %s", __func__, hash.ToString(), pos.ToString() ) ;
+            if ( ! fWitness ) {
+                // The coinbase of a stored block has witness whenever any transaction
+                // of the block has (ContextualCheckBlock), so looking at it is enough
+                // to know whether the stored bytes are the same without witness
+                uint64_t nTx = ReadCompactSize( reader ) ;
+                int32_t nTxVersion ;
+                reader >> nTxVersion ;
+                fRaw = ( nTx == 0 || ReadCompactSize( reader ) != 0 ) ;
+            }
+        } catch ( const std::exception & e ) {
+            return error( "%s: Deserialize error - %s at %s", __func__, e.what(), pos.ToString() ) ;
+        }
+        if ( fRaw ) {
+            vchBlock.assign( pbegin, pend ) ;
+            return true ;
+        }
+    }
+
+    // stripped of witness or not mapped, through the block
+    CBlock block ;
+    if ( ! ReadBlockOrHeader( block, pos, consensusParams, ! fPowChecked ) )
+        return false ;
+    if ( block.GetSha256Hash() != hash )
+        return error( "%s: sha256 hash doesn't match index for %s at %s", __func__, hash.ToString(), pos.ToString() ) ;
+    if ( ! fPowChecked )
+        SetPowChecked( hash, pos ) ;
+    vchBlock.clear() ;
+    CVectorWriter( SER_NETWORK, PEER_VERSION | ( fWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS ), vchBlock, 0, block ) ;
+    return true ;
+}
+
 /*
 CAmount GetBitcoinBlockSubsidy( int nHeight, const Consensus::Params & consensusParams )
 {
@@ -1241,25 +1537,14 @@ void UpdateCoins( const CTransaction & tx, CCoinsViewCache & inputs, CTxUndo & t
     if ( ! tx.IsCoinBase() ) {
         txundo.vprevout.reserve( tx.vin.size() ) ;
         for ( const CTxIn & txin : tx.vin ) {
-            CCoinsModifier coins = inputs.ModifyCoins( txin.prevout.hash ) ;
-            unsigned nPos = txin.prevout.n ;
-
-            if ( nPos >= coins->vout.size() || coins->vout[ nPos ].IsNull() )
-                assert( false ) ;
-
             // mark an outpoint spent, and construct undo information
-            txundo.vprevout.push_back( CTxInUndo( coins->vout[ nPos ] ) ) ;
-            coins->Spend( nPos ) ;
-            if ( coins->vout.size() == 0 ) {
-                CTxInUndo& undo = txundo.vprevout.back() ;
-                undo.nHeight = coins->nHeight ;
-                undo.fCoinBase = coins->fCoinBase ;
-                undo.nVersion = coins->nVersion ;
-            }
+            txundo.vprevout.emplace_back() ;
+            bool is_spent = inputs.SpendCoin( txin.prevout, &txundo.vprevout.back() ) ;
+            assert( is_spent ) ;
         }
     }
     // add outputs
-    inputs.ModifyNewCoins( tx.GetTxHash(), tx.IsCoinBase() )->FromTx( tx, nHeight ) ;
+    AddCoins( inputs, tx, nHeight ) ;
 }
 
 void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, int nHeight)
@@ -1300,22 +1585,22 @@ bool CheckTxInputs(const CChainParams& params, const CTransaction& tx, CValidati
         for (unsigned int i = 0; i < tx.vin.size(); i++)
         {
             const COutPoint &prevout = tx.vin[i].prevout;
-            const CCoins *coins = inputs.AccessCoins(prevout.hash);
-            assert(coins);
+            const Coin& coin = inputs.AccessCoin(prevout);
+            assert(!coin.IsSpent());
 
             // If prev is coinbase, check that it's matured
-            if (coins->IsCoinBase()) {
+            if (coin.IsCoinBase()) {
                 // Dogecoin: Switch maturity at depth 145,000
-                int nCoinbaseMaturity = params.GetConsensus(coins->nHeight).nCoinbaseMaturity;
-                if (nSpendHeight - coins->nHeight < nCoinbaseMaturity)
+                int nCoinbaseMaturity = params.GetConsensus(coin.nHeight).nCoinbaseMaturity;
+                if (nSpendHeight - coin.nHeight < nCoinbaseMaturity)
                     return state.Invalid(false,
                         REJECT_INVALID, "bad-txns-premature-spend-of-coinbase",
-                        strprintf("tried to spend coinbase at depth %d", nSpendHeight - coins->nHeight));
+                        strprintf("tried to spend coinbase at depth %d", nSpendHeight - coin.nHeight));
             }
 
             // Check for negative or overflow input values
-            nValueIn += coins->vout[ prevout.n ].nValue ;
-            if ( ! MoneyRange( coins->vout[ prevout.n ].nValue ) || ! MoneyRange( nValueIn ) )
+            nValueIn += coin.out.nValue ;
+            if ( ! MoneyRange( coin.out.nValue ) || ! MoneyRange( nValueIn ) )
                 return state.DoS( 10, false, REJECT_INVALID, "bad-txns-inputvalues-outofrange" ) ;
 
         }
@@ -1357,11 +1642,11 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
         if ( fScriptChecks ) {
             for (unsigned int i = 0; i < tx.vin.size(); i++) {
                 const COutPoint &prevout = tx.vin[i].prevout;
-                const CCoins* coins = inputs.AccessCoins(prevout.hash);
-                assert(coins);
+                const Coin& coin = inputs.AccessCoin(prevout);
+                assert(!coin.IsSpent());
 
                 // Verify signature
-                CScriptCheck check(*coins, tx, i, flags, cacheStore, &txdata);
+                CScriptCheck check(coin.out, tx, i, flags, cacheStore, &txdata);
                 if (pvChecks) {
                     pvChecks->push_back(CScriptCheck());
                     check.swap(pvChecks->back());
@@ -1373,7 +1658,7 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
                         // arguments; if so, don't trigger DoS protection to
                         // avoid splitting the network between upgraded and
                         // non-upgraded nodes
-                        CScriptCheck check2(*coins, tx, i,
+                        CScriptCheck check2(coin.out, tx, i,
                                 flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheStore, &txdata);
                         if (check2())
                             return state.Invalid(false, REJECT_NONSTANDARD, strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(check.GetScriptError())));
@@ -1425,16 +1710,23 @@ bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint
 
 bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock)
 {
-    // Open history file to read
-    CAutoFile filein( OpenUndoFile( pos, true ), SER_DISK, PEER_VERSION ) ;
-    if ( filein.isNull() )
-        return error( "%s: OpenUndoFile failed", __func__ ) ;
-
-    // Read block
+    // Read undo data and its checksum from mapping of the file, or else from the file
     uint256 hashChecksum;
+    const char * pbegin = nullptr ;
+    const char * pend = nullptr ;
+    std::shared_ptr< const CMappedFile > mapped = MapDiskRecord( pos, "rev", sizeof( hashChecksum ), pbegin, pend ) ;
     try {
-        filein >> blockundo;
-        filein >> hashChecksum;
+        if ( mapped ) {
+            CMemoryReader reader( SER_DISK, PEER_VERSION, pbegin, pend ) ;
+            reader >> blockundo ;
+            reader >> hashChecksum ;
+        } else {
+            CAutoFile filein( OpenUndoFile( pos, true ), SER_DISK, PEER_VERSION ) ;
+            if ( filein.isNull() )
+                return error( "%s: OpenUndoFile failed", __func__ ) ;
+            filein >> blockundo ;
+            filein >> hashChecksum ;
+        }
     }
     catch (const std::exception& e) {
         return error("%s: Deserialize or I/O error - %s", __func__, e.what());
@@ -1471,34 +1763,31 @@ bool AbortNode(CValidationState& state, const std::string& strMessage, const std
 } // anon namespace
 
 /**
- * Apply the undo operation of a CTxInUndo to the given chain state.
- * @param undo The undo object.
+ * Restore the UTXO in a Coin at a given COutPoint
+ * @param undo The Coin to be restored.
  * @param view The coins view to which to apply the changes.
  * @param out The out point that corresponds to the tx input.
  * @return True on success.
  */
-bool ApplyTxInUndo(const CTxInUndo& undo, CCoinsViewCache& view, const COutPoint& out)
+bool ApplyTxInUndo(Coin&& undo, CCoinsViewCache& view, const COutPoint& out)
 {
     bool fClean = true;
 
-    CCoinsModifier coins = view.ModifyCoins(out.hash);
-    if (undo.nHeight != 0) {
-        // undo data contains height: this is the last output of the prevout tx being spent
-        if (!coins->IsPruned())
-            fClean = fClean && error("%s: undo data overwriting existing transaction", __func__);
-        coins->Clear();
-        coins->fCoinBase = undo.fCoinBase;
-        coins->nHeight = undo.nHeight;
-        coins->nVersion = undo.nVersion;
-    } else {
-        if (coins->IsPruned())
-            fClean = fClean && error("%s: undo data adding output to missing transaction", __func__);
-    }
-    if (coins->IsAvailable(out.n))
+    if (view.HaveCoin(out))
         fClean = fClean && error("%s: undo data overwriting existing output", __func__);
-    if (coins->vout.size() < out.n+1)
-        coins->vout.resize(out.n+1);
-    coins->vout[out.n] = undo.txout;
+    if (undo.nHeight == 0) {
+        // Missing undo metadata (height and coinbase). Older versions included this
+        // information only in undo records for the last spend of a transactions'
+        // outputs. This implies that it must be present for some other output of the same tx.
+        const Coin& alternate = AccessByTxid(view, out.hash);
+        if (!alternate.IsSpent()) {
+            undo.nHeight = alternate.nHeight;
+            undo.fCoinBase = alternate.fCoinBase;
+        } else {
+            return error("%s: undo data adding output to missing transaction", __func__);
+        }
+    }
+    view.AddCoin(out, std::move(undo), undo.fCoinBase);
 
     return fClean;
 }
@@ -1527,34 +1816,28 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
         const CTransaction &tx = *(block.vtx[i]);
         uint256 hash = tx.GetTxHash() ;
 
-        // Check that all outputs are available and match the outputs in the block itself
-        // exactly
-        {
-        CCoinsModifier outs = view.ModifyCoins(hash);
-        outs->ClearUnspendable();
-
-        CCoins outsBlock(tx, pindex->nHeight);
-        // The CCoins serialization does not serialize negative numbers.
-        // No network rules currently depend on the version here, so an inconsistency is harmless
-        // but it must be corrected before txout nversion ever influences a network rule
-        if (outsBlock.nVersion < 0)
-            outs->nVersion = outsBlock.nVersion;
-        if (*outs != outsBlock)
-            fClean = fClean && error("DisconnectBlock(): added transaction mismatch? database corrupted");
+        bool is_coinbase = tx.IsCoinBase();
 
-        // remove outputs
-        outs->Clear();
+        // Check that all outputs are available and match the outputs in the block itself
+        // exactly.
+        for (size_t o = 0; o < tx.vout.size(); o++) {
+            if (!tx.vout[o].scriptPubKey.IsUnspendable()) {
+                COutPoint out(hash, o);
+                Coin coin;
+                bool is_spent = view.SpendCoin(out, &coin);
+                if (!is_spent || tx.vout[o] != coin.out || pindex->nHeight != coin.nHeight || is_coinbase != coin.fCoinBase)
+                    fClean = fClean && error("DisconnectBlock(): added transaction mismatch? database corrupted");
+            }
         }
 
         // restore inputs
         if (i > 0) { // not coinbases
-            const CTxUndo &txundo = blockUndo.vtxundo[i-1];
+            CTxUndo &txundo = blockUndo.vtxundo[i-1];
             if (txundo.vprevout.size() != tx.vin.size())
                 return error("DisconnectBlock(): transaction and undo data inconsistent");
             for (unsigned int j = tx.vin.size(); j-- > 0;) {
                 const COutPoint &out = tx.vin[j].prevout;
-                const CTxInUndo &undo = txundo.vprevout[j];
-                if (!ApplyTxInUndo(undo, view, out))
+                if (!ApplyTxInUndo(std::move(txundo.vprevout[j]), view, out))
                     fClean = false;
             }
         }
@@ -1579,16 +1862,20 @@ void static FlushBlockFile(bool fFinalize = false)
 
     FILE *fileOld = OpenBlockFile(posOld);
     if (fileOld) {
-        if (fFinalize)
+        if ( fFinalize ) {
             TruncateFile(fileOld, vinfoBlockFile[nLastBlockFile].nSize);
+            blockFileMapper.Forget( GetBlockPosFilename( posOld, "blk" ).string() ) ;
+        }
         FileCommit(fileOld);
         fclose(fileOld);
     }
 
     fileOld = OpenUndoFile(posOld);
     if (fileOld) {
-        if (fFinalize)
+        if ( fFinalize ) {
             TruncateFile(fileOld, vinfoBlockFile[nLastBlockFile].nUndoSize);
+            blockFileMapper.Forget( GetBlockPosFilename( posOld, "rev" ).string() ) ;
+        }
         FileCommit(fileOld);
         fclose(fileOld);
     }
@@ -1610,6 +1897,252 @@ void StopScriptChecking()
     scriptcheckqueue.Quit() ;
 }
 
+/**
+ * Outpoints spent by the block except outputs created by this same block,
+ * which are in no view yet, and except those fSkip says so about
+ */
+template < typename Skip >
+static std::vector< COutPoint > GetBlockInputs( const CBlock & block, const Skip & fSkip )
+{
+    std::unordered_set< uint256, SaltedTxHasher > txidsInBlock ;
+    txidsInBlock.reserve( block.vtx.size() ) ;
+    for ( const CTransactionRef & tx : block.vtx )
+        txidsInBlock.insert( tx->GetTxHash() ) ;
+
+    std::vector< COutPoint > vOutpoints ;
+    for ( const CTransactionRef & tx : block.vtx ) {
+        if ( tx->IsCoinBase() ) continue ;
+        for ( const CTxIn & txin : tx->vin )
+            if ( txidsInBlock.count( txin.prevout.hash ) == 0 && ! fSkip( txin.prevout ) )
+                vOutpoints.push_back( txin.prevout ) ;
+    }
+    return vOutpoints ;
+}
+
+/**
+ * Reads coins from the view in parallel, not found ones are left spent. Reads
+ * of leveldb don't block each other, so on a cold cache inputs of a block are
+ * read on the parallel task workers instead of one by one while connecting
+ */
+static std::vector< Coin > ReadCoins( const AbstractCoinsView & view, const std::vector< COutPoint > & vOutpoints )
+{
+    std::vector< Coin > vCoins( vOutpoints.size() ) ;
+    ForEachInParallel( vOutpoints.size(), [ & ]( size_t i ) {  view.GetCoin( vOutpoints[ i ], vCoins[ i ] ) ;  } ) ;
+    return vCoins ;
+}
+
+size_t PrefetchBlockInputs( const CBlock & block, CCoinsViewCache & cache )
+{
+    AssertLockHeld( cs_main ) ;
+    if ( nScriptCheckThreads <= 1 ) return 0 ;
+
+    std::vector< COutPoint > vOutpoints = GetBlockInputs( block, [ &cache ] ( const COutPoint & outpoint ) {  return cache.HaveEntryInCache( outpoint ) ;  } ) ;
+    if ( vOutpoints.empty() ) return 0 ;
+
+    // the cache isn't touched until all reads are done, and while cs_main
+    // is held nobody else writes to the views below it
+    std::vector< Coin > vCoins = ReadCoins( *cache.GetBackend(), vOutpoints ) ;
+
+    size_t nFetched = 0 ;
+    for ( size_t i = 0 ; i < vOutpoints.size() ; i ++ ) {
+        if ( vCoins[ i ].IsSpent() ) continue ;
+        cache.AddFetchedCoin( vOutpoints[ i ], std::move( vCoins[ i ] ) ) ;
+        nFetched ++ ;
+    }
+    return nFetched ;
+}
+
+/**
+ * Like a seqlock, odd while pcoinsTip is being flushed and bumped once more
+ * after that. Coins read from under pcoinsTip with no flush since then are
+ * as good as fetched by pcoinsTip itself
+ */
+static std::atomic< uint64_t > nCoinsTipFlushSeq( 0 ) ;
+
+/**
+ * Earlier stage of connecting blocks of the active chain. While one block is
+ * being connected, blocks scheduled to go after it are read from disk, checked
+ * without context (merkle root, proof of work) and coins they spend are read
+ * from the database, by a thread of its own and the coin prefetch queue.
+ * Coins are read from the view given to the latest Schedule, taken when the
+ * thread starts on a block, and Clear waits until the thread is done with it
+ */
+class CBlockReadAhead
+{
+private:
+    struct Entry
+    {
+        CBlockIndex * pindex ;
+        CDiskBlockPos pos ;
+        uint256 hash ;
+        const Consensus::Params * consensus ;
+
+        bool fStarted ;
+        bool fDone ;
+        std::shared_ptr< CBlock > block ; // null when reading failed
+        uint64_t nFlushSeq ;
+        std::vector< COutPoint > vOutpoints ;
+        std::vector< Coin > vCoins ;
+
+        Entry() : pindex( nullptr ), consensus( nullptr ), fStarted( false ), fDone( false ), nFlushSeq( 0 ) {}
+    } ;
+
+    std::mutex mutex ;
+    std::condition_variable condWorker ;
+    std::condition_variable condDone ;
+    std::deque< std::shared_ptr< Entry > > queue ; // in order of connecting
+    const AbstractCoinsView * coinsView ;
+    bool fWorking ;
+    bool fRunning ;
+    bool fQuit ;
+    std::atomic< uint64_t > nTaken ;
+
+    void Work( Entry & entry, const AbstractCoinsView * view )
+    {
+        std::shared_ptr< CBlock > block = std::make_shared< CBlock >() ;
+        if ( ! ReadBlockOrHeader( *block, entry.pos, *entry.consensus, false ) || block->GetSha256Hash() != entry.hash )
+            return ;
+
+        // a block which fails is left unchecked, for ConnectBlock to tell why
+        CValidationState state ;
+        CheckBlock( *block, state, true, true ) ;
+        entry.block = block ;
+        if ( ! block->fChecked ) return ;
+
+        entry.nFlushSeq = nCoinsTipFlushSeq ;
+        if ( view == nullptr || entry.nFlushSeq % 2 != 0 ) return ;
+        entry.vOutpoints = GetBlockInputs( *block, [] ( const COutPoint & ) {  return false ;  } ) ;
+        entry.vCoins = ReadCoins( *view, entry.vOutpoints ) ;
+    }
+
+public:
+    CBlockReadAhead() : coinsView( nullptr ), fWorking( false ), fRunning( false ), fQuit( false ), nTaken( 0 ) {}
+
+    void Loop()
+    {
+        std::unique_lock< std::mutex > lock( mutex ) ;
+        fRunning = true ;
+        while ( true ) {
+            std::shared_ptr< Entry > entry ;
+            while ( ! fQuit ) {
+                for ( const std::shared_ptr< Entry > & queued : queue )
+                    if ( ! queued->fStarted ) {  entry = queued ;  break ;  }
+                if ( entry != nullptr ) break ;
+                condWorker.wait( lock ) ;
+            }
+            if ( fQuit ) break ;
+
+            entry->fStarted = true ;
+            fWorking = true ;
+            const AbstractCoinsView * view = coinsView ;
+            lock.unlock() ;
+            Work( *entry, view ) ;
+            lock.lock() ;
+            entry->fDone = true ;
+            fWorking = false ;
+            condDone.notify_all() ;
+        }
+        // the request is done with, so the thread can be started again
+        fQuit = false ;
+        fRunning = false ;
+        queue.clear() ;
+    }
+
+    void Quit()
+    {
+        std::lock_guard< std::mutex > lock( mutex ) ;
+        fQuit = true ;
+        condWorker.notify_all() ;
+    }
+
+    /** Forget what's scheduled and the view, before blocks or coins views are deleted */
+    void Clear()
+    {
+        std::unique_lock< std::mutex > lock( mutex ) ;
+        queue.clear() ;
+        coinsView = nullptr ;
+        condDone.wait( lock, [ this ] {  return ! fWorking ;  } ) ;
+    }
+
+    /** Blocks taken read ahead, since start */
+    uint64_t Taken() const {  return nTaken ;  }
+
+    /** Blocks to be connected next, in order, the first one right after the tip */
+    void Schedule( const std::vector< CBlockIndex * > & vpindex, const CChainParams & chainparams, const AbstractCoinsView & coinsView )
+    {
+        AssertLockHeld( cs_main ) ;
+        std::lock_guard< std::mutex > lock( mutex ) ;
+        if ( ! fRunning || vpindex.empty() ) return ;
+
+        // what's queued past where it differs was scheduled for another chain
+        size_t nSame = 0 ;
+        while ( nSame < queue.size() && nSame < vpindex.size() && queue[ nSame ]->pindex == vpindex[ nSame ] )
+            nSame ++ ;
+        queue.erase( queue.begin() + nSame, queue.end() ) ;
+        this->coinsView = &coinsView ;
+
+        for ( size_t i = queue.size() ; i < vpindex.size() && queue.size() < BLOCK_READ_AHEAD_DEPTH ; i ++ ) {
+            CBlockIndex * pindex = vpindex[ i ] ;
+            if ( ! ( pindex->nStatus & BLOCK_DATA_EXISTS ) ) break ;
+            std::shared_ptr< Entry > entry = std::make_shared< Entry >() ;
+            entry->pindex = pindex ;
+            entry->pos = pindex->GetBlockPos() ;
+            entry->hash = pindex->GetBlockSha256Hash() ;
+            entry->consensus = &chainparams.GetConsensus( pindex->nHeight ) ;
+            queue.push_back( entry ) ;
+        }
+        condWorker.notify_one() ;
+    }
+
+    /**
+     * The block, read and checked ahead, and coins it spends, which can be put into
+     * pcoinsTip as fetched by it. Null when the block wasn't read ahead
+     */
+    std::shared_ptr< const CBlock > Take( const CBlockIndex * pindex, std::vector< COutPoint > & vOutpoints, std::vector< Coin > & vCoins )
+    {
+        AssertLockHeld( cs_main ) ;
+        std::unique_lock< std::mutex > lock( mutex ) ;
+        if ( queue.empty() ) return nullptr ;
+        if ( queue.front()->pindex != pindex ) {
+            queue.clear() ;
+            return nullptr ;
+        }
+
+        std::shared_ptr< Entry > entry = queue.front() ;
+        queue.pop_front() ;
+        // not started yet, reading it here is not slower than waiting
+        if ( ! entry->fStarted ) return nullptr ;
+        condDone.wait( lock, [ &entry ] {  return entry->fDone ;  } ) ;
+
+        if ( entry->nFlushSeq == nCoinsTipFlushSeq ) {
+            vOutpoints.swap( entry->vOutpoints ) ;
+            vCoins.swap( entry->vCoins ) ;
+        }
+        if ( entry->block != nullptr )
+            nTaken ++ ;
+        return entry->block ;
+    }
+} ;
+
+static CBlockReadAhead blockReadAhead ;
+
+void ThreadBlockReadAhead()
+{
+    RenameThread( "readahead" ) ;
+    blockReadAhead.Loop() ;
+}
+
+void StopBlockReadAhead()
+{
+    LogPrintf( "%s()\n", __func__ ) ;
+    blockReadAhead.Quit() ;
+}
+
+uint64_t GetBlocksReadAhead()
+{
+    return blockReadAhead.Taken() ;
+}
+
 // Protected by cs_main
 VersionBitsCache versionbitscache;
 
@@ -1734,10 +2267,11 @@ bool ConnectBlock( const CBlock & block, CValidationState & state, CBlockIndex *
 
     if (fEnforceBIP30) {
         for ( const auto & tx : block.vtx ) {
-            const CCoins * coins = view.AccessCoins( tx->GetTxHash() ) ;
-            if ( coins && ! coins->IsPruned() )
-                return state.DoS( 50, error("ConnectBlock(): tried to overwrite transaction"),
-                                  REJECT_INVALID, "bad-txns-BIP30" ) ;
+            for ( size_t o = 0 ; o < tx->vout.size() ; o ++ ) {
+                if ( view.HaveCoin( COutPoint( tx->GetTxHash(), o ) ) )
+                    return state.DoS( 50, error("ConnectBlock(): tried to overwrite transaction"),
+                                      REJECT_INVALID, "bad-txns-BIP30" ) ;
+            }
         }
     }
 
@@ -1806,7 +2340,7 @@ bool ConnectBlock( const CBlock & block, CValidationState & state, CBlockIndex *
             // be in ConnectBlock because they require the UTXO set
             prevheights.resize(tx.vin.size());
             for (size_t j = 0; j < tx.vin.size(); j++) {
-                prevheights[j] = view.AccessCoins(tx.vin[j].prevout.hash)->nHeight;
+                prevheights[j] = view.AccessCoin(tx.vin[j].prevout).nHeight;
             }
 
             if ( ! SequenceLocks( tx, nLockTimeFlags, &prevheights, *pindex ) ) {
@@ -1910,6 +2444,24 @@ bool ConnectBlock( const CBlock & block, CValidationState & state, CBlockIndex *
     return true;
 }
 
+/** All blocks of mapBlockIndex sorted by height, so parents come before children */
+static std::vector< CBlockIndex * > BlocksByHeight()
+{
+    std::vector< std::pair< int, CBlockIndex* > > vSortedByHeight ;
+    vSortedByHeight.reserve( mapBlockIndex.size() ) ;
+    for ( const std::pair< const uint256, CBlockIndex* > & item : mapBlockIndex )
+    {
+        CBlockIndex * pindex = item.second ;
+        vSortedByHeight.push_back( std::make_pair( pindex->nHeight, pindex ) ) ;
+    }
+    std::sort( vSortedByHeight.begin(), vSortedByHeight.end() ) ;
+    std::vector< CBlockIndex * > vOrdered ;
+    vOrdered.reserve( vSortedByHeight.size() ) ;
+    for ( const std::pair< int, CBlockIndex* > & item : vSortedByHeight )
+        vOrdered.push_back( item.second ) ;
+    return vOrdered ;
+}
+
 /**
  * Update the on-disk chain state
  *
@@ -1960,7 +2512,9 @@ bool static FlushStateToDisk( CValidationState & state, FlushStateMode mode, int
         nLastSetChain = nNow;
     }
     int64_t nMempoolSizeMax = GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
-    int64_t cacheSize = pcoinsTip->DynamicMemoryUsage() * DB_PEAK_USAGE_FACTOR;
+    // Coins flushed before and still written in background are in memory too, their
+    // usage is counted with the cache so the two together stay within -dbcache
+    int64_t cacheSize = ( pcoinsTip->DynamicMemoryUsage() + pcoinsTip->WritingMemoryUsage() ) * DB_PEAK_USAGE_FACTOR ;
     int64_t nTotalSpace = nCoinCacheUsage + std::max<int64_t>(nMempoolSizeMax - nMempoolUsage, 0);
     // The cache is large and we're within 10% and 200 MiB or 50% and 50MiB of the limit, but we have time now (not in the middle of a block processing)
     bool fCacheLarge = ( mode == FLUSH_STATE_PERIODIC &&
@@ -1991,7 +2545,7 @@ bool static FlushStateToDisk( CValidationState & state, FlushStateMode mode, int
                 vFiles.push_back( std::make_pair( *it, &vinfoBlockFile[ *it ] ) ) ;
                 setOfDirtyBlockFiles.erase( it ++ ) ;
             }
-            std::vector< const CBlockIndex * > vBlocks ;
+            std::vector< CBlockIndex * > vBlocks ;
             vBlocks.reserve( setOfDirtyBlockIndices.size() ) ;
             for ( std::set< CBlockIndex* >::iterator it = setOfDirtyBlockIndices.begin() ; it != setOfDirtyBlockIndices.end() ; ) {
                 vBlocks.push_back( *it ) ;
@@ -2000,24 +2554,37 @@ bool static FlushStateToDisk( CValidationState & state, FlushStateMode mode, int
             if ( ! pblocktree->WriteBatchSync( vFiles, nLastBlockFile, vBlocks ) ) {
                 return AbortNode( state, "Failed to write to block index database" ) ;
             }
+            // each write of a block appends its record to the snapshot, which is written again once they pile up
+            if ( pblocktree->IndexSnapshotWantsCompacting() )
+                pblocktree->WriteIndexSnapshot( BlocksByHeight() ) ;
         }
-        // Finally remove any pruned files
-        if (fFlushForPrune)
+        // Finally remove any pruned files, after coins of the previous flush are on disk
+        if (fFlushForPrune) {
+            if ( ! pcoinsTip->Sync() )
+                return AbortNode( state, "Failed to write to coin database" ) ;
             UnlinkPrunedFiles(setFilesToPrune);
+        }
         nLastWrite = nNow;
     }
     // Flush best chain related state. This can only be done if the blocks / block index write was also done
     if (fDoFullFlush) {
-        // Typical CCoins structures on disk are around 128 bytes in size.
+        // Typical Coin structures on disk are around 48 bytes in size.
         // Pushing a new one to the database can cause it to be written
         // twice (once in the log, and once in the tables). This is already
         // an overestimation, as most will delete an existing entry or
         // overwrite one. Still, use a conservative safety factor of 2
-        if (!CheckDiskSpace(128 * 2 * 2 * pcoinsTip->GetCacheSize()))
+        if (!CheckDiskSpace(48 * 2 * 2 * pcoinsTip->GetCacheSize()))
             return state.Error("out of disk space");
         // Flush the chainstate (which may refer to block index entries)
-        if (!pcoinsTip->Flush())
-            return AbortNode(state, "Failed to write to coin database");
+        nCoinsTipFlushSeq ++ ;
+        bool fFlushed = pcoinsTip->Flush() ;
+        nCoinsTipFlushSeq ++ ;
+        // The database may write coins in background, while blocks are connected
+        // against the emptied pcoinsTip. Unless everything has to be on disk now
+        if ( fFlushed && ( mode == FLUSH_STATE_ALWAYS || fFlushForPrune ) )
+            fFlushed = pcoinsTip->Sync() ;
+        if ( ! fFlushed )
+            return AbortNode( state, "Failed to write to coin database" ) ;
         nLastFlush = nNow;
     }
     if (fDoFullFlush || ((mode == FLUSH_STATE_ALWAYS || mode == FLUSH_STATE_PERIODIC) && nNow > nLastSetChain + (int64_t)DATABASE_WRITE_INTERVAL * 1000000)) {
@@ -2055,10 +2622,9 @@ void PruneAndFlush() {
             CAmount txValueIn = 0 ;
             for ( const CTxIn & txin : tx->vin )
             {
-                const CCoins * coins = view.AccessCoins( txin.prevout.hash ) ;
-                if ( coins != nullptr && txin.prevout.n < coins->vout.size() ) {
-                    const CTxOut & vout = coins->vout[ txin.prevout.n ] ;
-                    txValueIn += vout.nValue ;
+                const Coin & coin = view.AccessCoin( txin.prevout ) ;
+                if ( ! coin.IsSpent() ) {
+                    txValueIn += coin.out.nValue ;
                 } else {
                     CTransactionRef prevoutTx ;
                     uint256 blockSha256 ;
@@ -2237,6 +2803,7 @@ bool static DisconnectTip( CValidationState & state, const CChainParams & chainp
 }
 
 static int64_t nTimeReadFromDisk = 0;
+static int64_t nTimePrefetch = 0 ;
 static int64_t nTimeConnectTotal = 0;
 static int64_t nTimeFlush = 0;
 static int64_t nTimeChainState = 0;
@@ -2264,7 +2831,12 @@ bool static ConnectTip( CValidationState & state, const CChainParams & chainpara
 
     // Read block from disk
     int64_t nTime1 = GetTimeMicros();
-    if (!pblock) {
+    std::vector< COutPoint > vOutpointsAhead ;
+    std::vector< Coin > vCoinsAhead ;
+    std::shared_ptr< const CBlock > pblockAhead = pblock ? nullptr : blockReadAhead.Take( pindexNew, vOutpointsAhead, vCoinsAhead ) ;
+    if ( pblockAhead != nullptr ) {
+        connectTrace.blocksConnected.emplace_back( pindexNew, pblockAhead ) ;
+    } else if (!pblock) {
         std::shared_ptr<CBlock> pblockNew = std::make_shared<CBlock>();
         connectTrace.blocksConnected.emplace_back(pindexNew, pblockNew);
         if (!ReadBlockFromDisk(*pblockNew, pindexNew, chainparams.GetConsensus(pindexNew->nHeight)))
@@ -2273,11 +2845,17 @@ bool static ConnectTip( CValidationState & state, const CChainParams & chainpara
         connectTrace.blocksConnected.emplace_back(pindexNew, pblock);
     }
     const CBlock& blockConnecting = *connectTrace.blocksConnected.back().second;
+    for ( size_t i = 0 ; i < vOutpointsAhead.size() ; i ++ )
+        if ( ! vCoinsAhead[ i ].IsSpent() )
+            pcoinsTip->AddFetchedCoin( vOutpointsAhead[ i ], std::move( vCoinsAhead[ i ] ) ) ;
     // Apply the block atomically to the chain state
     int64_t nTime2 = GetTimeMicros(); nTimeReadFromDisk += nTime2 - nTime1;
     int64_t nTime3;
     LogPrint("bench", "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * 0.001, nTimeReadFromDisk * 0.000001);
     {
+        size_t nPrefetched = PrefetchBlockInputs( blockConnecting, *pcoinsTip ) ;
+        int64_t nTimePrefetched = GetTimeMicros() ; nTimePrefetch += nTimePrefetched - nTime2 ;
+        LogPrint( "bench", "  - Prefetch %u inputs: %.2fms [%.2fs]\n", nPrefetched, ( nTimePrefetched - nTime2 ) * 0.001, nTimePrefetch * 0.000001 ) ;
         CCoinsViewCache view( pcoinsTip ) ;
         bool rv = ConnectBlock(blockConnecting, state, pindexNew, view, chainparams);
         GetMainSignals().BlockChecked(blockConnecting, state);
@@ -2419,6 +2997,14 @@ static bool ActivateBestChainStep( CValidationState & state, const CChainParams
         }
         nHeight = nTargetHeight ;
 
+        // Blocks after the first one are read while the ones before them are being connected
+        if ( vpindexToConnect.size() > 1 ) {
+            std::vector< CBlockIndex * > vpindexAhead( vpindexToConnect.rbegin(), vpindexToConnect.rend() ) ;
+            if ( pblock && vpindexAhead.back() == pindexHighest )
+                vpindexAhead.pop_back() ;
+            blockReadAhead.Schedule( vpindexAhead, chainparams, *pcoinsTip->GetBackend() ) ;
+        }
+
         // Connect new blocks
         BOOST_REVERSE_FOREACH(CBlockIndex *pindexConnect, vpindexToConnect) {
             if ( ! ConnectTip( state, chainparams, pindexConnect, pindexConnect == pindexHighest ? pblock : std::shared_ptr< const CBlock >(), connectTrace ) ) {
@@ -2694,8 +3280,7 @@ CBlockIndex* AddToBlockIndex( const CBlockHeader & block )
         return it->second ;
 
     // Construct new block index object
-    CBlockIndex* pindexNew = new CBlockIndex( block ) ;
-    assert( pindexNew ) ;
+    CBlockIndex* pindexNew = blockIndexArena.New( block ) ;
     // We assign the sequence id to blocks only when the full data is available,
     // to avoid miners withholding blocks but broadcasting headers to get
     // a competitive advantage
@@ -3164,7 +3749,7 @@ bool ContextualCheckBlock( const CBlock & block, CValidationState & state, const
     return true;
 }
 
-static bool AcceptBlockHeader( const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex )
+static bool AcceptBlockHeader( const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fCheckPOW = true )
 {
     AssertLockHeld(cs_main);
     // Check for duplicate
@@ -3183,7 +3768,7 @@ static bool AcceptBlockHeader( const CBlockHeader& block, CValidationState& stat
             return true;
         }
 
-        if (!CheckBlockHeader(block, state))
+        if (!CheckBlockHeader(block, state, fCheckPOW))
             return error("%s: Consensus::CheckBlockHeader: %s, %s", __func__, hash.ToString(), FormatStateMessage(state));
 
         // Get previous block index
@@ -3202,8 +3787,11 @@ static bool AcceptBlockHeader( const CBlockHeader& block, CValidationState& stat
         if ( ! ContextualCheckBlockHeader( block, state, pindexPrev, GetAdjustedTime() ) )
             return error( "%s: Consensus::ContextualCheckBlockHeader: %s, %s", __func__, hash.ToString(), FormatStateMessage( state ) ) ;
     }
-    if (pindex == NULL)
+    if (pindex == NULL) {
         pindex = AddToBlockIndex(block);
+        // Headers of new blocks are the ones most asked for by peers
+        auxpowCache.Put( pindex->GetBlockSha256Hash(), block.auxpow ) ;
+    }
 
     if (ppindex)
         *ppindex = pindex;
@@ -3216,11 +3804,73 @@ static bool AcceptBlockHeader( const CBlockHeader& block, CValidationState& stat
 // Exposed wrapper for AcceptBlockHeader
 bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& headers, CValidationState& state, const CChainParams& chainparams, const CBlockIndex** ppindex)
 {
+    // Proof of work of headers not seen before is checked by the parallel task
+    // workers without holding cs_main, then only contextual checks are left
+    // for AcceptBlockHeader. When some header fails, all of them go the usual
+    // way to find which one is bad, hashes are remembered so that's cheap
+    std::vector< bool > vPowChecked( headers.size(), false ) ;
+    if ( nScriptCheckThreads > 1 && ! headers.empty() )
+    {
+        std::vector< uint256 > vHashes ;
+        vHashes.reserve( headers.size() ) ;
+        for ( const CBlockHeader & header : headers )
+            vHashes.push_back( header.GetSha256Hash() ) ;
+
+        std::vector< size_t > vNew ;
+        {
+            LOCK( cs_main ) ;
+            for ( size_t i = 0 ; i < headers.size() ; i ++ )
+                if ( mapBlockIndex.count( vHashes[ i ] ) == 0 )
+                    vNew.push_back( i ) ;
+        }
+
+        if ( ! vNew.empty() ) {
+            // headers without auxpow are scrypted in groups by the multi-lane kernel,
+            // then each is checked against own bits with its scrypt hash remembered
+            std::vector< size_t > vAux ;
+            std::vector< size_t > vPlain ;
+            for ( size_t i : vNew )
+                ( headers[ i ].auxpow != nullptr ? vAux : vPlain ).push_back( i ) ;
+            const size_t nWays = scrypt_multi_ways() ;
+            const size_t nGroups = ( vPlain.size() + nWays - 1 ) / nWays ;
+
+            std::atomic< bool > fFailed( false ) ;
+            ForEachInParallel( nGroups + vAux.size(), [ & ]( size_t n ) {
+                if ( fFailed ) return ;
+                if ( n >= nGroups ) {
+                    if ( ! CheckDogecoinProofOfWork( headers[ vAux[ n - nGroups ] ], chainparams.GetConsensus( 0 ) ) )
+                        fFailed = true ;
+                    return ;
+                }
+
+                const size_t nBegin = n * nWays ;
+                const size_t nLanes = std::min( nWays, vPlain.size() - nBegin ) ;
+                std::vector< char > vInput( nLanes * 80 ) ;
+                std::vector< uint256 > vScryptHashes( nLanes ) ;
+                for ( size_t l = 0 ; l < nLanes ; l ++ )
+                    memcpy( &vInput[ l * 80 ], &headers[ vPlain[ nBegin + l ] ].nVersion, 80 ) ;
+                scrypt_1024_1_1_256_sp_multi( vInput.data(), (char*)vScryptHashes.data(), scrypt_thread_scratchpad( SCRYPT_MULTI_SCRATCHPAD_SIZE ), nLanes ) ;
+                for ( size_t l = 0 ; l < nLanes ; l ++ ) {
+                    const CBlockHeader & header = headers[ vPlain[ nBegin + l ] ] ;
+                    header.RememberScryptHash( vScryptHashes[ l ] ) ;
+                    if ( ! CheckDogecoinProofOfWork( header, chainparams.GetConsensus( 0 ) ) ) {
+                        fFailed = true ;
+                        return ;
+                    }
+                }
+            } ) ;
+            if ( ! fFailed )
+                for ( size_t i : vNew )
+                    vPowChecked[ i ] = true ;
+        }
+    }
+
     {
         LOCK(cs_main);
-        for (const CBlockHeader& header : headers) {
+        for (size_t i = 0; i < headers.size(); i++) {
+            const CBlockHeader& header = headers[i];
             CBlockIndex *pindex = NULL; // Use a temp pindex instead of ppindex to avoid a const_cast
-            if (!AcceptBlockHeader(header, state, chainparams, &pindex)) {
+            if (!AcceptBlockHeader(header, state, chainparams, &pindex, !vPowChecked[i])) {
                 return false;
             }
             if (ppindex) {
@@ -3302,6 +3952,8 @@ static bool AcceptBlock( const std::shared_ptr< const CBlock > & pblock, CValida
         if (dbp == NULL)
             if (!WriteBlockToDisk(block, blockPos, chainparams.MessageStart()))
                 AbortNode(state, "Failed to write block");
+        // Proof of work of this block data is checked by CheckBlock above
+        pindex->nStatus |= BLOCK_POW_CHECKED ;
         if ( ! ReceivedBlockTransactions( block, state, pindex, blockPos ) )
             return error("AcceptBlock(): ReceivedBlockTransactions failed");
     } catch (const std::runtime_error& e) {
@@ -3406,6 +4058,7 @@ void PruneOneBlockFile(const int fileNumber)
         if ( pindex->nFile == fileNumber ) {
             pindex->nStatus &= ~BLOCK_DATA_EXISTS ;
             pindex->nStatus &= ~BLOCK_UNDO_EXISTS ;
+            pindex->nStatus &= ~BLOCK_POW_CHECKED ;
             pindex->nFile = 0 ;
             pindex->nDataPos = 0 ;
             pindex->nUndoPos = 0 ;
@@ -3435,8 +4088,11 @@ void UnlinkPrunedFiles(const std::set<int>& setFilesToPrune)
 {
     for (std::set<int>::iterator it = setFilesToPrune.begin(); it != setFilesToPrune.end(); ++it) {
         CDiskBlockPos pos(*it, 0);
-        boost::filesystem::remove(GetBlockPosFilename(pos, "blk"));
-        boost::filesystem::remove(GetBlockPosFilename(pos, "rev"));
+        for ( const char * prefix : { "blk", "rev" } ) {
+            boost::filesystem::path path = GetBlockPosFilename( pos, prefix ) ;
+            blockFileMapper.Forget( path.string() ) ;
+            boost::filesystem::remove( path ) ;
+        }
         LogPrintf("Prune: %s deleted blk/rev (%05u)\n", __func__, *it);
     }
 }
@@ -3559,6 +4215,30 @@ FILE* OpenUndoFile(const CDiskBlockPos &pos, bool fReadOnly) {
     return OpenDiskFile(pos, "rev", fReadOnly);
 }
 
+std::shared_ptr< const CMappedFile > MapDiskRecord( const CDiskBlockPos & pos, const char * prefix, size_t nExtra, const char * & pbegin, const char * & pend )
+{
+    // a record follows network magic and its size
+    if ( pos.IsNull() || pos.nPos < 8 )
+        return nullptr ;
+
+    std::string strPath = GetBlockPosFilename( pos, prefix ).string() ;
+    std::shared_ptr< const CMappedFile > mapped = blockFileMapper.Map( strPath, pos.nPos ) ;
+    if ( mapped == nullptr )
+        return nullptr ;
+
+    size_t nEnd = (size_t)pos.nPos + ReadLE32( (const unsigned char *)mapped->data() + pos.nPos - 4 ) + nExtra ;
+    if ( mapped->size() < nEnd ) {
+        // written after the file was mapped
+        mapped = blockFileMapper.Map( strPath, nEnd ) ;
+        if ( mapped == nullptr )
+            return nullptr ;
+    }
+
+    pbegin = mapped->data() + pos.nPos ;
+    pend = mapped->data() + nEnd ;
+    return mapped ;
+}
+
 boost::filesystem::path GetBlockPosFilename( const CDiskBlockPos & pos, const char * prefix )
 {
     return GetDirForData() / "blocks" / strprintf( "%s%05u.dat", prefix, pos.nFile ) ;
@@ -3574,9 +4254,7 @@ CBlockIndex * InsertBlockIndex( uint256 hash )
         return mi->second ;
 
     // Create new
-    CBlockIndex * pindexNew = new CBlockIndex() ;
-    if ( pindexNew == nullptr )
-        throw std::runtime_error( std::string(__func__) + ": new CBlockIndex failed" ) ;
+    CBlockIndex * pindexNew = blockIndexArena.New() ;
     mi = mapBlockIndex.insert( std::make_pair( hash, pindexNew ) ).first ;
     pindexNew->SetBlockSha256Hash( mi->first ) ;
 
@@ -3588,7 +4266,9 @@ static std::atomic< bool > loadingBlockIndexDB( false ) ;
 bool static LoadBlockIndexDB( const CChainParams & chainparams )
 {
     loadingBlockIndexDB = true ;
-    if ( ! pblocktree->LoadBlockIndexGuts( InsertBlockIndex, loadingBlockIndexDB ) )
+    // from the snapshot, blocks come with parents before children
+    std::vector< CBlockIndex * > vOrdered ;
+    if ( ! pblocktree->LoadBlockIndexGuts( InsertBlockIndex, loadingBlockIndexDB, vOrdered ) )
         return false ;
 
     if ( ! loadingBlockIndexDB || ShutdownRequested() ) {
@@ -3596,18 +4276,17 @@ bool static LoadBlockIndexDB( const CChainParams & chainparams )
         throw std::string( "stopthread" ) ;
     }
 
-    // sort blocks in chain by height
-    std::vector< std::pair< int, CBlockIndex* > > vSortedByHeight ;
-    vSortedByHeight.reserve( mapBlockIndex.size() ) ;
-    for ( const std::pair< uint256, CBlockIndex* > & item : mapBlockIndex )
-    {
-        CBlockIndex * pindex = item.second ;
-        vSortedByHeight.push_back( std::make_pair( pindex->nHeight, pindex ) ) ;
+    if ( vOrdered.empty() ) {
+        vOrdered = BlocksByHeight() ;
+
+        // next time it loads from the snapshot
+        if ( ! vOrdered.empty() )
+            pblocktree->WriteIndexSnapshot( vOrdered ) ;
     }
-    std::sort( vSortedByHeight.begin(), vSortedByHeight.end() ) ;
-    for ( const std::pair< int, CBlockIndex* > & item : vSortedByHeight )
+
+    // what's computed along the chain is computed once for each block, after its parent
+    for ( CBlockIndex * pindex : vOrdered )
     {
-        CBlockIndex * pindex = item.second ;
 
         // calculate nChainCoins, the summary number of coins generated in the chain up to and including this block
         /* CBlock block ;
@@ -3643,6 +4322,8 @@ bool static LoadBlockIndexDB( const CChainParams & chainparams )
             pindexBestHeader = pindex ;
     }
 
+    LogPrintf( "%s: %u block index entries in %.1f MiB\n", __func__, blockIndexArena.size(), blockIndexArena.DynamicMemoryUsage() / 1048576.0 ) ;
+
     // Load block file info
     pblocktree->ReadLastBlockFile(nLastBlockFile);
     vinfoBlockFile.resize(nLastBlockFile + 1);
@@ -3715,135 +4396,350 @@ bool static LoadBlockIndexDB( const CChainParams & chainparams )
     return true ;
 }
 
-WVerifyDB::WVerifyDB()
+WVerifyDB::WVerifyDB( bool showProgress ) : showProgress( showProgress )
 {
-    uiInterface.ShowProgress( _("Verifying blocks..."), 0 ) ;
+    if ( showProgress )
+        uiInterface.ShowProgress( _("Verifying blocks..."), 0 ) ;
 }
 
 WVerifyDB::~WVerifyDB()
 {
-    uiInterface.ShowProgress( "", 100 ) ;
+    if ( showProgress )
+        uiInterface.ShowProgress( "", 100 ) ;
 }
 
-bool WVerifyDB::VerifyDB( const CChainParams & chainparams, AbstractCoinsView * coinsview, int nCheckLevel, int nCheckDepth )
+static std::mutex mutexVerifyDBStatus ;
+static CVerifyDBStatus verifyDBStatus ;
+static std::atomic< int > nVerifyDBBlocksChecked( 0 ) ;
+static std::atomic< bool > fStopVerifyDB( false ) ;
+
+static void SetVerifyDBStatus( const std::string & strState, int nCheckLevel, int nBlocksToCheck )
 {
-    verifying = true ;
+    std::lock_guard< std::mutex > lock( mutexVerifyDBStatus ) ;
+    verifyDBStatus.strState = strState ;
+    if ( nCheckLevel >= 0 ) verifyDBStatus.nCheckLevel = nCheckLevel ;
+    if ( nBlocksToCheck >= 0 ) {
+        verifyDBStatus.nBlocksToCheck = nBlocksToCheck ;
+        nVerifyDBBlocksChecked = 0 ;
+    }
+}
 
-    LOCK( cs_main ) ;
-    if ( chainActive.Tip() == nullptr || chainActive.Tip()->pprev == nullptr )
-        return true ;
+CVerifyDBStatus GetVerifyDBStatus()
+{
+    std::lock_guard< std::mutex > lock( mutexVerifyDBStatus ) ;
+    CVerifyDBStatus status = verifyDBStatus ;
+    status.nBlocksChecked = nVerifyDBBlocksChecked ;
+    return status ;
+}
 
-    // Verify blocks in the best chain
-    if ( nCheckDepth <= 0 ) nCheckDepth = 1000000000 ;
-    if ( nCheckDepth > chainActive.Height() )
-        nCheckDepth = chainActive.Height() ;
-    nCheckLevel = std::max( 0, std::min( 4, nCheckLevel ) ) ;
-    LogPrintf( "Verifying last %i blocks at level %i\n", nCheckDepth, nCheckLevel ) ;
+/** Check levels 0 to 2 of a block, which need no chain state. Returns what's wrong, empty when nothing is */
+static std::string VerifyBlockOnDisk( const CBlockIndex * pindex, int nCheckLevel, const CChainParams & chainparams )
+{
+    CBlock block ;
+    // check level 0: read from disk
+    if ( ! ReadBlockFromDisk( block, pindex, chainparams.GetConsensus( pindex->nHeight ) ) )
+        return strprintf( "ReadBlockFromDisk failed at height %d, sha256_hash=%s",
+                            pindex->nHeight, pindex->GetBlockSha256Hash().ToString() ) ;
 
-    CCoinsViewCache coins( coinsview ) ;
-    CBlockIndex* pindexState = chainActive.Tip() ;
-    CBlockIndex* pindexFailure = nullptr ;
-    int nGoodTransactions = 0 ;
+    // check level 1: verify block validity
     CValidationState state ;
+    if ( nCheckLevel >= 1 && ! CheckBlock( block, state ) )
+        return strprintf( "found bad block at height %d, sha256_hash=%s (%s)",
+                            pindex->nHeight, pindex->GetBlockSha256Hash().ToString(), FormatStateMessage( state ) ) ;
+
+    // check level 2: verify undo validity
+    if ( nCheckLevel >= 2 ) {
+        CBlockUndo undo ;
+        CDiskBlockPos pos = pindex->GetUndoPos() ;
+        if ( ! pos.IsNull() && ! UndoReadFromDisk( undo, pos, pindex->pprev->GetBlockSha256Hash() ) )
+            return strprintf( "found bad undo data at height %d, sha256_hash=%s",
+                                pindex->nHeight, pindex->GetBlockSha256Hash().ToString() ) ;
+    }
 
-    int reportDone = 0 ;
-    LogPrintf( "[0%%]..." ) ;
+    return std::string() ;
+}
 
-    for ( CBlockIndex* pindex = chainActive.Tip() ; pindex && pindex->pprev ; pindex = pindex->pprev )
-    {
-        if ( ! verifying || ShutdownRequested() ) {
-            LogPrintf( "%s: stopping\n", __func__ ) ;
-            throw std::string( "stopthread" ) ;
-        }
+/** Blocks checked by one ForEachInParallel, no more are checked past a failed one than these */
+static const size_t VERIFY_BLOCKS_BATCH = 64 ;
 
-        int percentageDone = std::max(1, std::min(99, (int)(((double)(chainActive.Height() - pindex->nHeight)) / (double)nCheckDepth * (nCheckLevel >= 4 ? 50 : 100))));
-        if ( reportDone < percentageDone / 10 ) {
-            // report every 10% step
-            LogPrintf( "[%d%%]...", percentageDone ) ;
-            reportDone = percentageDone / 10 ;
+/** Check levels 0 to 2 of these blocks in parallel, without cs_main */
+static bool VerifyBlocksOnDisk( const std::vector< CBlockIndex * > & vBlocks, int nCheckLevel, const CChainParams & chainparams,
+                                const bool & verifying, bool showProgress )
+{
+    std::atomic< bool > fFailed( false ) ;
+    std::atomic< bool > fStop( false ) ;
+    std::mutex mutexFailure ;
+    size_t nFailure = vBlocks.size() ;
+    std::string strFailure ;
+
+    // the whole progress is to 100 or, reconnecting blocks after, to 50
+    const int nProgressScale = ( nCheckLevel >= 4 ) ? 50 : 100 ;
+    auto check = [ & ]( size_t i ) {
+        if ( fFailed || fStop )
+            return ;
+        if ( ! verifying || fStopVerifyDB || ShutdownRequested() ) {
+            fStop = true ;
+            return ;
         }
-        uiInterface.ShowProgress( _("Verifying blocks..."), percentageDone ) ;
-        if ( pindex->nHeight < chainActive.Height() - nCheckDepth )
-            break ;
-        if ( fPruneMode && ! ( pindex->nStatus & BLOCK_DATA_EXISTS ) ) {
-            // If pruning, only go back as far as we have data
-            LogPrintf( "%s: block verification stopping at height %d (pruning, no data)\n", __func__, pindex->nHeight ) ;
-            break ;
+        std::string strError = VerifyBlockOnDisk( vBlocks[ i ], nCheckLevel, chainparams ) ;
+        if ( ! strError.empty() ) {
+            std::lock_guard< std::mutex > lock( mutexFailure ) ;
+            if ( i < nFailure ) {
+                nFailure = i ;
+                strFailure = strError ;
+            }
+            fFailed = true ;
+        }
+        int nChecked = ++ nVerifyDBBlocksChecked ;
+        int nPercentage = nChecked * nProgressScale / vBlocks.size() ;
+        if ( nPercentage != ( nChecked - 1 ) * nProgressScale / (int)vBlocks.size() ) {
+            if ( showProgress )
+                uiInterface.ShowProgress( _("Verifying blocks..."), std::max( 1, std::min( 99, nPercentage ) ) ) ;
+            if ( nPercentage % 10 == 0 )
+                LogPrintf( "[%d%%]...", nPercentage ) ;
         }
+    } ;
 
-        CBlock block ;
-        // check level 0: read from disk
-        if ( ! ReadBlockFromDisk( block, pindex, chainparams.GetConsensus( pindex->nHeight ) ) )
-            return error( "%s: *** ReadBlockFromDisk failed at height %d, sha256_hash=%s", __func__,
-                            pindex->nHeight, pindex->GetBlockSha256Hash().ToString() ) ;
+    for ( size_t nBegin = 0 ; nBegin < vBlocks.size() && ! fFailed && ! fStop ; nBegin += VERIFY_BLOCKS_BATCH ) {
+        const size_t nBatch = std::min( VERIFY_BLOCKS_BATCH, vBlocks.size() - nBegin ) ;
+        ForEachInParallel( nBatch, [ & ]( size_t i ) {  check( nBegin + i ) ;  } ) ;
+    }
 
-        // check level 1: verify block validity
-        if ( nCheckLevel >= 1 && ! CheckBlock( block, state ) )
-            return error( "%s: *** found bad block at height %d, sha256_hash=%s (%s)\n", __func__,
-                          pindex->nHeight, pindex->GetBlockSha256Hash().ToString(), FormatStateMessage( state ) ) ;
-
-        // check level 2: verify undo validity
-        if ( nCheckLevel >= 2 && pindex != nullptr ) {
-            CBlockUndo undo ;
-            CDiskBlockPos pos = pindex->GetUndoPos() ;
-            if ( ! pos.IsNull() ) {
-                if ( ! UndoReadFromDisk( undo, pos, pindex->pprev->GetBlockSha256Hash() ) )
-                    return error( "%s: *** found bad undo data at height %d, sha256_hash=%s\n", __func__,
-                                    pindex->nHeight, pindex->GetBlockSha256Hash().ToString() ) ;
-            }
+    if ( fStop ) {
+        LogPrintf( "%s: stopping\n", __func__ ) ;
+        throw std::string( "stopthread" ) ;
+    }
+    if ( fFailed ) {
+        // blocks pruned while they were checked aren't a failure
+        LOCK( cs_main ) ;
+        if ( ! ( vBlocks[ nFailure ]->nStatus & BLOCK_DATA_EXISTS ) ) {
+            LogPrintf( "%s: block verification stopping at height %d (pruned meanwhile)\n", __func__, vBlocks[ nFailure ]->nHeight ) ;
+            return true ;
         }
+        return error( "%s: *** %s", __func__, strFailure ) ;
+    }
+    return true ;
+}
 
-        // check level 3: check for inconsistencies during memory-only disconnect of tip blocks
-        if ( nCheckLevel >= 3 && pindex == pindexState &&
-                ( coins.DynamicMemoryUsage() + pcoinsTip->DynamicMemoryUsage() ) <= nCoinCacheUsage ) {
-            bool fClean = true ;
-            if ( ! DisconnectBlock( block, state, pindex, coins, &fClean ) )
-                return error( "%s: *** irrecoverable inconsistency in block data at height %d, sha256_hash=%s", __func__,
-                                pindex->nHeight, pindex->GetBlockSha256Hash().ToString() ) ;
-            pindexState = pindex->pprev ;
-            if ( ! fClean ) {
-                nGoodTransactions = 0 ;
-                pindexFailure = pindex ;
-            } else
-                nGoodTransactions += block.vtx.size() ;
+/**
+ * Coins as they are at the tip the check of levels 3 and 4 started from, each read with
+ * cs_main held. Once the tip is another one, no coin is found and TipChanged says so
+ */
+class CCoinsViewAtTip : public CCoinsViewBacked
+{
+private:
+    const CBlockIndex * pindexTip ;
+    mutable bool fTipChanged ;
+
+    bool AtTip() const
+    {
+        AssertLockHeld( cs_main ) ;
+        if ( chainActive.Tip() != pindexTip )
+            fTipChanged = true ;
+        return ! fTipChanged ;
+    }
+
+public:
+    CCoinsViewAtTip( AbstractCoinsView * view, const CBlockIndex * pindex ) : CCoinsViewBacked( view ), pindexTip( pindex ), fTipChanged( false ) {}
+
+    virtual bool GetCoin( const COutPoint & outpoint, Coin & coin ) const override {
+        LOCK( cs_main ) ;
+        return AtTip() && base->GetCoin( outpoint, coin ) ;
+    }
+    virtual bool HaveCoin( const COutPoint & outpoint ) const override {
+        LOCK( cs_main ) ;
+        return AtTip() && base->HaveCoin( outpoint ) ;
+    }
+    virtual uint256 GetSha256OfBestBlock() const override {  return pindexTip->GetBlockSha256Hash() ;  }
+    // what's disconnected and connected here is never written below
+    virtual bool BatchWrite( CCoinsMap & mapCoins, const uint256 & blockHash ) override {  return false ;  }
+
+    bool TipChanged() const {  return fTipChanged ;  }
+} ;
+
+/**
+ * Check levels 3 and 4, disconnecting blocks at the tip in memory and connecting them again.
+ * cs_main is held to take the tip and blocks under it, then blocks are read and disconnected
+ * without it, with coins read through CCoinsViewAtTip. Connecting a block needs the chain,
+ * so cs_main is held for one block at a time. When the tip changes meanwhile, the check stops
+ */
+static bool VerifyCoinsAtTip( const CChainParams & chainparams, AbstractCoinsView * coinsview, int nCheckLevel, int nCheckDepth,
+                              const bool & verifying, bool showProgress )
+{
+    CBlockIndex * pindexTip = nullptr ;
+    std::vector< CBlockIndex * > vBlocks ; // from the tip down
+    size_t nTipCacheUsage = 0 ;
+    {
+        LOCK( cs_main ) ;
+        pindexTip = chainActive.Tip() ;
+        if ( nCheckDepth > pindexTip->nHeight )
+            nCheckDepth = pindexTip->nHeight ;
+        for ( CBlockIndex * pindex = pindexTip ; pindex->pprev != nullptr ; pindex = pindex->pprev ) {
+            if ( pindex->nHeight <= pindexTip->nHeight - nCheckDepth )
+                break ;
+            if ( fPruneMode && ! ( pindex->nStatus & BLOCK_DATA_EXISTS ) )
+                break ;
+            vBlocks.push_back( pindex ) ;
+        }
+        nTipCacheUsage = pcoinsTip->DynamicMemoryUsage() ;
+    }
+
+    // a failure after the tip changed or the block got pruned isn't one of databases
+    auto changedMeanwhile = [ &pindexTip ]( const CBlockIndex * pindex ) {
+        LOCK( cs_main ) ;
+        if ( chainActive.Tip() == pindexTip && ( pindex->nStatus & BLOCK_DATA_EXISTS ) )
+            return false ;
+        LogPrintf( "%s: stopping at height %d, the tip changed or the block was pruned meanwhile\n", "VerifyCoinsAtTip", pindex->nHeight ) ;
+        return true ;
+    } ;
+    auto stopIfAsked = [ & ]() {
+        if ( ! verifying || fStopVerifyDB || ShutdownRequested() ) {
+            LogPrintf( "%s: stopping\n", "VerifyCoinsAtTip" ) ;
+            throw std::string( "stopthread" ) ;
         }
+    } ;
+
+    CCoinsViewAtTip viewAtTip( coinsview, pindexTip ) ;
+    CCoinsViewCache coins( &viewAtTip ) ;
+    CBlockIndex* pindexState = pindexTip ;
+    CBlockIndex* pindexFailure = nullptr ;
+    size_t nDisconnected = 0 ;
+    int nGoodTransactions = 0 ;
+    CValidationState state ;
+
+    // check level 3: check for inconsistencies during memory-only disconnect of tip blocks
+    for ( CBlockIndex * pindex : vBlocks )
+    {
+        stopIfAsked() ;
+        if ( coins.DynamicMemoryUsage() + nTipCacheUsage > nCoinCacheUsage )
+            break ;
 
-        if ( ShutdownRequested() ) return true ;
+        CBlock block ;
+        if ( ! ReadBlockFromDisk( block, pindex, chainparams.GetConsensus( pindex->nHeight ) ) )
+            return changedMeanwhile( pindex ) ||
+                    error( "%s: *** ReadBlockFromDisk failed at height %d, sha256_hash=%s", __func__,
+                            pindex->nHeight, pindex->GetBlockSha256Hash().ToString() ) ;
+        bool fClean = true ;
+        bool fDisconnected = DisconnectBlock( block, state, pindex, coins, &fClean ) ;
+        if ( viewAtTip.TipChanged() )
+            return changedMeanwhile( pindex ) ;
+        if ( ! fDisconnected )
+            return changedMeanwhile( pindex ) ||
+                    error( "%s: *** irrecoverable inconsistency in block data at height %d, sha256_hash=%s", __func__,
+                            pindex->nHeight, pindex->GetBlockSha256Hash().ToString() ) ;
+        pindexState = pindex->pprev ;
+        nDisconnected ++ ;
+        if ( ! fClean ) {
+            nGoodTransactions = 0 ;
+            pindexFailure = pindex ;
+        } else
+            nGoodTransactions += block.vtx.size() ;
     }
     if ( pindexFailure != nullptr )
         return error( "%s: *** coin database inconsistencies found (last %i blocks, %i good transactions before that)\n", __func__,
-                        chainActive.Height() - pindexFailure->nHeight + 1, nGoodTransactions ) ;
+                        pindexTip->nHeight - pindexFailure->nHeight + 1, nGoodTransactions ) ;
 
     // check level 4: try reconnecting blocks
     if ( nCheckLevel >= 4 ) {
-        CBlockIndex * pindex = pindexState ;
-        while ( pindex != chainActive.Tip() )
+        for ( size_t i = nDisconnected ; i -- > 0 ; )
         {
-            if ( ! verifying || ShutdownRequested() ) {
-                LogPrintf( "%s: stopping\n", __func__ ) ;
-                throw std::string( "stopthread" ) ;
-            }
-
-            uiInterface.ShowProgress( _("Verifying blocks..."), std::max(1, std::min(99, 100 - (int)(((double)(chainActive.Height() - pindex->nHeight)) / (double)nCheckDepth * 50))) ) ;
-            pindex = chainActive.Next( pindex ) ;
+            stopIfAsked() ;
+            CBlockIndex * pindex = vBlocks[ i ] ;
+            if ( showProgress )
+                uiInterface.ShowProgress( _("Verifying blocks..."), std::max(1, std::min(99, 100 - (int)(((double)(pindexTip->nHeight - pindex->nHeight)) / (double)nCheckDepth * 50))) ) ;
             CBlock block ;
             if ( ! ReadBlockFromDisk( block, pindex, chainparams.GetConsensus( pindex->nHeight ) ) )
-                return error( "%s: *** ReadBlockFromDisk failed at height %d, sha256_hash=%s", __func__,
+                return changedMeanwhile( pindex ) ||
+                        error( "%s: *** ReadBlockFromDisk failed at height %d, sha256_hash=%s", __func__,
                                 pindex->nHeight, pindex->GetBlockSha256Hash().ToString() ) ;
+
+            LOCK( cs_main ) ;
+            if ( chainActive.Tip() != pindexTip )
+                return changedMeanwhile( pindex ) ;
             if ( ! ConnectBlock( block, state, pindex, coins, chainparams ) )
-                return error( "%s: *** found unconnectable block at height %d, sha256_hash=%s", __func__,
+                return viewAtTip.TipChanged() ||
+                        error( "%s: *** found unconnectable block at height %d, sha256_hash=%s", __func__,
                                 pindex->nHeight, pindex->GetBlockSha256Hash().ToString() ) ;
         }
     }
 
-    LogPrintf( "[DONE]\n" ) ;
     LogPrintf( "%s: no coin database inconsistencies in last %i blocks (%i transactions)\n", __func__,
-                chainActive.Height() - pindexState->nHeight, nGoodTransactions ) ;
+                pindexTip->nHeight - pindexState->nHeight, nGoodTransactions ) ;
+    return true ;
+}
 
+bool WVerifyDB::VerifyDB( const CChainParams & chainparams, AbstractCoinsView * coinsview, int nCheckLevel, int nCheckDepth )
+{
+    nCheckLevel = std::max( 0, std::min( 4, nCheckLevel ) ) ;
+
+    // Blocks in the best chain to verify, from the tip down
+    std::vector< CBlockIndex * > vBlocks ;
+    {
+        LOCK( cs_main ) ;
+        if ( chainActive.Tip() == nullptr || chainActive.Tip()->pprev == nullptr ) {
+            SetVerifyDBStatus( "passed", nCheckLevel, 0 ) ;
+            return true ;
+        }
+
+        if ( nCheckDepth <= 0 ) nCheckDepth = 1000000000 ;
+        if ( nCheckDepth > chainActive.Height() )
+            nCheckDepth = chainActive.Height() ;
+        for ( CBlockIndex * pindex = chainActive.Tip() ; pindex->pprev != nullptr ; pindex = pindex->pprev ) {
+            if ( pindex->nHeight <= chainActive.Height() - nCheckDepth )
+                break ;
+            if ( fPruneMode && ! ( pindex->nStatus & BLOCK_DATA_EXISTS ) ) {
+                // If pruning, only go back as far as we have data
+                LogPrintf( "%s: block verification stopping at height %d (pruning, no data)\n", __func__, pindex->nHeight ) ;
+                break ;
+            }
+            vBlocks.push_back( pindex ) ;
+        }
+    }
+    verifying = true ;
+    LogPrintf( "Verifying last %i blocks at level %i\n", nCheckDepth, nCheckLevel ) ;
+    SetVerifyDBStatus( "running", nCheckLevel, vBlocks.size() ) ;
+    LogPrintf( "[0%%]..." ) ;
+
+    try {
+        if ( ! VerifyBlocksOnDisk( vBlocks, nCheckLevel, chainparams, verifying, showProgress ) ||
+                ( nCheckLevel >= 3 && ! VerifyCoinsAtTip( chainparams, coinsview, nCheckLevel, nCheckDepth, verifying, showProgress ) ) ) {
+            SetVerifyDBStatus( "failed", -1, -1 ) ;
+            verifying = false ;
+            return false ;
+        }
+    } catch ( const std::string & ) {
+        SetVerifyDBStatus( "stopped", -1, -1 ) ;
+        verifying = false ;
+        throw ;
+    }
+
+    LogPrintf( "[DONE]\n" ) ;
+    SetVerifyDBStatus( "passed", -1, -1 ) ;
     verifying = false ;
     return true ;
 }
 
+void ThreadVerifyDB( int nCheckLevel, int nCheckDepth )
+{
+    RenameThread( "verifydb" ) ;
+    try {
+        // no modal progress dialog while the node is up, just the log and getblockchaininfo
+        if ( ! WVerifyDB( false ).VerifyDB( Params(), pcoinsTip, nCheckLevel, nCheckDepth ) )
+            AbortNode( "Corrupted block database detected",
+                        _("Corrupted block database detected. Please restart with -reindex or -reindex-chainstate to recover") ) ;
+    } catch ( const std::string & ) {
+        // stopped before it's done
+    } catch ( const std::exception & e ) {
+        PrintExceptionContinue( &e, "verifydb" ) ;
+    }
+}
+
+void StopVerifyingDB()
+{
+    LogPrintf( "%s()\n", __func__ ) ;
+    fStopVerifyDB = true ;
+}
+
 bool RewindBlockIndex(const CChainParams& params)
 {
     LOCK(cs_main);
@@ -3891,7 +4787,7 @@ bool RewindBlockIndex(const CChainParams& params)
             // Reduce validity
             pindexIter->nStatus = std::min<unsigned int>(pindexIter->nStatus & BLOCK_VALID_MASK, BLOCK_VALID_TREE) | (pindexIter->nStatus & ~BLOCK_VALID_MASK);
             // Remove have-data flags
-            pindexIter->nStatus &= ~ ( BLOCK_DATA_EXISTS | BLOCK_UNDO_EXISTS ) ;
+            pindexIter->nStatus &= ~ ( BLOCK_DATA_EXISTS | BLOCK_UNDO_EXISTS | BLOCK_POW_CHECKED ) ;
             // Remove storage location
             pindexIter->nFile = 0;
             pindexIter->nDataPos = 0;
@@ -3935,6 +4831,8 @@ bool RewindBlockIndex(const CChainParams& params)
 void UnloadBlockIndex()
 {
     LOCK( cs_main ) ;
+    // nothing read ahead refers to blocks or the coins view any more
+    blockReadAhead.Clear() ;
     setOfBlockIndexCandidates.clear() ;
     chainActive.SetTip( nullptr ) ;
     pindexBestInvalid = NULL;
@@ -3951,10 +4849,8 @@ void UnloadBlockIndex()
         warningcache[ b ].clear() ;
     }
 
-    for ( BlockMap::value_type & entry : mapBlockIndex ) {
-        delete entry.second ;
-    }
     mapBlockIndex.clear() ;
+    blockIndexArena.Clear() ;
     fHavePruned = false ;
 }
 
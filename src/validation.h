@@ -22,6 +22,7 @@
 #include <algorithm>
 #include <exception>
 #include <map>
+#include <memory>
 #include <set>
 #include <unordered_map>
 #include <stdint.h>
@@ -38,6 +39,7 @@ class CBlockTreeDB;
 class CBloomFilter;
 class CChainParams;
 class CInv;
+class CMappedFile;
 class CConnman;
 class CScriptCheck;
 class CTxMemPool;
@@ -75,6 +77,8 @@ static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
+/** Number of blocks read from disk and checked ahead of the one being connected */
+static const unsigned int BLOCK_READ_AHEAD_DEPTH = 16 ;
 /** Number of blocks that can be requested at any given time from a single peer */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 64 ;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected */
@@ -208,6 +212,12 @@ bool CheckDiskSpace(uint64_t nAdditionalBytes = 0);
 FILE* OpenBlockFile(const CDiskBlockPos &pos, bool fReadOnly = false);
 /** Open an undo file (rev?????.dat) */
 FILE* OpenUndoFile(const CDiskBlockPos &pos, bool fReadOnly = false);
+/**
+ * Mapping of the file with the record at pos, a block or undo data, which is from pbegin
+ * to pend there, with nExtra bytes after the record. Null when the file can't be mapped,
+ * the record is read from the file then
+ */
+std::shared_ptr< const CMappedFile > MapDiskRecord( const CDiskBlockPos & pos, const char * prefix, size_t nExtra, const char * & pbegin, const char * & pend ) ;
 /** Translation to a filesystem path */
 boost::filesystem::path GetBlockPosFilename(const CDiskBlockPos &pos, const char *prefix);
 /** Import blocks from an external file */
@@ -222,6 +232,17 @@ void UnloadBlockIndex();
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck() ;
 void StopScriptChecking() ;
+/**
+ * Reads coins spent by the block which aren't in cache yet from its backing view
+ * in parallel and puts them into cache, so connecting the block finds them there.
+ * Returns how many coins were put into cache
+ */
+size_t PrefetchBlockInputs( const CBlock & block, CCoinsViewCache & cache ) ;
+/** Run the thread reading blocks ahead of the one being connected */
+void ThreadBlockReadAhead() ;
+void StopBlockReadAhead() ;
+/** How many blocks were connected as read ahead */
+uint64_t GetBlocksReadAhead() ;
 
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
 bool IsInitialBlockDownload() ;
@@ -292,6 +313,20 @@ bool AcceptToMemoryPool( CTxMemPool& pool, CValidationState &state, const CTrans
 bool AcceptToMemoryPoolWithTime( CTxMemPool& pool, CValidationState &state, const CTransactionRef &tx, bool fLimitFree,
                                  bool* pfMissingInputs, int64_t nAcceptTime, std::list<CTransactionRef>* plTxnReplaced = NULL ) ;
 
+/**
+ * Check transactions before they're accepted to the memory pool one by one, in parallel and
+ * mostly without cs_main: context-free checks, then scripts against coins of the chain tip,
+ * the pool and transactions before in vtx, putting signatures that pass into the signature cache.
+ * vPassed tells for each transaction whether it passed context-free checks
+ */
+void PreCheckTransactions( CTxMemPool & pool, const std::vector< CTransactionRef > & vtx, std::vector< char > & vPassed ) ;
+
+/** Load transactions of mempool.dat, of either version, into the memory pool */
+bool LoadMempoolFromDump() ;
+
+/** Write the memory pool to mempool.dat */
+void DumpMempoolToFile() ;
+
 /** Convert CValidationState to a human-readable message for logging */
 std::string FormatStateMessage(const CValidationState &state);
 
@@ -410,8 +445,8 @@ private:
 
 public:
     CScriptCheck(): amount(0), ptxTo(0), nIn(0), nFlags(0), cacheStore(false), error(SCRIPT_ERR_UNKNOWN_ERROR) {}
-    CScriptCheck(const CCoins& txFromIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn, PrecomputedTransactionData* txdataIn) :
-        scriptPubKey(txFromIn.vout[txToIn.vin[nInIn].prevout.n].scriptPubKey), amount(txFromIn.vout[txToIn.vin[nInIn].prevout.n].nValue),
+    CScriptCheck(const CTxOut& outIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn, PrecomputedTransactionData* txdataIn) :
+        scriptPubKey(outIn.scriptPubKey), amount(outIn.nValue),
         ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), cacheStore(cacheIn), error(SCRIPT_ERR_UNKNOWN_ERROR), txdata(txdataIn) { }
 
     bool operator()();
@@ -436,6 +471,12 @@ bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHea
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams);
 bool ReadBlockHeaderFromDisk(CBlockHeader& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams);
+/**
+ * Serialized block as it goes to peers, copied from the block file when it's the same bytes as stored.
+ * Position, hash and BLOCK_POW_CHECKED of the block are taken from its index under cs_main, to read without the lock
+ */
+bool ReadRawBlockFromDisk( std::vector< unsigned char > & vchBlock, const CDiskBlockPos & pos, const uint256 & hash, bool fPowChecked,
+                           bool fWitness, const Consensus::Params & consensusParams ) ;
 
 /** Functions for validating blocks and updating the block tree */
 
@@ -479,11 +520,39 @@ std::vector< unsigned char > GenerateCoinbaseCommitment( CBlock & block, const C
 static const signed int DEFAULT_CHECKBLOCKS = 30 ;
 static const unsigned int DEFAULT_CHECKLEVEL = 3 ;
 
-/** Wrapper for VerifyDB */
+/** Default for -checkinbackground */
+static const bool DEFAULT_CHECK_IN_BACKGROUND = true ;
+
+/** How the latest verification of databases goes */
+struct CVerifyDBStatus
+{
+    std::string strState ; // "none", "running", "passed", "failed" or "stopped"
+    int nCheckLevel ;
+    int nBlocksToCheck ;
+    int nBlocksChecked ;
+
+    CVerifyDBStatus() : strState( "none" ), nCheckLevel( 0 ), nBlocksToCheck( 0 ), nBlocksChecked( 0 ) {}
+} ;
+
+CVerifyDBStatus GetVerifyDBStatus() ;
+
+/**
+ * Verify databases with -checklevel and -checkblocks after the node is up.
+ * Aborts the node when they're corrupted
+ */
+void ThreadVerifyDB( int nCheckLevel, int nCheckDepth ) ;
+void StopVerifyingDB() ;
+
+/**
+ * Wrapper for VerifyDB. Blocks are read and checked on threads without cs_main, then
+ * disconnected and connected again at the tip in memory, with cs_main held only to read coins
+ * and connect each block. The check stops when the tip changes meanwhile.
+ * Without showProgress (as in the background) progress is only logged and in getblockchaininfo
+ */
 class WVerifyDB
 {
 public:
-    WVerifyDB() ;
+    explicit WVerifyDB( bool showProgress = true ) ;
     ~WVerifyDB() ;
 
     // Verify consistency of the block and coin databases
@@ -493,6 +562,7 @@ public:
 
 private:
     bool verifying{ false } ;
+    const bool showProgress ;
 } ;
 
 /** Find the last common block between the parameter chain and a locator */